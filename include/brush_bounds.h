@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define BOUNDS_BATCH 8 // Boxes tested per kernel call
+
+// Kernel implementations, picked at runtime from what the CPU supports
+#define BOUNDS_KERNEL_SCALAR 0
+#define BOUNDS_KERNEL_SSE 1
+#define BOUNDS_KERNEL_AVX2 2
+
+// Structure-of-arrays copy of brush bounds, in whatever order the owner iterates them.
+// The arrays are padded with BOUNDS_BATCH extra boxes so a whole batch can always be loaded.
+struct BrushBounds {
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+    size_t count;
+
+    BrushBounds() : count(0) {}
+};
+
+// Up to BOUNDS_BATCH rays in structure-of-arrays form, tested together against one box
+struct RayPacket {
+    float origin_x[BOUNDS_BATCH], origin_y[BOUNDS_BATCH], origin_z[BOUNDS_BATCH];
+    float inv_dir_x[BOUNDS_BATCH], inv_dir_y[BOUNDS_BATCH], inv_dir_z[BOUNDS_BATCH];
+    float t_max[BOUNDS_BATCH]; // Boxes entered after t_max do not count, negative for unused rays
+};
+
+struct Brush;
+
+void build_brush_bounds(const std::vector<Brush>& brushes, const uint32_t* order, size_t count, BrushBounds* bounds);
+uint32_t ray_bounds_mask(const BrushBounds* bounds, size_t first, size_t count, glm::vec3 origin, glm::vec3 inv_dir);
+uint32_t ray_packet_mask(const RayPacket* packet, glm::vec3 min, glm::vec3 max);
+uint32_t overlap_bounds_mask(const BrushBounds* bounds, size_t first, size_t count, glm::vec3 min, glm::vec3 max);
+int bounds_kernel();
+int set_bounds_kernel(int kernel);
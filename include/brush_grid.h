@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "brush_bounds.h"
+
+#define BRUSH_GRID_MAX_CELLS (1 << 22)
+#define BRUSH_GRID_MAX_BRUSH_CELLS 64 // Brushes covering more cells than this are kept in a separate list
+
+// Uniform grid over the scene bounds. Every brush is listed in each cell its bounds overlap.
+struct BrushGrid {
+    glm::vec3 origin;
+    float cell_size;
+    int dims[3];
+    std::vector<uint32_t> cell_first; // Brushes of cell i are brushes[cell_first[i] .. cell_first[i + 1])
+    std::vector<uint32_t> brushes;
+    BrushBounds bounds; // Bounds of the brushes in the same order as brushes
+    std::vector<uint32_t> large_brushes; // Tested by every query
+    size_t brush_count; // Number of brushes the grid was built for
+
+    BrushGrid() : origin(0.0f), cell_size(1.0f), brush_count(0) {
+        dims[0] = dims[1] = dims[2] = 0;
+    }
+};
+
+struct Brush;
+
+void build_brush_grid(const std::vector<Brush>& brushes, glm::vec3 bounds_min, glm::vec3 bounds_max, BrushGrid* grid);
+void brush_grid_query(const BrushGrid* grid, const std::vector<Brush>& brushes, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "scene.h"
+
+size_t merge_brushes(Scene* scene);
+void set_authored_map(Scene* scene, const std::vector<uint32_t>& authored_map);
+const Brush* authored_brush_at(Scene* scene, const Brush* brush, glm::vec3 normal, glm::vec3 point);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "brush_bounds.h"
+
+#define BVH_MAX_LEAF_SIZE 8      // Nodes this small are never split
+#define BVH_MAX_SAH_LEAF_SIZE 16  // Nodes up to this size stay leaves when the SAH says splitting does not pay
+#define BVH_BIN_COUNT 16
+#define BVH_TRAVERSAL_COST 2.0f  // Relative to one brush intersection test
+#define BVH_MAX_DEPTH 48
+#define BVH_STACK_SIZE (BVH_MAX_DEPTH + 2)
+
+// Leaves have count > 0 and cover indices[left_first .. left_first + count).
+// Inner nodes have count == 0 and children at left_first and left_first + 1.
+struct BVHNode {
+    glm::vec3 min;
+    uint32_t left_first;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+struct BVH {
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices; // Brush indices referenced by the leaves
+    BrushBounds leaf_bounds; // Bounds of the brushes in indices order, not stored in scene files
+};
+
+struct Brush;
+
+void build_bvh(const std::vector<Brush>& brushes, BVH* bvh);
+void refit_bvh(BVH* bvh, const std::vector<Brush>& brushes);
+bool validate_bvh(const BVH* bvh, size_t brush_count);
+void update_leaf_bounds(BVH* bvh, const std::vector<Brush>& brushes);
+bool ray_node_intersection(const BVHNode* node, glm::vec3 origin, glm::vec3 inv_dir, float* t_entry);
+void bvh_query_aabb(const BVH* bvh, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results);
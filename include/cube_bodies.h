@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define CUBE_BODIES_BATCH 4 // Bodies per SIMD step, the hot arrays are padded to a multiple of this
+#define CUBE_BODIES_ALIGNMENT 16 // Bytes, one batch of floats. The hot arrays start on this so the SIMD loops use aligned loads.
+
+// Flags of a body
+#define CUBE_GRABBED 1 // Held by the player, pulled towards the holding position instead of falling
+#define CUBE_ASLEEP 2 // Left out of update_cubes until something wakes its island, padding is always asleep
+
+// One cube as authored, loaded or saved. A running scene keeps its cubes in CubeBodies.
+struct Cube {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    glm::vec3 color;
+    float size;
+    bool grabbed;
+
+    Cube(glm::vec3 position, glm::vec3 color): position(position), velocity(glm::vec3(0.0f)), color(color), size(0.25f), grabbed(false) {}
+};
+
+// Allocator for the hot arrays, which start on a CUBE_BODIES_ALIGNMENT boundary. Allocates a little more with malloc and
+// keeps the pointer malloc returned just before the aligned block, so it works the same on every platform.
+template <typename T>
+struct BodyAllocator {
+    typedef T value_type;
+
+    BodyAllocator() {}
+    template <typename U> BodyAllocator(const BodyAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* block = malloc(n * sizeof(T) + CUBE_BODIES_ALIGNMENT + sizeof(void*));
+        if (block == NULL) throw std::bad_alloc();
+        uintptr_t aligned = ((uintptr_t)block + sizeof(void*) + CUBE_BODIES_ALIGNMENT - 1) & ~(uintptr_t)(CUBE_BODIES_ALIGNMENT - 1);
+        ((void**)aligned)[-1] = block;
+        return (T*)aligned;
+    }
+
+    void deallocate(T* p, size_t) {
+        free(((void**)p)[-1]);
+    }
+};
+
+template <typename T, typename U> bool operator==(const BodyAllocator<T>&, const BodyAllocator<U>&) { return true; }
+template <typename T, typename U> bool operator!=(const BodyAllocator<T>&, const BodyAllocator<U>&) { return false; }
+
+typedef std::vector<float, BodyAllocator<float> > BodyArray; // Padded to a multiple of CUBE_BODIES_BATCH, aligned
+
+// The cubes of a scene as structure of arrays. The hot arrays are what update_cubes goes through every tick, padded to a
+// multiple of CUBE_BODIES_BATCH and aligned so the SIMD loops have no scalar tail and use aligned loads. Colors are cold, only drawing and saving read them.
+struct CubeBodies {
+    size_t count;
+
+    // Hot
+    BodyArray position_x, position_y, position_z;
+    BodyArray previous_x, previous_y, previous_z; // Position before the last update_cubes, cubes are drawn between the two
+    BodyArray velocity_x, velocity_y, velocity_z;
+    BodyArray size; // Half of the edge length
+    std::vector<uint32_t, BodyAllocator<uint32_t> > flags;
+
+    // Kept by update_cubes for every body, not padded
+    std::vector<int> proxy; // Leaf of the cube in Scene::cube_tree, DYNAMIC_TREE_NULL until it is added
+    std::vector<uint32_t> still_ticks; // Ticks in a row the cube has barely moved
+    std::vector<uint32_t> island; // Lowest index among the cubes it fell asleep touching, directly or through others
+
+    // Cold
+    std::vector<glm::vec3> color;
+
+    CubeBodies() : count(0) {}
+};
+
+/** Bodies **/
+void clear_cube_bodies(CubeBodies* bodies);
+uint32_t add_cube_body(CubeBodies* bodies, const Cube* cube);
+Cube cube_body(const CubeBodies* bodies, size_t i);
+size_t padded_body_count(const CubeBodies* bodies);
+glm::vec3 body_position(const CubeBodies* bodies, size_t i);
+glm::vec3 body_previous_position(const CubeBodies* bodies, size_t i);
+glm::vec3 body_velocity(const CubeBodies* bodies, size_t i);
+void set_body_position(CubeBodies* bodies, size_t i, glm::vec3 position);
+void set_body_previous_position(CubeBodies* bodies, size_t i, glm::vec3 position);
+void set_body_velocity(CubeBodies* bodies, size_t i, glm::vec3 velocity);
+
+/** Integration, over all bodies at once **/
+void save_previous_positions(CubeBodies* bodies);
+void integrate_gravity(CubeBodies* bodies, float delta_velocity);
+void body_inverse_masses(const CubeBodies* bodies, float* inverse_masses);
+void body_translations(const CubeBodies* bodies, const float* const pushes[3], float deltaTime, float* const translations[3]);
+void translate_bodies(CubeBodies* bodies, const float* const translations[3]);
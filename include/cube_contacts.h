@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cube_bodies.h"
+#include "sweep_prune.h"
+
+#define CUBE_CONTACT_GROUND UINT32_MAX // Second body of a contact between a cube and the brushes below it
+#define CUBE_CONTACT_MARGIN 0.05f // Cubes this close get a contact before they touch, so resting contacts do not drop in and out
+#define CUBE_CONTACT_SLOP 0.005f // Overlap left alone, so resting cubes do not jitter
+#define CUBE_CONTACT_BIAS 0.25f // Fraction of the overlap pushed out per tick
+#define CUBE_FRICTION 0.5f
+#define CUBE_SOLVER_ITERATIONS 12
+
+// Two cubes, or a cube and the ground, closer than CUBE_CONTACT_MARGIN. Cubes are boxes that never rotate,
+// so the normal is always along an axis and the friction directions are the two other axes.
+struct CubeContact {
+    uint32_t a;
+    uint32_t b; // Greater than a, CUBE_CONTACT_GROUND for the ground
+    int axis;
+    float sign; // Normal is sign along axis, pointing from a to b
+    float separation; // Negative when the cubes overlap
+    float normal_impulse; // Accumulated by the solver and kept for the next tick
+    glm::vec2 tangent_impulse; // Along axis + 1 and axis + 2
+};
+
+void find_cube_contacts(const CubeBodies* bodies, const float* ground_distances, const std::vector<SweepPair>* pairs, std::vector<CubeContact>* contacts);
+void solve_cube_contacts(std::vector<CubeContact>* contacts, CubeBodies* bodies, float* const pushes[3], const float* inverse_masses, float deltaTime, int iterations);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define DYNAMIC_TREE_NULL -1
+#define DYNAMIC_TREE_MARGIN 0.1f // Leaf boxes are fattened by this much on every side
+#define DYNAMIC_TREE_DISPLACEMENT_MULTIPLIER 2.0f // Leaf boxes are stretched by this many frames of movement ahead
+#define DYNAMIC_TREE_STACK_SIZE 128 // Queries on taller trees allocate their stack
+
+// Leaves have child1 == DYNAMIC_TREE_NULL and hold an object. Free nodes are linked through parent.
+struct DynamicTreeNode {
+    glm::vec3 min;
+    glm::vec3 max;
+    int parent;
+    int child1;
+    int child2;
+    int height; // 0 for leaves, -1 for free nodes
+    uint32_t object;
+};
+
+// Bounding volume hierarchy over moving objects, kept balanced while objects are inserted, moved and removed.
+// Proxies are node indices and stay valid until the object is removed.
+struct DynamicTree {
+    std::vector<DynamicTreeNode> nodes;
+    int root;
+    int free_list;
+    size_t proxy_count;
+
+    DynamicTree() : root(DYNAMIC_TREE_NULL), free_list(DYNAMIC_TREE_NULL), proxy_count(0) {}
+};
+
+void dynamic_tree_clear(DynamicTree* tree);
+int dynamic_tree_insert(DynamicTree* tree, glm::vec3 min, glm::vec3 max, uint32_t object);
+void dynamic_tree_remove(DynamicTree* tree, int proxy);
+bool dynamic_tree_update(DynamicTree* tree, int proxy, glm::vec3 min, glm::vec3 max, glm::vec3 displacement);
+void dynamic_tree_query(const DynamicTree* tree, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results);
+void dynamic_tree_raycast(const DynamicTree* tree, glm::vec3 origin, glm::vec3 dir, float max_distance, std::vector<uint32_t>* results);
+bool validate_dynamic_tree(const DynamicTree* tree);
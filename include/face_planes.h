@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define FACE_PLANE_NONE UINT32_MAX
+#define PORTAL_FRONT_CLEARANCE 0.05f // Brushes closer than this in front of a portal's surface block it
+
+// Visible brush face as a rectangle in its plane. Coordinates are along the u and v axes of the face, see face_plane_coords.
+struct FaceRect {
+    glm::vec2 min;
+    glm::vec2 max;
+    uint32_t brush;
+};
+
+// All visible faces that lie in the same plane and face the same way
+struct FacePlane {
+    int face;
+    float offset; // Position of the plane along the axis of the face
+    uint32_t first_rect; // Rects of the plane are rects[first_rect .. first_rect + rect_count), sorted by min.x
+    uint32_t rect_count;
+    float max_width; // Widest rect along u, bounds how far back a query has to look
+};
+
+// Visible faces grouped by plane, so the faces next to a hit face can be found without searching the scene.
+// Planes and rects are baked by scenec, the lookup is always built at load time.
+struct FacePlaneIndex {
+    std::vector<FacePlane> planes;
+    std::vector<FaceRect> rects;
+    std::unordered_map<uint64_t, uint32_t> lookup; // Plane of each face and offset, see find_face_plane
+};
+
+struct Scene;
+struct Portal;
+struct RaycastHitInfo;
+
+void build_face_planes(Scene* scene, FacePlaneIndex* index);
+bool validate_face_planes(const Scene* scene, const FacePlaneIndex* index);
+void build_face_plane_lookup(FacePlaneIndex* index);
+glm::vec2 face_plane_coords(int face, glm::vec3 point);
+glm::vec3 face_plane_point(int face, float offset, glm::vec2 coords);
+uint32_t find_face_plane(const FacePlaneIndex* index, int face, float offset);
+void face_plane_query(const FacePlaneIndex* index, uint32_t plane, glm::vec2 min, glm::vec2 max, std::vector<uint32_t>* rects);
+bool face_plane_covers(const FacePlaneIndex* index, uint32_t plane, glm::vec2 min, glm::vec2 max, std::vector<uint32_t>* rects);
+bool find_portal_placement(Scene* scene, const Portal* portal, const Portal* other, const RaycastHitInfo* hit_info, glm::vec3* position);
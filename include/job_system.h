@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the indices begin .. end - 1 of a parallel_for
+typedef void (*JobFunction)(void* data, size_t begin, size_t end);
+
+struct JobRange {
+    size_t begin;
+    size_t end;
+};
+
+// Ranges waiting to run on one thread. The owner takes from the back, other threads steal from the front.
+struct JobQueue {
+    std::mutex mutex;
+    std::deque<JobRange> ranges;
+};
+
+// Pool of worker threads for splitting loops over threads. Every thread has its own queue of ranges and
+// steals from the others once it runs out, so uneven ranges still finish together.
+struct JobSystem {
+    std::vector<std::thread> workers;
+    std::vector<JobQueue*> queues; // Queue 0 belongs to the thread calling parallel_for, queue i + 1 to worker i
+
+    std::mutex calling; // Held by the thread running a parallel_for, callers on other threads wait their turn
+    std::mutex mutex;
+    std::condition_variable wake; // Workers wait here for the next parallel_for
+    std::condition_variable done; // The caller waits here for the last range
+    uint64_t generation; // Bumped by every parallel_for
+    bool stopping;
+    size_t pending; // Ranges of the current parallel_for not finished yet, guarded by mutex
+
+    JobFunction function;
+    void* data;
+
+    JobSystem() : generation(0), stopping(false), pending(0), function(NULL), data(NULL) {}
+    ~JobSystem();
+};
+
+void start_job_system(JobSystem* jobs, size_t worker_count);
+void stop_job_system(JobSystem* jobs);
+JobSystem* shared_job_system();
+size_t job_thread_count(const JobSystem* jobs);
+void parallel_for(JobSystem* jobs, size_t count, size_t grain, JobFunction function, void* data);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#else
+    int fd;
+#endif
+
+    MappedFile() : data(NULL), size(0),
+#ifdef _WIN32
+        file_handle(NULL), mapping_handle(NULL)
+#else
+        fd(-1)
+#endif
+    {}
+};
+
+// What changes when a file is written. The modification time is in nanoseconds where the platform keeps them,
+// the size catches most writes that land within one tick of a coarser clock.
+struct FileStamp {
+    int64_t modification_time; // -1 if the file cannot be read
+    int64_t size;
+};
+
+int map_file(const char* path, MappedFile* file);
+void unmap_file(MappedFile* file);
+FileStamp file_stamp(const char* path);
+bool same_file_stamp(const FileStamp* a, const FileStamp* b);
@@ -3,10 +3,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <vector>
+
 #define CUBE_VERTEX_COUNT 36
 
 #define POSITION_NORMAL 1
 #define POSITION_UV 2
+#define POSITION_NORMAL_COLOR 3
+
+#define FACE_VERTEX_COUNT 4 // Faces of the static geometry never share vertices
+#define FACE_INDEX_COUNT 6
 
 struct MeshObjectData
 {
@@ -15,6 +21,27 @@ struct MeshObjectData
     GLuint ebo;
 };
 
+// World space vertex of the merged static geometry. Normals and colors are normalized bytes.
+struct StaticVertex {
+    float position[3];
+    int8_t normal[4];
+    uint8_t color[4];
+};
+
+// Merged static geometry ready for upload. The pointers either refer to the owned
+// vectors or straight into a mapped baked scene file.
+struct StaticMesh {
+    const StaticVertex* vertices;
+    size_t vertex_count;
+    const GLuint* indices;
+    size_t index_count;
+
+    std::vector<StaticVertex> owned_vertices;
+    std::vector<GLuint> owned_indices;
+
+    StaticMesh() : vertices(NULL), vertex_count(0), indices(NULL), index_count(0) {}
+};
+
 MeshObjectData *gen_meshobjdata(GLfloat *vertices, size_t vertex_array_size, GLuint *indices, size_t index_array_size, uint8_t vertex_data_type);
 void del_meshobjdata(MeshObjectData **data);
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define PVS_MAX_CELLS 4096
+#define PVS_MIN_CELL_SIZE 4.0f
+#define PVS_SAMPLE_RAYS 8192 // Rays cast in random directions from random points of every cell
+#define PVS_CELL_VOXELS 8 // Voxels along each side of a cell when finding the space the player can reach
+#define PVS_TARGET_RAYS 4 // Rays aimed at every cell whose space was seen
+#define PVS_MARCH_STEP 0.5f // Rays find the cells they pass through at steps of this many cells
+
+// Potentially visible set: a uniform grid of cells over the scene bounds, with for every cell the cells
+// whose brushes may be seen from it. Brushes belong to the cell holding their center.
+// Visibility is baked by scenec --pvs, the grouping of the static mesh by cell is rebuilt at load time.
+struct PVS {
+    glm::vec3 origin;
+    float cell_size;
+    int dims[3];
+    uint32_t cell_count; // 0 when the scene has no PVS
+    uint32_t row_words;
+    std::vector<uint32_t> visibility; // Bit j of row i is set if cell j may be visible from cell i, rows are row_words long
+
+    std::vector<uint32_t> indices; // The static mesh indices, grouped by cell
+    std::vector<uint32_t> cell_first_index; // Indices of cell i are indices[cell_first_index[i] .. cell_first_index[i + 1])
+
+    PVS() : origin(0.0f), cell_size(1.0f), cell_count(0), row_words(0) {
+        dims[0] = dims[1] = dims[2] = 0;
+    }
+};
+
+struct Scene;
+
+void build_pvs(Scene* scene, PVS* pvs);
+void build_pvs_indices(Scene* scene, PVS* pvs);
+void clear_pvs(PVS* pvs);
+int pvs_cell(const PVS* pvs, glm::vec3 point);
+bool pvs_visible(const PVS* pvs, int from, int to);
+void pvs_draw_ranges(const PVS* pvs, int cell, std::vector<uint32_t>* ranges);
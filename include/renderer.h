@@ -1,6 +1,7 @@
 #pragma once
 
 #include "scene.h"
+#include "scene_reload.h"
 
 struct StandardShader {
     GLuint program;
@@ -13,6 +14,14 @@ struct StandardShader {
     GLuint u_slicenormal;
 };
 
+struct StaticShader {
+    GLuint program;
+    GLuint u_VP;
+    GLuint u_lightdir;
+    GLuint u_slicepos;
+    GLuint u_slicenormal;
+};
+
 struct ScreenShader {
     GLuint program;
     GLuint u_screentex;
@@ -42,9 +51,13 @@ namespace renderer {
     int load_shader(const char* vertex_path, const char* fragment_path);
     int gen_rendertarget(RenderTarget* target, int width, int height, bool fpbuff=false);
     void del_rendertarget(RenderTarget* target);
-    void render_scene(Scene* scene, glm::mat4 view, glm::mat4 projection, bool draw_portals, glm::vec3 slice_pos, glm::vec3 slice_normal);
+    void upload_scene(Scene* scene);
+    void update_scene(Scene* scene, SceneReload* reload);
+    void render_loading_screen(int scr_width, int scr_height, float fraction);
+    void render_scene(Scene* scene, glm::mat4 view, glm::mat4 projection, int cell, bool draw_portals, glm::vec3 slice_pos, glm::vec3 slice_normal);
     void render_screen(Scene* scene, Camera* cam);
 
     extern bool debug_cube_xray;
     extern bool show_pcam_povs;
+    extern float tick_interpolation; // Cubes are drawn this far from their position before the last tick to their current one
 }
\ No newline at end of file
@@ -3,6 +3,15 @@
 #include <vector>
 
 #include "mesh.h"
+#include "scene_file.h"
+#include "bvh.h"
+#include "brush_grid.h"
+#include "dynamic_tree.h"
+#include "sweep_prune.h"
+#include "cube_bodies.h"
+#include "cube_contacts.h"
+#include "pvs.h"
+#include "face_planes.h"
 
 #define PORTAL_THICKNESS 0.1f
 #define GRAVITY -8.0f
@@ -33,25 +42,38 @@ struct Portal {
     Portal(glm::vec3 position, glm::vec3 normal, float width, float height) : open(true), position(position), normal(normal), width(width), height(height) {}
 };
 
-struct Cube {
-    glm::vec3 position;
-    glm::vec3 velocity;
-    glm::vec3 color;
-    float size;
-    bool grabbed;
-
-    Cube(glm::vec3 position, glm::vec3 color): position(position), velocity(glm::vec3(0.0f)), color(color), size(0.25f), grabbed(false) {}
-    
-    glm::mat4 GetTransform();
-};
-
 struct Scene {
     std::vector<Brush> geometry;
-    std::vector<Cube> cubes;
+    CubeBodies cubes;
     Portal portal1;
     Portal portal2;
     glm::vec3 light_dir;
+    glm::vec3 spawn_position;
+    float spawn_yaw;
+    float spawn_pitch;
     double time;
+
+    SceneFile file; // Kept mapped so sections can be loaded lazily
+
+    // Runtime data derived from the brushes, either baked by scenec or built at load time
+    BVH bvh;
+    std::vector<uint16_t> face_flags;
+    StaticMesh static_mesh;
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    BrushGrid brush_grid; // Collision broadphase, always built at load time
+    PVS pvs; // Only present when baked by scenec --pvs
+    FacePlaneIndex face_planes; // Surfaces portals can be placed on
+    DynamicTree cube_tree; // Fattened bounds of the cubes, kept up to date by update_cubes
+    SweepPrune cube_sweep;
+    std::vector<SweepPair> cube_pairs; // Cubes within CUBE_CONTACT_MARGIN of each other at the start of the last update_cubes, at least one of them awake
+    std::vector<CubeContact> cube_contacts; // Contacts solved by the last update_cubes, warm starting the next one
+
+    // Brushes as authored, only set when geometry holds merged brushes, see merge_brushes
+    std::vector<Brush> authored_geometry;
+    std::vector<uint32_t> authored_map; // Merged brush of every authored brush
+    std::vector<uint32_t> authored_first; // Authored brushes of merged brush i are authored_indices[authored_first[i] .. authored_first[i + 1])
+    std::vector<uint32_t> authored_indices;
 };
 
 struct Camera {
@@ -76,12 +98,51 @@ struct RaycastHitInfo {
     glm::vec3 intersection;
     glm::vec3 normal;
     glm::vec3 face_min;
-    glm::vec3 face_max;
+    glm::vec3 face_max; // Face of the authored brush, which is smaller than the hit brush when brushes were merged
     Brush* brush;
+    const Brush* authored_brush;
+};
+
+#define PORTAL_RAYCAST_MAX_HOPS 8
+
+// One straight piece of a ray followed through portals, see raycast_portals
+struct RaySegment {
+    glm::vec3 start;
+    glm::vec3 dir; // Normalized
+    float length; // Up to the brush hit, the portal entered or the end of the ray
+    Portal* portal; // Portal the segment enters, NULL for the last segment
+};
+
+struct PortalRaycast {
+    RaySegment segments[PORTAL_RAYCAST_MAX_HOPS + 1];
+    int segment_count;
+    float distance; // Total length of all segments
+    glm::mat4 transform; // Maps positions from the space of the first segment into that of the last one
+    RaycastHitInfo hit_info; // Brush hit at the end of the last segment, brush is NULL if there is none
 };
 
+// Whether a box touching the brush at hit_normal passes through it, see move_aabb
+typedef bool (*CollisionFilter)(Scene* scene, Brush* brush, glm::vec3 hit_normal, glm::vec3 aabb_min, glm::vec3 aabb_max);
+
+// Reports how far a load got, called on the thread doing the loading
+struct SceneLoadProgress {
+    void (*callback)(void* user_data, float fraction, const char* step);
+    void* user_data;
+};
+
+// Options of load_scene_file
+#define SCENE_LOAD_RUNTIME_DATA 1 // Load or build the BVH, face flags and static mesh
+#define SCENE_LOAD_MERGE_BRUSHES 2 // Merge brushes into larger boxes first, see merge_brushes
+
 /** General **/
-void load_scene_file(const char* path, Scene* scene);
+void report_progress(const SceneLoadProgress* progress, float fraction, const char* step);
+bool validate_brushes(const char* path, const Brush* brushes, size_t brush_count);
+bool validate_cubes(const char* path, const SceneCubeRecord* cubes, size_t cube_count);
+void apply_scene_defaults(Scene* scene);
+int load_scene_file(const char* path, Scene* scene, int options=SCENE_LOAD_RUNTIME_DATA, const SceneLoadProgress* progress=NULL);
+void close_scene_file(Scene* scene);
+void scene_sections(Scene* scene, std::vector<SceneSectionData>* sections);
+int save_scene_file(const char* path, Scene* scene);
 
 /** Portal related **/
 glm::mat4 portal_rotation(Portal* portal);
@@ -93,7 +154,19 @@ bool portal_aabb_collision_test(Portal* portal, glm::vec3 min, glm::vec3 max);
 
 /** Movement and Physics **/
 bool check_aabb_intersection(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max);
-bool aabb_brush_collision(glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, Brush* brush, glm::vec3* hit_normal);
+bool sweep_aabb_brush(glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, Brush* brush, float* time, glm::vec3* hit_normal);
+glm::vec3 move_aabb(Scene* scene, glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, CollisionFilter filter, std::vector<uint32_t>* candidates, bool* on_ground);
+void collision_candidates(Scene* scene, glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, std::vector<uint32_t>* candidates);
 bool raycast(Camera* cam, Scene* scene, RaycastHitInfo* hit_info);
-void scene_aware_movement(Camera* cam, glm::vec3 translation, Scene* scene, bool* on_ground);
-void update_cubes(Scene* scene, Camera* camera, float deltaTime);
\ No newline at end of file
+bool raycast_ray(Scene* scene, glm::vec3 origin, glm::vec3 dir, RaycastHitInfo* hit_info);
+bool raycast_portals(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance, int max_hops, PortalRaycast* result);
+size_t raycast_batch(Scene* scene, const glm::vec3* origins, const glm::vec3* dirs, size_t count, RaycastHitInfo* results);
+bool scene_aware_movement(Camera* cam, glm::vec3 translation, Scene* scene, bool* on_ground);
+void update_cubes(Scene* scene, Camera* camera, float deltaTime);
+void sync_cube_tree(Scene* scene);
+void update_cube_pairs(Scene* scene);
+void wake_cube(Scene* scene, uint32_t cube_index);
+void wake_cubes(Scene* scene, glm::vec3 min, glm::vec3 max);
+void cube_query(Scene* scene, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results);
+void cube_raycast(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance, std::vector<uint32_t>* results);
+int nearest_cube_hit(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance);
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "scene.h"
+
+// Faces are numbered -X, +X, -Y, +Y, -Z, +Z
+#define FACE_COUNT 6
+#define FACE_VISIBLE(face) (1 << (face))
+
+// Parts of the runtime data, see bake_scene
+#define BAKED_BVH 1
+#define BAKED_FACE_FLAGS 2
+#define BAKED_STATIC_MESH 4
+#define BAKED_BOUNDS 8
+#define BAKED_ALL (BAKED_BVH | BAKED_FACE_FLAGS | BAKED_STATIC_MESH | BAKED_BOUNDS | BAKED_FACE_PLANES)
+#define BAKED_PVS 16 // Never built at load time, see build_pvs
+#define BAKED_FACE_PLANES 32
+
+int face_index(glm::vec3 normal);
+void compute_face_flags(Scene* scene, std::vector<uint16_t>* flags);
+void update_face_flags(Scene* scene, const std::vector<uint32_t>& brushes);
+int visible_face_count(uint16_t flags);
+size_t write_brush_vertices(const Brush* brush, uint16_t flags, StaticVertex* vertices);
+void build_static_mesh(Scene* scene, StaticMesh* mesh);
+void move_static_mesh(StaticMesh* from, StaticMesh* to);
+void compute_scene_bounds(Scene* scene);
+void bake_scene(Scene* scene, int already_baked=0, const SceneLoadProgress* progress=NULL);
+int load_baked_sections(SceneFile* file, Scene* scene);
+void baked_sections(Scene* scene, std::vector<SceneSectionData>* sections);
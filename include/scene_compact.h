@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include "scene.h"
+
+// Compact brush encoding. Brush coordinates are snapped to a per-scene grid of 16-bit
+// steps and colors are replaced by indices into a palette. Each brush becomes seven
+// varints: the zigzag delta of its grid minimum from the previous brush (x, y, z), its
+// size in grid steps (x, y, z) and the zigzag delta of its palette index. The varint
+// bytes are entropy coded with rANS, one frequency table per field.
+//
+// Coded stream: for each field, the number of distinct bytes (uint16) followed by
+// (byte, varint frequency) pairs, then the rANS state (4 bytes, little endian)
+// and the renormalization bytes.
+#define COMPACT_GRID_STEPS 65536
+#define COMPACT_FIELD_COUNT 7
+#define COMPACT_MAX_PALETTE (1 << 24)
+
+int encode_compact_brushes(const std::vector<Brush>& brushes, float grid, SceneSectionData* section);
+int decode_compact_brushes(const void* data, size_t size, uint32_t brush_count, std::vector<Brush>* brushes);
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Version 2 scene files start with a header and a table of typed sections.
+// Files that do not start with the magic number are read as the original
+// unversioned format (light direction, brush count, brushes).
+#define SCENE_FILE_MAGIC 0x4E435350 // "PSCN"
+#define SCENE_FILE_VERSION 2
+#define SCENE_SECTION_ALIGNMENT 16
+
+#define SCENE_SECTION_BRUSHES 1
+#define SCENE_SECTION_CUBES 2
+#define SCENE_SECTION_SPAWN_POINTS 3
+#define SCENE_SECTION_LIGHTS 4
+#define SCENE_SECTION_PORTALS 5
+#define SCENE_SECTION_COMPACT_BRUSHES 6 // Replaces SCENE_SECTION_BRUSHES, see scene_compact.h
+#define SCENE_SECTION_AUTHORED_BRUSHES 7 // Brushes before merging, when SCENE_SECTION_BRUSHES holds merged ones
+#define SCENE_SECTION_MERGE_MAP 8 // Merged brush index of every authored brush
+
+// Baked runtime data, written by scenec
+#define SCENE_SECTION_BVH 16
+#define SCENE_SECTION_BVH_INDICES 17
+#define SCENE_SECTION_STATIC_VERTICES 18
+#define SCENE_SECTION_STATIC_INDICES 19
+#define SCENE_SECTION_FACE_FLAGS 20
+#define SCENE_SECTION_BOUNDS 21
+#define SCENE_SECTION_PVS 22 // Only written by scenec --pvs
+#define SCENE_SECTION_PVS_VISIBILITY 23
+#define SCENE_SECTION_FACE_PLANES 24
+#define SCENE_SECTION_FACE_RECTS 25
+
+#define SECTION_UNCHECKED 0
+#define SECTION_VALID 1
+#define SECTION_CORRUPT 2
+
+struct SceneFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t section_count;
+    uint32_t flags;
+};
+
+struct SceneSectionEntry {
+    uint32_t type;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t element_count;
+    uint32_t reserved;
+};
+
+/** Section records **/
+struct SceneBrushRecord {
+    float min[3];
+    float max[3];
+    float color[3];
+};
+
+struct SceneCubeRecord {
+    float position[3];
+    float color[3];
+    float size;
+};
+
+struct SceneSpawnRecord {
+    float position[3];
+    float yaw;
+    float pitch;
+};
+
+struct SceneLightRecord {
+    float direction[3];
+};
+
+struct ScenePortalRecord {
+    float width;
+    float height;
+};
+
+// Followed by palette_count colors and the entropy coded brush stream
+struct SceneCompactBrushHeader {
+    float origin[3];
+    float grid; // World size of one step of the 16-bit grid
+    uint32_t palette_count;
+    uint32_t coded_size;
+};
+
+struct SceneBVHNodeRecord {
+    float min[3];
+    uint32_t left_first;
+    float max[3];
+    uint32_t count;
+};
+
+struct SceneStaticVertexRecord {
+    float position[3];
+    int8_t normal[4];
+    uint8_t color[4];
+};
+
+struct SceneBoundsRecord {
+    float min[3];
+    float max[3];
+};
+
+// Grid of the PVS, its visibility rows are in SCENE_SECTION_PVS_VISIBILITY
+struct ScenePVSRecord {
+    float origin[3];
+    float cell_size;
+    uint32_t dims[3];
+    uint32_t brush_count; // Brushes the visibility was computed for
+};
+
+struct SceneFacePlaneRecord {
+    int32_t face;
+    float offset;
+    uint32_t first_rect;
+    uint32_t rect_count;
+    float max_width;
+};
+
+struct SceneFaceRectRecord {
+    float min[2];
+    float max[2];
+    uint32_t brush;
+};
+
+// An open scene file. The mapping stays alive so sections can be read lazily.
+struct SceneFile {
+    MappedFile mapping;
+    uint32_t version;
+    std::vector<SceneSectionEntry> sections;
+    std::vector<unsigned char> section_state;
+
+    SceneFile() : version(0) {}
+};
+
+// A section to be written, see write_scene_sections
+struct SceneSectionData {
+    uint32_t type;
+    uint32_t element_count;
+    std::vector<unsigned char> data;
+
+    SceneSectionData(uint32_t type) : type(type), element_count(0) {}
+};
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc=0);
+
+int scene_file_open(const char* path, SceneFile* file);
+void scene_file_close(SceneFile* file);
+void scene_file_validate(SceneFile* file, const uint32_t* types, size_t type_count);
+const SceneSectionEntry* scene_file_find(SceneFile* file, uint32_t type);
+const void* scene_file_section(SceneFile* file, uint32_t type, uint32_t* element_count);
+int write_scene_sections(const char* path, const std::vector<SceneSectionData>& sections);
+
+template <typename T>
+void append_record(SceneSectionData* section, const T& record) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&record);
+    section->data.insert(section->data.end(), bytes, bytes + sizeof(T));
+    section->element_count++;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "scene.h"
+
+#define SCENE_LOAD_IDLE 0
+#define SCENE_LOAD_RUNNING 1
+#define SCENE_LOAD_DONE 2
+#define SCENE_LOAD_FAILED 3
+
+// A scene loading on a worker thread. The worker parses, validates and bakes into a scene of
+// its own, the main loop polls the state and takes the result with finish_scene_load.
+// Creating GPU buffers for it is left to the caller, on the GL thread.
+struct SceneLoad {
+    std::thread worker;
+    std::atomic<int> state;
+    std::atomic<float> fraction;
+    std::atomic<const char*> step; // Always a string literal
+    std::string path;
+    int options; // See load_scene_file
+    Scene* scene;
+    SceneLoadProgress progress; // Optional callback, called on the worker thread
+
+    SceneLoad() : state(SCENE_LOAD_IDLE), fraction(0.0f), step(""), options(SCENE_LOAD_RUNTIME_DATA), scene(NULL) {
+        progress.callback = NULL;
+        progress.user_data = NULL;
+    }
+};
+
+int start_scene_load(SceneLoad* load, const char* path, int options=SCENE_LOAD_RUNTIME_DATA, const SceneLoadProgress* progress=NULL);
+int scene_load_state(SceneLoad* load);
+float scene_load_progress(SceneLoad* load, const char** step);
+int finish_scene_load(SceneLoad* load, Scene* scene);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "scene.h"
+
+#define SCENE_RELOAD_INTERVAL 1.0 // Seconds between checks of the scene file
+#define SCENE_PATCH_LIMIT 4 // Patch in place while at most 1 in this many brushes changed
+
+#define RELOAD_UNCHANGED 0
+#define RELOAD_PATCHED 1
+#define RELOAD_REBUILT 2
+
+struct SceneWatch {
+    const char* path;
+    FileStamp loaded; // Of the file the scene was last loaded from
+    double last_check;
+};
+
+// What a reload changed, for the renderer
+struct SceneReload {
+    int kind;
+    std::vector<uint32_t> vertex_ranges; // Pairs of (first vertex, vertex count) of the static mesh to upload again when patched
+};
+
+void watch_scene_file(SceneWatch* watch, const char* path, double time);
+bool scene_file_modified(SceneWatch* watch, double time, FileStamp* stamp);
+int reload_scene_file(const char* path, Scene* scene, SceneReload* reload);
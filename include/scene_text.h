@@ -0,0 +1,21 @@
+#pragma once
+
+#include "scene.h"
+
+// Line based text scenes, for generating and diffing levels. The first line is the header,
+// every other line holds one item, # starts a comment:
+//
+//   portal-scene 1
+//   light <dx> <dy> <dz>
+//   spawn <x> <y> <z> <yaw> <pitch>
+//   portal <width> <height>                 first line for portal 1, second for portal 2
+//   cube <x> <y> <z> <r> <g> <b> [size]
+//   brush <min x> <min y> <min z> <max x> <max y> <max z> <r> <g> <b>
+//
+// The light is required, everything else falls back to the same defaults as unversioned files.
+#define SCENE_TEXT_HEADER "portal-scene"
+#define SCENE_TEXT_VERSION 1
+
+bool is_scene_text(const MappedFile* mapping);
+int load_scene_text(const char* path, const MappedFile* mapping, Scene* scene);
+int save_scene_text(const char* path, Scene* scene);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "scene.h"
+#include "snapshot.h"
+
+#define SIMULATION_TICK_RATE 60 // Ticks per second unless configured otherwise
+#define SIMULATION_MAX_FRAME_TICKS 8 // Most ticks run for one frame, a longer stall is dropped instead of caught up on
+#define MOVEMENT_SPEED 5.0f
+#define JUMP_SPEED 4.0f
+
+// Buttons held during a tick
+#define TICK_INPUT_FORWARD 1
+#define TICK_INPUT_BACK 2
+#define TICK_INPUT_RIGHT 4
+#define TICK_INPUT_LEFT 8
+#define TICK_INPUT_JUMP 16
+#define TICK_INPUT_DOWN 32
+#define TICK_INPUT_WALK 64 // Move at a fifth of the speed
+
+// Presses, acted on by the first tick after them only
+#define TICK_INPUT_PORTAL1 128
+#define TICK_INPUT_PORTAL2 256
+#define TICK_INPUT_GRAB 512
+
+// Everything a tick reads from the player. Feeding the same stream of these to the same scene
+// gives the same results bit for bit, whatever the frame rate.
+struct TickInput {
+    uint32_t buttons;
+    float yaw;
+    float pitch;
+};
+
+// Fixed-rate clock for the simulation, decoupled from the frame rate
+struct Simulation {
+    int tick_rate;
+    double accumulator; // Time not simulated yet, less than a tick between frames
+    uint64_t tick; // Ticks run since the last reset
+    glm::vec3 previous_position; // Player camera before the last tick, for interpolating between ticks
+
+    Simulation() : tick_rate(SIMULATION_TICK_RATE), accumulator(0.0), tick(0), previous_position(0.0f) {}
+};
+
+void reset_simulation(Simulation* sim, Scene* scene, const PlayerState* player);
+float tick_duration(const Simulation* sim);
+int advance_simulation(Simulation* sim, double frame_time);
+void simulate_tick(Simulation* sim, Scene* scene, PlayerState* player, const TickInput* input);
+float tick_blend(const Simulation* sim);
+Camera interpolated_camera(const Simulation* sim, const PlayerState* player);
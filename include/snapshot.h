@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "scene.h"
+
+// Save states of the dynamic parts of a session: the player, both portals, the cubes with their sleep state and the
+// contacts the solver warm starts from, so the cubes carry on after a restore exactly as they did after the save.
+// Brushes are not stored, a snapshot only restores onto the scene it was taken from.
+#define SNAPSHOT_MAGIC 0x504E5350 // "PSNP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_NO_BRUSH 0xFFFFFFFF
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t brush_count;
+    uint32_t cube_count;
+    uint32_t contact_count;
+    uint32_t crc; // Of everything after the header
+};
+
+/** Snapshot records **/
+struct SnapshotPlayerRecord {
+    float position[3];
+    float yaw;
+    float pitch;
+    float vel_y;
+    uint32_t on_ground;
+};
+
+// Portals refer to their brush by index. The brush itself is kept to check it did not change.
+struct SnapshotPortalRecord {
+    uint32_t open;
+    uint32_t draw_on_top;
+    uint32_t brush_index;
+    float age; // Seconds since the portal opened. The scene clock restarts on every load, so spawn times would not carry over.
+    float position[3];
+    float normal[3];
+    float width;
+    float height;
+    SceneBrushRecord brush;
+};
+
+struct SnapshotCubeRecord {
+    float position[3];
+    float velocity[3];
+    float color[3];
+    float size;
+    uint32_t grabbed;
+    uint32_t asleep;
+    uint32_t island;
+    uint32_t still_ticks;
+};
+
+struct SnapshotContactRecord {
+    uint32_t a;
+    uint32_t b;
+    uint32_t axis;
+    float sign;
+    float separation;
+    float normal_impulse;
+    float tangent_impulse[2];
+};
+
+// Player state that lives outside the scene
+struct PlayerState {
+    Camera camera;
+    float vel_y;
+    bool on_ground;
+
+    PlayerState(Camera camera, float vel_y, bool on_ground) : camera(camera), vel_y(vel_y), on_ground(on_ground) {}
+};
+
+void save_snapshot(Scene* scene, const PlayerState* player, std::vector<unsigned char>* snapshot);
+int restore_snapshot(const unsigned char* data, size_t size, Scene* scene, PlayerState* player);
+int write_snapshot_file(const char* path, const std::vector<unsigned char>& snapshot);
+int read_snapshot_file(const char* path, std::vector<unsigned char>* snapshot);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#define SWEEP_AXIS_SWITCH_RATIO 1.5f // Another axis must spread the objects this much more before the sweep moves to it
+
+// Box of an object with its components rotated so the sweep axis comes first
+struct SweepEntry {
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t object;
+};
+
+// Two objects whose boxes overlap, with a < b
+struct SweepPair {
+    uint32_t a;
+    uint32_t b;
+};
+
+// Sort-and-sweep broadphase along the axis the objects are most spread out on.
+// The entries stay sorted between updates, so while objects move a little per tick sorting them again is close to linear.
+struct SweepPrune {
+    int axis;
+    std::vector<SweepEntry> entries; // Sorted by min along axis
+
+    SweepPrune() : axis(0) {}
+};
+
+void sweep_prune_update(SweepPrune* sweep, const glm::vec3* mins, const glm::vec3* maxs, size_t count, std::vector<SweepPair>* pairs);
@@ -0,0 +1,21 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aColor;
+
+uniform mat4 u_VP;
+
+out vec3 frag_normal;
+out vec3 frag_worldpos;
+out vec3 frag_color_in;
+
+void main()
+{
+    // Static geometry is already in world space
+    gl_Position = u_VP * vec4(aPos, 1.0);
+    frag_worldpos = aPos;
+
+    frag_normal = aNormal;
+    frag_color_in = aColor;
+}
\ No newline at end of file
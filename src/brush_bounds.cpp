@@ -0,0 +1,253 @@
+#include "brush_bounds.h"
+
+#include <cfloat>
+#include <cmath>
+
+#include "scene.h"
+
+// SSE2 is part of x86-64, AVX2 is checked at runtime
+#if defined(__x86_64__)
+#define BOUNDS_X86 1
+#include <immintrin.h>
+#endif
+
+// Boxes are tested against rays slightly fattened, with the same margin as the BVH nodes, so the kernels never
+// reject a brush that intersect_AABB would hit. Callers confirm every candidate with the exact test.
+#define BOUNDS_EPSILON 0.0001f
+#define BOUNDS_RELATIVE_EPSILON (16.0f * FLT_EPSILON)
+
+void build_brush_bounds(const std::vector<Brush>& brushes, const uint32_t* order, size_t count, BrushBounds* bounds) {
+    std::vector<float>* arrays[6] = { &bounds->min_x, &bounds->min_y, &bounds->min_z, &bounds->max_x, &bounds->max_y, &bounds->max_z };
+    for (int a = 0; a < 6; a++) {
+        arrays[a]->assign(count + BOUNDS_BATCH, 0.0f);
+    }
+    bounds->count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        const Brush* brush = &brushes[order ? order[i] : i];
+        bounds->min_x[i] = brush->min.x;
+        bounds->min_y[i] = brush->min.y;
+        bounds->min_z[i] = brush->min.z;
+        bounds->max_x[i] = brush->max.x;
+        bounds->max_y[i] = brush->max.y;
+        bounds->max_z[i] = brush->max.z;
+    }
+}
+
+/** Scalar kernels **/
+
+// Same results as _mm_min_ps and _mm_max_ps, including which operand wins when one is NaN
+static inline float min_ps(float a, float b) { return a < b ? a : b; }
+static inline float max_ps(float a, float b) { return a > b ? a : b; }
+
+// Narrow [t_min, t_max] to the part of the ray inside one fattened slab
+static inline void ray_slab(float box_min, float box_max, float origin, float inv_dir, float* t_min, float* t_max) {
+    float margin = BOUNDS_EPSILON + BOUNDS_RELATIVE_EPSILON * (max_ps(std::fabs(box_min), std::fabs(box_max)) + std::fabs(origin));
+    float t1 = ((box_min - margin) - origin) * inv_dir;
+    float t2 = ((box_max + margin) - origin) * inv_dir;
+    *t_min = max_ps(min_ps(t1, t2), *t_min);
+    *t_max = min_ps(max_ps(t1, t2), *t_max);
+}
+
+static uint32_t ray_bounds_mask_scalar(const BrushBounds* bounds, size_t first, glm::vec3 origin, glm::vec3 inv_dir) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i++) {
+        size_t b = first + i;
+        float t_min = 0.0f;
+        float t_max = FLT_MAX;
+        ray_slab(bounds->min_x[b], bounds->max_x[b], origin.x, inv_dir.x, &t_min, &t_max);
+        ray_slab(bounds->min_y[b], bounds->max_y[b], origin.y, inv_dir.y, &t_min, &t_max);
+        ray_slab(bounds->min_z[b], bounds->max_z[b], origin.z, inv_dir.z, &t_min, &t_max);
+        if (t_min <= t_max) mask |= 1u << i;
+    }
+    return mask;
+}
+
+static uint32_t ray_packet_mask_scalar(const RayPacket* packet, glm::vec3 min, glm::vec3 max) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i++) {
+        float t_min = 0.0f;
+        float t_max = packet->t_max[i];
+        ray_slab(min.x, max.x, packet->origin_x[i], packet->inv_dir_x[i], &t_min, &t_max);
+        ray_slab(min.y, max.y, packet->origin_y[i], packet->inv_dir_y[i], &t_min, &t_max);
+        ray_slab(min.z, max.z, packet->origin_z[i], packet->inv_dir_z[i], &t_min, &t_max);
+        if (t_min <= t_max) mask |= 1u << i;
+    }
+    return mask;
+}
+
+static uint32_t overlap_bounds_mask_scalar(const BrushBounds* bounds, size_t first, glm::vec3 min, glm::vec3 max) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i++) {
+        size_t b = first + i;
+        if (min.x <= bounds->max_x[b] && max.x >= bounds->min_x[b] &&
+            min.y <= bounds->max_y[b] && max.y >= bounds->min_y[b] &&
+            min.z <= bounds->max_z[b] && max.z >= bounds->min_z[b]) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef BOUNDS_X86
+
+/** SSE kernels, 4 boxes per instruction **/
+
+static inline void ray_slab_sse(__m128 box_min, __m128 box_max, __m128 o, __m128 inv, __m128* t_min, __m128* t_max) {
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 magnitude = _mm_add_ps(_mm_max_ps(_mm_andnot_ps(sign, box_min), _mm_andnot_ps(sign, box_max)), _mm_andnot_ps(sign, o));
+    __m128 margin = _mm_add_ps(_mm_set1_ps(BOUNDS_EPSILON), _mm_mul_ps(_mm_set1_ps(BOUNDS_RELATIVE_EPSILON), magnitude));
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(box_min, margin), o), inv);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(box_max, margin), o), inv);
+    *t_min = _mm_max_ps(_mm_min_ps(t1, t2), *t_min);
+    *t_max = _mm_min_ps(_mm_max_ps(t1, t2), *t_max);
+}
+
+static uint32_t ray_bounds_mask_sse(const BrushBounds* bounds, size_t first, glm::vec3 origin, glm::vec3 inv_dir) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i += 4) {
+        size_t b = first + i;
+        __m128 t_min = _mm_setzero_ps();
+        __m128 t_max = _mm_set1_ps(FLT_MAX);
+        ray_slab_sse(_mm_loadu_ps(&bounds->min_x[b]), _mm_loadu_ps(&bounds->max_x[b]), _mm_set1_ps(origin.x), _mm_set1_ps(inv_dir.x), &t_min, &t_max);
+        ray_slab_sse(_mm_loadu_ps(&bounds->min_y[b]), _mm_loadu_ps(&bounds->max_y[b]), _mm_set1_ps(origin.y), _mm_set1_ps(inv_dir.y), &t_min, &t_max);
+        ray_slab_sse(_mm_loadu_ps(&bounds->min_z[b]), _mm_loadu_ps(&bounds->max_z[b]), _mm_set1_ps(origin.z), _mm_set1_ps(inv_dir.z), &t_min, &t_max);
+        mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_min, t_max)) << i;
+    }
+    return mask;
+}
+
+static uint32_t ray_packet_mask_sse(const RayPacket* packet, glm::vec3 min, glm::vec3 max) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i += 4) {
+        __m128 t_min = _mm_setzero_ps();
+        __m128 t_max = _mm_loadu_ps(&packet->t_max[i]);
+        ray_slab_sse(_mm_set1_ps(min.x), _mm_set1_ps(max.x), _mm_loadu_ps(&packet->origin_x[i]), _mm_loadu_ps(&packet->inv_dir_x[i]), &t_min, &t_max);
+        ray_slab_sse(_mm_set1_ps(min.y), _mm_set1_ps(max.y), _mm_loadu_ps(&packet->origin_y[i]), _mm_loadu_ps(&packet->inv_dir_y[i]), &t_min, &t_max);
+        ray_slab_sse(_mm_set1_ps(min.z), _mm_set1_ps(max.z), _mm_loadu_ps(&packet->origin_z[i]), _mm_loadu_ps(&packet->inv_dir_z[i]), &t_min, &t_max);
+        mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_min, t_max)) << i;
+    }
+    return mask;
+}
+
+static uint32_t overlap_bounds_mask_sse(const BrushBounds* bounds, size_t first, glm::vec3 min, glm::vec3 max) {
+    uint32_t mask = 0;
+    for (int i = 0; i < BOUNDS_BATCH; i += 4) {
+        size_t b = first + i;
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(min.x), _mm_loadu_ps(&bounds->max_x[b])), _mm_cmpge_ps(_mm_set1_ps(max.x), _mm_loadu_ps(&bounds->min_x[b])));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(min.y), _mm_loadu_ps(&bounds->max_y[b])), _mm_cmpge_ps(_mm_set1_ps(max.y), _mm_loadu_ps(&bounds->min_y[b]))));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(min.z), _mm_loadu_ps(&bounds->max_z[b])), _mm_cmpge_ps(_mm_set1_ps(max.z), _mm_loadu_ps(&bounds->min_z[b]))));
+        mask |= (uint32_t)_mm_movemask_ps(hit) << i;
+    }
+    return mask;
+}
+
+/** AVX2 kernels, 8 boxes per instruction. Compiled for AVX2 only, and only called when the CPU has it. **/
+
+__attribute__((target("avx2")))
+static inline void ray_slab_avx2(__m256 box_min, __m256 box_max, __m256 o, __m256 inv, __m256* t_min, __m256* t_max) {
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 magnitude = _mm256_add_ps(_mm256_max_ps(_mm256_andnot_ps(sign, box_min), _mm256_andnot_ps(sign, box_max)), _mm256_andnot_ps(sign, o));
+    __m256 margin = _mm256_add_ps(_mm256_set1_ps(BOUNDS_EPSILON), _mm256_mul_ps(_mm256_set1_ps(BOUNDS_RELATIVE_EPSILON), magnitude));
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(box_min, margin), o), inv);
+    __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(box_max, margin), o), inv);
+    *t_min = _mm256_max_ps(_mm256_min_ps(t1, t2), *t_min);
+    *t_max = _mm256_min_ps(_mm256_max_ps(t1, t2), *t_max);
+}
+
+__attribute__((target("avx2")))
+static uint32_t ray_bounds_mask_avx2(const BrushBounds* bounds, size_t first, glm::vec3 origin, glm::vec3 inv_dir) {
+    __m256 t_min = _mm256_setzero_ps();
+    __m256 t_max = _mm256_set1_ps(FLT_MAX);
+    ray_slab_avx2(_mm256_loadu_ps(&bounds->min_x[first]), _mm256_loadu_ps(&bounds->max_x[first]), _mm256_set1_ps(origin.x), _mm256_set1_ps(inv_dir.x), &t_min, &t_max);
+    ray_slab_avx2(_mm256_loadu_ps(&bounds->min_y[first]), _mm256_loadu_ps(&bounds->max_y[first]), _mm256_set1_ps(origin.y), _mm256_set1_ps(inv_dir.y), &t_min, &t_max);
+    ray_slab_avx2(_mm256_loadu_ps(&bounds->min_z[first]), _mm256_loadu_ps(&bounds->max_z[first]), _mm256_set1_ps(origin.z), _mm256_set1_ps(inv_dir.z), &t_min, &t_max);
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2")))
+static uint32_t ray_packet_mask_avx2(const RayPacket* packet, glm::vec3 min, glm::vec3 max) {
+    __m256 t_min = _mm256_setzero_ps();
+    __m256 t_max = _mm256_loadu_ps(packet->t_max);
+    ray_slab_avx2(_mm256_set1_ps(min.x), _mm256_set1_ps(max.x), _mm256_loadu_ps(packet->origin_x), _mm256_loadu_ps(packet->inv_dir_x), &t_min, &t_max);
+    ray_slab_avx2(_mm256_set1_ps(min.y), _mm256_set1_ps(max.y), _mm256_loadu_ps(packet->origin_y), _mm256_loadu_ps(packet->inv_dir_y), &t_min, &t_max);
+    ray_slab_avx2(_mm256_set1_ps(min.z), _mm256_set1_ps(max.z), _mm256_loadu_ps(packet->origin_z), _mm256_loadu_ps(packet->inv_dir_z), &t_min, &t_max);
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2")))
+static uint32_t overlap_bounds_mask_avx2(const BrushBounds* bounds, size_t first, glm::vec3 min, glm::vec3 max) {
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(min.x), _mm256_loadu_ps(&bounds->max_x[first]), _CMP_LE_OQ),
+                               _mm256_cmp_ps(_mm256_set1_ps(max.x), _mm256_loadu_ps(&bounds->min_x[first]), _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(min.y), _mm256_loadu_ps(&bounds->max_y[first]), _CMP_LE_OQ),
+                                           _mm256_cmp_ps(_mm256_set1_ps(max.y), _mm256_loadu_ps(&bounds->min_y[first]), _CMP_GE_OQ)));
+    hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(min.z), _mm256_loadu_ps(&bounds->max_z[first]), _CMP_LE_OQ),
+                                           _mm256_cmp_ps(_mm256_set1_ps(max.z), _mm256_loadu_ps(&bounds->min_z[first]), _CMP_GE_OQ)));
+    return (uint32_t)_mm256_movemask_ps(hit);
+}
+
+#endif
+
+/** Dispatch **/
+
+static int best_bounds_kernel() {
+#ifdef BOUNDS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return BOUNDS_KERNEL_AVX2;
+    return BOUNDS_KERNEL_SSE;
+#else
+    return BOUNDS_KERNEL_SCALAR;
+#endif
+}
+
+static int current_kernel = best_bounds_kernel();
+
+int bounds_kernel() {
+    return current_kernel;
+}
+
+// Switch to another kernel, for example to compare them. Falls back to the best supported one below it.
+// Returns the kernel now in use.
+int set_bounds_kernel(int kernel) {
+    int best = best_bounds_kernel();
+    current_kernel = kernel < best ? kernel : best;
+    if (current_kernel < BOUNDS_KERNEL_SCALAR) current_kernel = BOUNDS_KERNEL_SCALAR;
+    return current_kernel;
+}
+
+// Test a ray against bounds[first .. first + count), count at most BOUNDS_BATCH.
+// Bit i of the result is set if the ray may hit box first + i.
+uint32_t ray_bounds_mask(const BrushBounds* bounds, size_t first, size_t count, glm::vec3 origin, glm::vec3 inv_dir) {
+    uint32_t valid = (1u << count) - 1;
+    switch (current_kernel) {
+#ifdef BOUNDS_X86
+        case BOUNDS_KERNEL_AVX2: return ray_bounds_mask_avx2(bounds, first, origin, inv_dir) & valid;
+        case BOUNDS_KERNEL_SSE: return ray_bounds_mask_sse(bounds, first, origin, inv_dir) & valid;
+#endif
+        default: return ray_bounds_mask_scalar(bounds, first, origin, inv_dir) & valid;
+    }
+}
+
+// Test all rays of a packet against one box. Bit i of the result is set if ray i may enter the box before its t_max.
+uint32_t ray_packet_mask(const RayPacket* packet, glm::vec3 min, glm::vec3 max) {
+    switch (current_kernel) {
+#ifdef BOUNDS_X86
+        case BOUNDS_KERNEL_AVX2: return ray_packet_mask_avx2(packet, min, max);
+        case BOUNDS_KERNEL_SSE: return ray_packet_mask_sse(packet, min, max);
+#endif
+        default: return ray_packet_mask_scalar(packet, min, max);
+    }
+}
+
+// Test a box against bounds[first .. first + count), count at most BOUNDS_BATCH.
+// Bit i of the result is set if box first + i overlaps it, touching counts as overlapping.
+uint32_t overlap_bounds_mask(const BrushBounds* bounds, size_t first, size_t count, glm::vec3 min, glm::vec3 max) {
+    uint32_t valid = (1u << count) - 1;
+    switch (current_kernel) {
+#ifdef BOUNDS_X86
+        case BOUNDS_KERNEL_AVX2: return overlap_bounds_mask_avx2(bounds, first, min, max) & valid;
+        case BOUNDS_KERNEL_SSE: return overlap_bounds_mask_sse(bounds, first, min, max) & valid;
+#endif
+        default: return overlap_bounds_mask_scalar(bounds, first, min, max) & valid;
+    }
+}
@@ -0,0 +1,145 @@
+#include "brush_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "scene.h"
+
+// Cell coordinate of a position along one axis, clamped to the grid
+static int grid_coord(const BrushGrid* grid, float position, int axis) {
+    float cell = std::floor((position - grid->origin[axis]) / grid->cell_size);
+    if (!(cell > 0.0f)) return 0; // Also catches NaN
+    if (cell >= (float)(grid->dims[axis] - 1)) return grid->dims[axis] - 1;
+    return (int)cell;
+}
+
+static void grid_cells(const BrushGrid* grid, glm::vec3 min, glm::vec3 max, int* cell_min, int* cell_max) {
+    for (int axis = 0; axis < 3; axis++) {
+        cell_min[axis] = grid_coord(grid, min[axis], axis);
+        cell_max[axis] = grid_coord(grid, max[axis], axis);
+    }
+}
+
+static size_t cell_span(const int* cell_min, const int* cell_max) {
+    return (size_t)(cell_max[0] - cell_min[0] + 1) * (cell_max[1] - cell_min[1] + 1) * (cell_max[2] - cell_min[2] + 1);
+}
+
+static size_t cell_index(const BrushGrid* grid, int x, int y, int z) {
+    return ((size_t)z * grid->dims[1] + y) * grid->dims[0] + x;
+}
+
+// Pick a cell size giving about one cell per brush, but no smaller than a typical brush
+// so that most brushes only land in a few cells
+static float choose_cell_size(const std::vector<Brush>& brushes, glm::vec3 extent) {
+    std::vector<float> sizes(brushes.size());
+    for (size_t i = 0; i < brushes.size(); i++) {
+        glm::vec3 size = brushes[i].max - brushes[i].min;
+        sizes[i] = std::max(std::max(size.x, size.y), size.z);
+    }
+    std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+    float median_size = sizes[sizes.size() / 2];
+
+    glm::vec3 padded = glm::max(extent, glm::vec3(median_size, median_size, median_size));
+    float volume_cell = std::cbrt(padded.x * padded.y * padded.z / (float)brushes.size());
+    float cell_size = std::max(volume_cell, median_size);
+    return cell_size > 0.0f ? cell_size : 1.0f;
+}
+
+// Build the grid over the scene bounds, which must contain every brush
+void build_brush_grid(const std::vector<Brush>& brushes, glm::vec3 bounds_min, glm::vec3 bounds_max, BrushGrid* grid) {
+    grid->cell_first.clear();
+    grid->brushes.clear();
+    grid->large_brushes.clear();
+    grid->brush_count = brushes.size();
+    grid->dims[0] = grid->dims[1] = grid->dims[2] = 0;
+    if (brushes.empty()) return;
+
+    glm::vec3 extent = bounds_max - bounds_min;
+    grid->origin = bounds_min;
+    grid->cell_size = choose_cell_size(brushes, extent);
+
+    size_t cell_count;
+    for (;;) {
+        cell_count = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            grid->dims[axis] = std::max(1, (int)std::min(std::ceil(extent[axis] / grid->cell_size), (float)BRUSH_GRID_MAX_CELLS));
+            cell_count *= grid->dims[axis];
+        }
+        if (cell_count <= BRUSH_GRID_MAX_CELLS) break;
+        grid->cell_size *= std::cbrt((float)cell_count / BRUSH_GRID_MAX_CELLS) * 1.01f;
+    }
+
+    // Count the brushes per cell, then fill the cells in brush order
+    grid->cell_first.assign(cell_count + 1, 0);
+    std::vector<char> large(brushes.size(), 0);
+    for (size_t i = 0; i < brushes.size(); i++) {
+        int cell_min[3], cell_max[3];
+        grid_cells(grid, brushes[i].min, brushes[i].max, cell_min, cell_max);
+        if (cell_span(cell_min, cell_max) > BRUSH_GRID_MAX_BRUSH_CELLS) {
+            large[i] = 1;
+            grid->large_brushes.push_back((uint32_t)i);
+            continue;
+        }
+        for (int z = cell_min[2]; z <= cell_max[2]; z++)
+            for (int y = cell_min[1]; y <= cell_max[1]; y++)
+                for (int x = cell_min[0]; x <= cell_max[0]; x++)
+                    grid->cell_first[cell_index(grid, x, y, z) + 1]++;
+    }
+
+    for (size_t i = 0; i < cell_count; i++) {
+        grid->cell_first[i + 1] += grid->cell_first[i];
+    }
+
+    grid->brushes.resize(grid->cell_first[cell_count]);
+    std::vector<uint32_t> cursor(grid->cell_first.begin(), grid->cell_first.end() - 1);
+    for (size_t i = 0; i < brushes.size(); i++) {
+        if (large[i]) continue;
+        int cell_min[3], cell_max[3];
+        grid_cells(grid, brushes[i].min, brushes[i].max, cell_min, cell_max);
+        for (int z = cell_min[2]; z <= cell_max[2]; z++)
+            for (int y = cell_min[1]; y <= cell_max[1]; y++)
+                for (int x = cell_min[0]; x <= cell_max[0]; x++)
+                    grid->brushes[cursor[cell_index(grid, x, y, z)]++] = (uint32_t)i;
+    }
+
+    build_brush_bounds(brushes, grid->brushes.empty() ? NULL : &grid->brushes[0], grid->brushes.size(), &grid->bounds);
+}
+
+// Collect the indices of all brushes whose bounds overlap the box (touching counts as overlapping),
+// in increasing brush index order. Replaces the contents of results.
+void brush_grid_query(const BrushGrid* grid, const std::vector<Brush>& brushes, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results) {
+    results->clear();
+    if (grid->cell_first.empty()) return;
+
+    for (size_t i = 0; i < grid->large_brushes.size(); i++) {
+        const Brush* brush = &brushes[grid->large_brushes[i]];
+        if (check_aabb_intersection(min, max, brush->min, brush->max)) results->push_back(grid->large_brushes[i]);
+    }
+
+    int query_min[3], query_max[3];
+    grid_cells(grid, min, max, query_min, query_max);
+    for (int z = query_min[2]; z <= query_max[2]; z++) {
+        for (int y = query_min[1]; y <= query_max[1]; y++) {
+            for (int x = query_min[0]; x <= query_max[0]; x++) {
+                size_t cell = cell_index(grid, x, y, z);
+                uint32_t end = grid->cell_first[cell + 1];
+                for (uint32_t first = grid->cell_first[cell]; first < end; first += BOUNDS_BATCH) {
+                    uint32_t mask = overlap_bounds_mask(&grid->bounds, first, std::min(end - first, (uint32_t)BOUNDS_BATCH), min, max);
+                    for (uint32_t i = first; mask != 0; i++, mask >>= 1) {
+                        if (!(mask & 1)) continue;
+
+                        // A brush spanning several cells of the query is only reported from the first one they share
+                        const Brush* brush = &brushes[grid->brushes[i]];
+                        int cell_min[3], cell_max[3];
+                        grid_cells(grid, brush->min, brush->max, cell_min, cell_max);
+                        if (x != std::max(cell_min[0], query_min[0]) || y != std::max(cell_min[1], query_min[1]) || z != std::max(cell_min[2], query_min[2])) continue;
+
+                        results->push_back(grid->brushes[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(results->begin(), results->end());
+}
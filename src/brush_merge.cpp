@@ -0,0 +1,160 @@
+#include "brush_merge.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "scene_bake.h"
+
+#define AUTHORED_FACE_EPSILON 1e-4f
+
+// Orders boxes so the ones that can merge along the axis end up next to each other:
+// same color, same extent on the other two axes, then by their start on the axis
+struct MergeOrder {
+    const std::vector<Brush>* boxes;
+    int axis;
+
+    bool operator()(uint32_t a, uint32_t b) const {
+        const Brush* box_a = &(*boxes)[a];
+        const Brush* box_b = &(*boxes)[b];
+        for (int k = 1; k < 3; k++) {
+            int other = (axis + k) % 3;
+            if (box_a->min[other] != box_b->min[other]) return box_a->min[other] < box_b->min[other];
+            if (box_a->max[other] != box_b->max[other]) return box_a->max[other] < box_b->max[other];
+        }
+        for (int k = 0; k < 3; k++) {
+            if (box_a->color[k] != box_b->color[k]) return box_a->color[k] < box_b->color[k];
+        }
+        if (box_a->min[axis] != box_b->min[axis]) return box_a->min[axis] < box_b->min[axis];
+        return a < b;
+    }
+};
+
+static bool mergeable(const Brush* a, const Brush* b, int axis) {
+    for (int k = 1; k < 3; k++) {
+        int other = (axis + k) % 3;
+        if (a->min[other] != b->min[other] || a->max[other] != b->max[other]) return false;
+    }
+    return a->color == b->color && b->min[axis] <= a->max[axis];
+}
+
+static uint32_t find_root(std::vector<uint32_t>* parent, uint32_t box) {
+    while ((*parent)[box] != box) {
+        (*parent)[box] = (*parent)[(*parent)[box]];
+        box = (*parent)[box];
+    }
+    return box;
+}
+
+// Merge brushes of the same color wherever their union is exactly a box, until no two can be merged.
+// The scene keeps the authored brushes and which merged brush each one ended up in, see authored_brush_at.
+// Must run before the runtime data is built. Returns the number of brushes removed.
+size_t merge_brushes(Scene* scene) {
+    std::vector<Brush> boxes = scene->geometry;
+    std::vector<uint32_t> parent(boxes.size());
+    std::vector<uint32_t> alive(boxes.size());
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        parent[i] = i;
+        alive[i] = i;
+    }
+
+    // Merging along one axis can line boxes up along another, so sweep the axes until nothing changes
+    int quiet_axes = 0;
+    for (int axis = 0; quiet_axes < 3; axis = (axis + 1) % 3) {
+        MergeOrder order = { &boxes, axis };
+        std::sort(alive.begin(), alive.end(), order);
+
+        bool merged = false;
+        size_t kept = 0;
+        for (size_t i = 0; i < alive.size(); i++) {
+            if (kept > 0 && mergeable(&boxes[alive[kept - 1]], &boxes[alive[i]], axis)) {
+                // The box with the lower index survives, so merged brushes keep the authored order
+                uint32_t survivor = std::min(alive[kept - 1], alive[i]);
+                uint32_t removed = std::max(alive[kept - 1], alive[i]);
+                boxes[survivor].min[axis] = glm::min(boxes[survivor].min[axis], boxes[removed].min[axis]);
+                boxes[survivor].max[axis] = glm::max(boxes[survivor].max[axis], boxes[removed].max[axis]);
+                parent[removed] = survivor;
+                alive[kept - 1] = survivor;
+                merged = true;
+            } else {
+                alive[kept++] = alive[i];
+            }
+        }
+        alive.resize(kept);
+        quiet_axes = merged ? 0 : quiet_axes + 1;
+    }
+
+    size_t removed = boxes.size() - alive.size();
+    if (removed == 0) return 0;
+
+    // Merged brushes in authored order
+    std::sort(alive.begin(), alive.end());
+    std::vector<uint32_t> merged_index(boxes.size());
+    std::vector<Brush> geometry;
+    geometry.reserve(alive.size());
+    for (size_t i = 0; i < alive.size(); i++) {
+        merged_index[alive[i]] = (uint32_t)i;
+        geometry.push_back(boxes[alive[i]]);
+    }
+
+    // Compose with an earlier merge, the mapping always goes back to the brushes in the file
+    std::vector<uint32_t> authored_map;
+    if (scene->authored_geometry.empty()) {
+        scene->authored_geometry.swap(scene->geometry);
+        authored_map.resize(scene->authored_geometry.size());
+        for (uint32_t i = 0; i < authored_map.size(); i++) authored_map[i] = merged_index[find_root(&parent, i)];
+    } else {
+        authored_map.resize(scene->authored_geometry.size());
+        for (uint32_t i = 0; i < authored_map.size(); i++) {
+            authored_map[i] = merged_index[find_root(&parent, scene->authored_map[i])];
+        }
+    }
+
+    scene->geometry.swap(geometry);
+    set_authored_map(scene, authored_map);
+    return removed;
+}
+
+// Set which merged brush every authored brush belongs to, and build the reverse lookup
+void set_authored_map(Scene* scene, const std::vector<uint32_t>& authored_map) {
+    scene->authored_map = authored_map;
+    scene->authored_first.assign(scene->geometry.size() + 1, 0);
+    for (size_t i = 0; i < authored_map.size(); i++) {
+        scene->authored_first[authored_map[i] + 1]++;
+    }
+    for (size_t i = 1; i < scene->authored_first.size(); i++) {
+        scene->authored_first[i] += scene->authored_first[i - 1];
+    }
+
+    std::vector<uint32_t> next(scene->authored_first.begin(), scene->authored_first.end() - 1);
+    scene->authored_indices.resize(authored_map.size());
+    for (uint32_t i = 0; i < authored_map.size(); i++) {
+        scene->authored_indices[next[authored_map[i]]++] = i;
+    }
+}
+
+// The authored brush whose face, facing along normal, contains the point on a merged brush.
+// Returns the brush itself when brushes were not merged or no authored face matches.
+const Brush* authored_brush_at(Scene* scene, const Brush* brush, glm::vec3 normal, glm::vec3 point) {
+    if (scene->authored_geometry.empty()) return brush;
+
+    // A zero normal means the point is inside the brush, any authored brush holding it will do
+    uint32_t merged = (uint32_t)(brush - &scene->geometry[0]);
+    bool inside_brush = normal == glm::vec3(0.0f);
+    int face = face_index(normal);
+    int axis = inside_brush ? -1 : face / 2;
+    float plane = inside_brush ? 0.0f : face & 1 ? brush->max[axis] : brush->min[axis];
+
+    // Authored brushes are listed in index order, so a point on a seam goes to the lowest index
+    for (uint32_t i = scene->authored_first[merged]; i < scene->authored_first[merged + 1]; i++) {
+        const Brush* authored = &scene->authored_geometry[scene->authored_indices[i]];
+        if (!inside_brush && (face & 1 ? authored->max[axis] : authored->min[axis]) != plane) continue;
+
+        bool inside = true;
+        for (int k = 0; k < 3; k++) {
+            if (k == axis) continue;
+            if (point[k] < authored->min[k] - AUTHORED_FACE_EPSILON || point[k] > authored->max[k] + AUTHORED_FACE_EPSILON) inside = false;
+        }
+        if (inside) return authored;
+    }
+    return brush;
+}
@@ -0,0 +1,278 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+#include "scene.h"
+
+// Node boxes are tested slightly fattened so the traversal never rejects a brush the exact test would hit.
+// Rounding grows with the magnitude of the coordinates, so part of the margin is relative.
+#define BVH_EPSILON 0.0001f
+#define BVH_RELATIVE_EPSILON (16.0f * FLT_EPSILON)
+
+void update_node_bounds(BVH* bvh, const std::vector<Brush>& brushes, uint32_t node_index) {
+    BVHNode* node = &bvh->nodes[node_index];
+    node->min = glm::vec3(std::numeric_limits<float>::max());
+    node->max = glm::vec3(-std::numeric_limits<float>::max());
+    for (uint32_t i = node->left_first; i < node->left_first + node->count; i++) {
+        const Brush* brush = &brushes[bvh->indices[i]];
+        node->min = glm::min(node->min, brush->min);
+        node->max = glm::max(node->max, brush->max);
+    }
+}
+
+struct BVHBin {
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+float half_surface_area(glm::vec3 min, glm::vec3 max) {
+    glm::vec3 extent = max - min;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+int centroid_bin(float centroid, float centroid_min, float scale) {
+    int bin = (int)((centroid - centroid_min) * scale);
+    return std::min(std::max(bin, 0), BVH_BIN_COUNT - 1);
+}
+
+// Find the cheapest split plane of a node by binning the centroids along each axis.
+// Returns the SAH cost of the split relative to an intersection cost of 1, or infinity if no axis can be split.
+float find_sah_split(const BVH* bvh, const std::vector<Brush>& brushes, const std::vector<glm::vec3>& centroids,
+                     uint32_t first, uint32_t count, glm::vec3 centroid_min, glm::vec3 centroid_max, int* split_axis, int* split_bin) {
+    float best_cost = std::numeric_limits<float>::infinity();
+
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroid_max[axis] - centroid_min[axis];
+        if (extent <= 0.0f) continue;
+        float scale = BVH_BIN_COUNT / extent;
+
+        BVHBin bins[BVH_BIN_COUNT];
+        for (int b = 0; b < BVH_BIN_COUNT; b++) {
+            bins[b].min = glm::vec3(std::numeric_limits<float>::max());
+            bins[b].max = glm::vec3(-std::numeric_limits<float>::max());
+            bins[b].count = 0;
+        }
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t brush_index = bvh->indices[i];
+            BVHBin* bin = &bins[centroid_bin(centroids[brush_index][axis], centroid_min[axis], scale)];
+            bin->min = glm::min(bin->min, brushes[brush_index].min);
+            bin->max = glm::max(bin->max, brushes[brush_index].max);
+            bin->count++;
+        }
+
+        // Sweep from the right to get the cost of the bins past each plane, then from the left
+        float right_cost[BVH_BIN_COUNT];
+        glm::vec3 right_min(std::numeric_limits<float>::max());
+        glm::vec3 right_max(-std::numeric_limits<float>::max());
+        uint32_t right_count = 0;
+        for (int b = BVH_BIN_COUNT - 1; b > 0; b--) {
+            right_min = glm::min(right_min, bins[b].min);
+            right_max = glm::max(right_max, bins[b].max);
+            right_count += bins[b].count;
+            right_cost[b] = right_count > 0 ? half_surface_area(right_min, right_max) * right_count : std::numeric_limits<float>::infinity();
+        }
+
+        glm::vec3 left_min(std::numeric_limits<float>::max());
+        glm::vec3 left_max(-std::numeric_limits<float>::max());
+        uint32_t left_count = 0;
+        for (int b = 1; b < BVH_BIN_COUNT; b++) {
+            left_min = glm::min(left_min, bins[b - 1].min);
+            left_max = glm::max(left_max, bins[b - 1].max);
+            left_count += bins[b - 1].count;
+            if (left_count == 0) continue;
+
+            float cost = half_surface_area(left_min, left_max) * left_count + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                *split_axis = axis;
+                *split_bin = b;
+            }
+        }
+    }
+
+    return best_cost;
+}
+
+// Build a BVH over the brushes with binned SAH splits
+void build_bvh(const std::vector<Brush>& brushes, BVH* bvh) {
+    uint32_t brush_count = (uint32_t)brushes.size();
+
+    bvh->nodes.clear();
+    bvh->indices.resize(brush_count);
+    if (brush_count == 0) return;
+
+    std::vector<glm::vec3> centroids(brush_count);
+    for (uint32_t i = 0; i < brush_count; i++) {
+        bvh->indices[i] = i;
+        centroids[i] = (brushes[i].min + brushes[i].max) * 0.5f;
+    }
+
+    bvh->nodes.reserve(brush_count * 2);
+    BVHNode root;
+    root.left_first = 0;
+    root.count = brush_count;
+    bvh->nodes.push_back(root);
+    update_node_bounds(bvh, brushes, 0);
+
+    // Pairs of (node index, depth)
+    std::vector<std::pair<uint32_t, int> > stack(1, std::make_pair(0u, 0));
+    while (!stack.empty()) {
+        uint32_t node_index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        uint32_t first = bvh->nodes[node_index].left_first;
+        uint32_t count = bvh->nodes[node_index].count;
+        if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH) continue;
+
+        glm::vec3 centroid_min = centroids[bvh->indices[first]];
+        glm::vec3 centroid_max = centroid_min;
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            centroid_min = glm::min(centroid_min, centroids[bvh->indices[i]]);
+            centroid_max = glm::max(centroid_max, centroids[bvh->indices[i]]);
+        }
+
+        int axis = 0;
+        int bin = 0;
+        float split_cost = find_sah_split(bvh, brushes, centroids, first, count, centroid_min, centroid_max, &axis, &bin);
+        if (std::isinf(split_cost)) continue; // All centroids coincide, keep as a leaf
+
+        // Splitting costs a traversal step plus the expected intersections in both children
+        const BVHNode* node = &bvh->nodes[node_index];
+        float leaf_cost = (float)count;
+        float node_cost = BVH_TRAVERSAL_COST + split_cost / half_surface_area(node->min, node->max);
+        if (node_cost >= leaf_cost && count <= BVH_MAX_SAH_LEAF_SIZE) continue;
+
+        float scale = BVH_BIN_COUNT / (centroid_max[axis] - centroid_min[axis]);
+        uint32_t* begin = &bvh->indices[0] + first;
+        uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t brush_index) {
+            return centroid_bin(centroids[brush_index][axis], centroid_min[axis], scale) < bin;
+        });
+        uint32_t half = (uint32_t)(middle - begin);
+
+        uint32_t left_index = (uint32_t)bvh->nodes.size();
+        BVHNode left, right;
+        left.left_first = first;
+        left.count = half;
+        right.left_first = first + half;
+        right.count = count - half;
+        bvh->nodes.push_back(left);
+        bvh->nodes.push_back(right);
+        update_node_bounds(bvh, brushes, left_index);
+        update_node_bounds(bvh, brushes, left_index + 1);
+
+        bvh->nodes[node_index].left_first = left_index;
+        bvh->nodes[node_index].count = 0;
+
+        stack.push_back(std::make_pair(left_index, depth + 1));
+        stack.push_back(std::make_pair(left_index + 1, depth + 1));
+    }
+
+    update_leaf_bounds(bvh, brushes);
+}
+
+// Copy the brush bounds into leaf order for the batched kernels
+void update_leaf_bounds(BVH* bvh, const std::vector<Brush>& brushes) {
+    build_brush_bounds(brushes, bvh->indices.empty() ? NULL : &bvh->indices[0], bvh->indices.size(), &bvh->leaf_bounds);
+}
+
+// Recompute all node bounds after brushes moved, keeping the tree structure
+void refit_bvh(BVH* bvh, const std::vector<Brush>& brushes) {
+    // Children always come after their parent, so walking backwards visits them first
+    for (size_t i = bvh->nodes.size(); i-- > 0;) {
+        BVHNode* node = &bvh->nodes[i];
+        if (node->count > 0) {
+            update_node_bounds(bvh, brushes, (uint32_t)i);
+        } else {
+            node->min = glm::min(bvh->nodes[node->left_first].min, bvh->nodes[node->left_first + 1].min);
+            node->max = glm::max(bvh->nodes[node->left_first].max, bvh->nodes[node->left_first + 1].max);
+        }
+    }
+
+    update_leaf_bounds(bvh, brushes);
+}
+
+// Check that a BVH read from a file only references existing nodes and brushes and is not too deep to traverse
+bool validate_bvh(const BVH* bvh, size_t brush_count) {
+    if (bvh->indices.size() != brush_count) return false;
+    if (bvh->nodes.empty()) return brush_count == 0;
+
+    // Children always come after their parent, so depths can be propagated in index order
+    std::vector<int> depth(bvh->nodes.size(), 0);
+    for (size_t i = 0; i < bvh->nodes.size(); i++) {
+        const BVHNode* node = &bvh->nodes[i];
+        if (node->count > 0) {
+            if (node->left_first > brush_count || node->count > brush_count - node->left_first) return false;
+        } else if (node->left_first <= i || node->left_first + 1 >= bvh->nodes.size() || depth[i] >= BVH_MAX_DEPTH) {
+            return false;
+        } else {
+            depth[node->left_first] = depth[i] + 1;
+            depth[node->left_first + 1] = depth[i] + 1;
+        }
+    }
+
+    for (size_t i = 0; i < bvh->indices.size(); i++) {
+        if (bvh->indices[i] >= brush_count) return false;
+    }
+
+    return true;
+}
+
+// Slab test against a node. inv_dir holds 1/dir per axis (infinite for zero components).
+// Sets t_entry to the distance along the ray where it enters the node.
+bool ray_node_intersection(const BVHNode* node, glm::vec3 origin, glm::vec3 inv_dir, float* t_entry) {
+    float t_min = 0.0f;
+    float t_max = std::numeric_limits<float>::max();
+
+    for (int i = 0; i < 3; i++) {
+        float margin = BVH_EPSILON + BVH_RELATIVE_EPSILON * (std::max(std::abs(node->min[i]), std::abs(node->max[i])) + std::abs(origin[i]));
+        float min = node->min[i] - margin;
+        float max = node->max[i] + margin;
+
+        if (std::isinf(inv_dir[i])) {
+            // Ray parallel to the slab
+            if (origin[i] < min || origin[i] > max) return false;
+            continue;
+        }
+
+        float t1 = (min - origin[i]) * inv_dir[i];
+        float t2 = (max - origin[i]) * inv_dir[i];
+        t_min = std::max(t_min, std::min(t1, t2));
+        t_max = std::min(t_max, std::max(t1, t2));
+        if (t_min > t_max) return false;
+    }
+
+    *t_entry = t_min;
+    return true;
+}
+
+// Collect the indices of all brushes whose bounds overlap the box (touching counts as overlapping)
+void bvh_query_aabb(const BVH* bvh, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results) {
+    if (bvh->nodes.empty()) return;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const BVHNode* node = &bvh->nodes[stack[--stack_size]];
+        if (!check_aabb_intersection(min, max, node->min, node->max)) continue;
+
+        if (node->count > 0) {
+            uint32_t end = node->left_first + node->count;
+            for (uint32_t first = node->left_first; first < end; first += BOUNDS_BATCH) {
+                uint32_t mask = overlap_bounds_mask(&bvh->leaf_bounds, first, std::min(end - first, (uint32_t)BOUNDS_BATCH), min, max);
+                for (uint32_t i = first; mask != 0; i++, mask >>= 1) {
+                    if (mask & 1) results->push_back(bvh->indices[i]);
+                }
+            }
+        } else {
+            stack[stack_size++] = node->left_first;
+            stack[stack_size++] = node->left_first + 1;
+        }
+    }
+}
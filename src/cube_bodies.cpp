@@ -0,0 +1,172 @@
+#include "cube_bodies.h"
+
+#include <algorithm>
+
+#include "dynamic_tree.h"
+
+// SSE2 is part of x86-64, other targets take the scalar loops
+#if defined(__x86_64__)
+#define BODIES_X86 1
+#include <emmintrin.h>
+#endif
+
+void clear_cube_bodies(CubeBodies* bodies) {
+    *bodies = CubeBodies();
+}
+
+// Append a cube and return its index. Grows the hot arrays a whole batch at a time, the new padding asleep.
+uint32_t add_cube_body(CubeBodies* bodies, const Cube* cube) {
+    size_t i = bodies->count;
+    if (i == bodies->flags.size()) {
+        BodyArray* hot[10] = {
+            &bodies->position_x, &bodies->position_y, &bodies->position_z,
+            &bodies->previous_x, &bodies->previous_y, &bodies->previous_z,
+            &bodies->velocity_x, &bodies->velocity_y, &bodies->velocity_z,
+            &bodies->size,
+        };
+        for (int a = 0; a < 10; a++) {
+            hot[a]->resize(i + CUBE_BODIES_BATCH, 0.0f);
+        }
+        bodies->flags.resize(i + CUBE_BODIES_BATCH, CUBE_ASLEEP);
+    }
+
+    bodies->count++;
+    set_body_position(bodies, i, cube->position);
+    set_body_previous_position(bodies, i, cube->position);
+    set_body_velocity(bodies, i, cube->velocity);
+    bodies->size[i] = cube->size;
+    bodies->flags[i] = cube->grabbed ? CUBE_GRABBED : 0;
+    bodies->proxy.push_back(DYNAMIC_TREE_NULL);
+    bodies->still_ticks.push_back(0);
+    bodies->island.push_back(0);
+    bodies->color.push_back(cube->color);
+    return (uint32_t)i;
+}
+
+// Copy of one body as a cube, for saving
+Cube cube_body(const CubeBodies* bodies, size_t i) {
+    Cube cube(body_position(bodies, i), bodies->color[i]);
+    cube.velocity = body_velocity(bodies, i);
+    cube.size = bodies->size[i];
+    cube.grabbed = (bodies->flags[i] & CUBE_GRABBED) != 0;
+    return cube;
+}
+
+// Length of the hot arrays, count rounded up to a whole batch
+size_t padded_body_count(const CubeBodies* bodies) {
+    return bodies->flags.size();
+}
+
+glm::vec3 body_position(const CubeBodies* bodies, size_t i) {
+    return glm::vec3(bodies->position_x[i], bodies->position_y[i], bodies->position_z[i]);
+}
+
+glm::vec3 body_previous_position(const CubeBodies* bodies, size_t i) {
+    return glm::vec3(bodies->previous_x[i], bodies->previous_y[i], bodies->previous_z[i]);
+}
+
+glm::vec3 body_velocity(const CubeBodies* bodies, size_t i) {
+    return glm::vec3(bodies->velocity_x[i], bodies->velocity_y[i], bodies->velocity_z[i]);
+}
+
+void set_body_position(CubeBodies* bodies, size_t i, glm::vec3 position) {
+    bodies->position_x[i] = position.x;
+    bodies->position_y[i] = position.y;
+    bodies->position_z[i] = position.z;
+}
+
+void set_body_previous_position(CubeBodies* bodies, size_t i, glm::vec3 position) {
+    bodies->previous_x[i] = position.x;
+    bodies->previous_y[i] = position.y;
+    bodies->previous_z[i] = position.z;
+}
+
+void set_body_velocity(CubeBodies* bodies, size_t i, glm::vec3 velocity) {
+    bodies->velocity_x[i] = velocity.x;
+    bodies->velocity_y[i] = velocity.y;
+    bodies->velocity_z[i] = velocity.z;
+}
+
+// Remember where every body starts the tick. Sleeping bodies already have both the same.
+void save_previous_positions(CubeBodies* bodies) {
+    std::copy(bodies->position_x.begin(), bodies->position_x.end(), bodies->previous_x.begin());
+    std::copy(bodies->position_y.begin(), bodies->position_y.end(), bodies->previous_y.begin());
+    std::copy(bodies->position_z.begin(), bodies->position_z.end(), bodies->previous_z.begin());
+}
+
+// Add delta_velocity to the vertical velocity of every body that is awake and not held
+void integrate_gravity(CubeBodies* bodies, float delta_velocity) {
+    size_t padded = padded_body_count(bodies);
+#ifdef BODIES_X86
+    __m128 dv = _mm_set1_ps(delta_velocity);
+    __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < padded; i += CUBE_BODIES_BATCH) {
+        __m128 movable = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i*)&bodies->flags[i]), zero));
+        __m128 v = _mm_load_ps(&bodies->velocity_y[i]);
+        _mm_store_ps(&bodies->velocity_y[i], _mm_or_ps(_mm_and_ps(movable, _mm_add_ps(v, dv)), _mm_andnot_ps(movable, v)));
+    }
+#else
+    for (size_t i = 0; i < padded; i++) {
+        if (bodies->flags[i] == 0) bodies->velocity_y[i] += delta_velocity;
+    }
+#endif
+}
+
+// Inverse mass of every body for the contact solver, one for a unit cube. Sleeping and held bodies get 0, so contacts
+// never push them. Writes padded_body_count values to an array aligned like the hot arrays.
+void body_inverse_masses(const CubeBodies* bodies, float* inverse_masses) {
+    size_t padded = padded_body_count(bodies);
+#ifdef BODIES_X86
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 eight = _mm_set1_ps(8.0f);
+    __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < padded; i += CUBE_BODIES_BATCH) {
+        __m128 movable = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i*)&bodies->flags[i]), zero));
+        __m128 s = _mm_load_ps(&bodies->size[i]);
+        __m128 inverse = _mm_div_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(eight, s), s), s));
+        _mm_store_ps(&inverse_masses[i], _mm_and_ps(movable, inverse));
+    }
+#else
+    for (size_t i = 0; i < padded; i++) {
+        float s = bodies->size[i];
+        inverse_masses[i] = bodies->flags[i] == 0 ? 1.0f / (8.0f * s * s * s) : 0.0f;
+    }
+#endif
+}
+
+// How far every body would move this tick without brushes or portals, from its velocity and the push out of other bodies.
+// Arrays are padded_body_count long and aligned like the hot arrays.
+void body_translations(const CubeBodies* bodies, const float* const pushes[3], float deltaTime, float* const translations[3]) {
+    const float* velocities[3] = { &bodies->velocity_x[0], &bodies->velocity_y[0], &bodies->velocity_z[0] };
+    size_t padded = padded_body_count(bodies);
+    for (int axis = 0; axis < 3; axis++) {
+#ifdef BODIES_X86
+        __m128 dt = _mm_set1_ps(deltaTime);
+        for (size_t i = 0; i < padded; i += CUBE_BODIES_BATCH) {
+            __m128 v = _mm_add_ps(_mm_load_ps(&velocities[axis][i]), _mm_load_ps(&pushes[axis][i]));
+            _mm_store_ps(&translations[axis][i], _mm_mul_ps(v, dt));
+        }
+#else
+        for (size_t i = 0; i < padded; i++) {
+            translations[axis][i] = (velocities[axis][i] + pushes[axis][i]) * deltaTime;
+        }
+#endif
+    }
+}
+
+// Move every body by its translation. The translations are aligned like the hot arrays.
+void translate_bodies(CubeBodies* bodies, const float* const translations[3]) {
+    float* positions[3] = { &bodies->position_x[0], &bodies->position_y[0], &bodies->position_z[0] };
+    size_t padded = padded_body_count(bodies);
+    for (int axis = 0; axis < 3; axis++) {
+#ifdef BODIES_X86
+        for (size_t i = 0; i < padded; i += CUBE_BODIES_BATCH) {
+            _mm_store_ps(&positions[axis][i], _mm_add_ps(_mm_load_ps(&positions[axis][i]), _mm_load_ps(&translations[axis][i])));
+        }
+#else
+        for (size_t i = 0; i < padded; i++) {
+            positions[axis][i] += translations[axis][i];
+        }
+#endif
+    }
+}
@@ -0,0 +1,137 @@
+#include "cube_contacts.h"
+
+#include <algorithm>
+#include <cmath>
+
+static bool contact_less(const CubeContact& a, const CubeContact& b) {
+    if (a.a != b.a) return a.a < b.a;
+    return a.b < b.b;
+}
+
+static bool same_contact(const CubeContact& a, const CubeContact& b) {
+    return a.a == b.a && a.b == b.b && a.axis == b.axis && a.sign == b.sign;
+}
+
+// Contacts for the pairs from the broadphase and the cubes with ground below them, in order of a and then b.
+// ground_distances holds how far each cube is above the brushes under it, INFINITY if none are within CUBE_CONTACT_MARGIN.
+// Replaces the contents of contacts. A contact that was there before with the same normal keeps its impulses, so the
+// solver starts from last tick's answer and stacks settle in a few iterations instead of one per cube.
+void find_cube_contacts(const CubeBodies* bodies, const float* ground_distances, const std::vector<SweepPair>* pairs, std::vector<CubeContact>* contacts) {
+    std::vector<CubeContact> found;
+    for (size_t i = 0; i < pairs->size(); i++) {
+        uint32_t a = (*pairs)[i].a;
+        uint32_t b = (*pairs)[i].b;
+        glm::vec3 offset = body_position(bodies, b) - body_position(bodies, a);
+        glm::vec3 overlap = glm::vec3(bodies->size[a] + bodies->size[b]) - glm::abs(offset);
+
+        // Push out along the axis with the least overlap, or across the widest gap when they do not overlap
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (overlap[k] < overlap[axis]) axis = k;
+        }
+        if (overlap[axis] < -CUBE_CONTACT_MARGIN) continue;
+
+        CubeContact contact;
+        contact.a = a;
+        contact.b = b;
+        contact.axis = axis;
+        contact.sign = offset[axis] < 0.0f ? -1.0f : 1.0f;
+        contact.separation = -overlap[axis];
+        contact.normal_impulse = 0.0f;
+        contact.tangent_impulse = glm::vec2(0.0f);
+        found.push_back(contact);
+    }
+
+    for (size_t i = 0; i < bodies->count; i++) {
+        if (!(ground_distances[i] <= CUBE_CONTACT_MARGIN)) continue;
+
+        CubeContact contact;
+        contact.a = (uint32_t)i;
+        contact.b = CUBE_CONTACT_GROUND;
+        contact.axis = 1;
+        contact.sign = -1.0f;
+        contact.separation = ground_distances[i];
+        contact.normal_impulse = 0.0f;
+        contact.tangent_impulse = glm::vec2(0.0f);
+        found.push_back(contact);
+    }
+    std::sort(found.begin(), found.end(), contact_less);
+
+    // Both lists are sorted, so matching them up is a merge
+    size_t previous = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+        while (previous < contacts->size() && contact_less((*contacts)[previous], found[i])) previous++;
+        if (previous < contacts->size() && same_contact((*contacts)[previous], found[i])) {
+            found[i].normal_impulse = (*contacts)[previous].normal_impulse;
+            found[i].tangent_impulse = (*contacts)[previous].tangent_impulse;
+        }
+    }
+    contacts->swap(found);
+}
+
+// Velocity or push of b relative to a along one axis, the ground never moves
+static inline float relative_value(const float* values, const CubeContact* contact) {
+    return (contact->b == CUBE_CONTACT_GROUND ? 0.0f : values[contact->b]) - values[contact->a];
+}
+
+// Apply an impulse along one axis to the velocities or pushes of both bodies of a contact, in opposite directions
+static inline void apply_impulse(float* values, const CubeContact* contact, float impulse, float inverse_a, float inverse_b) {
+    values[contact->a] -= impulse * inverse_a;
+    if (contact->b != CUBE_CONTACT_GROUND) values[contact->b] += impulse * inverse_b;
+}
+
+// Sequential impulses: change the velocities so no contact closes further than its gap this tick, with Coulomb friction
+// along the faces. Overlap is pushed out separately, through pushes, which move the cubes this tick without adding to
+// their velocities, so pushing cubes apart does not make stacks bounce. Cubes with an inverse mass of 0 are pushed by
+// nothing. Goes through the contacts in order, so the result only depends on the input.
+void solve_cube_contacts(std::vector<CubeContact>* contacts, CubeBodies* bodies, float* const pushes[3], const float* inverse_masses, float deltaTime, int iterations) {
+    float* velocities[3] = { &bodies->velocity_x[0], &bodies->velocity_y[0], &bodies->velocity_z[0] };
+    for (size_t i = 0; i < contacts->size(); i++) {
+        const CubeContact* contact = &(*contacts)[i];
+        float inverse_b = contact->b == CUBE_CONTACT_GROUND ? 0.0f : inverse_masses[contact->b];
+        int axis = contact->axis;
+
+        // Warm start
+        apply_impulse(velocities[axis], contact, contact->normal_impulse * contact->sign, inverse_masses[contact->a], inverse_b);
+        apply_impulse(velocities[(axis + 1) % 3], contact, contact->tangent_impulse.x, inverse_masses[contact->a], inverse_b);
+        apply_impulse(velocities[(axis + 2) % 3], contact, contact->tangent_impulse.y, inverse_masses[contact->a], inverse_b);
+    }
+
+    std::vector<float> push_impulses(contacts->size(), 0.0f);
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (size_t i = 0; i < contacts->size(); i++) {
+            CubeContact* contact = &(*contacts)[i];
+            float inverse_a = inverse_masses[contact->a];
+            float inverse_b = contact->b == CUBE_CONTACT_GROUND ? 0.0f : inverse_masses[contact->b];
+            if (inverse_a + inverse_b == 0.0f) continue;
+            float mass = 1.0f / (inverse_a + inverse_b);
+            int axis = contact->axis;
+
+            // Normal first, so friction is clamped by this iteration's pressure. Cubes apart may close up to their gap.
+            float target = std::max(contact->separation, 0.0f) / deltaTime;
+            float normal_speed = relative_value(velocities[axis], contact) * contact->sign;
+            float normal_impulse = std::max(contact->normal_impulse - (normal_speed + target) * mass, 0.0f);
+            float normal_delta = normal_impulse - contact->normal_impulse;
+            contact->normal_impulse = normal_impulse;
+            apply_impulse(velocities[axis], contact, normal_delta * contact->sign, inverse_a, inverse_b);
+
+            float limit = CUBE_FRICTION * contact->normal_impulse;
+            for (int k = 0; k < 2; k++) {
+                float* tangent_velocities = velocities[(axis + 1 + k) % 3];
+                float tangent_impulse = glm::clamp(contact->tangent_impulse[k] - relative_value(tangent_velocities, contact) * mass, -limit, limit);
+                float tangent_delta = tangent_impulse - contact->tangent_impulse[k];
+                contact->tangent_impulse[k] = tangent_impulse;
+                apply_impulse(tangent_velocities, contact, tangent_delta, inverse_a, inverse_b);
+            }
+
+            // Push out part of the overlap
+            float push_target = std::max(-contact->separation - CUBE_CONTACT_SLOP, 0.0f) * CUBE_CONTACT_BIAS / deltaTime;
+            if (push_target == 0.0f) continue;
+            float push_speed = relative_value(pushes[axis], contact) * contact->sign;
+            float push_impulse = std::max(push_impulses[i] + (push_target - push_speed) * mass, 0.0f);
+            float push_delta = push_impulse - push_impulses[i];
+            push_impulses[i] = push_impulse;
+            apply_impulse(pushes[axis], contact, push_delta * contact->sign, inverse_a, inverse_b);
+        }
+    }
+}
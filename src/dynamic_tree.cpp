@@ -0,0 +1,314 @@
+#include "dynamic_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static float box_area(glm::vec3 min, glm::vec3 max) {
+    glm::vec3 extent = max - min;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static bool box_contains(glm::vec3 outer_min, glm::vec3 outer_max, glm::vec3 min, glm::vec3 max) {
+    return outer_min.x <= min.x && outer_min.y <= min.y && outer_min.z <= min.z &&
+           max.x <= outer_max.x && max.y <= outer_max.y && max.z <= outer_max.z;
+}
+
+static bool boxes_overlap(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max) {
+    return a_min.x <= b_max.x && b_min.x <= a_max.x &&
+           a_min.y <= b_max.y && b_min.y <= a_max.y &&
+           a_min.z <= b_max.z && b_min.z <= a_max.z;
+}
+
+// Box a leaf gets for an object: fattened by the margin and stretched ahead along the displacement
+static void fat_box(glm::vec3 min, glm::vec3 max, glm::vec3 displacement, glm::vec3* fat_min, glm::vec3* fat_max) {
+    glm::vec3 ahead = displacement * DYNAMIC_TREE_DISPLACEMENT_MULTIPLIER;
+    *fat_min = min - glm::vec3(DYNAMIC_TREE_MARGIN) + glm::min(ahead, glm::vec3(0.0f));
+    *fat_max = max + glm::vec3(DYNAMIC_TREE_MARGIN) + glm::max(ahead, glm::vec3(0.0f));
+}
+
+static int allocate_node(DynamicTree* tree) {
+    int node;
+    if (tree->free_list != DYNAMIC_TREE_NULL) {
+        node = tree->free_list;
+        tree->free_list = tree->nodes[node].parent;
+    } else {
+        node = (int)tree->nodes.size();
+        tree->nodes.push_back(DynamicTreeNode());
+    }
+
+    DynamicTreeNode* n = &tree->nodes[node];
+    n->parent = n->child1 = n->child2 = DYNAMIC_TREE_NULL;
+    n->height = 0;
+    n->object = 0;
+    return node;
+}
+
+static void free_node(DynamicTree* tree, int node) {
+    tree->nodes[node].parent = tree->free_list;
+    tree->nodes[node].height = -1;
+    tree->free_list = node;
+}
+
+static void update_inner_node(DynamicTree* tree, int node) {
+    DynamicTreeNode* n = &tree->nodes[node];
+    const DynamicTreeNode* c1 = &tree->nodes[n->child1];
+    const DynamicTreeNode* c2 = &tree->nodes[n->child2];
+    n->min = glm::min(c1->min, c2->min);
+    n->max = glm::max(c1->max, c2->max);
+    n->height = 1 + std::max(c1->height, c2->height);
+}
+
+static void replace_child(DynamicTree* tree, int parent, int old_child, int new_child) {
+    if (parent == DYNAMIC_TREE_NULL) {
+        tree->root = new_child;
+    } else if (tree->nodes[parent].child1 == old_child) {
+        tree->nodes[parent].child1 = new_child;
+    } else {
+        tree->nodes[parent].child2 = new_child;
+    }
+}
+
+// If one child of the node is more than one level taller than the other, rotate the taller child up.
+// This keeps the tree roughly balanced, though not as strictly as an AVL tree.
+// Returns the node now at the position of the given one.
+static int balance(DynamicTree* tree, int a) {
+    DynamicTreeNode* node_a = &tree->nodes[a];
+    if (node_a->child1 == DYNAMIC_TREE_NULL || node_a->height < 2) return a;
+
+    int b = node_a->child1;
+    int c = node_a->child2;
+    int difference = tree->nodes[c].height - tree->nodes[b].height;
+    if (difference >= -1 && difference <= 1) return a;
+
+    // Rotate the taller child up, keeping its own taller child and giving its shorter child to a
+    int up = difference > 1 ? c : b;
+    DynamicTreeNode* node_up = &tree->nodes[up];
+    int f = node_up->child1;
+    int g = node_up->child2;
+    int keep = tree->nodes[f].height > tree->nodes[g].height ? f : g;
+    int give = keep == f ? g : f;
+
+    node_up->parent = node_a->parent;
+    replace_child(tree, node_up->parent, a, up);
+    node_up->child1 = a;
+    node_up->child2 = keep;
+    node_a->parent = up;
+    if (up == c) node_a->child2 = give; else node_a->child1 = give;
+    tree->nodes[give].parent = a;
+
+    update_inner_node(tree, a);
+    update_inner_node(tree, up);
+    return up;
+}
+
+// Fix the boxes and heights of the ancestors of a changed node, rebalancing on the way up
+static void refit_ancestors(DynamicTree* tree, int node) {
+    while (node != DYNAMIC_TREE_NULL) {
+        node = balance(tree, node);
+        update_inner_node(tree, node);
+        node = tree->nodes[node].parent;
+    }
+}
+
+static void insert_leaf(DynamicTree* tree, int leaf) {
+    if (tree->root == DYNAMIC_TREE_NULL) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = DYNAMIC_TREE_NULL;
+        return;
+    }
+
+    // Walk down to the sibling that makes the tree grow the least, counting the growth of every
+    // ancestor on the way, and stop once making the current node the sibling is cheapest
+    glm::vec3 leaf_min = tree->nodes[leaf].min;
+    glm::vec3 leaf_max = tree->nodes[leaf].max;
+    int sibling = tree->root;
+    while (tree->nodes[sibling].child1 != DYNAMIC_TREE_NULL) {
+        const DynamicTreeNode* node = &tree->nodes[sibling];
+        float area = box_area(node->min, node->max);
+        float combined_area = box_area(glm::min(node->min, leaf_min), glm::max(node->max, leaf_max));
+        float cost = 2.0f * combined_area;
+        float inherited_cost = 2.0f * (combined_area - area);
+
+        float child_costs[2];
+        int children[2] = { node->child1, node->child2 };
+        for (int i = 0; i < 2; i++) {
+            const DynamicTreeNode* child = &tree->nodes[children[i]];
+            float grown = box_area(glm::min(child->min, leaf_min), glm::max(child->max, leaf_max));
+            if (child->child1 != DYNAMIC_TREE_NULL) grown -= box_area(child->min, child->max);
+            child_costs[i] = grown + inherited_cost;
+        }
+
+        if (cost < child_costs[0] && cost < child_costs[1]) break;
+        sibling = child_costs[0] < child_costs[1] ? children[0] : children[1];
+    }
+
+    // Pair the leaf with the sibling under a new parent
+    int old_parent = tree->nodes[sibling].parent;
+    int new_parent = allocate_node(tree);
+    DynamicTreeNode* parent = &tree->nodes[new_parent];
+    parent->parent = old_parent;
+    parent->child1 = sibling;
+    parent->child2 = leaf;
+    replace_child(tree, old_parent, sibling, new_parent);
+    tree->nodes[sibling].parent = new_parent;
+    tree->nodes[leaf].parent = new_parent;
+
+    refit_ancestors(tree, new_parent);
+}
+
+static void remove_leaf(DynamicTree* tree, int leaf) {
+    if (leaf == tree->root) {
+        tree->root = DYNAMIC_TREE_NULL;
+        return;
+    }
+
+    // The sibling takes the place of the parent
+    int parent = tree->nodes[leaf].parent;
+    int grandparent = tree->nodes[parent].parent;
+    int sibling = tree->nodes[parent].child1 == leaf ? tree->nodes[parent].child2 : tree->nodes[parent].child1;
+    replace_child(tree, grandparent, parent, sibling);
+    tree->nodes[sibling].parent = grandparent;
+    free_node(tree, parent);
+
+    refit_ancestors(tree, grandparent);
+}
+
+// Stack for walking the tree from the root, the fixed one unless the tree is too tall for it.
+// Popping a node and pushing its children adds at most one entry per level.
+static int* traversal_stack(const DynamicTree* tree, int* fixed_stack, std::vector<int>* tall_stack) {
+    size_t needed = (size_t)tree->nodes[tree->root].height + 2;
+    if (needed <= DYNAMIC_TREE_STACK_SIZE) return fixed_stack;
+    tall_stack->resize(needed);
+    return &(*tall_stack)[0];
+}
+
+void dynamic_tree_clear(DynamicTree* tree) {
+    tree->nodes.clear();
+    tree->root = DYNAMIC_TREE_NULL;
+    tree->free_list = DYNAMIC_TREE_NULL;
+    tree->proxy_count = 0;
+}
+
+// Add an object with the given bounds, returns its proxy
+int dynamic_tree_insert(DynamicTree* tree, glm::vec3 min, glm::vec3 max, uint32_t object) {
+    int proxy = allocate_node(tree);
+    DynamicTreeNode* leaf = &tree->nodes[proxy];
+    fat_box(min, max, glm::vec3(0.0f), &leaf->min, &leaf->max);
+    leaf->object = object;
+
+    insert_leaf(tree, proxy);
+    tree->proxy_count++;
+    return proxy;
+}
+
+void dynamic_tree_remove(DynamicTree* tree, int proxy) {
+    remove_leaf(tree, proxy);
+    free_node(tree, proxy);
+    tree->proxy_count--;
+}
+
+// Give an object new bounds after it moved by displacement.
+// The object is only reinserted if it left its fat box, or if the box is far larger than needed now.
+// Returns true if it was reinserted.
+bool dynamic_tree_update(DynamicTree* tree, int proxy, glm::vec3 min, glm::vec3 max, glm::vec3 displacement) {
+    DynamicTreeNode* leaf = &tree->nodes[proxy];
+    glm::vec3 fat_min, fat_max;
+    fat_box(min, max, displacement, &fat_min, &fat_max);
+
+    if (box_contains(leaf->min, leaf->max, min, max)) {
+        glm::vec3 huge(4.0f * DYNAMIC_TREE_MARGIN);
+        if (box_contains(fat_min - huge, fat_max + huge, leaf->min, leaf->max)) return false;
+    }
+
+    remove_leaf(tree, proxy);
+    leaf = &tree->nodes[proxy];
+    leaf->min = fat_min;
+    leaf->max = fat_max;
+    insert_leaf(tree, proxy);
+    return true;
+}
+
+// Collect the objects whose fat boxes overlap the box. Appends to results, in no particular order.
+void dynamic_tree_query(const DynamicTree* tree, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results) {
+    if (tree->root == DYNAMIC_TREE_NULL) return;
+
+    int fixed_stack[DYNAMIC_TREE_STACK_SIZE];
+    std::vector<int> tall_stack;
+    int* stack = traversal_stack(tree, fixed_stack, &tall_stack);
+    int stack_size = 0;
+    stack[stack_size++] = tree->root;
+    while (stack_size > 0) {
+        const DynamicTreeNode* node = &tree->nodes[stack[--stack_size]];
+        if (!boxes_overlap(node->min, node->max, min, max)) continue;
+
+        if (node->child1 == DYNAMIC_TREE_NULL) {
+            results->push_back(node->object);
+        } else {
+            stack[stack_size++] = node->child1;
+            stack[stack_size++] = node->child2;
+        }
+    }
+}
+
+// Collect the objects whose fat boxes a ray enters within max_distance along dir.
+// Appends to results, in no particular order.
+void dynamic_tree_raycast(const DynamicTree* tree, glm::vec3 origin, glm::vec3 dir, float max_distance, std::vector<uint32_t>* results) {
+    if (tree->root == DYNAMIC_TREE_NULL) return;
+
+    glm::vec3 inv_dir = 1.0f / dir;
+    int fixed_stack[DYNAMIC_TREE_STACK_SIZE];
+    std::vector<int> tall_stack;
+    int* stack = traversal_stack(tree, fixed_stack, &tall_stack);
+    int stack_size = 0;
+    stack[stack_size++] = tree->root;
+    while (stack_size > 0) {
+        const DynamicTreeNode* node = &tree->nodes[stack[--stack_size]];
+
+        float t_min = 0.0f;
+        float t_max = max_distance;
+        for (int axis = 0; axis < 3; axis++) {
+            float t1 = (node->min[axis] - origin[axis]) * inv_dir[axis];
+            float t2 = (node->max[axis] - origin[axis]) * inv_dir[axis];
+            if (std::isnan(t1) || std::isnan(t2)) continue; // Origin on a slab plane of an axis the ray does not move along
+            t_min = std::max(t_min, std::min(t1, t2));
+            t_max = std::min(t_max, std::max(t1, t2));
+        }
+        if (t_min > t_max) continue;
+
+        if (node->child1 == DYNAMIC_TREE_NULL) {
+            results->push_back(node->object);
+        } else {
+            stack[stack_size++] = node->child1;
+            stack[stack_size++] = node->child2;
+        }
+    }
+}
+
+// Check the links, heights and boxes of every node reachable from the root
+bool validate_dynamic_tree(const DynamicTree* tree) {
+    if (tree->root == DYNAMIC_TREE_NULL) return tree->proxy_count == 0;
+    if (tree->nodes[tree->root].parent != DYNAMIC_TREE_NULL) return false;
+
+    size_t leaves = 0;
+    std::vector<int> stack(1, tree->root);
+    while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        const DynamicTreeNode* node = &tree->nodes[index];
+        if (node->child1 == DYNAMIC_TREE_NULL) {
+            if (node->height != 0) return false;
+            leaves++;
+            continue;
+        }
+
+        const DynamicTreeNode* c1 = &tree->nodes[node->child1];
+        const DynamicTreeNode* c2 = &tree->nodes[node->child2];
+        if (c1->parent != index || c2->parent != index) return false;
+        if (node->height != 1 + std::max(c1->height, c2->height)) return false;
+        if (node->min != glm::min(c1->min, c2->min) || node->max != glm::max(c1->max, c2->max)) return false;
+        stack.push_back(node->child1);
+        stack.push_back(node->child2);
+    }
+    return leaves == tree->proxy_count;
+}
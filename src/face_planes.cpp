@@ -0,0 +1,286 @@
+#include "face_planes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "scene.h"
+#include "scene_bake.h"
+
+#define FACE_PLANE_SEAM_TOLERANCE 0.001f // Gaps between faces narrower than this do not break up a surface
+
+struct FaceEntry {
+    uint64_t key;
+    FaceRect rect;
+};
+
+// Face number and offset of a plane packed into one key. -0 and 0 are the same plane.
+static uint64_t face_plane_key(int face, float offset) {
+    if (offset == 0.0f) offset = 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &offset, sizeof(bits));
+    return ((uint64_t)face << 32) | bits;
+}
+
+static bool entry_less(const FaceEntry& a, const FaceEntry& b) {
+    if (a.key != b.key) return a.key < b.key;
+    return a.rect.min.x < b.rect.min.x;
+}
+
+// Position of a point in the plane of a face, along the same axes as place_portal
+glm::vec2 face_plane_coords(int face, glm::vec3 point) {
+    int axis = face / 2;
+    return glm::vec2(axis == 0 ? point.y : point.x, axis == 2 ? point.y : point.z);
+}
+
+glm::vec3 face_plane_point(int face, float offset, glm::vec2 coords) {
+    int axis = face / 2;
+    glm::vec3 point;
+    point[axis] = offset;
+    point[axis == 0 ? 1 : 0] = coords.x;
+    point[axis == 2 ? 1 : 2] = coords.y;
+    return point;
+}
+
+// Group the visible faces of all brushes by plane. Needs the face flags.
+void build_face_planes(Scene* scene, FacePlaneIndex* index) {
+    std::vector<FaceEntry> entries;
+    for (size_t i = 0; i < scene->geometry.size() && i < scene->face_flags.size(); i++) {
+        const Brush* brush = &scene->geometry[i];
+        for (int face = 0; face < FACE_COUNT; face++) {
+            if (!(scene->face_flags[i] & FACE_VISIBLE(face))) continue;
+
+            FaceEntry entry;
+            entry.key = face_plane_key(face, face & 1 ? brush->max[face / 2] : brush->min[face / 2]);
+            entry.rect.min = face_plane_coords(face, brush->min);
+            entry.rect.max = face_plane_coords(face, brush->max);
+            entry.rect.brush = (uint32_t)i;
+            entries.push_back(entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(), entry_less);
+
+    index->planes.clear();
+    index->lookup.clear();
+    index->rects.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i == 0 || entries[i].key != entries[i - 1].key) {
+            FacePlane plane;
+            plane.face = (int)(entries[i].key >> 32);
+            uint32_t bits = (uint32_t)entries[i].key;
+            memcpy(&plane.offset, &bits, sizeof(bits));
+            plane.first_rect = (uint32_t)i;
+            plane.rect_count = 0;
+            plane.max_width = 0.0f;
+            index->planes.push_back(plane);
+        }
+
+        FacePlane* plane = &index->planes.back();
+        plane->rect_count++;
+        plane->max_width = std::max(plane->max_width, entries[i].rect.max.x - entries[i].rect.min.x);
+        index->rects[i] = entries[i].rect;
+    }
+    build_face_plane_lookup(index);
+}
+
+// Whether baked planes and rects are exactly what build_face_planes makes from the brushes and face flags:
+// every visible face once, in the plane of its face, with planes and rects in order.
+bool validate_face_planes(const Scene* scene, const FacePlaneIndex* index) {
+    size_t brush_count = scene->geometry.size();
+    if (scene->face_flags.size() != brush_count) return false;
+
+    std::vector<uint16_t> seen(brush_count, 0);
+    size_t next_rect = 0;
+    for (size_t p = 0; p < index->planes.size(); p++) {
+        const FacePlane* plane = &index->planes[p];
+        if (plane->face < 0 || plane->face >= FACE_COUNT || plane->first_rect != next_rect || plane->rect_count == 0) return false;
+        if (plane->rect_count > index->rects.size() - next_rect) return false;
+        uint64_t key = face_plane_key(plane->face, plane->offset);
+        if (p > 0 && key <= face_plane_key(index->planes[p - 1].face, index->planes[p - 1].offset)) return false;
+
+        float max_width = 0.0f;
+        for (uint32_t r = plane->first_rect; r < plane->first_rect + plane->rect_count; r++) {
+            const FaceRect* rect = &index->rects[r];
+            if (rect->brush >= brush_count) return false;
+            if (r > plane->first_rect && rect->min.x < index->rects[r - 1].min.x) return false;
+
+            const Brush* brush = &scene->geometry[rect->brush];
+            uint16_t bit = FACE_VISIBLE(plane->face);
+            if (!(scene->face_flags[rect->brush] & bit) || (seen[rect->brush] & bit)) return false;
+            seen[rect->brush] |= bit;
+            if (face_plane_key(plane->face, plane->face & 1 ? brush->max[plane->face / 2] : brush->min[plane->face / 2]) != key) return false;
+            if (rect->min != face_plane_coords(plane->face, brush->min) || rect->max != face_plane_coords(plane->face, brush->max)) return false;
+            max_width = std::max(max_width, rect->max.x - rect->min.x);
+        }
+        if (plane->max_width != max_width) return false;
+        next_rect += plane->rect_count;
+    }
+    if (next_rect != index->rects.size()) return false;
+
+    // Every visible face has a rect
+    for (size_t i = 0; i < brush_count; i++) {
+        if (seen[i] != (scene->face_flags[i] & ((1 << FACE_COUNT) - 1))) return false;
+    }
+    return true;
+}
+
+// Map the face number and offset of every plane to the plane, see find_face_plane
+void build_face_plane_lookup(FacePlaneIndex* index) {
+    index->lookup.clear();
+    index->lookup.reserve(index->planes.size());
+    for (size_t i = 0; i < index->planes.size(); i++) {
+        index->lookup[face_plane_key(index->planes[i].face, index->planes[i].offset)] = (uint32_t)i;
+    }
+}
+
+// Plane holding the visible faces with this number and offset, FACE_PLANE_NONE if there are none
+uint32_t find_face_plane(const FacePlaneIndex* index, int face, float offset) {
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it = index->lookup.find(face_plane_key(face, offset));
+    return it == index->lookup.end() ? FACE_PLANE_NONE : it->second;
+}
+
+static bool rect_min_less(const FaceRect& rect, float x) {
+    return rect.min.x < x;
+}
+
+// Collect the rects of the plane that overlap the rectangle, touching included. Replaces the contents of rects.
+void face_plane_query(const FacePlaneIndex* index, uint32_t plane, glm::vec2 min, glm::vec2 max, std::vector<uint32_t>* rects) {
+    rects->clear();
+    const FacePlane* p = &index->planes[plane];
+    const FaceRect* begin = &index->rects[p->first_rect];
+    const FaceRect* end = begin + p->rect_count;
+
+    // Rects starting further back than the widest one cannot reach the rectangle
+    for (const FaceRect* rect = std::lower_bound(begin, end, min.x - p->max_width, rect_min_less); rect != end && rect->min.x <= max.x; rect++) {
+        if (rect->max.x >= min.x && rect->min.y <= max.y && rect->max.y >= min.y) {
+            rects->push_back((uint32_t)(rect - &index->rects[0]));
+        }
+    }
+}
+
+// Whether the faces of the plane cover all of the rectangle
+bool face_plane_covers(const FacePlaneIndex* index, uint32_t plane, glm::vec2 min, glm::vec2 max, std::vector<uint32_t>* rects) {
+    face_plane_query(index, plane, min, max, rects);
+
+    // Cut the rectangle along every edge of the rects inside it, each piece is then either covered or not
+    std::vector<float> cuts[2];
+    for (int k = 0; k < 2; k++) {
+        cuts[k].push_back(min[k]);
+        cuts[k].push_back(max[k]);
+        for (size_t i = 0; i < rects->size(); i++) {
+            const FaceRect* rect = &index->rects[(*rects)[i]];
+            if (rect->min[k] > min[k] && rect->min[k] < max[k]) cuts[k].push_back(rect->min[k]);
+            if (rect->max[k] > min[k] && rect->max[k] < max[k]) cuts[k].push_back(rect->max[k]);
+        }
+        std::sort(cuts[k].begin(), cuts[k].end());
+    }
+
+    for (size_t i = 0; i + 1 < cuts[0].size(); i++) {
+        if (cuts[0][i + 1] - cuts[0][i] < FACE_PLANE_SEAM_TOLERANCE) continue;
+        for (size_t j = 0; j + 1 < cuts[1].size(); j++) {
+            if (cuts[1][j + 1] - cuts[1][j] < FACE_PLANE_SEAM_TOLERANCE) continue;
+
+            glm::vec2 center((cuts[0][i] + cuts[0][i + 1]) * 0.5f, (cuts[1][j] + cuts[1][j + 1]) * 0.5f);
+            bool covered = false;
+            for (size_t r = 0; r < rects->size() && !covered; r++) {
+                const FaceRect* rect = &index->rects[(*rects)[r]];
+                covered = rect->min.x <= center.x && center.x <= rect->max.x && rect->min.y <= center.y && center.y <= rect->max.y;
+            }
+            if (!covered) return false;
+        }
+    }
+
+    return true;
+}
+
+static bool span_less(glm::vec2 a, glm::vec2 b) {
+    return a.x < b.x;
+}
+
+// Covered stretch of the line through point along u (axis 0) or v (axis 1), looking up to reach away from it.
+// Returns false if the point is not on any face.
+static bool covered_span(const FacePlaneIndex* index, uint32_t plane, glm::vec2 point, int axis, float reach, float* lo, float* hi, std::vector<uint32_t>* rects) {
+    glm::vec2 min = point;
+    glm::vec2 max = point;
+    min[axis] -= reach;
+    max[axis] += reach;
+    face_plane_query(index, plane, min, max, rects);
+
+    std::vector<glm::vec2> spans(rects->size());
+    for (size_t i = 0; i < rects->size(); i++) {
+        const FaceRect* rect = &index->rects[(*rects)[i]];
+        spans[i] = glm::vec2(rect->min[axis], rect->max[axis]);
+    }
+    std::sort(spans.begin(), spans.end(), span_less);
+
+    // Merge spans that touch into runs, stopping at the run holding the point
+    float start = 0.0f;
+    float end = -INFINITY;
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (spans[i].x > end + FACE_PLANE_SEAM_TOLERANCE) {
+            if (start <= point[axis] && point[axis] <= end) break;
+            start = spans[i].x;
+            end = spans[i].y;
+        } else {
+            end = std::max(end, spans[i].y);
+        }
+    }
+
+    *lo = start;
+    *hi = end;
+    return start <= point[axis] && point[axis] <= end;
+}
+
+// Find where a portal aimed at the hit point can go: on the surface formed by the faces in the plane of the hit face,
+// moved by at most its own size to fit, with no brush sticking out in front of it and clear of the other portal.
+// Returns false if there is no such place.
+bool find_portal_placement(Scene* scene, const Portal* portal, const Portal* other, const RaycastHitInfo* hit_info, glm::vec3* position) {
+    const FacePlaneIndex* index = &scene->face_planes;
+    int face = face_index(hit_info->normal);
+    int axis = face / 2;
+    float offset = face & 1 ? hit_info->brush->max[axis] : hit_info->brush->min[axis];
+    uint32_t plane = find_face_plane(index, face, offset);
+    if (plane == FACE_PLANE_NONE) {
+        return false; // Face is hidden
+    }
+
+    glm::vec2 half_size(portal->width, portal->height);
+    glm::vec2 center = face_plane_coords(face, hit_info->intersection);
+    std::vector<uint32_t> rects;
+    for (int k = 0; k < 2; k++) {
+        float lo, hi;
+        if (!covered_span(index, plane, center, k, half_size[k] * 2.0f, &lo, &hi, &rects) || hi - lo < half_size[k] * 2.0f) {
+            return false; // Surface is too small
+        }
+        center[k] = glm::clamp(center[k], lo + half_size[k], hi - half_size[k]);
+    }
+
+    if (!face_plane_covers(index, plane, center - half_size, center + half_size, &rects)) {
+        return false; // Surface has holes or edges under the portal
+    }
+
+    // Brushes merely touching the surface or the edges of the portal do not block it
+    float sign = face & 1 ? 1.0f : -1.0f;
+    glm::vec3 front_min = face_plane_point(face, offset, center - half_size + glm::vec2(FACE_PLANE_SEAM_TOLERANCE));
+    glm::vec3 front_max = face_plane_point(face, offset, center + half_size - glm::vec2(FACE_PLANE_SEAM_TOLERANCE));
+    front_min[axis] = std::min(offset + sign * FACE_PLANE_SEAM_TOLERANCE, offset + sign * PORTAL_FRONT_CLEARANCE);
+    front_max[axis] = std::max(offset + sign * FACE_PLANE_SEAM_TOLERANCE, offset + sign * PORTAL_FRONT_CLEARANCE);
+    collision_candidates(scene, front_min, front_max, glm::vec3(0.0f), &rects);
+    for (size_t i = 0; i < rects.size(); i++) {
+        const Brush* brush = &scene->geometry[rects[i]];
+        if (check_aabb_intersection(front_min, front_max, brush->min, brush->max)) {
+            return false; // Something is in front of the surface
+        }
+    }
+
+    // The other portal sits PORTAL_FRONT_CLEARANCE or less in front of its surface
+    if (other != NULL && other->open && face_index(other->normal) == face && glm::abs(other->position[axis] - offset) < PORTAL_FRONT_CLEARANCE) {
+        glm::vec2 distance = glm::abs(face_plane_coords(face, other->position) - center);
+        if (distance.x < half_size.x + other->width && distance.y < half_size.y + other->height) {
+            return false; // Overlaps the other portal
+        }
+    }
+
+    *position = face_plane_point(face, offset, center);
+    return true;
+}
@@ -0,0 +1,145 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+JobSystem::~JobSystem() {
+    stop_job_system(this);
+}
+
+// Next range for a thread: the newest one of its own queue, else the oldest one of another queue
+static bool take_range(JobSystem* jobs, size_t self, JobRange* range) {
+    {
+        JobQueue* queue = jobs->queues[self];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->ranges.empty()) {
+            *range = queue->ranges.back();
+            queue->ranges.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < jobs->queues.size(); k++) {
+        JobQueue* victim = jobs->queues[(self + k) % jobs->queues.size()];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->ranges.empty()) {
+            *range = victim->ranges.front();
+            victim->ranges.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Run ranges until every queue is empty
+static void run_ranges(JobSystem* jobs, size_t self) {
+    JobRange range;
+    size_t finished = 0;
+    while (take_range(jobs, self, &range)) {
+        jobs->function(jobs->data, range.begin, range.end);
+        finished++;
+    }
+
+    if (finished > 0) {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->pending -= finished;
+        if (jobs->pending == 0) jobs->done.notify_all();
+    }
+}
+
+static void worker_main(JobSystem* jobs, size_t self) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(jobs->mutex);
+            while (!jobs->stopping && jobs->generation == seen) jobs->wake.wait(lock);
+            if (jobs->stopping) return;
+            seen = jobs->generation;
+        }
+        run_ranges(jobs, self);
+    }
+}
+
+void start_job_system(JobSystem* jobs, size_t worker_count) {
+    stop_job_system(jobs);
+    for (size_t i = 0; i <= worker_count; i++) {
+        jobs->queues.push_back(new JobQueue());
+    }
+    for (size_t i = 0; i < worker_count; i++) {
+        jobs->workers.push_back(std::thread(worker_main, jobs, i + 1));
+    }
+}
+
+void stop_job_system(JobSystem* jobs) {
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->stopping = true;
+    }
+    jobs->wake.notify_all();
+    for (size_t i = 0; i < jobs->workers.size(); i++) {
+        jobs->workers[i].join();
+    }
+    jobs->workers.clear();
+
+    for (size_t i = 0; i < jobs->queues.size(); i++) {
+        delete jobs->queues[i];
+    }
+    jobs->queues.clear();
+    jobs->stopping = false;
+}
+
+// Pool with a worker for every core but the one of the calling thread, started on first use
+JobSystem* shared_job_system() {
+    static JobSystem jobs;
+    static std::once_flag started;
+    std::call_once(started, []() {
+        start_job_system(&jobs, std::max(1u, std::thread::hardware_concurrency()) - 1);
+    });
+    return &jobs;
+}
+
+// Threads a parallel_for runs on, counting the caller
+size_t job_thread_count(const JobSystem* jobs) {
+    return jobs->workers.size() + 1;
+}
+
+// Call function on ranges of grain indices covering 0 .. count - 1, on the calling thread and the workers,
+// and return once all of them are done. Ranges may run in any order, so they must not depend on each other.
+// Calls from several threads take turns. A range must not call parallel_for on the same job system, it would
+// wait for itself.
+void parallel_for(JobSystem* jobs, size_t count, size_t grain, JobFunction function, void* data) {
+    if (count == 0) return;
+
+    grain = std::max(grain, (size_t)1);
+    size_t range_count = (count + grain - 1) / grain;
+    if (jobs->workers.empty() || range_count == 1) {
+        function(data, 0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> calling(jobs->calling);
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->function = function;
+        jobs->data = data;
+        jobs->pending = range_count;
+
+        // Every thread starts with consecutive ranges, for locality
+        size_t thread_count = jobs->queues.size();
+        for (size_t t = 0; t < thread_count; t++) {
+            JobQueue* queue = jobs->queues[t];
+            std::lock_guard<std::mutex> queue_lock(queue->mutex);
+            for (size_t r = range_count * t / thread_count; r < range_count * (t + 1) / thread_count; r++) {
+                JobRange range = { r * grain, std::min(count, (r + 1) * grain) };
+                queue->ranges.push_back(range);
+            }
+        }
+        jobs->generation++;
+    }
+    jobs->wake.notify_all();
+
+    run_ranges(jobs, 0);
+
+    std::unique_lock<std::mutex> lock(jobs->mutex);
+    while (jobs->pending > 0) jobs->done.wait(lock);
+}
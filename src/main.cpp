@@ -2,6 +2,7 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <cstdlib>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,29 +13,36 @@
 #include "scene.h"
 #include "mesh.h"
 #include "renderer.h"
+#include "scene_bake.h"
+#include "scene_reload.h"
+#include "scene_loader.h"
+#include "snapshot.h"
+#include "simulation.h"
 
 #define CAPTURE_CURSOR
-#define MOVEMENT_SPEED 5.0f
+#define SCENE_PATH "res/scene.bin"
+#define QUICKSAVE_PATH "quicksave.snap"
 #define MOUSE_X_SENSITIVITY 0.1f
 #define MOUSE_Y_SENSITIVITY 0.1f
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void cursor_pos_callback(GLFWwindow* window, double xposIn, double yposIn);
-void process_input(GLFWwindow* window, double deltaTime);
+void process_input(GLFWwindow* window, double frame_time);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 unsigned int screen_width = 1280;
 unsigned int screen_height = 720;
 
-Camera cam = Camera(glm::vec3(-5.0f, 10.0f, 2.0f), 0.0f, 0.0f);
+PlayerState player(Camera(glm::vec3(-5.0f, 10.0f, 2.0f), 0.0f, 0.0f), 0.0f, false);
 Scene scene;
+SceneLoad scene_load;
+Simulation sim;
+uint32_t pressed_buttons = 0; // Presses since the last tick, see TICK_INPUT_PORTAL1
 
-float vel_y = 0.0f;
 float last_cursor_x = 0.0f;
 float last_cursor_y = 0.0f;
 bool focused = false;
-bool on_ground;
 
 int glfw_setup(GLFWwindow** window) {
     glfwInit();
@@ -72,27 +80,80 @@ int glfw_setup(GLFWwindow** window) {
     return 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--tick-rate" && i + 1 < argc) {
+            sim.tick_rate = atoi(argv[++i]);
+        }
+    }
+    if (sim.tick_rate <= 0) {
+        std::cout << "Tick rate must be positive" << std::endl;
+        return -1;
+    }
+
     GLFWwindow* window;
     if (glfw_setup(&window) != 0) return -1;
 
     primitives::setup();
     renderer::setup(screen_width, screen_height, glm::radians(45.0f));
 
-    load_scene_file("res/scene.bin", &scene);
+    // The scene loads in the background, the loop shows a loading screen until it is ready
+    start_scene_load(&scene_load, SCENE_PATH);
+    bool scene_ready = false;
+    int exit_code = 0;
+
+    SceneWatch scene_watch;
 
     double previousTime = glfwGetTime(); // Used for FPS counter, not refreshed every frame
+    double lastFrameTime = previousTime;
     int frameCount = 0;
 
     while (!glfwWindowShouldClose(window))
     {
-        // FPS Counter
         double time = glfwGetTime();
-        double deltaTime = time - scene.time;
-        scene.time = time;
+
+        int load_state = scene_load_state(&scene_load);
+        if (load_state == SCENE_LOAD_RUNNING) {
+            const char* step;
+            float fraction = scene_load_progress(&scene_load, &step);
+
+            std::stringstream titlestream;
+            titlestream << "Portal [" << step << " " << (int)(fraction * 100.0f) << "%]";
+            glfwSetWindowTitle(window, titlestream.str().c_str());
+
+            // A restart keeps playing the current scene, only the first load has nothing to show
+            if (!scene_ready) {
+                renderer::render_loading_screen(screen_width, screen_height, fraction);
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+                continue;
+            }
+        }
+
+        if (load_state != SCENE_LOAD_IDLE) {
+            if (finish_scene_load(&scene_load, &scene) == 0) {
+                // Only the GPU buffers are created on this thread
+                renderer::upload_scene(&scene);
+                player = PlayerState(Camera(scene.spawn_position, scene.spawn_yaw, scene.spawn_pitch), 0.0f, false);
+                reset_simulation(&sim, &scene, &player);
+                lastFrameTime = time; // The time spent loading is not simulated
+                previousTime = time;
+                frameCount = 0;
+                watch_scene_file(&scene_watch, SCENE_PATH, time);
+                scene_ready = true;
+            } else if (!scene_ready) {
+                std::cout << "Failed to load scene" << std::endl;
+                exit_code = -1;
+                break;
+            }
+        }
+
+        // FPS Counter
+        double deltaTime = time - lastFrameTime;
+        lastFrameTime = time;
         frameCount++;
-        if (time - previousTime >= 2.0)
+        if (time - previousTime >= 2.0 && load_state != SCENE_LOAD_RUNNING)
         {
             std::stringstream titlestream;
             titlestream << "Portal [" << frameCount / 2.0f << " FPS]";
@@ -102,73 +163,64 @@ int main()
             previousTime = time;
         }
 
+        FileStamp stamp;
+        if (scene_file_modified(&scene_watch, time, &stamp)) {
+            SceneReload reload;
+            if (reload_scene_file(SCENE_PATH, &scene, &reload) == 0) {
+                renderer::update_scene(&scene, &reload);
+                scene_watch.loaded = stamp;
+            }
+        }
+
         process_input(window, deltaTime);
 
-        renderer::render_screen(&scene, &cam);
+        // Draw the state between the last two ticks, the time left in the accumulator decides where
+        Camera view = interpolated_camera(&sim, &player);
+        renderer::tick_interpolation = tick_blend(&sim);
+        renderer::render_screen(&scene, &view);
  
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    // Waits for a load still running
+    if (scene_load_state(&scene_load) != SCENE_LOAD_IDLE) finish_scene_load(&scene_load, &scene);
+
     renderer::dispose();
     primitives::dispose();
+    close_scene_file(&scene);
 
     glfwTerminate();
-    return 0;
+    return exit_code;
 }
 
-void process_input(GLFWwindow *window, double deltaTime)
+// Run the ticks the frame time adds up to, each with the keys held now and the presses since the last one
+void process_input(GLFWwindow *window, double frame_time)
 {
-    if (deltaTime > 0.5f) {
-        return;
-    }
-
-    glm::vec3 translation = glm::vec3(0.0f);
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
-    float speed_multiplier = deltaTime * MOVEMENT_SPEED * (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS ? 0.2f : 1.0f); 
-
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-        translation += cam.GetPitchlessForwardDirection() * speed_multiplier;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-        translation -= cam.GetPitchlessForwardDirection() * speed_multiplier;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        translation += cam.GetRightDirection() * speed_multiplier;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        translation -= cam.GetRightDirection() * speed_multiplier;
-    }
-
-    if (on_ground && glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-        vel_y = 4.0f;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
-        vel_y = -4.0f;
-    }
-
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         focused = false;
     }
 
-    translation.y += vel_y * deltaTime;
-
-    scene_aware_movement(&cam, translation, &scene, &on_ground);
-    update_cubes(&scene, &cam, deltaTime);
-
-    scene.portal1.draw_on_top = scene.portal1.open && is_in_portal(cam.position, &scene.portal1);
-    scene.portal2.draw_on_top = scene.portal2.open && is_in_portal(cam.position, &scene.portal2);
-
-    if (on_ground) {
-        vel_y = 0;
-    } else {
-        vel_y += GRAVITY * deltaTime;
+    uint32_t held_buttons = 0;
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) held_buttons |= TICK_INPUT_FORWARD;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) held_buttons |= TICK_INPUT_BACK;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) held_buttons |= TICK_INPUT_RIGHT;
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) held_buttons |= TICK_INPUT_LEFT;
+    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) held_buttons |= TICK_INPUT_JUMP;
+    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) held_buttons |= TICK_INPUT_DOWN;
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) held_buttons |= TICK_INPUT_WALK;
+
+    int ticks = advance_simulation(&sim, frame_time);
+    for (int i = 0; i < ticks; i++) {
+        TickInput input;
+        input.buttons = held_buttons | pressed_buttons;
+        input.yaw = player.camera.yaw;
+        input.pitch = player.camera.pitch;
+        simulate_tick(&sim, &scene, &player, &input);
+        pressed_buttons = 0;
     }
 
     renderer::debug_cube_xray = glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS;
@@ -200,8 +252,8 @@ void cursor_pos_callback(GLFWwindow* window, double xposIn, double yposIn)
     float offsetx = xpos - last_cursor_x;
     float offsety = ypos - last_cursor_y;
 
-    cam.yaw -= offsetx * MOUSE_X_SENSITIVITY;
-    cam.pitch -= offsety * MOUSE_Y_SENSITIVITY;
+    player.camera.yaw -= offsetx * MOUSE_X_SENSITIVITY;
+    player.camera.pitch -= offsety * MOUSE_Y_SENSITIVITY;
 
 #ifdef CAPTURE_CURSOR
     if (xpos != 0.0f || ypos != 0.0f) {
@@ -215,56 +267,10 @@ void cursor_pos_callback(GLFWwindow* window, double xposIn, double yposIn)
     last_cursor_y = ypos;
 
     // make sure that when pitch is out of bounds, screen doesn't get flipped
-    if (cam.pitch > 89.0f)
-        cam.pitch = 89.0f;
-    if (cam.pitch < -89.0f)
-        cam.pitch = -89.0f;
-}
-
-bool place_portal(Portal* portal, RaycastHitInfo* hit_info) {
-    glm::vec3 A;
-    glm::vec3 B;
-
-    if (glm::abs(1.0f - glm::abs(glm::dot(hit_info->normal, glm::vec3(1,0,0)))) < 0.001) {
-        // Normal is parallel to x-axis
-        A = glm::vec3(0,1,0);
-        B = glm::vec3(0,0,1);
-    } else if (glm::abs(1.0f - glm::abs(glm::dot(hit_info->normal, glm::vec3(0,1,0)))) < 0.001) {
-        // Normal is parallel to y-axis
-        A = glm::vec3(1,0,0);
-        B = glm::vec3(0,0,1);
-    } else if (glm::abs(1.0f - glm::abs(glm::dot(hit_info->normal, glm::vec3(0,0,1)))) < 0.001) {
-        // Normal is parallel to z-axis
-        A = glm::vec3(1,0,0);
-        B = glm::vec3(0,1,0);
-    } else {
-        assert(false);
-    }
-
-    glm::vec3 x = hit_info->intersection - hit_info->face_min;
-    glm::vec3 x_max = hit_info->face_max - hit_info->face_min;
-    float u = glm::dot(A,x);
-    float v = glm::dot(B,x);
-
-    float u_max = glm::dot(A, x_max);
-    float v_max = glm::dot(B, x_max);
-
-    if (u_max < portal->width * 2.0f || v_max < portal->height * 2.0f) {
-        return false; // Face is too small
-    }
-
-    float u_corrected = glm::min(glm::max(u, portal->width), u_max - portal->width);
-    float v_corrected = glm::min(glm::max(v, portal->height), v_max - portal->height);
-
-    glm::vec3 corrected_pos = hit_info->face_min + A * u_corrected + B * v_corrected;
-
-    portal->position = corrected_pos + hit_info->normal * 0.001f;
-    portal->normal = hit_info->normal;
-    portal->spawn_time = scene.time;
-    portal->brush = hit_info->brush;
-    portal->open = true;
-
-    return true;
+    if (player.camera.pitch > 89.0f)
+        player.camera.pitch = 89.0f;
+    if (player.camera.pitch < -89.0f)
+        player.camera.pitch = -89.0f;
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
@@ -278,32 +284,46 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
         return;
     }
 
-    RaycastHitInfo hit_info;
-    if (button == GLFW_MOUSE_BUTTON_1 && raycast(&cam, &scene, &hit_info)) {
-        place_portal(&scene.portal1, &hit_info);
+    // Portals are shot by the next tick
+    if (button == GLFW_MOUSE_BUTTON_1) {
+        pressed_buttons |= TICK_INPUT_PORTAL1;
     }
 
-    if (button == GLFW_MOUSE_BUTTON_2 && raycast(&cam, &scene, &hit_info)) {
-        place_portal(&scene.portal2, &hit_info);
+    if (button == GLFW_MOUSE_BUTTON_2) {
+        pressed_buttons |= TICK_INPUT_PORTAL2;
     }
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+        std::vector<unsigned char> snapshot;
+        save_snapshot(&scene, &player, &snapshot);
+        if (write_snapshot_file(QUICKSAVE_PATH, snapshot) == 0) std::cout << "Saved " << QUICKSAVE_PATH << std::endl;
+    }
+
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        std::vector<unsigned char> snapshot;
+        if (read_snapshot_file(QUICKSAVE_PATH, &snapshot) == 0 && restore_snapshot(snapshot.data(), snapshot.size(), &scene, &player) == 0) {
+            sim.previous_position = player.camera.position; // Do not draw the player sliding over from where they were
+        }
+    }
+
+    // Restart the level, the current one stays playable until the new one is loaded
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS && scene_load_state(&scene_load) == SCENE_LOAD_IDLE) {
+        start_scene_load(&scene_load, SCENE_PATH);
+    }
+
     if (key == GLFW_KEY_P && action == GLFW_PRESS) { 
-        PRINT_VEC3(cam.position);
-        if (scene.portal1.open && is_in_portal(cam.position, &scene.portal1)) {
+        PRINT_VEC3(player.camera.position);
+        if (scene.portal1.open && is_in_portal(player.camera.position, &scene.portal1)) {
             std::cout << "In portal 1" << std::endl;
         }
-        if (scene.portal2.open && is_in_portal(cam.position, &scene.portal2)) {
+        if (scene.portal2.open && is_in_portal(player.camera.position, &scene.portal2)) {
             std::cout << "In portal 2" << std::endl;
         }
     }
 
-    if (key == GLFW_KEY_E && action == GLFW_PRESS) { 
-        Cube* cube = &scene.cubes[0];
-        cube->grabbed = !cube->grabbed;
-        if (glm::length(cube->velocity) > 10.0f) {
-            cube->velocity = glm::normalize(cube->velocity) * 10.0f;
-        }
+    if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+        pressed_buttons |= TICK_INPUT_GRAB;
     }
 }
\ No newline at end of file
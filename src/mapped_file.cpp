@@ -0,0 +1,118 @@
+#include "mapped_file.h"
+
+#include <iostream>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Map the entire file read-only. Returns 0 on success.
+// An empty file is mapped successfully with data set to NULL and size 0.
+int map_file(const char* path, MappedFile* file) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        std::cerr << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size)) {
+        std::cerr << "Could not stat " << path << std::endl;
+        CloseHandle(handle);
+        return 1;
+    }
+
+    file->file_handle = handle;
+    file->size = (size_t)file_size.QuadPart;
+    if (file->size == 0) return 0;
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        std::cerr << "Could not map " << path << std::endl;
+        unmap_file(file);
+        return 1;
+    }
+    file->mapping_handle = mapping;
+
+    file->data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (file->data == NULL) {
+        std::cerr << "Could not map " << path << std::endl;
+        unmap_file(file);
+        return 1;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "Could not stat " << path << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    file->fd = fd;
+    file->size = (size_t)st.st_size;
+    if (file->size == 0) return 0;
+
+    void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "Could not map " << path << std::endl;
+        unmap_file(file);
+        return 1;
+    }
+    file->data = (const unsigned char*)data;
+
+    // The loaders read the whole file front to back
+    madvise(data, file->size, MADV_SEQUENTIAL);
+#endif
+
+    return 0;
+}
+
+// Modification time and size of a file, the time is -1 if it cannot be read
+FileStamp file_stamp(const char* path) {
+    FileStamp stamp = { -1, 0 };
+    struct stat st;
+    if (stat(path, &st) != 0) return stamp;
+
+#if defined(__APPLE__)
+    stamp.modification_time = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp.modification_time = (int64_t)st.st_mtime * 1000000000;
+#else
+    stamp.modification_time = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    stamp.size = (int64_t)st.st_size;
+    return stamp;
+}
+
+bool same_file_stamp(const FileStamp* a, const FileStamp* b) {
+    return a->modification_time == b->modification_time && a->size == b->size;
+}
+
+void unmap_file(MappedFile* file) {
+#ifdef _WIN32
+    if (file->data) UnmapViewOfFile(file->data);
+    if (file->mapping_handle) CloseHandle(file->mapping_handle);
+    if (file->file_handle) CloseHandle(file->file_handle);
+    file->file_handle = NULL;
+    file->mapping_handle = NULL;
+#else
+    if (file->data) munmap((void*)file->data, file->size);
+    if (file->fd >= 0) close(file->fd);
+    file->fd = -1;
+#endif
+    file->data = NULL;
+    file->size = 0;
+}
@@ -29,6 +29,18 @@ MeshObjectData* gen_meshobjdata(GLfloat* vertices, size_t vertex_array_size, GLu
         // aNormal
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
         glEnableVertexAttribArray(1);
+    } else if (vertex_data_type == POSITION_NORMAL_COLOR) {
+        // aPos
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float) + 8, (void*)0);
+        glEnableVertexAttribArray(0);
+
+        // aNormal
+        glVertexAttribPointer(1, 3, GL_BYTE, GL_TRUE, 3 * sizeof(float) + 8, (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+
+        // aColor
+        glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, 3 * sizeof(float) + 8, (void*)(3 * sizeof(float) + 4));
+        glEnableVertexAttribArray(2);
     } else if (vertex_data_type == POSITION_UV) {
         // aPos
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
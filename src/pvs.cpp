@@ -0,0 +1,387 @@
+#include "pvs.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "scene.h"
+#include "scene_bake.h"
+
+#include <glm/gtc/constants.hpp>
+
+// xorshift64*, so the same scene always bakes the same PVS
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static float random_float(uint64_t* state) {
+    return (float)(next_random(state) >> 40) / (float)(1 << 24);
+}
+
+// Cell holding a point, points outside the grid go to the nearest cell
+static int nearest_cell(const PVS* pvs, glm::vec3 point) {
+    int coords[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float cell = std::floor((point[axis] - pvs->origin[axis]) / pvs->cell_size);
+        coords[axis] = !(cell > 0.0f) ? 0 : (int)std::min(cell, (float)(pvs->dims[axis] - 1)); // Also catches NaN
+    }
+    return (coords[2] * pvs->dims[1] + coords[1]) * pvs->dims[0] + coords[0];
+}
+
+// Cell holding a point, -1 if it is outside the grid
+static int pvs_cell_index(const PVS* pvs, glm::vec3 point) {
+    glm::vec3 cell = glm::floor((point - pvs->origin) / pvs->cell_size);
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(cell[axis] >= 0.0f && cell[axis] < (float)pvs->dims[axis])) return -1;
+    }
+    return ((int)cell.z * pvs->dims[1] + (int)cell.y) * pvs->dims[0] + (int)cell.x;
+}
+
+static void cell_coords(const PVS* pvs, int cell, int* coords) {
+    coords[0] = cell % pvs->dims[0];
+    coords[1] = (cell / pvs->dims[0]) % pvs->dims[1];
+    coords[2] = cell / (pvs->dims[0] * pvs->dims[1]);
+}
+
+static void set_visible(PVS* pvs, int from, int to) {
+    pvs->visibility[(size_t)from * pvs->row_words + to / 32] |= 1u << (to % 32);
+}
+
+// Call visit for every cell set in a row, in increasing order
+template <typename F>
+static void for_each_visible(const uint32_t* row, uint32_t row_words, F visit) {
+    for (uint32_t word = 0; word < row_words; word++) {
+        for (uint32_t bits = row[word]; bits != 0; bits &= bits - 1) {
+            visit((int)(word * 32 + __builtin_ctz(bits)));
+        }
+    }
+}
+
+// Space the player can reach, on a grid of voxels PVS_CELL_VOXELS to a cell side
+struct PVSVoxels {
+    int dims[3];
+    float size;
+    std::vector<char> reachable;
+};
+
+// Flood fill the voxels that overlap no brush, starting from the spawn point. Rays are only cast from this space,
+// so cells that also hold some of the space around the level do not see all of it.
+// Falls back to all open voxels when the spawn point is not in one.
+static void flood_reachable(Scene* scene, const PVS* pvs, PVSVoxels* voxels) {
+    voxels->size = pvs->cell_size / PVS_CELL_VOXELS;
+    size_t count = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        voxels->dims[axis] = pvs->dims[axis] * PVS_CELL_VOXELS;
+        count *= voxels->dims[axis];
+    }
+
+    // Voxels that only touch a brush are open, so the flood still gets through openings as wide as two voxels
+    std::vector<char> open(count);
+    std::vector<uint32_t> candidates;
+    glm::vec3 inset(voxels->size * 0.01f);
+    for (int z = 0; z < voxels->dims[2]; z++) {
+        for (int y = 0; y < voxels->dims[1]; y++) {
+            for (int x = 0; x < voxels->dims[0]; x++) {
+                glm::vec3 min = pvs->origin + glm::vec3(x, y, z) * voxels->size;
+                brush_grid_query(&scene->brush_grid, scene->geometry, min + inset, min + glm::vec3(voxels->size) - inset, &candidates);
+                open[((size_t)z * voxels->dims[1] + y) * voxels->dims[0] + x] = candidates.empty();
+            }
+        }
+    }
+
+    int start[3];
+    bool inside = true;
+    for (int axis = 0; axis < 3; axis++) {
+        float voxel = std::floor((scene->spawn_position[axis] - pvs->origin[axis]) / voxels->size);
+        inside = inside && voxel >= 0.0f && voxel < (float)voxels->dims[axis];
+        start[axis] = inside ? (int)voxel : 0;
+    }
+    size_t start_index = ((size_t)start[2] * voxels->dims[1] + start[1]) * voxels->dims[0] + start[0];
+    if (!inside || !open[start_index]) {
+        voxels->reachable.swap(open);
+        return;
+    }
+
+    voxels->reachable.assign(count, 0);
+    voxels->reachable[start_index] = 1;
+    std::vector<size_t> queue(1, start_index);
+    size_t strides[3] = { 1, (size_t)voxels->dims[0], (size_t)voxels->dims[0] * voxels->dims[1] };
+    for (size_t next = 0; next < queue.size(); next++) {
+        size_t voxel = queue[next];
+        for (int axis = 0; axis < 3; axis++) {
+            int coord = (int)(voxel / strides[axis] % voxels->dims[axis]);
+            if (coord > 0 && open[voxel - strides[axis]] && !voxels->reachable[voxel - strides[axis]]) {
+                voxels->reachable[voxel - strides[axis]] = 1;
+                queue.push_back(voxel - strides[axis]);
+            }
+            if (coord + 1 < voxels->dims[axis] && open[voxel + strides[axis]] && !voxels->reachable[voxel + strides[axis]]) {
+                voxels->reachable[voxel + strides[axis]] = 1;
+                queue.push_back(voxel + strides[axis]);
+            }
+        }
+    }
+}
+
+// Scratch space for sampling the visibility of one cell at a time
+struct PVSSampler {
+    PVSVoxels voxels;
+    std::vector<uint32_t> brush_cells; // Cell of every brush
+    std::vector<size_t> cell_voxels; // Reachable voxels of the current cell
+    std::vector<glm::vec3> points; // Points of the current cell outside the brushes
+    std::vector<glm::vec3> origins, dirs;
+    std::vector<RaycastHitInfo> hits;
+    std::vector<int> frontier, next_frontier;
+    std::vector<char> queued;
+};
+
+// Mark what a ray cast from the cell saw: the brush it hit and the cell of the hit. The cells its segment
+// passed through hold space that can be seen, but not necessarily their brushes, so they are only added to
+// the next frontier to aim more rays at.
+static void mark_ray(Scene* scene, PVS* pvs, int cell, glm::vec3 origin, glm::vec3 dir, const RaycastHitInfo* hit, PVSSampler* sampler) {
+    float length;
+    if (hit->brush != NULL) {
+        length = glm::dot(hit->intersection - origin, dir);
+        set_visible(pvs, cell, sampler->brush_cells[hit->brush - &scene->geometry[0]]);
+        set_visible(pvs, cell, nearest_cell(pvs, hit->intersection));
+    } else {
+        length = glm::length(glm::vec3(pvs->dims[0], pvs->dims[1], pvs->dims[2])) * pvs->cell_size;
+    }
+
+    float step = pvs->cell_size * PVS_MARCH_STEP;
+    for (float t = 0.0f; t < length; t += step) {
+        int passed = pvs_cell_index(pvs, origin + dir * t);
+        if (passed < 0) break;
+        if (!sampler->queued[passed]) {
+            sampler->queued[passed] = 1;
+            sampler->next_frontier.push_back(passed);
+        }
+    }
+}
+
+static void cast_and_mark(Scene* scene, PVS* pvs, int cell, PVSSampler* sampler) {
+    size_t count = sampler->origins.size();
+    if (count == 0) return;
+
+    sampler->hits.resize(count);
+    raycast_batch(scene, &sampler->origins[0], &sampler->dirs[0], count, &sampler->hits[0]);
+    for (size_t i = 0; i < count; i++) {
+        mark_ray(scene, pvs, cell, sampler->origins[i], sampler->dirs[i], &sampler->hits[i], sampler);
+    }
+    sampler->origins.clear();
+    sampler->dirs.clear();
+}
+
+// Sample what can be seen from the reachable space of the cell. Rays in random directions find the space
+// around the cell, then rays aimed at every cell whose space was seen find what lies behind narrow openings,
+// which random directions rarely pass through from afar. Returns false if no part of the cell can be reached.
+static bool sample_cell(Scene* scene, PVS* pvs, int cell, PVSSampler* sampler) {
+    set_visible(pvs, cell, cell);
+
+    int coords[3];
+    cell_coords(pvs, cell, coords);
+    uint64_t random = cell * 0x9E3779B97F4A7C15ull + 1;
+
+    const PVSVoxels* voxels = &sampler->voxels;
+    sampler->cell_voxels.clear();
+    for (int z = 0; z < PVS_CELL_VOXELS; z++) {
+        for (int y = 0; y < PVS_CELL_VOXELS; y++) {
+            for (int x = 0; x < PVS_CELL_VOXELS; x++) {
+                size_t voxel = ((size_t)(coords[2] * PVS_CELL_VOXELS + z) * voxels->dims[1] + coords[1] * PVS_CELL_VOXELS + y) * voxels->dims[0] + coords[0] * PVS_CELL_VOXELS + x;
+                if (voxels->reachable[voxel]) sampler->cell_voxels.push_back(voxel);
+            }
+        }
+    }
+    if (sampler->cell_voxels.empty()) return false;
+
+    sampler->points.clear();
+    for (int ray = 0; ray < PVS_SAMPLE_RAYS; ray++) {
+        size_t voxel = sampler->cell_voxels[next_random(&random) % sampler->cell_voxels.size()];
+        glm::vec3 voxel_min = pvs->origin + glm::vec3(voxel % voxels->dims[0], voxel / voxels->dims[0] % voxels->dims[1], voxel / ((size_t)voxels->dims[0] * voxels->dims[1])) * voxels->size;
+        sampler->points.push_back(voxel_min + glm::vec3(random_float(&random), random_float(&random), random_float(&random)) * voxels->size);
+    }
+
+    std::fill(sampler->queued.begin(), sampler->queued.end(), 0);
+    sampler->queued[cell] = 1;
+    sampler->next_frontier.clear();
+
+    // Uniform directions on the sphere
+    for (size_t i = 0; i < sampler->points.size(); i++) {
+        float z = 2.0f * random_float(&random) - 1.0f;
+        float angle = 2.0f * glm::pi<float>() * random_float(&random);
+        float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        sampler->origins.push_back(sampler->points[i]);
+        sampler->dirs.push_back(glm::vec3(r * std::cos(angle), r * std::sin(angle), z));
+    }
+    cast_and_mark(scene, pvs, cell, sampler);
+
+    while (!sampler->next_frontier.empty()) {
+        sampler->frontier.swap(sampler->next_frontier);
+        sampler->next_frontier.clear();
+        for (size_t i = 0; i < sampler->frontier.size(); i++) {
+            int target[3];
+            cell_coords(pvs, sampler->frontier[i], target);
+            glm::vec3 target_min = pvs->origin + glm::vec3(target[0], target[1], target[2]) * pvs->cell_size;
+            for (int ray = 0; ray < PVS_TARGET_RAYS; ray++) {
+                glm::vec3 origin = sampler->points[next_random(&random) % sampler->points.size()];
+                glm::vec3 point = target_min + glm::vec3(random_float(&random), random_float(&random), random_float(&random)) * pvs->cell_size;
+                if (point == origin) continue;
+                sampler->origins.push_back(origin);
+                sampler->dirs.push_back(glm::normalize(point - origin));
+            }
+        }
+        cast_and_mark(scene, pvs, cell, sampler);
+    }
+    return true;
+}
+
+// Compute the PVS of the scene, which needs its bounds and brush grid. Cells the player cannot reach from
+// the spawn point see everything, so a camera that ends up there anyway still sees the scene.
+// Visibility is sampled, not exact: brushes only seen through gaps the rays missed can be culled, which
+// growing every set by one cell and making it symmetric makes unlikely.
+void build_pvs(Scene* scene, PVS* pvs) {
+    clear_pvs(pvs);
+    if (scene->geometry.empty()) return;
+
+    glm::vec3 extent = glm::max(scene->bounds_max - scene->bounds_min, glm::vec3(PVS_MIN_CELL_SIZE));
+    pvs->origin = scene->bounds_min;
+    pvs->cell_size = std::max(PVS_MIN_CELL_SIZE, std::cbrt(extent.x * extent.y * extent.z / PVS_MAX_CELLS));
+
+    size_t cell_count;
+    for (;;) {
+        cell_count = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            pvs->dims[axis] = std::max(1, (int)std::min(std::ceil(extent[axis] / pvs->cell_size), (float)PVS_MAX_CELLS));
+            cell_count *= pvs->dims[axis];
+        }
+        if (cell_count <= PVS_MAX_CELLS) break;
+        pvs->cell_size *= std::cbrt((float)cell_count / PVS_MAX_CELLS) * 1.01f;
+    }
+
+    pvs->cell_count = (uint32_t)cell_count;
+    pvs->row_words = (pvs->cell_count + 31) / 32;
+    pvs->visibility.assign((size_t)pvs->cell_count * pvs->row_words, 0);
+
+    PVSSampler sampler;
+    sampler.brush_cells.resize(scene->geometry.size());
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        sampler.brush_cells[i] = nearest_cell(pvs, (scene->geometry[i].min + scene->geometry[i].max) * 0.5f);
+    }
+    sampler.queued.resize(cell_count);
+    flood_reachable(scene, pvs, &sampler.voxels);
+
+    std::vector<char> solid(cell_count, 0);
+    for (uint32_t cell = 0; cell < pvs->cell_count; cell++) {
+        solid[cell] = !sample_cell(scene, pvs, cell, &sampler);
+    }
+
+    // Grow every set by the neighbours of its cells
+    std::vector<uint32_t> sampled = pvs->visibility;
+    for (uint32_t cell = 0; cell < pvs->cell_count; cell++) {
+        for_each_visible(&sampled[(size_t)cell * pvs->row_words], pvs->row_words, [&](int visible) {
+            int coords[3];
+            cell_coords(pvs, visible, coords);
+            for (int z = std::max(coords[2] - 1, 0); z <= std::min(coords[2] + 1, pvs->dims[2] - 1); z++)
+                for (int y = std::max(coords[1] - 1, 0); y <= std::min(coords[1] + 1, pvs->dims[1] - 1); y++)
+                    for (int x = std::max(coords[0] - 1, 0); x <= std::min(coords[0] + 1, pvs->dims[0] - 1); x++)
+                        set_visible(pvs, cell, (z * pvs->dims[1] + y) * pvs->dims[0] + x);
+        });
+    }
+
+    // A cell that sees another is seen by it
+    sampled = pvs->visibility;
+    for (uint32_t cell = 0; cell < pvs->cell_count; cell++) {
+        for_each_visible(&sampled[(size_t)cell * pvs->row_words], pvs->row_words, [&](int visible) {
+            set_visible(pvs, visible, cell);
+        });
+    }
+
+    for (uint32_t cell = 0; cell < pvs->cell_count; cell++) {
+        if (!solid[cell]) continue;
+        for (uint32_t other = 0; other < pvs->cell_count; other++) {
+            set_visible(pvs, cell, other);
+        }
+    }
+}
+
+// Group the static mesh indices by the cell of their brush, so the faces of a cell can be drawn with one call
+void build_pvs_indices(Scene* scene, PVS* pvs) {
+    pvs->indices.clear();
+    pvs->cell_first_index.clear();
+    if (pvs->cell_count == 0) return;
+
+    size_t brush_count = scene->geometry.size();
+    std::vector<uint32_t> brush_cells(brush_count);
+    pvs->cell_first_index.assign(pvs->cell_count + 1, 0);
+    for (size_t i = 0; i < brush_count; i++) {
+        brush_cells[i] = nearest_cell(pvs, (scene->geometry[i].min + scene->geometry[i].max) * 0.5f);
+        pvs->cell_first_index[brush_cells[i] + 1] += visible_face_count(scene->face_flags[i]) * FACE_INDEX_COUNT;
+    }
+
+    for (uint32_t i = 0; i < pvs->cell_count; i++) {
+        pvs->cell_first_index[i + 1] += pvs->cell_first_index[i];
+    }
+    if (pvs->cell_first_index[pvs->cell_count] != scene->static_mesh.index_count) {
+        // The static mesh does not match the brushes, nothing can be culled
+        pvs->cell_first_index.clear();
+        return;
+    }
+
+    // The mesh holds the visible faces of every brush in brush order, as quads of their own vertices
+    pvs->indices.resize(scene->static_mesh.index_count);
+    std::vector<uint32_t> cursor(pvs->cell_first_index.begin(), pvs->cell_first_index.end() - 1);
+    uint32_t first_vertex = 0;
+    for (size_t i = 0; i < brush_count; i++) {
+        int faces = visible_face_count(scene->face_flags[i]);
+        for (int face = 0; face < faces; face++) {
+            uint32_t first = first_vertex + face * FACE_VERTEX_COUNT;
+            uint32_t quad[FACE_INDEX_COUNT] = { first, first + 1, first + 2, first + 2, first + 3, first };
+            std::copy(quad, quad + FACE_INDEX_COUNT, &pvs->indices[cursor[brush_cells[i]]]);
+            cursor[brush_cells[i]] += FACE_INDEX_COUNT;
+        }
+        first_vertex += faces * FACE_VERTEX_COUNT;
+    }
+}
+
+void clear_pvs(PVS* pvs) {
+    *pvs = PVS();
+}
+
+// Cell holding a point, -1 if there is no PVS or the point is outside the grid
+int pvs_cell(const PVS* pvs, glm::vec3 point) {
+    if (pvs->cell_first_index.empty()) return -1;
+    return pvs_cell_index(pvs, point);
+}
+
+bool pvs_visible(const PVS* pvs, int from, int to) {
+    return (pvs->visibility[(size_t)from * pvs->row_words + to / 32] >> (to % 32)) & 1;
+}
+
+// Pairs of (first index, index count) into pvs->indices covering the faces that may be visible from a cell,
+// with neighbouring cells joined into one range. A cell of -1 gives one range covering everything.
+// Replaces the contents of ranges.
+void pvs_draw_ranges(const PVS* pvs, int cell, std::vector<uint32_t>* ranges) {
+    ranges->clear();
+    if (cell < 0) {
+        if (!pvs->indices.empty()) {
+            ranges->push_back(0);
+            ranges->push_back((uint32_t)pvs->indices.size());
+        }
+        return;
+    }
+
+    for_each_visible(&pvs->visibility[(size_t)cell * pvs->row_words], pvs->row_words, [&](int visible) {
+        uint32_t first = pvs->cell_first_index[visible];
+        uint32_t count = pvs->cell_first_index[visible + 1] - first;
+        if (count == 0) return;
+
+        size_t size = ranges->size();
+        if (size > 0 && (*ranges)[size - 2] + (*ranges)[size - 1] == first) {
+            (*ranges)[size - 1] += count;
+        } else {
+            ranges->push_back(first);
+            ranges->push_back(count);
+        }
+    });
+}
@@ -16,15 +16,22 @@
 
 namespace renderer {
     StandardShader standard_shader;
+    StaticShader static_shader;
     ScreenShader screen_shader;
     PortalShader portal_shader;
     glm::mat4 projection;
     RenderTarget main_target;
     RenderTarget portal1_target, portal2_target;
+    MeshObjectData* static_geometry = NULL;
+    GLsizei static_index_count = 0;
+    std::vector<uint32_t> pvs_ranges;
+    std::vector<GLsizei> draw_counts;
+    std::vector<const void*> draw_offsets;
     glm::mat4 debug_cube_transform(1.0f);
     float aspect_ratio;
     bool debug_cube_xray = false;
     bool show_pcam_povs = false;
+    float tick_interpolation = 1.0f;
 
     // Build an OpenGL Shader progam from a vertex shader and a fragment shader
     int load_shader(const char* vertex_path, const char* fragment_path) {
@@ -137,6 +144,12 @@ namespace renderer {
         LOCATE_UNIFORM(standard_shader, u_slicepos);
         LOCATE_UNIFORM(standard_shader, u_slicenormal);
 
+        LOAD_SHADERPRG(static_shader, "static");
+        LOCATE_UNIFORM(static_shader, u_VP);
+        LOCATE_UNIFORM(static_shader, u_lightdir);
+        LOCATE_UNIFORM(static_shader, u_slicepos);
+        LOCATE_UNIFORM(static_shader, u_slicenormal);
+
         LOAD_SHADERPRG(screen_shader, "screen");
         LOCATE_UNIFORM(screen_shader, u_screentex);
         LOCATE_UNIFORM(screen_shader, u_transform);
@@ -174,9 +187,62 @@ namespace renderer {
         gen_rendertarget(&portal2_target, scr_width, scr_height);
     }
 
+    // Upload the merged static geometry of the scene, replacing the previous one.
+    // With a PVS the indices are uploaded grouped by cell, so the faces visible from a cell are a few ranges.
+    void upload_scene(Scene* scene) {
+        if (static_geometry) del_meshobjdata(&static_geometry);
+
+        StaticMesh* mesh = &scene->static_mesh;
+        const GLuint* indices = scene->pvs.indices.empty() ? mesh->indices : &scene->pvs.indices[0];
+        static_geometry = gen_meshobjdata((GLfloat*)mesh->vertices, mesh->vertex_count * sizeof(StaticVertex), (GLuint*)indices, mesh->index_count * sizeof(GLuint), POSITION_NORMAL_COLOR);
+        static_index_count = (GLsizei)mesh->index_count;
+    }
+
+    // Bring the static geometry up to date after a scene reload. A patch only uploads the vertex ranges that changed.
+    void update_scene(Scene* scene, SceneReload* reload) {
+        if (reload->kind == RELOAD_REBUILT || static_geometry == NULL) {
+            upload_scene(scene);
+            return;
+        }
+        if (reload->kind != RELOAD_PATCHED) return;
+
+        const StaticVertex* vertices = scene->static_mesh.vertices;
+        glBindBuffer(GL_ARRAY_BUFFER, static_geometry->vbo);
+        for (size_t i = 0; i + 1 < reload->vertex_ranges.size(); i += 2) {
+            uint32_t first = reload->vertex_ranges[i];
+            uint32_t count = reload->vertex_ranges[i + 1];
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(StaticVertex), count * sizeof(StaticVertex), vertices + first);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Progress bar on a plain background, drawn with scissored clears so it needs no scene
+    void render_loading_screen(int scr_width, int scr_height, float fraction) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, scr_width, scr_height);
+        glClearColor(0.05f, 0.05f, 0.07f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        int bar_width = scr_width / 2;
+        int bar_height = glm::max(scr_height / 60, 4);
+        int bar_x = (scr_width - bar_width) / 2;
+        int bar_y = scr_height / 4;
+
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(bar_x, bar_y, bar_width, bar_height);
+        glClearColor(0.2f, 0.2f, 0.25f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glScissor(bar_x, bar_y, (int)(bar_width * glm::clamp(fraction, 0.0f, 1.0f)), bar_height);
+        glClearColor(0.15f, 0.55f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+
     void dispose() {
         glDeleteProgram(standard_shader.program);
+        glDeleteProgram(static_shader.program);
         glDeleteProgram(screen_shader.program);
+        if (static_geometry) del_meshobjdata(&static_geometry);
         del_rendertarget(&main_target);
         del_rendertarget(&portal1_target);
         del_rendertarget(&portal2_target);
@@ -200,42 +266,53 @@ namespace renderer {
         glDrawElements(GL_TRIANGLES, CUBE_VERTEX_COUNT, GL_UNSIGNED_INT, 0);
     }
 
-    // Render the specified scene from the specified POV
-    void render_scene(Scene* scene, glm::mat4 view, glm::mat4 projection, bool draw_portals=true, glm::vec3 slice_pos=glm::vec3(0.0f), glm::vec3 slice_normal=glm::vec3(0.0f)) {
+    // Render the specified scene from the specified POV.
+    // Brushes are culled with the PVS of the given cell, -1 draws all of them.
+    void render_scene(Scene* scene, glm::mat4 view, glm::mat4 projection, int cell, bool draw_portals=true, glm::vec3 slice_pos=glm::vec3(0.0f), glm::vec3 slice_normal=glm::vec3(0.0f)) {
         glm::mat4 model;
         glm::mat4 mvp;
 
         glClearColor(0.1f, 0.1f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Draw brushes
+        // Draw brushes, all merged into one mesh
+        if (static_geometry) {
+            glm::mat4 vp = projection * view;
+            glUseProgram(static_shader.program);
+            glBindVertexArray(static_geometry->vao);
+            glUniformMatrix4fv(static_shader.u_VP, 1, GL_FALSE, glm::value_ptr(vp));
+            glUniform3f(static_shader.u_lightdir, scene->light_dir.x, scene->light_dir.y, scene->light_dir.z);
+            glUniform3f(static_shader.u_slicepos, slice_pos.x, slice_pos.y, slice_pos.z);
+            glUniform3f(static_shader.u_slicenormal, slice_normal.x, slice_normal.y, slice_normal.z);
+            if (cell < 0) {
+                glDrawElements(GL_TRIANGLES, static_index_count, GL_UNSIGNED_INT, 0);
+            } else {
+                pvs_draw_ranges(&scene->pvs, cell, &pvs_ranges);
+                draw_counts.clear();
+                draw_offsets.clear();
+                for (size_t i = 0; i < pvs_ranges.size(); i += 2) {
+                    draw_offsets.push_back((const void*)(pvs_ranges[i] * sizeof(GLuint)));
+                    draw_counts.push_back((GLsizei)pvs_ranges[i + 1]);
+                }
+                if (!draw_counts.empty()) glMultiDrawElements(GL_TRIANGLES, &draw_counts[0], GL_UNSIGNED_INT, &draw_offsets[0], (GLsizei)draw_counts.size());
+            }
+        }
+
         glUseProgram(standard_shader.program);
         glBindVertexArray(primitives::cube->vao);
 
         glUniform3f(standard_shader.u_lightdir, scene->light_dir.x, scene->light_dir.y, scene->light_dir.z);
         glUniform1i(standard_shader.u_highlightfrontface, 0);
-        glUniform3f(standard_shader.u_slicepos, slice_pos.x, slice_pos.y, slice_pos.z);
-        glUniform3f(standard_shader.u_slicenormal, slice_normal.x, slice_normal.y, slice_normal.z);
-        for (size_t i = 0; i<scene->geometry.size(); i++) {
-            Brush* brush = &scene->geometry[i];
-            glm::vec3 half_size = (brush->max - brush->min) / 2.0f;
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, brush->min + half_size);
-            model = glm::scale(model, half_size);
-            mvp = projection * view * model;
-            glUniformMatrix4fv(standard_shader.u_M, 1, GL_FALSE, glm::value_ptr(model));
-            glUniformMatrix4fv(standard_shader.u_MVP, 1, GL_FALSE, glm::value_ptr(mvp));
-            glUniform3f(standard_shader.u_color, brush->color.r, brush->color.g, brush->color.b);
-            glDrawElements(GL_TRIANGLES, CUBE_VERTEX_COUNT, GL_UNSIGNED_INT, 0);
-        }
 
         // Draw cubes
-        for (size_t i = 0; i<scene->cubes.size(); i++) {
-            Cube* cube = &scene->cubes[i];
+        for (size_t i = 0; i<scene->cubes.count; i++) {
+            glm::vec3 position = glm::mix(body_previous_position(&scene->cubes, i), body_position(&scene->cubes, i), tick_interpolation);
+            float size = scene->cubes.size[i];
+            glm::vec3 color = scene->cubes.color[i];
 
             model = glm::mat4(1.0f);
-            model = glm::translate(model, cube->position);
-            model = glm::scale(model, glm::vec3(cube->size));
+            model = glm::translate(model, position);
+            model = glm::scale(model, glm::vec3(size));
 
             glm::vec3 cube_slice_pos;
             glm::vec3 cube_slice_normal(0.0f);
@@ -243,10 +320,10 @@ namespace renderer {
             if (portals_open(scene)) {
                 Portal* traversed_portal = NULL;
                 Portal* other_portal = NULL;
-                if (portal_aabb_collision_test(&scene->portal1, cube->position-cube->size, cube->position+cube->size)) {
+                if (portal_aabb_collision_test(&scene->portal1, position-size, position+size)) {
                     traversed_portal = &scene->portal1;
                     other_portal = &scene->portal2;
-                } else if (portal_aabb_collision_test(&scene->portal2, cube->position-cube->size, cube->position+cube->size)) {
+                } else if (portal_aabb_collision_test(&scene->portal2, position-size, position+size)) {
                     traversed_portal = &scene->portal2;
                     other_portal = &scene->portal1;
                 }
@@ -261,7 +338,7 @@ namespace renderer {
                     mvp = projection * view * transformed_model;
                     glUniformMatrix4fv(standard_shader.u_M, 1, GL_FALSE, glm::value_ptr(transformed_model));
                     glUniformMatrix4fv(standard_shader.u_MVP, 1, GL_FALSE, glm::value_ptr(mvp));
-                    glUniform3f(standard_shader.u_color, cube->color.r, cube->color.g, cube->color.b);
+                    glUniform3f(standard_shader.u_color, color.r, color.g, color.b);
                     glDrawElements(GL_TRIANGLES, CUBE_VERTEX_COUNT, GL_UNSIGNED_INT, 0);
 
                     cube_slice_pos = other_portal->position;
@@ -275,7 +352,7 @@ namespace renderer {
             glUniformMatrix4fv(standard_shader.u_MVP, 1, GL_FALSE, glm::value_ptr(mvp));
             glUniform3f(standard_shader.u_slicepos, cube_slice_pos.x, cube_slice_pos.y, cube_slice_pos.z);
             glUniform3f(standard_shader.u_slicenormal, cube_slice_normal.x, cube_slice_normal.y, cube_slice_normal.z);
-            glUniform3f(standard_shader.u_color, cube->color.r, cube->color.g, cube->color.b);
+            glUniform3f(standard_shader.u_color, color.r, color.g, color.b);
             glDrawElements(GL_TRIANGLES, CUBE_VERTEX_COUNT, GL_UNSIGNED_INT, 0);
         }
 
@@ -313,20 +390,21 @@ namespace renderer {
             
             glBindFramebuffer(GL_FRAMEBUFFER, portal1_target.fbo);
             glEnable(GL_DEPTH_TEST);
-            render_scene(scene, p1cam.GetView(), projection, false, scene->portal2.position, scene->portal2.normal);
+            // Portal cameras see what is in front of the linked portal, so they use its cell
+            render_scene(scene, p1cam.GetView(), projection, pvs_cell(&scene->pvs, scene->portal2.position), false, scene->portal2.position, scene->portal2.normal);
 
             // Second portal target
             Camera p2cam = Camera(pcam_transform(cam, &scene->portal2, &scene->portal1));
             
             glBindFramebuffer(GL_FRAMEBUFFER, portal2_target.fbo);
             glEnable(GL_DEPTH_TEST);
-            render_scene(scene, p2cam.GetView(), projection, false, scene->portal1.position, scene->portal1.normal);
+            render_scene(scene, p2cam.GetView(), projection, pvs_cell(&scene->pvs, scene->portal1.position), false, scene->portal1.position, scene->portal1.normal);
         }
 
         // Main target
         glBindFramebuffer(GL_FRAMEBUFFER, main_target.fbo);
         glEnable(GL_DEPTH_TEST);
-        render_scene(scene, cam->GetView(), projection);
+        render_scene(scene, cam->GetView(), projection, pvs_cell(&scene->pvs, cam->position));
 
         // Draw to screen
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
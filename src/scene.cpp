@@ -1,12 +1,20 @@
 #include "scene.h"
+#include "scene_bake.h"
+#include "scene_compact.h"
+#include "brush_merge.h"
+#include "scene_text.h"
+#include "job_system.h"
 
 #include <algorithm>
 #include <initializer_list>
 #include <limits>
-#include <fstream>
 #include <vector>
 #include <iostream>
 #include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/intersect.hpp>
@@ -14,43 +22,334 @@
 #include <glm/gtx/euler_angles.hpp>
 
 #define ARRAY_TO_VEC3(arr) glm::vec3((arr)[0], (arr)[1], (arr)[2])
-#define READ_INT32(value) file.read(reinterpret_cast<char*>((value)), sizeof(int))
-#define READ_FLOAT(value) file.read(reinterpret_cast<char*>((value)), sizeof(float))
-#define READ_FLOAT3(value) file.read(reinterpret_cast<char*>((value)), sizeof(float) * 3)
 #define VERY_CLOSE(vec1, vec2) glm::length(vec1 - vec2) < 0.001
 
-void load_scene_file(const char* path, Scene* scene) {
-    std::ifstream file(path, std::ios::binary);
+#define SCENE_V1_HEADER_SIZE (sizeof(float) * 3 + sizeof(int32_t))
+#define SCENE_V1_BRUSH_SIZE (sizeof(float) * 9)
+#define RAYCAST_PRUNE_TOLERANCE (16.0f * FLT_EPSILON)
+#define PORTAL_RAYCAST_SURFACE_TOLERANCE 0.01f // A portal this far behind a brush hit still counts as in front of it
+#define PORTAL_RAYCAST_EXIT_OFFSET 0.001f // Rays leaving a portal are cast from this far in front of it
+#define RAYCAST_PACKET_SIZE BOUNDS_BATCH // Rays traced together through the BVH by raycast_batch
+#define RAYCAST_BATCH_PARALLEL_MIN 4096 // Fewest rays of a batch worth spreading over the job system
+#define RAYCAST_BATCH_GRAIN (128 * RAYCAST_PACKET_SIZE) // Rays traced by one job of raycast_batch, whole packets
+#define CUBE_UPDATE_PARALLEL_MIN 256 // Fewest cubes worth spreading over the job system
+#define CUBE_UPDATE_GRAIN 64 // Cubes stepped by one job of update_cubes
+#define CUBE_PAIRS_SWEEP_AWAKE 4 // Pairs come from sweeping all cubes once at least one in this many is awake
+#define CUBE_SLEEP_SPEED 0.05f // Cubes slower than this count as still
+#define CUBE_SLEEP_TICKS 30 // Ticks a whole island has to stay still before it falls asleep
+#define SWEEP_MAX_CONTACTS 4 // Contacts move_aabb resolves before dropping the rest of the motion
+#define SWEEP_TOLERANCE 0.01f // Boxes up to this far inside a brush still collide with it, so rounding cannot let them sink in
+
+// Brushes are copied straight out of the file, so the struct must match the on-disk layout
+static_assert(sizeof(Brush) == SCENE_V1_BRUSH_SIZE, "Brush must be 9 tightly packed floats");
+static_assert(sizeof(Brush) == sizeof(SceneBrushRecord), "Brush must match SceneBrushRecord");
+
+// Check brush data straight from the mapping before it is copied into the scene
+bool validate_brushes(const char* path, const Brush* brushes, size_t brush_count) {
+    const float* brush_floats = reinterpret_cast<const float*>(brushes);
+    for (size_t i = 0; i < brush_count * 9; i++) {
+        if (!std::isfinite(brush_floats[i])) {
+            std::cerr << "Scene file " << path << " contains non-finite values" << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < brush_count; i++) {
+        if (brushes[i].min.x > brushes[i].max.x || brushes[i].min.y > brushes[i].max.y || brushes[i].min.z > brushes[i].max.z) {
+            std::cerr << "Scene file " << path << " contains an inverted brush (#" << i << ")" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Check cube records straight from the mapping, like validate_brushes
+bool validate_cubes(const char* path, const SceneCubeRecord* cubes, size_t cube_count) {
+    for (size_t i = 0; i < cube_count; i++) {
+        const float* cube_floats = reinterpret_cast<const float*>(&cubes[i]);
+        for (size_t k = 0; k < sizeof(SceneCubeRecord) / sizeof(float); k++) {
+            if (!std::isfinite(cube_floats[k])) {
+                std::cerr << "Scene file " << path << " contains non-finite values" << std::endl;
+                return false;
+            }
+        }
+
+        if (cubes[i].size <= 0.0f) {
+            std::cerr << "Scene file " << path << " contains a cube without a positive size (#" << i << ")" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Everything the unversioned format does not store
+void apply_scene_defaults(Scene* scene) {
+    scene->portal1.width = 1.0f;
+    scene->portal1.height = 1.0f;
+    scene->portal2.width = 1.0f;
+    scene->portal2.height = 1.0f;
+
+    scene->spawn_position = glm::vec3(-5.0f, 10.0f, 2.0f);
+    scene->spawn_yaw = 0.0f;
+    scene->spawn_pitch = 0.0f;
+
+    Cube cube(glm::vec3(-10.0f, 10.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    clear_cube_bodies(&scene->cubes);
+    add_cube_body(&scene->cubes, &cube);
+
+    // Brushes are as authored unless the file says otherwise
+    scene->authored_geometry.clear();
+    scene->authored_map.clear();
+    scene->authored_first.clear();
+    scene->authored_indices.clear();
+}
+
+int load_scene_v1(const char* path, SceneFile* file, Scene* scene) {
+    const MappedFile* mapping = &file->mapping;
+    if (mapping->size < SCENE_V1_HEADER_SIZE) {
+        std::cerr << "Scene file " << path << " is truncated (" << mapping->size << " bytes)" << std::endl;
+        return 1;
+    }
 
     float light_dir[3];
-    READ_FLOAT3(light_dir);
+    int32_t brush_count;
+    memcpy(light_dir, mapping->data, sizeof(light_dir));
+    memcpy(&brush_count, mapping->data + sizeof(light_dir), sizeof(brush_count));
+
+    // Check the size against the brush count before touching any brush data
+    if (brush_count < 0 || (size_t)brush_count > (mapping->size - SCENE_V1_HEADER_SIZE) / SCENE_V1_BRUSH_SIZE) {
+        std::cerr << "Scene file " << path << " is truncated or corrupt (" << brush_count << " brushes in " << mapping->size << " bytes)" << std::endl;
+        return 1;
+    }
+
+    size_t expected_size = SCENE_V1_HEADER_SIZE + (size_t)brush_count * SCENE_V1_BRUSH_SIZE;
+    if (mapping->size != expected_size) {
+        std::cerr << "Scene file " << path << " has " << mapping->size - expected_size << " unexpected trailing bytes" << std::endl;
+        return 1;
+    }
+
+    if (!std::isfinite(light_dir[0]) || !std::isfinite(light_dir[1]) || !std::isfinite(light_dir[2])) {
+        std::cerr << "Scene file " << path << " contains non-finite values" << std::endl;
+        return 1;
+    }
+
+    const Brush* brushes = reinterpret_cast<const Brush*>(mapping->data + SCENE_V1_HEADER_SIZE);
+    if (!validate_brushes(path, brushes, brush_count)) return 1;
+
     scene->light_dir = ARRAY_TO_VEC3(light_dir);
+    scene->geometry.assign(brushes, brushes + brush_count);
+    apply_scene_defaults(scene);
+
+    return 0;
+}
 
-    int brush_count;
-    READ_INT32(&brush_count);
+int load_scene_v2(const char* path, SceneFile* file, Scene* scene) {
+    // Check the sections needed right away in parallel, the rest are checked when first used
+    static const uint32_t eager_sections[] = {
+        SCENE_SECTION_BRUSHES, SCENE_SECTION_COMPACT_BRUSHES, SCENE_SECTION_CUBES, SCENE_SECTION_SPAWN_POINTS, SCENE_SECTION_LIGHTS, SCENE_SECTION_PORTALS
+    };
+    scene_file_validate(file, eager_sections, sizeof(eager_sections) / sizeof(eager_sections[0]));
+
+    uint32_t brush_count = 0;
+    const Brush* brushes = static_cast<const Brush*>(scene_file_section(file, SCENE_SECTION_BRUSHES, &brush_count));
+
+    // Compact files decode into a buffer that is moved into the scene afterwards
+    std::vector<Brush> decoded;
+    const void* compact = brushes == NULL ? scene_file_section(file, SCENE_SECTION_COMPACT_BRUSHES, &brush_count) : NULL;
+    if (compact != NULL) {
+        if (decode_compact_brushes(compact, (size_t)scene_file_find(file, SCENE_SECTION_COMPACT_BRUSHES)->size, brush_count, &decoded) != 0) {
+            std::cerr << "Scene file " << path << " has a malformed compact brush section" << std::endl;
+            return 1;
+        }
+        brushes = decoded.empty() ? NULL : &decoded[0];
+    }
 
-    scene->geometry.clear();
+    if (brushes == NULL && compact == NULL) {
+        std::cerr << "Scene file " << path << " has no valid brush section" << std::endl;
+        return 1;
+    }
+    if (!validate_brushes(path, brushes, brush_count)) return 1;
 
-    for (int i = 0; i<brush_count; i++) {
-        float min_xyz[3];
-        float max_xyz[3];
-        float rgb[3];
+    uint32_t cube_count = 0;
+    const SceneCubeRecord* cubes = static_cast<const SceneCubeRecord*>(scene_file_section(file, SCENE_SECTION_CUBES, &cube_count));
+    if (cubes != NULL && !validate_cubes(path, cubes, cube_count)) return 1;
 
-        READ_FLOAT3(min_xyz);
-        READ_FLOAT3(max_xyz);
-        READ_FLOAT3(rgb);
+    uint32_t light_count = 0;
+    const SceneLightRecord* lights = static_cast<const SceneLightRecord*>(scene_file_section(file, SCENE_SECTION_LIGHTS, &light_count));
+    if (lights == NULL || light_count == 0) {
+        std::cerr << "Scene file " << path << " has no valid light section" << std::endl;
+        return 1;
+    }
 
-        Brush brush = Brush(ARRAY_TO_VEC3(min_xyz), ARRAY_TO_VEC3(max_xyz), ARRAY_TO_VEC3(rgb));
+    scene->light_dir = ARRAY_TO_VEC3(lights[0].direction);
+    if (compact != NULL) {
+        scene->geometry.swap(decoded);
+    } else {
+        scene->geometry.assign(brushes, brushes + brush_count);
+    }
+    apply_scene_defaults(scene);
+
+    // Optional sections fall back to the defaults
+    if (cubes != NULL) {
+        clear_cube_bodies(&scene->cubes);
+        for (uint32_t i = 0; i < cube_count; i++) {
+            Cube cube = Cube(ARRAY_TO_VEC3(cubes[i].position), ARRAY_TO_VEC3(cubes[i].color));
+            cube.size = cubes[i].size;
+            add_cube_body(&scene->cubes, &cube);
+        }
+    }
 
-        scene->geometry.push_back(brush);
+    uint32_t spawn_count = 0;
+    const SceneSpawnRecord* spawns = static_cast<const SceneSpawnRecord*>(scene_file_section(file, SCENE_SECTION_SPAWN_POINTS, &spawn_count));
+    if (spawns != NULL && spawn_count > 0) {
+        scene->spawn_position = ARRAY_TO_VEC3(spawns[0].position);
+        scene->spawn_yaw = spawns[0].yaw;
+        scene->spawn_pitch = spawns[0].pitch;
     }
 
-    scene->portal1.width = 1.0f;
-    scene->portal1.height = 1.0f;
-    scene->portal2.width = 1.0f;
-    scene->portal2.height = 1.0f;
+    // Brushes merged by scenec, the authored ones are kept for raycast hits
+    uint32_t authored_count = 0;
+    uint32_t map_count = 0;
+    const Brush* authored = static_cast<const Brush*>(scene_file_section(file, SCENE_SECTION_AUTHORED_BRUSHES, &authored_count));
+    const uint32_t* merge_map = static_cast<const uint32_t*>(scene_file_section(file, SCENE_SECTION_MERGE_MAP, &map_count));
+    if (authored != NULL && merge_map != NULL && authored_count == map_count && validate_brushes(path, authored, authored_count)) {
+        std::vector<uint32_t> authored_map(merge_map, merge_map + map_count);
+        bool in_range = true;
+        for (uint32_t i = 0; i < map_count; i++) {
+            if (authored_map[i] >= scene->geometry.size()) in_range = false;
+        }
+
+        if (in_range) {
+            scene->authored_geometry.assign(authored, authored + authored_count);
+            set_authored_map(scene, authored_map);
+        } else {
+            std::cerr << "Scene file " << path << " has a malformed merge map, ignoring it" << std::endl;
+        }
+    }
+
+    uint32_t portal_count = 0;
+    const ScenePortalRecord* portals = static_cast<const ScenePortalRecord*>(scene_file_section(file, SCENE_SECTION_PORTALS, &portal_count));
+    if (portals != NULL && portal_count >= 2) {
+        scene->portal1.width = portals[0].width;
+        scene->portal1.height = portals[0].height;
+        scene->portal2.width = portals[1].width;
+        scene->portal2.height = portals[1].height;
+    }
+
+    return 0;
+}
+
+void report_progress(const SceneLoadProgress* progress, float fraction, const char* step) {
+    if (progress && progress->callback) progress->callback(progress->user_data, fraction, step);
+}
+
+// Load a scene file (unversioned, version 2 or text). Returns 0 on success.
+// On failure an error is printed and the scene is left untouched.
+// Without SCENE_LOAD_RUNTIME_DATA only the scene description is loaded, no BVH, face flags or static mesh.
+int load_scene_file(const char* path, Scene* scene, int options, const SceneLoadProgress* progress) {
+    report_progress(progress, 0.0f, "Opening scene");
+    SceneFile file;
+    if (scene_file_open(path, &file) != 0) return 1;
+
+    report_progress(progress, 0.05f, "Reading scene");
+    int result;
+    if (file.version == 1 && is_scene_text(&file.mapping)) {
+        result = load_scene_text(path, &file.mapping, scene);
+    } else {
+        result = file.version == 1 ? load_scene_v1(path, &file, scene) : load_scene_v2(path, &file, scene);
+    }
+    if (result != 0) {
+        scene_file_close(&file);
+        return result;
+    }
+
+    if (options & SCENE_LOAD_MERGE_BRUSHES) {
+        report_progress(progress, 0.2f, "Merging brushes");
+        merge_brushes(scene);
+    }
+
+    if (file.version == 1) {
+        // Nothing to load lazily from unversioned or text files
+        scene_file_close(&file);
+        close_scene_file(scene);
+        if (options & SCENE_LOAD_RUNTIME_DATA) bake_scene(scene, 0, progress);
+        report_progress(progress, 1.0f, "Done");
+        return 0;
+    }
+
+    // The static mesh may point into the new mapping, so the old one is only closed afterwards
+    if (options & SCENE_LOAD_RUNTIME_DATA) bake_scene(scene, load_baked_sections(&file, scene), progress);
+    close_scene_file(scene);
+    scene->file = file;
+
+    report_progress(progress, 1.0f, "Done");
+    return 0;
+}
+
+void close_scene_file(Scene* scene) {
+    scene_file_close(&scene->file);
+}
+
+// Build the version 2 sections describing the scene
+void scene_sections(Scene* scene, std::vector<SceneSectionData>* sections) {
+    SceneSectionData brushes(SCENE_SECTION_BRUSHES);
+    if (!scene->geometry.empty()) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&scene->geometry[0]);
+        brushes.data.assign(bytes, bytes + scene->geometry.size() * sizeof(Brush));
+        brushes.element_count = (uint32_t)scene->geometry.size();
+    }
+    sections->push_back(brushes);
+
+    SceneSectionData cubes(SCENE_SECTION_CUBES);
+    for (size_t i = 0; i < scene->cubes.count; i++) {
+        Cube cube = cube_body(&scene->cubes, i);
+        SceneCubeRecord record = {
+            { cube.position.x, cube.position.y, cube.position.z },
+            { cube.color.r, cube.color.g, cube.color.b },
+            cube.size
+        };
+        append_record(&cubes, record);
+    }
+    sections->push_back(cubes);
+
+    SceneSectionData spawns(SCENE_SECTION_SPAWN_POINTS);
+    SceneSpawnRecord spawn = { { scene->spawn_position.x, scene->spawn_position.y, scene->spawn_position.z }, scene->spawn_yaw, scene->spawn_pitch };
+    append_record(&spawns, spawn);
+    sections->push_back(spawns);
+
+    SceneSectionData lights(SCENE_SECTION_LIGHTS);
+    SceneLightRecord light = { { scene->light_dir.x, scene->light_dir.y, scene->light_dir.z } };
+    append_record(&lights, light);
+    sections->push_back(lights);
+
+    if (!scene->authored_geometry.empty()) {
+        SceneSectionData authored(SCENE_SECTION_AUTHORED_BRUSHES);
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&scene->authored_geometry[0]);
+        authored.data.assign(bytes, bytes + scene->authored_geometry.size() * sizeof(Brush));
+        authored.element_count = (uint32_t)scene->authored_geometry.size();
+        sections->push_back(authored);
+
+        SceneSectionData merge_map(SCENE_SECTION_MERGE_MAP);
+        for (size_t i = 0; i < scene->authored_map.size(); i++) {
+            append_record(&merge_map, scene->authored_map[i]);
+        }
+        sections->push_back(merge_map);
+    }
+
+    SceneSectionData portals(SCENE_SECTION_PORTALS);
+    ScenePortalRecord portal1 = { scene->portal1.width, scene->portal1.height };
+    ScenePortalRecord portal2 = { scene->portal2.width, scene->portal2.height };
+    append_record(&portals, portal1);
+    append_record(&portals, portal2);
+    sections->push_back(portals);
+}
 
-    scene->cubes.push_back(Cube(glm::vec3(-10.0f, 10.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+int save_scene_file(const char* path, Scene* scene) {
+    std::vector<SceneSectionData> sections;
+    scene_sections(scene, &sections);
+    return write_scene_sections(path, sections);
 }
 
 Camera::Camera(glm::mat4 transform) {
@@ -117,10 +416,6 @@ glm::mat4 Camera::GetTransform() {
     return translationMatrix * rotationMatrix;
 }
 
-glm::mat4 Cube::GetTransform() {
-    return glm::translate(glm::mat4(1.0f), this->position);
-}
-
 glm::mat4 portal_rotation(Portal* portal) {
     return glm::eulerAngleYX(glm::atan(portal->normal.x, portal->normal.z), glm::asin(-portal->normal.y));
 }
@@ -158,6 +453,90 @@ inline glm::vec3 portal_max(Portal* portal) {
     return portal->position + glm::vec3(portal->width, portal->height, PORTAL_THICKNESS);
 }
 
+// Distance along a ray with normalized dir to where it passes through the front of the portal opening
+bool ray_portal_distance(Portal* portal, glm::vec3 origin, glm::vec3 dir, float* distance) {
+    float facing = glm::dot(dir, portal->normal);
+    if (facing >= 0.0f) return false;
+
+    float t = glm::dot(portal->position - origin, portal->normal) / facing;
+    if (t < 0.0f || glm::distance(origin + dir * t, portal->position) >= portal->width) return false;
+
+    *distance = t;
+    return true;
+}
+
+// Cast a ray that continues through open portals, for at most max_hops portals and max_distance in total.
+// Fills in the segments of the path and returns true if it ends on a brush closer than max_distance.
+// A segment ending in a portal is continued from the linked portal with portal_transform applied to the ray.
+bool raycast_portals(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance, int max_hops, PortalRaycast* result) {
+    bool through_portals = portals_open(scene);
+    glm::mat4 transforms[2];
+    if (through_portals) {
+        transforms[0] = portal_transform(&scene->portal1, &scene->portal2);
+        transforms[1] = portal_transform(&scene->portal2, &scene->portal1);
+    }
+
+    max_hops = std::min(std::max(max_hops, 0), PORTAL_RAYCAST_MAX_HOPS);
+    dir = glm::normalize(dir);
+    result->segment_count = 0;
+    result->distance = 0.0f;
+    result->transform = glm::mat4(1.0f);
+    result->hit_info.brush = NULL;
+    result->hit_info.authored_brush = NULL;
+
+    glm::vec3 cast_origin = origin;
+    for (;;) {
+        RaySegment* segment = &result->segments[result->segment_count++];
+        segment->start = origin;
+        segment->dir = dir;
+        segment->length = max_distance - result->distance;
+        segment->portal = NULL;
+
+        RaycastHitInfo hit;
+        float hit_distance = std::numeric_limits<float>::max();
+        if (raycast_ray(scene, cast_origin, dir, &hit)) hit_distance = glm::distance(origin, hit.intersection);
+
+        // Portals sit just in front of their wall, so one on the brush that was hit is entered before it
+        int entered = -1;
+        float portal_distance = 0.0f;
+        if (through_portals && result->segment_count <= max_hops) {
+            Portal* portals[2] = { &scene->portal1, &scene->portal2 };
+            for (int p = 0; p < 2; p++) {
+                float distance;
+                if (ray_portal_distance(portals[p], origin, dir, &distance) && distance <= hit_distance + PORTAL_RAYCAST_SURFACE_TOLERANCE &&
+                    distance < segment->length && (entered < 0 || distance < portal_distance)) {
+                    entered = p;
+                    portal_distance = distance;
+                }
+            }
+        }
+
+        if (entered >= 0) {
+            segment->length = portal_distance;
+            segment->portal = entered == 0 ? &scene->portal1 : &scene->portal2;
+            result->distance += portal_distance;
+
+            // Continue from the linked portal, starting the cast just off its wall
+            Portal* exit_portal = entered == 0 ? &scene->portal2 : &scene->portal1;
+            origin = transforms[entered] * glm::vec4(origin + dir * portal_distance, 1.0f);
+            dir = glm::normalize(glm::vec3(transforms[entered] * glm::vec4(dir, 0.0f)));
+            cast_origin = origin + exit_portal->normal * PORTAL_RAYCAST_EXIT_OFFSET;
+            result->transform = transforms[entered] * result->transform;
+            continue;
+        }
+
+        if (hit_distance < segment->length) {
+            segment->length = hit_distance;
+            result->distance += hit_distance;
+            result->hit_info = hit;
+            return true;
+        }
+
+        result->distance = max_distance;
+        return false;
+    }
+}
+
 bool is_in_portal(glm::vec3 point, Portal* portal) {
     glm::vec3 min = portal_min(portal);
     glm::vec3 max = portal_max(portal);
@@ -211,6 +590,9 @@ bool intersect_AABB(glm::vec3 minB, glm::vec3 maxB, glm::vec3 origin, glm::vec3
     /* Ray origin inside bounding box */
     if (inside) {
         *intersection = origin;
+        *normal = glm::vec3(0.0f);
+        *face_min = minB;
+        *face_max = maxB;
         return true;
     }
 
@@ -283,38 +665,319 @@ bool intersect_AABB(glm::vec3 minB, glm::vec3 maxB, glm::vec3 origin, glm::vec3
     return true; /* ray hits box */
 }
 
+// Test one brush and keep it if it is the closest hit so far. Ties go to the lowest brush index,
+// which is the order a linear scan over the brushes would find them in.
+void raycast_brush(Scene* scene, uint32_t brush_index, glm::vec3 origin, glm::vec3 dir, bool* hit, float* hit_distance, RaycastHitInfo* hit_info) {
+    Brush* brush = &scene->geometry[brush_index];
+
+    glm::vec3 brush_intersection;
+    glm::vec3 brush_normal;
+    glm::vec3 brush_face_min;
+    glm::vec3 brush_face_max;
+    if (intersect_AABB(brush->min, brush->max, origin, dir, &brush_intersection, &brush_normal, &brush_face_min, &brush_face_max)) {
+        float distance = glm::distance(origin, brush_intersection);
+        if (!*hit || distance < *hit_distance || (distance == *hit_distance && brush < hit_info->brush)) {
+            *hit = true;
+            *hit_distance = distance;
+            hit_info->intersection = brush_intersection;
+            hit_info->normal = brush_normal;
+            hit_info->face_min = brush_face_min;
+            hit_info->face_max = brush_face_max;
+            hit_info->brush = brush;
+        }
+    }
+}
+
+// Report the face of the authored brush that was hit rather than the whole merged face
+void resolve_authored_hit(Scene* scene, RaycastHitInfo* hit_info) {
+    hit_info->authored_brush = authored_brush_at(scene, hit_info->brush, hit_info->normal, hit_info->intersection);
+    if (hit_info->authored_brush == hit_info->brush) return;
+
+    hit_info->face_min = hit_info->authored_brush->min;
+    hit_info->face_max = hit_info->authored_brush->max;
+    if (hit_info->normal == glm::vec3(0.0f)) return; // Started inside the brush, the face is the whole brush
+
+    int axis = face_index(hit_info->normal) / 2;
+    float plane = hit_info->normal[axis] > 0.0f ? hit_info->brush->max[axis] : hit_info->brush->min[axis];
+    hit_info->face_min[axis] = plane;
+    hit_info->face_max[axis] = plane;
+}
+
+// Distance past which no brush can tie with or beat a hit at hit_distance, allowing for the rounding
+// of intersection points, which grows with the magnitude of the coordinates
+float raycast_prune_distance(glm::vec3 origin, float hit_distance) {
+    float magnitude = std::max(std::max(std::abs(origin.x), std::abs(origin.y)), std::abs(origin.z)) + hit_distance;
+    return (hit_distance + RAYCAST_PRUNE_TOLERANCE * magnitude) * (1.0f + RAYCAST_PRUNE_TOLERANCE);
+}
+
 bool raycast(Camera* cam, Scene* scene, RaycastHitInfo* hit_info) {
+    return raycast_ray(scene, cam->position, cam->GetForwardDirection(), hit_info);
+}
+
+// Find the closest brush hit by a ray from origin along dir. dir does not need to be normalized.
+bool raycast_ray(Scene* scene, glm::vec3 origin, glm::vec3 dir, RaycastHitInfo* hit_info) {
     bool hit = false;
-    for (size_t brush_index = 0; brush_index < scene->geometry.size(); brush_index++) {
-        Brush* brush = &scene->geometry[brush_index];
-
-        glm::vec3 brush_intersection;
-        glm::vec3 brush_normal;
-        glm::vec3 brush_face_min;
-        glm::vec3 brush_face_max;
-        if (intersect_AABB(brush->min, brush->max, cam->position, cam->GetForwardDirection(), &brush_intersection, &brush_normal, &brush_face_min, &brush_face_max)) {
-            if (hit) {
-                if (glm::distance(cam->position, brush_intersection) < glm::distance(cam->position, hit_info->intersection)) {
-                    hit_info->intersection = brush_intersection;
-                    hit_info->normal = brush_normal;
-                    hit_info->face_min = brush_face_min;
-                    hit_info->face_max = brush_face_max;
-                    hit_info->brush = brush;
+    float hit_distance = 0.0f;
+
+    if (scene->bvh.indices.size() != scene->geometry.size()) {
+        // No BVH for the current brushes
+        for (size_t brush_index = 0; brush_index < scene->geometry.size(); brush_index++) {
+            raycast_brush(scene, (uint32_t)brush_index, origin, dir, &hit, &hit_distance, hit_info);
+        }
+        if (hit) resolve_authored_hit(scene, hit_info);
+        return hit;
+    }
+
+    if (scene->bvh.nodes.empty()) return false;
+
+    // Visit the nearer child first and skip nodes the ray enters beyond the closest hit so far.
+    // A node is never entered later than the brushes in it, so only rounding can make a brush at the same
+    // distance look further away than its node. The bound allows for that, ties must still be visited.
+    glm::vec3 inv_dir = 1.0f / dir;
+    float dir_length = glm::length(dir);
+    float hit_t = std::numeric_limits<float>::max();
+    uint32_t stack[BVH_STACK_SIZE];
+    float stack_t[BVH_STACK_SIZE];
+    int stack_size = 0;
+
+    float t_entry;
+    if (!ray_node_intersection(&scene->bvh.nodes[0], origin, inv_dir, &t_entry)) return false;
+    stack[stack_size] = 0;
+    stack_t[stack_size++] = t_entry;
+
+    while (stack_size > 0) {
+        stack_size--;
+        if (stack_t[stack_size] > hit_t) continue;
+        const BVHNode* node = &scene->bvh.nodes[stack[stack_size]];
+
+        if (node->count > 0) {
+            // The batched test only rules brushes out, the exact test decides the hit
+            uint32_t end = node->left_first + node->count;
+            for (uint32_t first = node->left_first; first < end; first += BOUNDS_BATCH) {
+                uint32_t mask = ray_bounds_mask(&scene->bvh.leaf_bounds, first, std::min(end - first, (uint32_t)BOUNDS_BATCH), origin, inv_dir);
+                for (uint32_t i = first; mask != 0; i++, mask >>= 1) {
+                    if (mask & 1) raycast_brush(scene, scene->bvh.indices[i], origin, dir, &hit, &hit_distance, hit_info);
                 }
-            } else {
-                hit = true;
-                hit_info->intersection = brush_intersection;
-                hit_info->normal = brush_normal;
-                hit_info->face_min = brush_face_min;
-                hit_info->face_max = brush_face_max;
-                hit_info->brush = brush;
             }
+            if (hit) hit_t = raycast_prune_distance(origin, hit_distance) / dir_length;
+            continue;
+        }
+
+        uint32_t near_child = node->left_first;
+        uint32_t far_child = node->left_first + 1;
+        float near_t, far_t;
+        bool near_hit = ray_node_intersection(&scene->bvh.nodes[near_child], origin, inv_dir, &near_t) && near_t <= hit_t;
+        bool far_hit = ray_node_intersection(&scene->bvh.nodes[far_child], origin, inv_dir, &far_t) && far_t <= hit_t;
+        if (near_hit && far_hit && far_t < near_t) {
+            std::swap(near_child, far_child);
+            std::swap(near_t, far_t);
+        } else if (!near_hit) {
+            near_child = far_child;
+            near_t = far_t;
+            near_hit = far_hit;
+            far_hit = false;
+        }
+
+        if (far_hit) {
+            stack[stack_size] = far_child;
+            stack_t[stack_size++] = far_t;
+        }
+        if (near_hit) {
+            stack[stack_size] = near_child;
+            stack_t[stack_size++] = near_t;
         }
     }
 
+    if (hit) resolve_authored_hit(scene, hit_info);
     return hit;
 }
 
+// Trace up to RAYCAST_PACKET_SIZE rays through the BVH together, testing each node against all of them at once.
+// Every ray keeps its own closest hit and prune distance, so each one visits at least the nodes it would
+// visit alone and finds the same hit.
+void raycast_packet(Scene* scene, const uint32_t* rays, int ray_count, const glm::vec3* ray_origins, const glm::vec3* ray_dirs, RaycastHitInfo* results) {
+    glm::vec3 origins[RAYCAST_PACKET_SIZE];
+    glm::vec3 dirs[RAYCAST_PACKET_SIZE];
+    glm::vec3 inv_dirs[RAYCAST_PACKET_SIZE];
+    float dir_lengths[RAYCAST_PACKET_SIZE];
+    bool hits[RAYCAST_PACKET_SIZE];
+    float hit_distances[RAYCAST_PACKET_SIZE];
+    RaycastHitInfo* infos[RAYCAST_PACKET_SIZE];
+    RayPacket packet;
+    for (int r = 0; r < RAYCAST_PACKET_SIZE; r++) {
+        bool used = r < ray_count;
+        origins[r] = used ? ray_origins[rays[r]] : glm::vec3(0.0f);
+        dirs[r] = used ? ray_dirs[rays[r]] : glm::vec3(1.0f);
+        inv_dirs[r] = 1.0f / dirs[r];
+        dir_lengths[r] = glm::length(dirs[r]);
+        hits[r] = false;
+        hit_distances[r] = 0.0f;
+        infos[r] = used ? &results[rays[r]] : NULL;
+
+        packet.origin_x[r] = origins[r].x;
+        packet.origin_y[r] = origins[r].y;
+        packet.origin_z[r] = origins[r].z;
+        packet.inv_dir_x[r] = inv_dirs[r].x;
+        packet.inv_dir_y[r] = inv_dirs[r].y;
+        packet.inv_dir_z[r] = inv_dirs[r].z;
+        packet.t_max[r] = used ? std::numeric_limits<float>::max() : -1.0f;
+    }
+
+    uint32_t stack[BVH_STACK_SIZE];
+    uint32_t stack_mask[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size] = 0;
+    stack_mask[stack_size++] = (1u << ray_count) - 1;
+
+    while (stack_size > 0) {
+        stack_size--;
+        const BVHNode* node = &scene->bvh.nodes[stack[stack_size]];
+        uint32_t active = ray_packet_mask(&packet, node->min, node->max) & stack_mask[stack_size];
+        if (active == 0) continue;
+
+        if (node->count > 0) {
+            uint32_t end = node->left_first + node->count;
+            for (int r = 0; r < ray_count; r++) {
+                if (!(active >> r & 1)) continue;
+                for (uint32_t first = node->left_first; first < end; first += BOUNDS_BATCH) {
+                    uint32_t mask = ray_bounds_mask(&scene->bvh.leaf_bounds, first, std::min(end - first, (uint32_t)BOUNDS_BATCH), origins[r], inv_dirs[r]);
+                    for (uint32_t i = first; mask != 0; i++, mask >>= 1) {
+                        if (mask & 1) raycast_brush(scene, scene->bvh.indices[i], origins[r], dirs[r], &hits[r], &hit_distances[r], infos[r]);
+                    }
+                }
+                // A ray without direction only hits brushes around its origin, all at distance 0, and is never pruned
+                if (hits[r] && dir_lengths[r] > 0.0f) packet.t_max[r] = raycast_prune_distance(origins[r], hit_distances[r]) / dir_lengths[r];
+            }
+            continue;
+        }
+
+        // Children are tested when popped. Visit the one nearer along the first active ray first.
+        int lead = 0;
+        while (!(active >> lead & 1)) lead++;
+        const BVHNode* left = &scene->bvh.nodes[node->left_first];
+        const BVHNode* right = &scene->bvh.nodes[node->left_first + 1];
+        bool left_first = glm::dot((left->min + left->max) - (right->min + right->max), dirs[lead]) <= 0.0f;
+
+        stack[stack_size] = left_first ? node->left_first + 1 : node->left_first;
+        stack_mask[stack_size++] = active;
+        stack[stack_size] = left_first ? node->left_first : node->left_first + 1;
+        stack_mask[stack_size++] = active;
+    }
+
+    for (int r = 0; r < ray_count; r++) {
+        if (hits[r]) {
+            resolve_authored_hit(scene, infos[r]);
+        } else {
+            infos[r]->brush = NULL;
+            infos[r]->authored_brush = NULL;
+        }
+    }
+}
+
+// Spread the low 5 bits of x so that there are two zero bits between them
+uint32_t spread_bits(uint32_t x) {
+    x &= 0x1f;
+    x = (x | (x << 8)) & 0x100f;
+    x = (x | (x << 4)) & 0x10c3;
+    x = (x | (x << 2)) & 0x1249;
+    return x;
+}
+
+// Sort key grouping rays that point the same way and start close together, so packets stay coherent.
+// Direction octant, then a 5 bit per axis Morton code of the origin, then one of the heading.
+uint32_t ray_order_key(Scene* scene, glm::vec3 origin, glm::vec3 dir) {
+    glm::vec3 extent = glm::max(scene->bounds_max - scene->bounds_min, glm::vec3(1e-6f));
+    glm::vec3 cell = glm::clamp((origin - scene->bounds_min) / extent, 0.0f, 1.0f) * 31.0f;
+    glm::vec3 heading = glm::clamp(dir / std::max(std::max(std::abs(dir.x), std::abs(dir.y)), std::max(std::abs(dir.z), 1e-30f)) * 0.5f + 0.5f, 0.0f, 1.0f) * 31.0f;
+    uint32_t octant = (dir.x < 0.0f ? 1 : 0) | (dir.y < 0.0f ? 2 : 0) | (dir.z < 0.0f ? 4 : 0);
+    uint32_t heading_code = spread_bits((uint32_t)heading.x) | spread_bits((uint32_t)heading.y) << 1 | spread_bits((uint32_t)heading.z) << 2;
+    uint32_t cell_code = spread_bits((uint32_t)cell.x) | spread_bits((uint32_t)cell.y) << 1 | spread_bits((uint32_t)cell.z) << 2;
+    return octant << 30 | cell_code << 15 | heading_code;
+}
+
+// Order the rays by ray_order_key with a radix sort on the key in the upper half of each entry
+void sort_rays(Scene* scene, const glm::vec3* origins, const glm::vec3* dirs, size_t count, std::vector<uint32_t>* order) {
+    std::vector<uint64_t> entries(count), sorted(count);
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = (uint64_t)ray_order_key(scene, origins[i], dirs[i]) << 32 | i;
+    }
+
+    for (int shift = 32; shift < 64; shift += 8) {
+        size_t offsets[257] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            offsets[(entries[i] >> shift & 0xff) + 1]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            offsets[b + 1] += offsets[b];
+        }
+        for (size_t i = 0; i < count; i++) {
+            sorted[offsets[entries[i] >> shift & 0xff]++] = entries[i];
+        }
+        entries.swap(sorted);
+    }
+
+    order->resize(count);
+    for (size_t i = 0; i < count; i++) {
+        (*order)[i] = (uint32_t)entries[i];
+    }
+}
+
+void raycast_batch_range(Scene* scene, const std::vector<uint32_t>* order, size_t begin, size_t end, const glm::vec3* origins, const glm::vec3* dirs, RaycastHitInfo* results) {
+    for (size_t i = begin; i < end; i += RAYCAST_PACKET_SIZE) {
+        int ray_count = (int)std::min(end - i, (size_t)RAYCAST_PACKET_SIZE);
+        raycast_packet(scene, &(*order)[i], ray_count, origins, dirs, results);
+    }
+}
+
+struct RaycastBatchJob {
+    Scene* scene;
+    const std::vector<uint32_t>* order;
+    const glm::vec3* origins;
+    const glm::vec3* dirs;
+    RaycastHitInfo* results;
+};
+
+static void raycast_batch_job(void* data, size_t begin, size_t end) {
+    RaycastBatchJob* job = (RaycastBatchJob*)data;
+    raycast_batch_range(job->scene, job->order, begin, end, job->origins, job->dirs, job->results);
+}
+
+// Cast count rays at once, ray i from origins[i] along dirs[i]. results[i] gets the closest hit of ray i,
+// with brush set to NULL if it hits nothing. Results are the same as raycast_ray for every ray.
+// Large batches are split over the shared job system. Returns the number of rays that hit something.
+size_t raycast_batch(Scene* scene, const glm::vec3* origins, const glm::vec3* dirs, size_t count, RaycastHitInfo* results) {
+    if (scene->bvh.indices.size() != scene->geometry.size() || scene->bvh.nodes.empty()) {
+        // No BVH for the current brushes
+        size_t hits = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (raycast_ray(scene, origins[i], dirs[i], &results[i])) {
+                hits++;
+            } else {
+                results[i].brush = NULL;
+                results[i].authored_brush = NULL;
+            }
+        }
+        return hits;
+    }
+
+    std::vector<uint32_t> order;
+    sort_rays(scene, origins, dirs, count, &order);
+
+    // Jobs start on whole packets, so no packet is split between two of them
+    RaycastBatchJob job = { scene, &order, origins, dirs, results };
+    if (count >= RAYCAST_BATCH_PARALLEL_MIN) {
+        parallel_for(shared_job_system(), count, RAYCAST_BATCH_GRAIN, raycast_batch_job, &job);
+    } else {
+        raycast_batch_job(&job, 0, count);
+    }
+
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (results[i].brush != NULL) hits++;
+    }
+    return hits;
+}
+
 bool check_aabb_intersection(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max) {
     return (
         a_min.x <= b_max.x &&
@@ -326,47 +989,79 @@ bool check_aabb_intersection(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min,
     );
 }
 
-// Checks if the AABB would collide with the brush if it was to be translated. Returns true and sets the hit_normal if a collision is detected.
-bool aabb_brush_collision(glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, Brush* brush, glm::vec3* hit_normal) {
-    // Calculate the translated AABB
-    glm::vec3 translated_min = aabb_min + translation;
-    glm::vec3 translated_max = aabb_max + translation;
-    
-    // Check if there is a collision
-    bool collision = (translated_min.x <= brush->max.x && translated_max.x >= brush->min.x) &&
-                     (translated_min.y <= brush->max.y && translated_max.y >= brush->min.y) &&
-                     (translated_min.z <= brush->max.z && translated_max.z >= brush->min.z);
+// Find when a box moving by translation first touches the brush. Returns true and sets time, as a fraction of the translation,
+// and the normal of the face hit if it does. Touching along an axis the box does not move on is not a collision, so boxes slide
+// along the faces they rest on, and boxes already further inside than SWEEP_TOLERANCE pass through so they can get out.
+bool sweep_aabb_brush(glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, Brush* brush, float* time, glm::vec3* hit_normal) {
+    float enter = -INFINITY;
+    float exit = INFINITY;
+    int enter_axis = -1;
+    for (int axis = 0; axis < 3; axis++) {
+        float d = translation[axis];
+        if (d == 0.0f) {
+            // Within the tolerance, so boxes do not catch on the edges of the next brush of a floor they slide on
+            if (aabb_max[axis] <= brush->min[axis] + SWEEP_TOLERANCE || aabb_min[axis] >= brush->max[axis] - SWEEP_TOLERANCE) return false;
+            continue;
+        }
 
-    if (!collision) {
-        return false;
+        float axis_enter = (d > 0.0f ? brush->min[axis] - aabb_max[axis] : brush->max[axis] - aabb_min[axis]) / d;
+        float axis_exit = (d > 0.0f ? brush->max[axis] - aabb_min[axis] : brush->min[axis] - aabb_max[axis]) / d;
+        if (axis_enter > enter) {
+            enter = axis_enter;
+            enter_axis = axis;
+        }
+        exit = std::min(exit, axis_exit);
     }
-    
-    // Determine the hit normal
-    glm::vec3 overlap_min = glm::max(translated_min, brush->min);
-    glm::vec3 overlap_max = glm::min(translated_max, brush->max);
-    glm::vec3 overlap_size = overlap_max - overlap_min;
-
-    if (overlap_size.x < overlap_size.y && overlap_size.x < overlap_size.z) {
-        if (translated_max.x > brush->min.x && translated_min.x < brush->min.x) {
-            *hit_normal = glm::vec3(-1, 0, 0);  // Collision on the left face of the brush
-        } else {
-            *hit_normal = glm::vec3(1, 0, 0);   // Collision on the right face of the brush
+
+    if (enter_axis < 0 || enter >= exit || enter > 1.0f || exit <= 0.0f) return false;
+    if (enter * glm::abs(translation[enter_axis]) < -SWEEP_TOLERANCE) return false;
+
+    *time = std::max(enter, 0.0f);
+    *hit_normal = glm::vec3(0.0f);
+    (*hit_normal)[enter_axis] = translation[enter_axis] > 0.0f ? -1.0f : 1.0f;
+    return true;
+}
+
+// Move a box through the brushes by up to translation and return how far it got. Contacts are resolved earliest first, the box
+// sliding along each face it hits with what is left of the motion, so nothing tunnels through thin brushes however far it moves.
+// Brushes the filter lets through are ignored, on_ground is set when the box lands on a face pointing up.
+glm::vec3 move_aabb(Scene* scene, glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, CollisionFilter filter, std::vector<uint32_t>* candidates, bool* on_ground) {
+    collision_candidates(scene, aabb_min, aabb_max, translation, candidates);
+
+    glm::vec3 moved(0.0f);
+    glm::vec3 remaining = translation;
+    for (int contact = 0; contact < SWEEP_MAX_CONTACTS; contact++) {
+        glm::vec3 min = aabb_min + moved;
+        glm::vec3 max = aabb_max + moved;
+
+        // Candidates come in index order and only an earlier hit replaces the current one, so ties go to the lowest index
+        float hit_time = INFINITY;
+        glm::vec3 hit_normal;
+        for (size_t i = 0; i < candidates->size(); i++) {
+            Brush* brush = &scene->geometry[(*candidates)[i]];
+            float time;
+            glm::vec3 normal;
+            if (!sweep_aabb_brush(min, max, remaining, brush, &time, &normal) || time >= hit_time) continue;
+            if (filter != NULL && filter(scene, brush, normal, min + remaining * time, max + remaining * time)) continue;
+            hit_time = time;
+            hit_normal = normal;
         }
-    } else if (overlap_size.y < overlap_size.x && overlap_size.y < overlap_size.z) {
-        if (translated_max.y > brush->min.y && translated_min.y < brush->min.y) {
-            *hit_normal = glm::vec3(0, -1, 0);  // Collision on the bottom face of the brush
-        } else {
-            *hit_normal = glm::vec3(0, 1, 0);   // Collision on the top face of the brush
+
+        if (hit_time == INFINITY) {
+            return moved + remaining;
         }
-    } else {
-        if (translated_max.z > brush->min.z && translated_min.z < brush->min.z) {
-            *hit_normal = glm::vec3(0, 0, -1);  // Collision on the front face of the brush
-        } else {
-            *hit_normal = glm::vec3(0, 0, 1);   // Collision on the back face of the brush
+
+        moved += remaining * hit_time;
+        remaining *= 1.0f - hit_time;
+        remaining -= glm::dot(hit_normal, remaining) * hit_normal;
+        if (glm::dot(hit_normal, glm::vec3(0.0f, 1.0f, 0.0f)) > 0.1f) {
+            *on_ground = true;
         }
+        if (remaining == glm::vec3(0.0f)) break;
     }
 
-    return true;
+    // Out of contacts, drop the rest of the motion rather than risk moving into a brush
+    return moved;
 }
 
 bool portal_aabb_collision_test(Portal* portal, glm::vec3 min, glm::vec3 max) {
@@ -385,85 +1080,90 @@ bool portal_aabb_collision_test(Portal* portal, glm::vec3 min, glm::vec3 max) {
     }
 }
 
-// Move the camera while handling collision and portal teleportation
-void scene_aware_movement(Camera* cam, glm::vec3 translation, Scene* scene, bool* on_ground) {
+// Brushes a box may collide with while moving by up to translation, in increasing index order.
+// Collision response only ever drops components of the translation, so the box never leaves the swept bounds.
+void collision_candidates(Scene* scene, glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 translation, std::vector<uint32_t>* candidates) {
+    if (scene->brush_grid.brush_count != scene->geometry.size()) {
+        // No grid for the current brushes
+        candidates->resize(scene->geometry.size());
+        for (size_t brush_index = 0; brush_index < scene->geometry.size(); brush_index++) {
+            (*candidates)[brush_index] = (uint32_t)brush_index;
+        }
+        return;
+    }
+
+    glm::vec3 swept_min = glm::min(aabb_min, aabb_min + translation);
+    glm::vec3 swept_max = glm::max(aabb_max, aabb_max + translation);
+    brush_grid_query(&scene->brush_grid, scene->geometry, swept_min, swept_max, candidates);
+}
+
+// Whether the face of the brush hit at hit_normal lies in the plane of the portal, which may span the faces of several brushes
+static bool portal_in_face_plane(Portal* portal, Brush* brush, glm::vec3 hit_normal) {
+    int axis = face_index(hit_normal) / 2;
+    float offset = hit_normal[axis] > 0.0f ? brush->max[axis] : brush->min[axis];
+    return glm::abs(portal->position[axis] - offset) < PORTAL_FRONT_CLEARANCE;
+}
+
+// If this brush has an open portal that is facing the same way as the hit face
+// and is close enough to the center of the player's AABB, ignore the collision
+static bool player_passes_portal(Scene* scene, Brush* brush, glm::vec3 hit_normal, glm::vec3 aabb_min, glm::vec3 aabb_max) {
+    glm::vec3 player_center = (aabb_min + aabb_max) / 2.0f;
+    return (
+        portals_open(scene) &&
+        (
+            (
+                portal_in_face_plane(&scene->portal1, brush, hit_normal) &&
+                VERY_CLOSE(scene->portal1.normal, hit_normal) &&
+                glm::length(scene->portal1.position - player_center) < scene->portal1.width
+            ) ||
+            (
+                portal_in_face_plane(&scene->portal2, brush, hit_normal) &&
+                VERY_CLOSE(scene->portal2.normal, hit_normal) &&
+                glm::length(scene->portal2.position - player_center) < scene->portal2.width
+            )
+        )
+    );
+}
+
+// Move the camera while handling collision and portal teleportation. Returns true if the camera went through a portal.
+bool scene_aware_movement(Camera* cam, glm::vec3 translation, Scene* scene, bool* on_ground) {
     *on_ground = false;
 
     glm::vec3 player_aabb_min = cam->position - glm::vec3(0.2f, 1.5f, 0.2f);
     glm::vec3 player_aabb_max = cam->position + glm::vec3(0.2f);
-    glm::vec3 player_center = (player_aabb_min + player_aabb_max) / 2.0f;
 
     // First run the portal logic
     // This will teleport the camera if it is moving through a portal
-    if (!handle_portal_movement(cam, translation, scene)) {
-        // If the portal logic did not move the camera, we do a collision check
-        for (size_t brush_index = 0; brush_index < scene->geometry.size(); brush_index++) {
-            Brush* brush = &scene->geometry[brush_index];
-
-            glm::vec3 hit_normal;
-            if (aabb_brush_collision(player_aabb_min, player_aabb_max, translation, brush, &hit_normal)) {
-                // If this brush has an open portal that is facing the same way as the hit face
-                // and is close enough to the center of the player's AABB, ignore the collision
-                if (
-                    portals_open(scene) &&
-                    (
-                        (
-                            scene->portal1.brush == brush &&
-                            VERY_CLOSE(scene->portal1.normal, hit_normal) &&
-                            glm::length(scene->portal1.position - player_center) < scene->portal1.width
-                        ) ||
-                        (
-                            scene->portal2.brush == brush &&
-                            VERY_CLOSE(scene->portal2.normal, hit_normal) &&
-                            glm::length(scene->portal2.position - player_center) < scene->portal2.width
-                        )
-                    )
-                ) {
-                    continue;
-                }
-                
-                glm::vec3 projection = glm::dot(hit_normal, translation) * hit_normal;
-                translation = translation - projection;
-
-                if (glm::dot(hit_normal, glm::vec3(0.0f, 1.0f, 0.0f)) > 0.1f) {
-                    *on_ground = true;
-                }
-            }
-        }
-
-        // If no collision is detected, just move the camera
-        cam->position += translation;
+    if (handle_portal_movement(cam, translation, scene)) {
+        return true;
     }
+
+    // If the portal logic did not move the camera, we do a collision check
+    std::vector<uint32_t> candidates;
+    cam->position += move_aabb(scene, player_aabb_min, player_aabb_max, translation, player_passes_portal, &candidates, on_ground);
+    return false;
 }
 
-void teleport_cube(Cube* cube, Portal* in_portal, Portal* out_portal) {
+void teleport_cube(CubeBodies* bodies, size_t cube_index, Portal* in_portal, Portal* out_portal) {
     glm::mat4 ptransform = portal_transform(in_portal, out_portal);
-    glm::mat4 cube_transform = cube->GetTransform();
+    glm::mat4 cube_transform = glm::translate(glm::mat4(1.0f), body_position(bodies, cube_index));
 
     glm::mat4 teleported_transform = ptransform * cube_transform;
 
-    cube->position = teleported_transform[3];
-    cube->velocity = ptransform * glm::vec4(cube->velocity, 0.0f);
+    set_body_position(bodies, cube_index, teleported_transform[3]);
+    set_body_previous_position(bodies, cube_index, ptransform * glm::vec4(body_previous_position(bodies, cube_index), 1.0f)); // Drawn coming out of the other portal
+    set_body_velocity(bodies, cube_index, ptransform * glm::vec4(body_velocity(bodies, cube_index), 0.0f));
 }
 
 glm::vec3 find_holding_position(Camera* cam, Scene* scene, float cube_size) {
-    glm::vec3 translation = cam->GetForwardDirection() * HOLDING_DISTANCE;
-    glm::vec3 holding_pos = cam->position + translation;
-
-    // Check if there is a portal in the way
-    glm::vec3 intersection;
-    if (find_portal_intersection(cam->position, translation, &scene->portal1, &intersection)) {
-        holding_pos = portal_transform(&scene->portal1, &scene->portal2) * glm::vec4(holding_pos, 1.0f);
-    } else if (find_portal_intersection(cam->position, translation, &scene->portal2, &intersection)) {
-        holding_pos = portal_transform(&scene->portal2, &scene->portal1) * glm::vec4(holding_pos, 1.0f);
-    } else {
-        RaycastHitInfo hit;
-        if (raycast(cam, scene, &hit) && glm::distance(cam->position, hit.intersection) < HOLDING_DISTANCE) {
-            holding_pos = hit.intersection + hit.normal * cube_size;
-        }
+    // Follow the view through portals, stopping in front of anything closer than the holding distance
+    PortalRaycast ray;
+    if (raycast_portals(scene, cam->position, cam->GetForwardDirection(), HOLDING_DISTANCE, PORTAL_RAYCAST_MAX_HOPS, &ray)) {
+        return ray.hit_info.intersection + ray.hit_info.normal * cube_size;
     }
 
-    return holding_pos;
+    const RaySegment* last = &ray.segments[ray.segment_count - 1];
+    return last->start + last->dir * last->length;
 }
 
 glm::vec3 portal_aware_direction(glm::vec3 start, glm::vec3 target, Scene* scene) {
@@ -481,87 +1181,387 @@ glm::vec3 portal_aware_direction(glm::vec3 start, glm::vec3 target, Scene* scene
     }
 }
 
-void update_cubes(Scene* scene, Camera* cam, float deltaTime) {
-    for (size_t cube_index = 0; cube_index < scene->cubes.size(); cube_index++) {
-        Cube* cube = &scene->cubes[cube_index];
-        glm::vec3 cube_aabb_min = cube->position - cube->size;
-        glm::vec3 cube_aabb_max = cube->position + cube->size;
-
-        if (cube->grabbed) {
-            glm::vec3 target_pos = find_holding_position(cam, scene, cube->size);
-            glm::vec3 difference = portal_aware_direction(cube->position, target_pos, scene);
-            if (glm::length(difference) > GRAB_REACH) {
-                cube->grabbed = false;
-                cube->velocity = glm::vec3(0.0f);
-            } else {
-                cube->velocity = difference * 10.0f;
-            }
-            // cube->velocity = glm::vec3(0.0f);
-            // cube->position = target_pos;
-        } else {
-            cube->velocity.y += GRAVITY * deltaTime;
+// Make sure every cube has a leaf in the cube tree, rebuilding it if the cubes were replaced since the last update
+void sync_cube_tree(Scene* scene) {
+    CubeBodies* bodies = &scene->cubes;
+    bool stale = scene->cube_tree.proxy_count != bodies->count;
+    for (size_t i = 0; i < bodies->count && !stale; i++) {
+        int proxy = bodies->proxy[i];
+        stale = proxy == DYNAMIC_TREE_NULL || (size_t)proxy >= scene->cube_tree.nodes.size() || scene->cube_tree.nodes[proxy].object != i;
+    }
+    if (!stale) return;
+
+    scene->cube_contacts.clear(); // Impulses of other cubes
+    dynamic_tree_clear(&scene->cube_tree);
+    for (size_t i = 0; i < bodies->count; i++) {
+        glm::vec3 position = body_position(bodies, i);
+        bodies->proxy[i] = dynamic_tree_insert(&scene->cube_tree, position - bodies->size[i], position + bodies->size[i], (uint32_t)i);
+    }
+}
+
+// Collect the indices of the cubes that may overlap the box, in increasing order. Replaces the contents of results.
+void cube_query(Scene* scene, glm::vec3 min, glm::vec3 max, std::vector<uint32_t>* results) {
+    sync_cube_tree(scene);
+    results->clear();
+    dynamic_tree_query(&scene->cube_tree, min, max, results);
+    std::sort(results->begin(), results->end());
+}
+
+// Collect the indices of the cubes a ray may hit within max_distance along dir, in increasing order.
+// Replaces the contents of results.
+void cube_raycast(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance, std::vector<uint32_t>* results) {
+    sync_cube_tree(scene);
+    results->clear();
+    dynamic_tree_raycast(&scene->cube_tree, origin, dir, max_distance, results);
+    std::sort(results->begin(), results->end());
+}
+
+// Find the nearest cube a ray hits within max_distance along dir, in front of any brush. Returns its index, or -1.
+int nearest_cube_hit(Scene* scene, glm::vec3 origin, glm::vec3 dir, float max_distance) {
+    std::vector<uint32_t> candidates;
+    cube_raycast(scene, origin, dir, max_distance, &candidates);
+
+    float nearest = max_distance;
+    RaycastHitInfo hit_info;
+    if (raycast_ray(scene, origin, dir, &hit_info)) {
+        nearest = std::min(nearest, glm::dot(hit_info.intersection - origin, dir) / glm::dot(dir, dir));
+    }
+
+    // The tree boxes are fattened, so test the cubes themselves
+    const CubeBodies* bodies = &scene->cubes;
+    glm::vec3 inv_dir = 1.0f / dir;
+    int result = -1;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        uint32_t cube_index = candidates[i];
+        glm::vec3 position = body_position(bodies, cube_index);
+        float size = bodies->size[cube_index];
+        float t_min = 0.0f;
+        float t_max = nearest;
+        for (int axis = 0; axis < 3; axis++) {
+            float t1 = (position[axis] - size - origin[axis]) * inv_dir[axis];
+            float t2 = (position[axis] + size - origin[axis]) * inv_dir[axis];
+            if (std::isnan(t1) || std::isnan(t2)) continue; // Origin on a face plane of an axis the ray does not move along
+            t_min = std::max(t_min, std::min(t1, t2));
+            t_max = std::min(t_max, std::max(t1, t2));
         }
+        if (t_min > t_max || (result >= 0 && t_min >= nearest)) continue;
+        nearest = t_min;
+        result = (int)cube_index;
+    }
+    return result;
+}
 
-        glm::vec3 translation = cube->velocity * deltaTime;
+// Box of a cube fattened by half the contact margin, two cubes whose boxes overlap are within the margin of each other
+static void cube_contact_box(const CubeBodies* bodies, size_t i, glm::vec3* min, glm::vec3* max) {
+    glm::vec3 position = body_position(bodies, i);
+    *min = position - bodies->size[i] - CUBE_CONTACT_MARGIN * 0.5f;
+    *max = position + bodies->size[i] + CUBE_CONTACT_MARGIN * 0.5f;
+}
+
+// Find the pairs of cubes within CUBE_CONTACT_MARGIN of each other, at least one of them awake, for resolving contacts
+// between them. Sweeps all cubes while many are awake, only looks around the awake ones in the cube tree otherwise.
+void update_cube_pairs(Scene* scene) {
+    sync_cube_tree(scene);
+    const CubeBodies* bodies = &scene->cubes;
+    size_t count = bodies->count;
+    std::vector<uint32_t> awake;
+    for (size_t i = 0; i < count; i++) {
+        if (!(bodies->flags[i] & CUBE_ASLEEP)) awake.push_back((uint32_t)i);
+    }
 
-        // Handle portal logic
-        glm::vec3 intersection;
-        bool both_portals_open = scene->portal1.open && scene->portal2.open;
-        if (both_portals_open && find_portal_intersection(cube->position, translation, &scene->portal1, &intersection)) {
-            teleport_cube(cube, &scene->portal1, &scene->portal2);
-        } else if (both_portals_open && find_portal_intersection(cube->position, translation, &scene->portal2, &intersection)) {
-            teleport_cube(cube, &scene->portal2, &scene->portal1);
+    if (awake.size() * CUBE_PAIRS_SWEEP_AWAKE >= count) {
+        std::vector<glm::vec3> mins(count), maxs(count);
+        for (size_t i = 0; i < count; i++) {
+            cube_contact_box(bodies, i, &mins[i], &maxs[i]);
         }
+        sweep_prune_update(&scene->cube_sweep, count == 0 ? NULL : &mins[0], count == 0 ? NULL : &maxs[0], count, &scene->cube_pairs);
 
-        glm::vec3 expand(0.1f);
-        // bool in_portal = portals_open(scene) && (
-        //     portal_aabb_collision_test(&scene->portal1, cube_aabb_min - expand, cube_aabb_max + expand) || portal_aabb_collision_test(&scene->portal2, cube_aabb_min - expand, cube_aabb_max + expand)
-        // );
+        size_t kept = 0;
+        for (size_t i = 0; i < scene->cube_pairs.size(); i++) {
+            SweepPair pair = scene->cube_pairs[i];
+            if ((bodies->flags[pair.a] & CUBE_ASLEEP) && (bodies->flags[pair.b] & CUBE_ASLEEP)) continue;
+            scene->cube_pairs[kept++] = pair;
+        }
+        scene->cube_pairs.resize(kept);
+        return;
+    }
 
-        translation = cube->velocity * deltaTime;
+    scene->cube_pairs.clear();
+    std::vector<uint32_t> nearby;
+    for (size_t i = 0; i < awake.size(); i++) {
+        uint32_t a = awake[i];
+        glm::vec3 min, max;
+        cube_contact_box(bodies, a, &min, &max);
+        nearby.clear();
+        dynamic_tree_query(&scene->cube_tree, min, max, &nearby);
+
+        for (size_t j = 0; j < nearby.size(); j++) {
+            uint32_t b = nearby[j];
+            if (b == a || (b < a && !(bodies->flags[b] & CUBE_ASLEEP))) continue; // Two awake cubes are paired up from the lower index
+            glm::vec3 other_min, other_max;
+            cube_contact_box(bodies, b, &other_min, &other_max);
+            if (!check_aabb_intersection(min, max, other_min, other_max)) continue;
+
+            SweepPair pair = { std::min(a, b), std::max(a, b) };
+            scene->cube_pairs.push_back(pair);
+        }
+    }
+}
 
-        // Collision logic
-        for (size_t brush_index = 0; brush_index < scene->geometry.size(); brush_index++) {
-            Brush* brush = &scene->geometry[brush_index];
+// Wake the cube along with every cube of the island it fell asleep with
+void wake_cube(Scene* scene, uint32_t cube_index) {
+    CubeBodies* bodies = &scene->cubes;
+    if (!(bodies->flags[cube_index] & CUBE_ASLEEP)) return;
 
-            // If the cube is inside the brush, ignore the collision
-            if (check_aabb_intersection(cube_aabb_min, cube_aabb_max, brush->min + glm::vec3(0.01f), brush->max - glm::vec3(0.01f))) {
-                continue;
-            }
+    uint32_t island = bodies->island[cube_index];
+    for (size_t i = 0; i < bodies->count; i++) {
+        if ((bodies->flags[i] & CUBE_ASLEEP) && bodies->island[i] == island) {
+            bodies->flags[i] &= ~CUBE_ASLEEP;
+            bodies->still_ticks[i] = 0;
+        }
+    }
+}
 
-            glm::vec3 hit_normal;
-            if (/*!in_portal && */aabb_brush_collision(cube_aabb_min, cube_aabb_max, translation, brush, &hit_normal)) {
-                // If this brush has an open portal that is facing the same way as the hit face
-                // and is close enough to the center of the cube's AABB, ignore the collision
-                if (
-                    portals_open(scene) &&
-                    (
-                        (
-                            scene->portal1.brush == brush &&
-                            VERY_CLOSE(scene->portal1.normal, hit_normal) &&
-                            glm::min(glm::length(scene->portal1.position - cube_aabb_min), glm::length(scene->portal1.position - cube_aabb_max)) < scene->portal1.width
-                        ) ||
-                        (
-                            scene->portal2.brush == brush &&
-                            VERY_CLOSE(scene->portal2.normal, hit_normal) &&
-                            glm::min(glm::length(scene->portal2.position - cube_aabb_min), glm::length(scene->portal2.position - cube_aabb_max)) < scene->portal2.width
-                        )
-                    )
-                ) {
-                    continue;
-                }
-                
-                glm::vec3 projection = glm::dot(hit_normal, translation) * hit_normal;
-                translation = translation - projection;
+// Wake the cubes overlapping the box and their islands, for when something they rest on or next to changed
+void wake_cubes(Scene* scene, glm::vec3 min, glm::vec3 max) {
+    std::vector<uint32_t> nearby;
+    cube_query(scene, min, max, &nearby);
+    for (size_t i = 0; i < nearby.size(); i++) {
+        glm::vec3 position = body_position(&scene->cubes, nearby[i]);
+        float size = scene->cubes.size[nearby[i]];
+        if (check_aabb_intersection(min, max, position - size, position + size)) {
+            wake_cube(scene, nearby[i]);
+        }
+    }
+}
 
-                if (glm::dot(hit_normal, glm::vec3(0.0f, 1.0f, 0.0f)) > 0.1f) {
-                    cube->velocity = glm::vec3(0.0f);
-                }
+// Put the islands of awake cubes, cubes connected through contacts, to sleep once all of their cubes have been still for
+// CUBE_SLEEP_TICKS. Islands are named after their lowest cube index, so the outcome does not depend on contact order.
+static void sleep_still_islands(Scene* scene, const std::vector<uint32_t>* awake) {
+    CubeBodies* bodies = &scene->cubes;
+    std::vector<uint32_t> parent(bodies->count);
+    for (size_t i = 0; i < awake->size(); i++) {
+        parent[(*awake)[i]] = (*awake)[i];
+    }
+
+    for (size_t i = 0; i < scene->cube_contacts.size(); i++) {
+        const CubeContact* contact = &scene->cube_contacts[i];
+        if (contact->b == CUBE_CONTACT_GROUND) continue;
+
+        uint32_t a = contact->a;
+        uint32_t b = contact->b;
+        while (parent[a] != a) a = parent[a] = parent[parent[a]];
+        while (parent[b] != b) b = parent[b] = parent[parent[b]];
+        if (a < b) parent[b] = a;
+        if (b < a) parent[a] = b;
+    }
+
+    // An island stays awake if any of its cubes is still moving
+    std::vector<bool> restless(bodies->count, false);
+    for (size_t i = 0; i < awake->size(); i++) {
+        uint32_t root = (*awake)[i];
+        while (parent[root] != root) root = parent[root];
+        parent[(*awake)[i]] = root;
+        if (bodies->still_ticks[(*awake)[i]] < CUBE_SLEEP_TICKS) restless[root] = true;
+    }
+
+    for (size_t i = 0; i < awake->size(); i++) {
+        uint32_t cube_index = (*awake)[i];
+        uint32_t root = parent[cube_index];
+        if (restless[root]) continue;
+
+        bodies->flags[cube_index] |= CUBE_ASLEEP;
+        bodies->island[cube_index] = root;
+        set_body_velocity(bodies, cube_index, glm::vec3(0.0f));
+        set_body_previous_position(bodies, cube_index, body_position(bodies, cube_index));
+    }
+}
+
+// If this brush has an open portal that is facing the same way as the hit face
+// and is close enough to the center of the cube's AABB, ignore the collision
+static bool cube_passes_portal(Scene* scene, Brush* brush, glm::vec3 hit_normal, glm::vec3 aabb_min, glm::vec3 aabb_max) {
+    return (
+        portals_open(scene) &&
+        (
+            (
+                portal_in_face_plane(&scene->portal1, brush, hit_normal) &&
+                VERY_CLOSE(scene->portal1.normal, hit_normal) &&
+                glm::min(glm::length(scene->portal1.position - aabb_min), glm::length(scene->portal1.position - aabb_max)) < scene->portal1.width
+            ) ||
+            (
+                portal_in_face_plane(&scene->portal2, brush, hit_normal) &&
+                VERY_CLOSE(scene->portal2.normal, hit_normal) &&
+                glm::min(glm::length(scene->portal2.position - aabb_min), glm::length(scene->portal2.position - aabb_max)) < scene->portal2.width
+            )
+        )
+    );
+}
+
+// Pull a held cube towards the holding position and find how far above the ground a loose one is.
+// Gravity was already applied by integrate_gravity.
+static void accelerate_cube(Scene* scene, Camera* cam, std::vector<uint32_t>* candidates, size_t cube_index, float* ground_distance) {
+    CubeBodies* bodies = &scene->cubes;
+    glm::vec3 position = body_position(bodies, cube_index);
+    float size = bodies->size[cube_index];
+    *ground_distance = INFINITY;
+
+    if (bodies->flags[cube_index] & CUBE_GRABBED) {
+        glm::vec3 target_pos = find_holding_position(cam, scene, size);
+        glm::vec3 difference = portal_aware_direction(position, target_pos, scene);
+        if (glm::length(difference) > GRAB_REACH) {
+            bodies->flags[cube_index] &= ~CUBE_GRABBED;
+            set_body_velocity(bodies, cube_index, glm::vec3(0.0f));
+        } else {
+            set_body_velocity(bodies, cube_index, difference * 10.0f);
+            return;
+        }
+    }
+
+    bool grounded = false;
+    glm::vec3 probe = move_aabb(scene, position - size, position + size, glm::vec3(0.0f, -CUBE_CONTACT_MARGIN, 0.0f), cube_passes_portal, candidates, &grounded);
+    if (grounded) {
+        *ground_distance = -probe.y;
+    }
+}
+
+// Take one cube through the portals and clip its translation against the brushes, leaving how far it gets for translate_bodies
+static void move_cube(Scene* scene, float deltaTime, std::vector<uint32_t>* candidates, size_t cube_index, float* const translations[3]) {
+    CubeBodies* bodies = &scene->cubes;
+    glm::vec3 translation(translations[0][cube_index], translations[1][cube_index], translations[2][cube_index]);
+
+    // Handle portal logic, the push was for the cubes on this side
+    glm::vec3 intersection;
+    bool both_portals_open = scene->portal1.open && scene->portal2.open;
+    if (both_portals_open && find_portal_intersection(body_position(bodies, cube_index), translation, &scene->portal1, &intersection)) {
+        teleport_cube(bodies, cube_index, &scene->portal1, &scene->portal2);
+        translation = body_velocity(bodies, cube_index) * deltaTime;
+    } else if (both_portals_open && find_portal_intersection(body_position(bodies, cube_index), translation, &scene->portal2, &intersection)) {
+        teleport_cube(bodies, cube_index, &scene->portal2, &scene->portal1);
+        translation = body_velocity(bodies, cube_index) * deltaTime;
+    }
+
+    // Collision logic, from where the portal logic left the cube
+    glm::vec3 position = body_position(bodies, cube_index);
+    float size = bodies->size[cube_index];
+    bool landed = false;
+    translation = move_aabb(scene, position - size, position + size, translation, cube_passes_portal, candidates, &landed);
+    if (landed) {
+        set_body_velocity(bodies, cube_index, glm::vec3(0.0f));
+    }
+
+    translations[0][cube_index] = translation.x;
+    translations[1][cube_index] = translation.y;
+    translations[2][cube_index] = translation.z;
+}
+
+struct CubeStepJob {
+    Scene* scene;
+    Camera* cam;
+    float deltaTime;
+    const std::vector<uint32_t>* awake;
+    float* ground_distances; // By cube index
+    float* translations[3]; // By cube index, padded for translate_bodies
+};
+
+static void accelerate_cube_range(void* data, size_t begin, size_t end) {
+    CubeStepJob* job = (CubeStepJob*)data;
+    std::vector<uint32_t> candidates;
+    for (size_t i = begin; i < end; i++) {
+        uint32_t cube_index = (*job->awake)[i];
+        accelerate_cube(job->scene, job->cam, &candidates, cube_index, &job->ground_distances[cube_index]);
+    }
+}
+
+static void move_cube_range(void* data, size_t begin, size_t end) {
+    CubeStepJob* job = (CubeStepJob*)data;
+    std::vector<uint32_t> candidates;
+    for (size_t i = begin; i < end; i++) {
+        move_cube(job->scene, job->deltaTime, &candidates, (*job->awake)[i], job->translations);
+    }
+}
+
+static void run_cube_jobs(size_t count, JobFunction function, CubeStepJob* job) {
+    if (count >= CUBE_UPDATE_PARALLEL_MIN) {
+        parallel_for(shared_job_system(), count, CUBE_UPDATE_GRAIN, function, job);
+    } else {
+        function(job, 0, count);
+    }
+}
+
+// Step the awake cubes. Gravity, the translations and the inverse masses are SIMD loops over the body arrays. What needs
+// the brushes, the portals or the holding position runs per awake cube, in parallel when there are enough of them, and
+// the contacts between cubes are solved in between on one thread. Every job only writes its own cubes, so the outcome is
+// the same however the work was split. Sleeping cubes cost nothing until an awake cube touches their island or something
+// wakes them.
+void update_cubes(Scene* scene, Camera* cam, float deltaTime) {
+    CubeBodies* bodies = &scene->cubes;
+    sync_cube_tree(scene);
+
+    size_t count = bodies->count;
+    for (size_t i = 0; i < count; i++) {
+        if (bodies->flags[i] & CUBE_GRABBED) wake_cube(scene, (uint32_t)i);
+    }
+
+    // Islands touched by awake cubes wake up, which may bring their own neighbours into reach
+    bool woke = true;
+    while (woke) {
+        woke = false;
+        update_cube_pairs(scene);
+        for (size_t i = 0; i < scene->cube_pairs.size(); i++) {
+            SweepPair pair = scene->cube_pairs[i];
+            if ((bodies->flags[pair.a] & CUBE_ASLEEP) != (bodies->flags[pair.b] & CUBE_ASLEEP)) {
+                wake_cube(scene, pair.a);
+                wake_cube(scene, pair.b);
+                woke = true;
             }
         }
+    }
 
-        cube->position += translation;
+    std::vector<uint32_t> awake;
+    for (size_t i = 0; i < count; i++) {
+        if (!(bodies->flags[i] & CUBE_ASLEEP)) awake.push_back((uint32_t)i);
+    }
+    if (awake.empty()) {
+        scene->cube_contacts.clear();
+        return;
     }
+
+    size_t padded = padded_body_count(bodies);
+    std::vector<float> ground_distances(count, INFINITY);
+    BodyArray inverse_masses(padded); // Aligned for the SIMD loops, like the body arrays
+    BodyArray pushes[3], translations[3];
+    for (int axis = 0; axis < 3; axis++) {
+        pushes[axis].assign(padded, 0.0f);
+        translations[axis].resize(padded);
+    }
+    float* push_arrays[3] = { &pushes[0][0], &pushes[1][0], &pushes[2][0] };
+    CubeStepJob job = { scene, cam, deltaTime, &awake, &ground_distances[0], { &translations[0][0], &translations[1][0], &translations[2][0] } };
+
+    save_previous_positions(bodies);
+    integrate_gravity(bodies, GRAVITY * deltaTime);
+    run_cube_jobs(awake.size(), accelerate_cube_range, &job);
+
+    body_inverse_masses(bodies, &inverse_masses[0]);
+    find_cube_contacts(bodies, &ground_distances[0], &scene->cube_pairs, &scene->cube_contacts);
+    solve_cube_contacts(&scene->cube_contacts, bodies, push_arrays, &inverse_masses[0], deltaTime, CUBE_SOLVER_ITERATIONS);
+
+    body_translations(bodies, push_arrays, deltaTime, job.translations);
+    run_cube_jobs(awake.size(), move_cube_range, &job);
+    translate_bodies(bodies, job.translations);
+
+    for (size_t i = 0; i < awake.size(); i++) {
+        uint32_t cube_index = awake[i];
+        glm::vec3 position = body_position(bodies, cube_index);
+        glm::vec3 displacement = position - body_previous_position(bodies, cube_index);
+        float size = bodies->size[cube_index];
+        dynamic_tree_update(&scene->cube_tree, bodies->proxy[cube_index], position - size, position + size, displacement);
+
+        float speed = std::max(glm::length(body_velocity(bodies, cube_index)), glm::length(displacement) / deltaTime);
+        bool still = !(bodies->flags[cube_index] & CUBE_GRABBED) && speed < CUBE_SLEEP_SPEED;
+        bodies->still_ticks[cube_index] = still ? bodies->still_ticks[cube_index] + 1 : 0;
+    }
+
+    sleep_still_islands(scene, &awake);
 }
 
 bool portals_open(Scene* scene) {
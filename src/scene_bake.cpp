@@ -0,0 +1,331 @@
+#include "scene_bake.h"
+
+#include <cstring>
+#include <iostream>
+
+static_assert(sizeof(BVHNode) == sizeof(SceneBVHNodeRecord), "BVHNode must match SceneBVHNodeRecord");
+static_assert(sizeof(StaticVertex) == sizeof(SceneStaticVertexRecord), "StaticVertex must match SceneStaticVertexRecord");
+static_assert(sizeof(FacePlane) == sizeof(SceneFacePlaneRecord), "FacePlane must match SceneFacePlaneRecord");
+static_assert(sizeof(FaceRect) == sizeof(SceneFaceRectRecord), "FaceRect must match SceneFaceRectRecord");
+
+// Corners of each face in counter-clockwise order seen from outside, -1 meaning min and 1 meaning max.
+// Same winding as the cube primitive.
+static const float face_corners[FACE_COUNT][4][3] = {
+    { { -1, -1, -1 }, { -1, -1,  1 }, { -1,  1,  1 }, { -1,  1, -1 } }, // -X
+    { {  1, -1, -1 }, {  1,  1, -1 }, {  1,  1,  1 }, {  1, -1,  1 } }, // +X
+    { { -1, -1, -1 }, {  1, -1, -1 }, {  1, -1,  1 }, { -1, -1,  1 } }, // -Y
+    { {  1,  1, -1 }, { -1,  1, -1 }, { -1,  1,  1 }, {  1,  1,  1 } }, // +Y
+    { { -1, -1, -1 }, { -1,  1, -1 }, {  1,  1, -1 }, {  1, -1, -1 } }, // -Z
+    { { -1, -1,  1 }, {  1, -1,  1 }, {  1,  1,  1 }, { -1,  1,  1 } }  // +Z
+};
+
+// Face number of an axis-aligned normal
+int face_index(glm::vec3 normal) {
+    int axis = 0;
+    if (glm::abs(normal.y) > glm::abs(normal[axis])) axis = 1;
+    if (glm::abs(normal.z) > glm::abs(normal[axis])) axis = 2;
+    return axis * 2 + (normal[axis] > 0.0f ? 1 : 0);
+}
+
+// A face is hidden when a single other brush fills the space right in front of all of it
+static bool face_covered(Scene* scene, size_t brush_index, int face, std::vector<uint32_t>* candidates) {
+    const Brush* brush = &scene->geometry[brush_index];
+    int axis = face / 2;
+    bool positive = face & 1;
+    float plane = positive ? brush->max[axis] : brush->min[axis];
+
+    glm::vec3 query_min = brush->min;
+    glm::vec3 query_max = brush->max;
+    query_min[axis] = plane;
+    query_max[axis] = plane;
+
+    candidates->clear();
+    bvh_query_aabb(&scene->bvh, query_min, query_max, candidates);
+
+    for (size_t i = 0; i < candidates->size(); i++) {
+        if ((*candidates)[i] == brush_index) continue;
+        const Brush* other = &scene->geometry[(*candidates)[i]];
+
+        bool in_front = positive ? (other->min[axis] <= plane && plane < other->max[axis]) : (other->min[axis] < plane && plane <= other->max[axis]);
+        if (!in_front) continue;
+
+        bool covers = true;
+        for (int k = 0; k < 3; k++) {
+            if (k != axis && (other->min[k] > brush->min[k] || other->max[k] < brush->max[k])) covers = false;
+        }
+        if (covers) return true;
+    }
+
+    return false;
+}
+
+static uint16_t brush_face_flags(Scene* scene, size_t brush_index, std::vector<uint32_t>* candidates) {
+    uint16_t flags = 0;
+    for (int face = 0; face < FACE_COUNT; face++) {
+        if (!face_covered(scene, brush_index, face, candidates)) flags |= FACE_VISIBLE(face);
+    }
+
+    return flags;
+}
+
+// Work out which faces of every brush are visible.
+// Needs the BVH.
+void compute_face_flags(Scene* scene, std::vector<uint16_t>* flags) {
+    flags->assign(scene->geometry.size(), 0);
+    std::vector<uint32_t> candidates;
+
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        (*flags)[i] = brush_face_flags(scene, i, &candidates);
+    }
+}
+
+// Recompute the face flags of some brushes only. Needs an up to date BVH.
+void update_face_flags(Scene* scene, const std::vector<uint32_t>& brushes) {
+    std::vector<uint32_t> candidates;
+    for (size_t i = 0; i < brushes.size(); i++) {
+        scene->face_flags[brushes[i]] = brush_face_flags(scene, brushes[i], &candidates);
+    }
+}
+
+int visible_face_count(uint16_t flags) {
+    int count = 0;
+    for (int face = 0; face < FACE_COUNT; face++) {
+        if (flags & FACE_VISIBLE(face)) count++;
+    }
+    return count;
+}
+
+// Write the vertices of the visible faces of a brush. Returns the number of vertices written.
+size_t write_brush_vertices(const Brush* brush, uint16_t flags, StaticVertex* vertices) {
+    uint8_t color[4];
+    for (int k = 0; k < 3; k++) {
+        color[k] = (uint8_t)(glm::clamp(brush->color[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+    color[3] = 255;
+
+    size_t count = 0;
+    for (int face = 0; face < FACE_COUNT; face++) {
+        if (!(flags & FACE_VISIBLE(face))) continue;
+
+        for (int corner = 0; corner < FACE_VERTEX_COUNT; corner++) {
+            StaticVertex* vertex = &vertices[count++];
+            for (int k = 0; k < 3; k++) {
+                vertex->position[k] = face_corners[face][corner][k] < 0 ? brush->min[k] : brush->max[k];
+                vertex->normal[k] = k == face / 2 ? (face & 1 ? 127 : -127) : 0;
+            }
+            vertex->normal[3] = 0;
+            memcpy(vertex->color, color, sizeof(color));
+        }
+    }
+
+    return count;
+}
+
+// Merge the visible faces of all brushes into a single world space mesh, in brush and face order
+void build_static_mesh(Scene* scene, StaticMesh* mesh) {
+    size_t face_count = 0;
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        face_count += visible_face_count(scene->face_flags[i]);
+    }
+
+    mesh->owned_vertices.resize(face_count * FACE_VERTEX_COUNT);
+    mesh->owned_indices.resize(face_count * FACE_INDEX_COUNT);
+
+    size_t vertex_count = 0;
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        vertex_count += write_brush_vertices(&scene->geometry[i], scene->face_flags[i], mesh->owned_vertices.empty() ? NULL : &mesh->owned_vertices[0] + vertex_count);
+    }
+
+    for (size_t face = 0; face < face_count; face++) {
+        GLuint first = (GLuint)(face * FACE_VERTEX_COUNT);
+        GLuint quad[FACE_INDEX_COUNT] = { first, first + 1, first + 2, first + 2, first + 3, first };
+        memcpy(&mesh->owned_indices[face * FACE_INDEX_COUNT], quad, sizeof(quad));
+    }
+
+    mesh->vertices = mesh->owned_vertices.empty() ? NULL : &mesh->owned_vertices[0];
+    mesh->vertex_count = mesh->owned_vertices.size();
+    mesh->indices = mesh->owned_indices.empty() ? NULL : &mesh->owned_indices[0];
+    mesh->index_count = mesh->owned_indices.size();
+}
+
+// Hand the mesh over to another scene. Swapping the vectors keeps the pointers valid.
+void move_static_mesh(StaticMesh* from, StaticMesh* to) {
+    to->owned_vertices.swap(from->owned_vertices);
+    to->owned_indices.swap(from->owned_indices);
+    to->vertices = from->vertices;
+    to->vertex_count = from->vertex_count;
+    to->indices = from->indices;
+    to->index_count = from->index_count;
+}
+
+void compute_scene_bounds(Scene* scene) {
+    scene->bounds_min = glm::vec3(0.0f);
+    scene->bounds_max = glm::vec3(0.0f);
+    if (scene->geometry.empty()) return;
+
+    scene->bounds_min = scene->geometry[0].min;
+    scene->bounds_max = scene->geometry[0].max;
+    for (size_t i = 1; i < scene->geometry.size(); i++) {
+        scene->bounds_min = glm::min(scene->bounds_min, scene->geometry[i].min);
+        scene->bounds_max = glm::max(scene->bounds_max, scene->geometry[i].max);
+    }
+}
+
+// Build the runtime data that was not loaded from a baked file
+void bake_scene(Scene* scene, int already_baked, const SceneLoadProgress* progress) {
+    report_progress(progress, 0.3f, "Building BVH");
+    if (!(already_baked & BAKED_BVH)) build_bvh(scene->geometry, &scene->bvh);
+    report_progress(progress, 0.55f, "Finding visible faces");
+    if (!(already_baked & BAKED_FACE_FLAGS)) compute_face_flags(scene, &scene->face_flags);
+    report_progress(progress, 0.8f, "Building static mesh");
+    if (!(already_baked & BAKED_STATIC_MESH)) build_static_mesh(scene, &scene->static_mesh);
+    report_progress(progress, 0.95f, "Computing bounds");
+    if (!(already_baked & BAKED_BOUNDS)) compute_scene_bounds(scene);
+    build_brush_grid(scene->geometry, scene->bounds_min, scene->bounds_max, &scene->brush_grid);
+    if (!(already_baked & BAKED_FACE_PLANES)) build_face_planes(scene, &scene->face_planes);
+    if (already_baked & BAKED_PVS) build_pvs_indices(scene, &scene->pvs);
+}
+
+// Take whatever baked data the file holds and matches the loaded brushes. Returns the BAKED_* parts that were loaded.
+// The static mesh is not copied, it keeps pointing into the mapping.
+int load_baked_sections(SceneFile* file, Scene* scene) {
+    size_t brush_count = scene->geometry.size();
+    int baked = 0;
+
+    uint32_t node_count = 0, index_count = 0;
+    const BVHNode* nodes = static_cast<const BVHNode*>(scene_file_section(file, SCENE_SECTION_BVH, &node_count));
+    const uint32_t* bvh_indices = static_cast<const uint32_t*>(scene_file_section(file, SCENE_SECTION_BVH_INDICES, &index_count));
+    if (nodes != NULL && bvh_indices != NULL) {
+        scene->bvh.nodes.assign(nodes, nodes + node_count);
+        scene->bvh.indices.assign(bvh_indices, bvh_indices + index_count);
+        if (validate_bvh(&scene->bvh, brush_count)) {
+            update_leaf_bounds(&scene->bvh, scene->geometry);
+            baked |= BAKED_BVH;
+        } else {
+            std::cerr << "Ignoring baked BVH that does not match the brushes" << std::endl;
+        }
+    }
+
+    uint32_t flag_count = 0;
+    const uint16_t* flags = static_cast<const uint16_t*>(scene_file_section(file, SCENE_SECTION_FACE_FLAGS, &flag_count));
+    if (flags != NULL && flag_count == brush_count) {
+        scene->face_flags.assign(flags, flags + flag_count);
+        baked |= BAKED_FACE_FLAGS;
+    }
+
+    // The mesh holds exactly the faces flagged visible, so it is only usable together with the flags
+    size_t visible_faces = 0;
+    for (size_t i = 0; i < scene->face_flags.size() && (baked & BAKED_FACE_FLAGS); i++) {
+        for (int face = 0; face < FACE_COUNT; face++) {
+            if (scene->face_flags[i] & FACE_VISIBLE(face)) visible_faces++;
+        }
+    }
+
+    uint32_t vertex_count = 0, mesh_index_count = 0;
+    const StaticVertex* vertices = static_cast<const StaticVertex*>(scene_file_section(file, SCENE_SECTION_STATIC_VERTICES, &vertex_count));
+    const GLuint* indices = static_cast<const GLuint*>(scene_file_section(file, SCENE_SECTION_STATIC_INDICES, &mesh_index_count));
+    if ((baked & BAKED_FACE_FLAGS) && vertices != NULL && indices != NULL && vertex_count == visible_faces * FACE_VERTEX_COUNT && mesh_index_count == visible_faces * FACE_INDEX_COUNT) {
+        // Out of range indices would make the GPU read past the vertex buffer
+        bool indices_valid = true;
+        for (uint32_t i = 0; i < mesh_index_count && indices_valid; i++) {
+            indices_valid = indices[i] < vertex_count;
+        }
+
+        if (indices_valid) {
+            scene->static_mesh.owned_vertices.clear();
+            scene->static_mesh.owned_indices.clear();
+            scene->static_mesh.vertices = vertices;
+            scene->static_mesh.vertex_count = vertex_count;
+            scene->static_mesh.indices = indices;
+            scene->static_mesh.index_count = mesh_index_count;
+            baked |= BAKED_STATIC_MESH;
+        }
+    }
+
+    // The planes hold exactly the faces flagged visible, so they are only usable together with the flags
+    uint32_t plane_count = 0, rect_count = 0;
+    const FacePlane* planes = static_cast<const FacePlane*>(scene_file_section(file, SCENE_SECTION_FACE_PLANES, &plane_count));
+    const FaceRect* rects = static_cast<const FaceRect*>(scene_file_section(file, SCENE_SECTION_FACE_RECTS, &rect_count));
+    if ((baked & BAKED_FACE_FLAGS) && planes != NULL && rects != NULL) {
+        scene->face_planes.planes.assign(planes, planes + plane_count);
+        scene->face_planes.rects.assign(rects, rects + rect_count);
+        if (validate_face_planes(scene, &scene->face_planes)) {
+            build_face_plane_lookup(&scene->face_planes);
+            baked |= BAKED_FACE_PLANES;
+        } else {
+            std::cerr << "Ignoring baked face planes that do not match the brushes" << std::endl;
+        }
+    }
+
+    uint32_t bounds_count = 0;
+    const SceneBoundsRecord* bounds = static_cast<const SceneBoundsRecord*>(scene_file_section(file, SCENE_SECTION_BOUNDS, &bounds_count));
+    if (bounds != NULL && bounds_count == 1) {
+        scene->bounds_min = glm::vec3(bounds->min[0], bounds->min[1], bounds->min[2]);
+        scene->bounds_max = glm::vec3(bounds->max[0], bounds->max[1], bounds->max[2]);
+        baked |= BAKED_BOUNDS;
+    }
+
+    uint32_t pvs_count = 0, word_count = 0;
+    const ScenePVSRecord* pvs = static_cast<const ScenePVSRecord*>(scene_file_section(file, SCENE_SECTION_PVS, &pvs_count));
+    const uint32_t* visibility = static_cast<const uint32_t*>(scene_file_section(file, SCENE_SECTION_PVS_VISIBILITY, &word_count));
+    if (pvs != NULL && visibility != NULL && pvs_count == 1 && pvs->brush_count == brush_count) {
+        uint64_t cell_count = (uint64_t)pvs->dims[0] * pvs->dims[1] * pvs->dims[2];
+        uint64_t row_words = (cell_count + 31) / 32;
+        if (cell_count > 0 && cell_count <= PVS_MAX_CELLS && word_count == cell_count * row_words && pvs->cell_size > 0.0f) {
+            scene->pvs.origin = glm::vec3(pvs->origin[0], pvs->origin[1], pvs->origin[2]);
+            scene->pvs.cell_size = pvs->cell_size;
+            for (int axis = 0; axis < 3; axis++) scene->pvs.dims[axis] = (int)pvs->dims[axis];
+            scene->pvs.cell_count = (uint32_t)cell_count;
+            scene->pvs.row_words = (uint32_t)row_words;
+            scene->pvs.visibility.assign(visibility, visibility + word_count);
+            baked |= BAKED_PVS;
+        } else {
+            std::cerr << "Ignoring baked PVS with an invalid grid" << std::endl;
+        }
+    }
+
+    return baked;
+}
+
+template <typename T>
+void array_section(uint32_t type, const T* data, size_t count, std::vector<SceneSectionData>* sections) {
+    SceneSectionData section(type);
+    if (count > 0) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        section.data.assign(bytes, bytes + count * sizeof(T));
+    }
+    section.element_count = (uint32_t)count;
+    sections->push_back(section);
+}
+
+// Build the sections holding the baked runtime data of the scene
+void baked_sections(Scene* scene, std::vector<SceneSectionData>* sections) {
+    array_section(SCENE_SECTION_BVH, scene->bvh.nodes.empty() ? NULL : &scene->bvh.nodes[0], scene->bvh.nodes.size(), sections);
+    array_section(SCENE_SECTION_BVH_INDICES, scene->bvh.indices.empty() ? NULL : &scene->bvh.indices[0], scene->bvh.indices.size(), sections);
+    array_section(SCENE_SECTION_STATIC_VERTICES, scene->static_mesh.vertices, scene->static_mesh.vertex_count, sections);
+    array_section(SCENE_SECTION_STATIC_INDICES, scene->static_mesh.indices, scene->static_mesh.index_count, sections);
+    array_section(SCENE_SECTION_FACE_FLAGS, scene->face_flags.empty() ? NULL : &scene->face_flags[0], scene->face_flags.size(), sections);
+    array_section(SCENE_SECTION_FACE_PLANES, scene->face_planes.planes.empty() ? NULL : &scene->face_planes.planes[0], scene->face_planes.planes.size(), sections);
+    array_section(SCENE_SECTION_FACE_RECTS, scene->face_planes.rects.empty() ? NULL : &scene->face_planes.rects[0], scene->face_planes.rects.size(), sections);
+
+    SceneSectionData bounds(SCENE_SECTION_BOUNDS);
+    SceneBoundsRecord record = {
+        { scene->bounds_min.x, scene->bounds_min.y, scene->bounds_min.z },
+        { scene->bounds_max.x, scene->bounds_max.y, scene->bounds_max.z }
+    };
+    append_record(&bounds, record);
+    sections->push_back(bounds);
+
+    if (scene->pvs.cell_count > 0) {
+        SceneSectionData pvs(SCENE_SECTION_PVS);
+        ScenePVSRecord pvs_record = {
+            { scene->pvs.origin.x, scene->pvs.origin.y, scene->pvs.origin.z },
+            scene->pvs.cell_size,
+            { (uint32_t)scene->pvs.dims[0], (uint32_t)scene->pvs.dims[1], (uint32_t)scene->pvs.dims[2] },
+            (uint32_t)scene->geometry.size()
+        };
+        append_record(&pvs, pvs_record);
+        sections->push_back(pvs);
+        array_section(SCENE_SECTION_PVS_VISIBILITY, &scene->pvs.visibility[0], scene->pvs.visibility.size(), sections);
+    }
+}
@@ -0,0 +1,349 @@
+#include "scene_compact.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+#define RANS_SCALE_BITS 12
+#define RANS_SCALE (1u << RANS_SCALE_BITS)
+#define RANS_LOW (1u << 23) // Lower bound of the normalized coder state
+
+#define GRID_EXPONENT_MAX 8 // Coarsest grid tried when looking for an exact one, 256 units
+#define GRID_EXPONENT_MIN -16
+
+struct RansTable {
+    uint16_t freq[256];
+    uint16_t start[256];
+    unsigned char symbol[RANS_SCALE]; // Symbol of every slot, only filled for decoding
+};
+
+typedef std::tuple<uint32_t, uint32_t, uint32_t> ColorKey;
+
+/** Varints **/
+static void put_varint(std::vector<unsigned char>* out, uint32_t value) {
+    while (value >= 0x80) {
+        out->push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((unsigned char)value);
+}
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Shared by the encoder and decoder so exact grids round trip bit for bit
+static float grid_value(float origin, uint32_t steps, float grid) {
+    return origin + (float)steps * grid;
+}
+
+/** Quantization **/
+// Snap every brush to the grid. With exact set this fails unless every coordinate is on the grid.
+static bool quantize_brushes(const std::vector<Brush>& brushes, glm::vec3 origin, float grid, bool exact, std::vector<uint16_t>* steps) {
+    steps->resize(brushes.size() * 6);
+    for (size_t i = 0; i < brushes.size(); i++) {
+        for (int k = 0; k < 6; k++) {
+            int axis = k % 3;
+            float value = k < 3 ? brushes[i].min[axis] : brushes[i].max[axis];
+            float q = std::floor((value - origin[axis]) / grid + 0.5f);
+            if (!(q >= 0.0f && q < COMPACT_GRID_STEPS)) return false;
+            if (exact && grid_value(origin[axis], (uint32_t)q, grid) != value) return false;
+            (*steps)[i * 6 + k] = (uint16_t)q;
+        }
+    }
+    return true;
+}
+
+static glm::vec3 grid_origin(const std::vector<Brush>& brushes, float grid) {
+    glm::vec3 min = brushes.empty() ? glm::vec3(0.0f) : brushes[0].min;
+    for (size_t i = 0; i < brushes.size(); i++) {
+        min = glm::min(min, brushes[i].min);
+    }
+    return glm::floor(min / grid) * grid;
+}
+
+/** rANS **/
+// Scale byte counts to frequencies summing to RANS_SCALE, keeping every byte that occurs codable
+static void normalize_frequencies(const uint32_t counts[256], uint64_t total, RansTable* table) {
+    memset(table->freq, 0, sizeof(table->freq));
+    if (total == 0) return;
+
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; s++) {
+        if (counts[s] == 0) continue;
+        uint32_t freq = (uint32_t)((uint64_t)counts[s] * RANS_SCALE / total);
+        table->freq[s] = (uint16_t)(freq > 0 ? freq : 1);
+        sum += table->freq[s];
+        if (table->freq[s] > table->freq[largest]) largest = s;
+    }
+
+    // Rounding leaves the sum off by a little, settle the difference on the most frequent bytes
+    table->freq[largest] += RANS_SCALE > sum ? RANS_SCALE - sum : 0;
+    while (sum > RANS_SCALE) {
+        int s = 0;
+        for (int k = 1; k < 256; k++) {
+            if (table->freq[k] > table->freq[s]) s = k;
+        }
+        table->freq[s]--;
+        sum--;
+    }
+}
+
+static void compute_starts(RansTable* table, bool fill_symbols) {
+    uint32_t start = 0;
+    for (int s = 0; s < 256; s++) {
+        table->start[s] = (uint16_t)start;
+        if (fill_symbols) memset(table->symbol + start, s, table->freq[s]);
+        start += table->freq[s];
+    }
+}
+
+struct RansDecoder {
+    const unsigned char* ptr;
+    const unsigned char* end;
+    uint32_t state;
+    bool failed;
+
+    unsigned char decode(const RansTable* table) {
+        uint32_t slot = state & (RANS_SCALE - 1);
+        unsigned char symbol = table->symbol[slot];
+        state = table->freq[symbol] * (state >> RANS_SCALE_BITS) + slot - table->start[symbol];
+        while (state < RANS_LOW) {
+            if (ptr == end) {
+                failed = true;
+                return 0;
+            }
+            state = (state << 8) | *ptr++;
+        }
+        return symbol;
+    }
+
+    uint32_t decode_varint(const RansTable* table) {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            unsigned char byte = decode(table);
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        failed = true;
+        return 0;
+    }
+};
+
+// Encode the brushes into a SCENE_SECTION_COMPACT_BRUSHES section. With grid set to 0 the coarsest
+// power of two grid that holds every coordinate exactly is used, otherwise coordinates are snapped
+// to the given grid. Returns 0 on success.
+int encode_compact_brushes(const std::vector<Brush>& brushes, float grid, SceneSectionData* section) {
+    std::vector<uint16_t> steps;
+    glm::vec3 origin;
+    bool fits = false;
+
+    bool snap = grid > 0.0f;
+    if (snap) {
+        origin = grid_origin(brushes, grid);
+        fits = quantize_brushes(brushes, origin, grid, false, &steps);
+    } else {
+        for (int exponent = GRID_EXPONENT_MAX; exponent >= GRID_EXPONENT_MIN && !fits; exponent--) {
+            grid = std::ldexp(1.0f, exponent);
+            origin = grid_origin(brushes, grid);
+            fits = quantize_brushes(brushes, origin, grid, true, &steps);
+        }
+    }
+
+    if (!fits) {
+        std::cerr << "Brushes do not fit on a " << COMPACT_GRID_STEPS << " step grid" << (snap ? "" : " exactly, pick a grid size") << std::endl;
+        return 1;
+    }
+
+    // Palette in order of first use, so palette index deltas stay small
+    std::map<ColorKey, uint32_t> palette_index;
+    std::vector<float> palette;
+    std::vector<uint32_t> colors(brushes.size());
+    for (size_t i = 0; i < brushes.size(); i++) {
+        // When snapping, colors are snapped too, to the 8 bits per channel the static mesh keeps
+        glm::vec3 color = brushes[i].color;
+        if (snap) color = glm::floor(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f) / 255.0f;
+
+        uint32_t bits[3];
+        memcpy(bits, &color, sizeof(bits));
+        ColorKey key(bits[0], bits[1], bits[2]);
+
+        std::map<ColorKey, uint32_t>::iterator found = palette_index.find(key);
+        if (found == palette_index.end()) {
+            if (palette_index.size() == COMPACT_MAX_PALETTE) {
+                std::cerr << "Brushes use more than " << COMPACT_MAX_PALETTE << " colors" << std::endl;
+                return 1;
+            }
+            found = palette_index.insert(std::make_pair(key, (uint32_t)palette_index.size())).first;
+            palette.insert(palette.end(), &color[0], &color[0] + 3);
+        }
+        colors[i] = found->second;
+    }
+
+    // Varint stream, remembering the field every byte belongs to
+    std::vector<unsigned char> bytes;
+    std::vector<unsigned char> fields;
+    bytes.reserve(brushes.size() * COMPACT_FIELD_COUNT * 2);
+    fields.reserve(bytes.capacity());
+
+    int32_t previous[4] = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < brushes.size(); i++) {
+        const uint16_t* q = &steps[i * 6];
+        uint32_t values[COMPACT_FIELD_COUNT] = {
+            zigzag(q[0] - previous[0]), zigzag(q[1] - previous[1]), zigzag(q[2] - previous[2]),
+            (uint32_t)(q[3] - q[0]), (uint32_t)(q[4] - q[1]), (uint32_t)(q[5] - q[2]),
+            zigzag((int32_t)colors[i] - previous[3])
+        };
+        previous[0] = q[0];
+        previous[1] = q[1];
+        previous[2] = q[2];
+        previous[3] = (int32_t)colors[i];
+
+        for (int f = 0; f < COMPACT_FIELD_COUNT; f++) {
+            put_varint(&bytes, values[f]);
+            fields.resize(bytes.size(), (unsigned char)f);
+        }
+    }
+
+    std::vector<RansTable> tables(COMPACT_FIELD_COUNT);
+    std::vector<unsigned char> coded;
+    for (int f = 0; f < COMPACT_FIELD_COUNT; f++) {
+        uint32_t counts[256] = { 0 };
+        uint64_t total = 0;
+        for (size_t i = 0; i < bytes.size(); i++) {
+            if (fields[i] == f) {
+                counts[bytes[i]]++;
+                total++;
+            }
+        }
+        normalize_frequencies(counts, total, &tables[f]);
+        compute_starts(&tables[f], false);
+
+        uint16_t distinct = 0;
+        for (int s = 0; s < 256; s++) distinct += tables[f].freq[s] > 0;
+        coded.push_back((unsigned char)distinct);
+        coded.push_back((unsigned char)(distinct >> 8));
+        for (int s = 0; s < 256; s++) {
+            if (tables[f].freq[s] == 0) continue;
+            coded.push_back((unsigned char)s);
+            put_varint(&coded, tables[f].freq[s]);
+        }
+    }
+
+    // rANS works backwards, so the decoder can read front to back
+    std::vector<unsigned char> stream(bytes.size() * 2 + 4);
+    unsigned char* end = stream.data() + stream.size();
+    unsigned char* ptr = end;
+    uint32_t state = RANS_LOW;
+    for (size_t i = bytes.size(); i-- > 0;) {
+        const RansTable* table = &tables[fields[i]];
+        uint32_t freq = table->freq[bytes[i]];
+        uint32_t state_max = ((RANS_LOW >> RANS_SCALE_BITS) << 8) * freq;
+        while (state >= state_max) {
+            *--ptr = (unsigned char)state;
+            state >>= 8;
+        }
+        state = ((state / freq) << RANS_SCALE_BITS) + (state % freq) + table->start[bytes[i]];
+    }
+    ptr -= 4;
+    for (int k = 0; k < 4; k++) ptr[k] = (unsigned char)(state >> (8 * k));
+    coded.insert(coded.end(), ptr, end);
+
+    SceneCompactBrushHeader header = { { origin.x, origin.y, origin.z }, grid, (uint32_t)(palette.size() / 3), (uint32_t)coded.size() };
+    const unsigned char* header_bytes = reinterpret_cast<const unsigned char*>(&header);
+    const unsigned char* palette_bytes = reinterpret_cast<const unsigned char*>(palette.data());
+
+    section->type = SCENE_SECTION_COMPACT_BRUSHES;
+    section->element_count = (uint32_t)brushes.size();
+    section->data.assign(header_bytes, header_bytes + sizeof(header));
+    section->data.insert(section->data.end(), palette_bytes, palette_bytes + palette.size() * sizeof(float));
+    section->data.insert(section->data.end(), coded.begin(), coded.end());
+    return 0;
+}
+
+// Decode a SCENE_SECTION_COMPACT_BRUSHES section straight into brushes. Returns 0 on success.
+int decode_compact_brushes(const void* data, size_t size, uint32_t brush_count, std::vector<Brush>* brushes) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    SceneCompactBrushHeader header;
+    if (size < sizeof(header)) return 1;
+    memcpy(&header, bytes, sizeof(header));
+
+    size_t palette_size = (size_t)header.palette_count * 3 * sizeof(float);
+    if (header.palette_count > COMPACT_MAX_PALETTE || size - sizeof(header) < palette_size || size - sizeof(header) - palette_size < header.coded_size) return 1;
+
+    std::vector<float> palette(header.palette_count * 3);
+    if (palette_size > 0) memcpy(palette.data(), bytes + sizeof(header), palette_size);
+
+    const unsigned char* ptr = bytes + sizeof(header) + palette_size;
+    const unsigned char* end = ptr + header.coded_size;
+
+    std::vector<RansTable> tables(COMPACT_FIELD_COUNT);
+    for (int f = 0; f < COMPACT_FIELD_COUNT; f++) {
+        RansTable* table = &tables[f];
+        memset(table->freq, 0, sizeof(table->freq));
+        if (end - ptr < 2) return 1;
+        uint32_t distinct = ptr[0] | (ptr[1] << 8);
+        ptr += 2;
+
+        // Every slot of the table must belong to exactly one symbol, so each byte is listed once with a frequency
+        // that fits, and the frequencies fill the table. Only a field that is never decoded may have no table.
+        if (distinct > 256) return 1;
+        uint32_t sum = 0;
+        for (uint32_t k = 0; k < distinct; k++) {
+            if (ptr == end) return 1;
+            unsigned char symbol = *ptr++;
+            uint32_t freq = 0;
+            for (int shift = 0; ; shift += 7) {
+                if (ptr == end || shift > 14) return 1;
+                freq |= (uint32_t)(*ptr & 0x7F) << shift;
+                if (!(*ptr++ & 0x80)) break;
+            }
+            if (freq == 0 || freq > RANS_SCALE - sum || table->freq[symbol] != 0) return 1;
+            table->freq[symbol] = (uint16_t)freq;
+            sum += freq;
+        }
+        if (distinct == 0 ? brush_count > 0 : sum != RANS_SCALE) return 1;
+        compute_starts(table, true);
+    }
+
+    if (end - ptr < 4) return 1;
+    RansDecoder decoder = { ptr + 4, end, (uint32_t)(ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24)), false };
+
+    brushes->clear();
+    brushes->reserve(brush_count);
+    uint32_t previous[4] = { 0, 0, 0, 0 }; // Wraps around on corrupt data and is caught by the range checks
+    for (uint32_t i = 0; i < brush_count; i++) {
+        uint32_t min[3], max[3];
+        for (int k = 0; k < 3; k++) {
+            previous[k] += (uint32_t)unzigzag(decoder.decode_varint(&tables[k]));
+            min[k] = previous[k];
+        }
+        for (int k = 0; k < 3; k++) {
+            max[k] = min[k] + decoder.decode_varint(&tables[3 + k]);
+        }
+        previous[3] += (uint32_t)unzigzag(decoder.decode_varint(&tables[6]));
+
+        if (decoder.failed || previous[3] >= header.palette_count) return 1;
+        for (int k = 0; k < 3; k++) {
+            if (min[k] >= COMPACT_GRID_STEPS || max[k] >= COMPACT_GRID_STEPS || max[k] < min[k]) return 1;
+        }
+
+        const float* color = &palette[previous[3] * 3];
+        brushes->push_back(Brush(
+            glm::vec3(grid_value(header.origin[0], min[0], header.grid), grid_value(header.origin[1], min[1], header.grid), grid_value(header.origin[2], min[2], header.grid)),
+            glm::vec3(grid_value(header.origin[0], max[0], header.grid), grid_value(header.origin[1], max[1], header.grid), grid_value(header.origin[2], max[2], header.grid)),
+            glm::vec3(color[0], color[1], color[2])));
+    }
+
+    // A stream that decoded correctly leaves the coder in its initial state with every byte consumed
+    if (decoder.state != RANS_LOW || decoder.ptr != end) return 1;
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "scene_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "job_system.h"
+
+#define ALIGN_UP(value, alignment) (((value) + (alignment) - 1) / (alignment) * (alignment))
+
+struct CRC32Table {
+    uint32_t entries[256];
+
+    CRC32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+static const uint32_t* crc32_table() {
+    static CRC32Table table; // Thread-safe initialization on first use
+    return table.entries;
+}
+
+// Standard CRC-32 (IEEE 802.3). Pass the previous result as crc to checksum data in pieces.
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    const uint32_t* table = crc32_table();
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Size of one record for section types with fixed-size records, 0 for everything else
+static size_t section_record_size(uint32_t type) {
+    switch (type) {
+        case SCENE_SECTION_BRUSHES: return sizeof(SceneBrushRecord);
+        case SCENE_SECTION_CUBES: return sizeof(SceneCubeRecord);
+        case SCENE_SECTION_SPAWN_POINTS: return sizeof(SceneSpawnRecord);
+        case SCENE_SECTION_LIGHTS: return sizeof(SceneLightRecord);
+        case SCENE_SECTION_PORTALS: return sizeof(ScenePortalRecord);
+        case SCENE_SECTION_AUTHORED_BRUSHES: return sizeof(SceneBrushRecord);
+        case SCENE_SECTION_MERGE_MAP: return sizeof(uint32_t);
+        case SCENE_SECTION_BVH: return sizeof(SceneBVHNodeRecord);
+        case SCENE_SECTION_BVH_INDICES: return sizeof(uint32_t);
+        case SCENE_SECTION_STATIC_VERTICES: return sizeof(SceneStaticVertexRecord);
+        case SCENE_SECTION_STATIC_INDICES: return sizeof(uint32_t);
+        case SCENE_SECTION_FACE_FLAGS: return sizeof(uint16_t);
+        case SCENE_SECTION_BOUNDS: return sizeof(SceneBoundsRecord);
+        case SCENE_SECTION_PVS: return sizeof(ScenePVSRecord);
+        case SCENE_SECTION_PVS_VISIBILITY: return sizeof(uint32_t);
+        case SCENE_SECTION_FACE_PLANES: return sizeof(SceneFacePlaneRecord);
+        case SCENE_SECTION_FACE_RECTS: return sizeof(SceneFaceRectRecord);
+        default: return 0;
+    }
+}
+
+static void validate_section(SceneFile* file, size_t index) {
+    const SceneSectionEntry* entry = &file->sections[index];
+    uint32_t crc = crc32(file->mapping.data + entry->offset, (size_t)entry->size);
+    file->section_state[index] = crc == entry->crc ? SECTION_VALID : SECTION_CORRUPT;
+}
+
+// Map a scene file and read its section table. Returns 0 on success.
+// Unversioned files are accepted with version set to 1 and no sections.
+int scene_file_open(const char* path, SceneFile* file) {
+    if (map_file(path, &file->mapping) != 0) return 1;
+
+    uint32_t magic = 0;
+    if (file->mapping.size >= sizeof(magic)) {
+        memcpy(&magic, file->mapping.data, sizeof(magic));
+    }
+
+    if (magic != SCENE_FILE_MAGIC) {
+        file->version = 1;
+        return 0;
+    }
+
+    SceneFileHeader header;
+    if (file->mapping.size < sizeof(header)) {
+        std::cerr << "Scene file " << path << " has a truncated header" << std::endl;
+        scene_file_close(file);
+        return 1;
+    }
+    memcpy(&header, file->mapping.data, sizeof(header));
+
+    if (header.version != SCENE_FILE_VERSION) {
+        std::cerr << "Scene file " << path << " has unsupported version " << header.version << std::endl;
+        scene_file_close(file);
+        return 1;
+    }
+
+    if (header.section_count > (file->mapping.size - sizeof(header)) / sizeof(SceneSectionEntry)) {
+        std::cerr << "Scene file " << path << " has a truncated section table" << std::endl;
+        scene_file_close(file);
+        return 1;
+    }
+
+    file->version = header.version;
+    file->sections.resize(header.section_count);
+    file->section_state.assign(header.section_count, SECTION_UNCHECKED);
+    if (header.section_count > 0) {
+        memcpy(&file->sections[0], file->mapping.data + sizeof(header), header.section_count * sizeof(SceneSectionEntry));
+    }
+
+    for (size_t i = 0; i < file->sections.size(); i++) {
+        const SceneSectionEntry* entry = &file->sections[i];
+        size_t record_size = section_record_size(entry->type);
+
+        if (entry->offset % SCENE_SECTION_ALIGNMENT != 0 || entry->offset > file->mapping.size || entry->size > file->mapping.size - entry->offset) {
+            std::cerr << "Scene file " << path << " section " << i << " (type " << entry->type << ") is out of bounds" << std::endl;
+            scene_file_close(file);
+            return 1;
+        }
+
+        if (record_size != 0 && entry->size != (uint64_t)entry->element_count * record_size) {
+            std::cerr << "Scene file " << path << " section " << i << " (type " << entry->type << ") has the wrong size" << std::endl;
+            scene_file_close(file);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void scene_file_close(SceneFile* file) {
+    unmap_file(&file->mapping);
+    file->version = 0;
+    file->sections.clear();
+    file->section_state.clear();
+}
+
+struct SectionValidateJob {
+    SceneFile* file;
+    const std::vector<size_t>* indices;
+};
+
+static void validate_section_range(void* data, size_t begin, size_t end) {
+    SectionValidateJob* job = (SectionValidateJob*)data;
+    for (size_t i = begin; i < end; i++) {
+        validate_section(job->file, (*job->indices)[i]);
+    }
+}
+
+// Check the CRC of every section of the given types, a section per job on the shared job system.
+// Sections of other types are skipped and left to be checked on first access.
+void scene_file_validate(SceneFile* file, const uint32_t* types, size_t type_count) {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < file->sections.size(); i++) {
+        if (file->section_state[i] != SECTION_UNCHECKED) continue;
+
+        for (size_t t = 0; t < type_count; t++) {
+            if (file->sections[i].type == types[t]) {
+                indices.push_back(i);
+                break;
+            }
+        }
+    }
+
+    SectionValidateJob job = { file, &indices };
+    parallel_for(shared_job_system(), indices.size(), 1, validate_section_range, &job);
+}
+
+const SceneSectionEntry* scene_file_find(SceneFile* file, uint32_t type) {
+    for (size_t i = 0; i < file->sections.size(); i++) {
+        if (file->sections[i].type == type) return &file->sections[i];
+    }
+    return NULL;
+}
+
+// Get a pointer to the data of the first section of the given type, checking its CRC on first access.
+// Returns NULL if the section is missing or corrupt.
+const void* scene_file_section(SceneFile* file, uint32_t type, uint32_t* element_count) {
+    const SceneSectionEntry* entry = scene_file_find(file, type);
+    if (entry == NULL) return NULL;
+
+    size_t index = entry - &file->sections[0];
+    if (file->section_state[index] == SECTION_UNCHECKED) {
+        validate_section(file, index);
+    }
+
+    if (file->section_state[index] != SECTION_VALID) {
+        std::cerr << "Scene file section of type " << type << " failed its checksum" << std::endl;
+        return NULL;
+    }
+
+    if (element_count) *element_count = entry->element_count;
+    return file->mapping.data + entry->offset;
+}
+
+// Write a version 2 scene file. Returns 0 on success.
+int write_scene_sections(const char* path, const std::vector<SceneSectionData>& sections) {
+    SceneFileHeader header;
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.section_count = (uint32_t)sections.size();
+    header.flags = 0;
+
+    std::vector<SceneSectionEntry> table(sections.size());
+    uint64_t offset = ALIGN_UP(sizeof(header) + sizeof(SceneSectionEntry) * sections.size(), SCENE_SECTION_ALIGNMENT);
+    for (size_t i = 0; i < sections.size(); i++) {
+        table[i].type = sections[i].type;
+        table[i].crc = crc32(sections[i].data.empty() ? NULL : &sections[i].data[0], sections[i].data.size());
+        table[i].offset = offset;
+        table[i].size = sections[i].data.size();
+        table[i].element_count = sections[i].element_count;
+        table[i].reserved = 0;
+        offset = ALIGN_UP(offset + table[i].size, SCENE_SECTION_ALIGNMENT);
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return 1;
+    }
+
+    static const char padding[SCENE_SECTION_ALIGNMENT] = {0};
+    uint64_t written = sizeof(header) + sizeof(SceneSectionEntry) * table.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!table.empty()) out.write(reinterpret_cast<const char*>(&table[0]), sizeof(SceneSectionEntry) * table.size());
+
+    for (size_t i = 0; i < sections.size(); i++) {
+        out.write(padding, table[i].offset - written);
+        if (!sections[i].data.empty()) out.write(reinterpret_cast<const char*>(&sections[i].data[0]), sections[i].data.size());
+        written = table[i].offset + table[i].size;
+    }
+
+    if (!out) {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
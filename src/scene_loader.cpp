@@ -0,0 +1,67 @@
+#include "scene_loader.h"
+
+#include <iostream>
+#include <utility>
+
+static void record_progress(void* user_data, float fraction, const char* step) {
+    SceneLoad* load = static_cast<SceneLoad*>(user_data);
+    load->fraction.store(fraction);
+    load->step.store(step);
+    report_progress(&load->progress, fraction, step);
+}
+
+static void load_worker(SceneLoad* load) {
+    SceneLoadProgress progress = { record_progress, load };
+    int result = load_scene_file(load->path.c_str(), load->scene, load->options, &progress);
+
+    // Publishes the scene to the thread that sees the new state
+    load->state.store(result == 0 ? SCENE_LOAD_DONE : SCENE_LOAD_FAILED, std::memory_order_release);
+}
+
+// Start loading a scene on a worker thread. Returns 1 if a load is already in progress.
+int start_scene_load(SceneLoad* load, const char* path, int options, const SceneLoadProgress* progress) {
+    if (load->state.load() != SCENE_LOAD_IDLE) {
+        std::cerr << "Already loading " << load->path << std::endl;
+        return 1;
+    }
+
+    load->path = path;
+    load->options = options;
+    load->scene = new Scene();
+    load->fraction.store(0.0f);
+    load->step.store("");
+    load->progress.callback = progress ? progress->callback : NULL;
+    load->progress.user_data = progress ? progress->user_data : NULL;
+    load->state.store(SCENE_LOAD_RUNNING);
+    load->worker = std::thread(load_worker, load);
+    return 0;
+}
+
+int scene_load_state(SceneLoad* load) {
+    return load->state.load(std::memory_order_acquire);
+}
+
+float scene_load_progress(SceneLoad* load, const char** step) {
+    if (step) *step = load->step.load();
+    return load->fraction.load();
+}
+
+// Wait for the load to end and replace the scene with the loaded one in a single step.
+// Returns 0 on success, on failure the scene is left untouched. Either way the load is idle afterwards.
+int finish_scene_load(SceneLoad* load, Scene* scene) {
+    if (load->state.load() == SCENE_LOAD_IDLE) return 1;
+    load->worker.join();
+
+    int result = 1;
+    if (load->state.load(std::memory_order_acquire) == SCENE_LOAD_DONE) {
+        // Moving the vectors keeps the static mesh pointers valid
+        close_scene_file(scene);
+        *scene = std::move(*load->scene);
+        result = 0;
+    }
+
+    delete load->scene;
+    load->scene = NULL;
+    load->state.store(SCENE_LOAD_IDLE);
+    return result;
+}
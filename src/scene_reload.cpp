@@ -0,0 +1,240 @@
+#include "scene_reload.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "brush_merge.h"
+#include "scene_bake.h"
+
+#define PORTAL_SURFACE_TOLERANCE 0.01f
+
+void watch_scene_file(SceneWatch* watch, const char* path, double time) {
+    watch->path = path;
+    watch->loaded = file_stamp(path);
+    watch->last_check = time;
+}
+
+// Poll the file, at most once every SCENE_RELOAD_INTERVAL, and fill in its stamp when it differs from the loaded one.
+// The watch only takes the stamp once the reload succeeded, so a file caught halfway through being written is tried
+// again at the next poll.
+bool scene_file_modified(SceneWatch* watch, double time, FileStamp* stamp) {
+    if (time - watch->last_check < SCENE_RELOAD_INTERVAL) return false;
+    watch->last_check = time;
+
+    *stamp = file_stamp(watch->path);
+    return stamp->modification_time != -1 && !same_file_stamp(stamp, &watch->loaded);
+}
+
+static bool same_brush(const Brush* a, const Brush* b) {
+    return memcmp(a, b, sizeof(Brush)) == 0;
+}
+
+// Whether the center of the portal lies on the face of the brush it is facing out of
+static bool portal_on_brush(Portal* portal, const Brush* brush) {
+    int face = face_index(portal->normal);
+    int axis = face / 2;
+    glm::vec3 surface = portal->position - portal->normal * 0.001f;
+    float plane = face & 1 ? brush->max[axis] : brush->min[axis];
+
+    if (glm::abs(surface[axis] - plane) > PORTAL_SURFACE_TOLERANCE) return false;
+    for (int k = 0; k < 3; k++) {
+        if (k != axis && (surface[k] < brush->min[k] || surface[k] > brush->max[k])) return false;
+    }
+    return true;
+}
+
+// Find a brush the portal still sits on after its own brush changed. Needs an up to date BVH.
+static Brush* find_portal_brush(Scene* scene, Portal* portal) {
+    glm::vec3 surface = portal->position - portal->normal * 0.001f;
+    std::vector<uint32_t> candidates;
+    bvh_query_aabb(&scene->bvh, surface - glm::vec3(PORTAL_SURFACE_TOLERANCE), surface + glm::vec3(PORTAL_SURFACE_TOLERANCE), &candidates);
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        Brush* brush = &scene->geometry[candidates[i]];
+        if (portal_on_brush(portal, brush)) return brush;
+    }
+    return NULL;
+}
+
+// Attach the portal to the brush at new_index if there is one, otherwise look for any brush it still sits on.
+// Closes the portal when it is left hanging in the air.
+static void resolve_portal(Scene* scene, Portal* portal, int64_t new_index) {
+    if (!portal->open) return;
+
+    if (new_index >= 0 && portal_on_brush(portal, &scene->geometry[new_index])) {
+        portal->brush = &scene->geometry[new_index];
+        return;
+    }
+
+    portal->brush = find_portal_brush(scene, portal);
+    if (portal->brush == NULL) {
+        std::cout << "Closing portal whose surface was removed" << std::endl;
+        portal->open = false;
+    }
+}
+
+static int64_t portal_brush_index(Scene* scene, Portal* portal) {
+    if (!portal->open || portal->brush == NULL) return -1;
+    return portal->brush - &scene->geometry[0];
+}
+
+// The static mesh must not keep pointing into the old mapping once it is closed
+static void adopt_scene_file(Scene* scene, Scene* fresh) {
+    if (scene->static_mesh.vertex_count > 0 && scene->static_mesh.owned_vertices.empty()) {
+        build_static_mesh(scene, &scene->static_mesh);
+    }
+
+    close_scene_file(scene);
+    scene->file = fresh->file;
+    fresh->file = SceneFile();
+}
+
+static void adopt_authored_brushes(Scene* scene, Scene* fresh) {
+    scene->authored_geometry.swap(fresh->authored_geometry);
+    scene->authored_map.swap(fresh->authored_map);
+    scene->authored_first.swap(fresh->authored_first);
+    scene->authored_indices.swap(fresh->authored_indices);
+}
+
+// Apply a small number of changed brushes in place: refit the BVH, refresh the face flags around
+// the changes and rewrite the vertices of the affected brushes.
+static void patch_brushes(Scene* scene, Scene* fresh, const std::vector<uint32_t>& changed, SceneReload* reload) {
+    // Neighbours of the old and the new bounds may have faces hidden or revealed
+    std::vector<uint32_t> affected;
+    for (size_t i = 0; i < changed.size(); i++) {
+        Brush* brush = &scene->geometry[changed[i]];
+        bvh_query_aabb(&scene->bvh, brush->min, brush->max, &affected);
+        *brush = fresh->geometry[changed[i]];
+    }
+
+    refit_bvh(&scene->bvh, scene->geometry);
+    for (size_t i = 0; i < changed.size(); i++) {
+        Brush* brush = &scene->geometry[changed[i]];
+        bvh_query_aabb(&scene->bvh, brush->min, brush->max, &affected);
+    }
+
+    std::sort(affected.begin(), affected.end());
+    affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+    std::vector<uint16_t> old_flags(affected.size());
+    for (size_t i = 0; i < affected.size(); i++) {
+        old_flags[i] = scene->face_flags[affected[i]];
+    }
+    update_face_flags(scene, affected);
+
+    bool same_layout = true;
+    for (size_t i = 0; i < affected.size(); i++) {
+        if (visible_face_count(old_flags[i]) != visible_face_count(scene->face_flags[affected[i]])) same_layout = false;
+    }
+
+    if (!same_layout || scene->static_mesh.owned_vertices.empty()) {
+        // Vertices move around in the mesh, or the mesh still points into the old mapping
+        build_static_mesh(scene, &scene->static_mesh);
+        if (!same_layout) {
+            reload->kind = RELOAD_REBUILT;
+            return;
+        }
+    }
+
+    // Find where the vertices of each affected brush start
+    size_t next = 0;
+    uint32_t first_vertex = 0;
+    for (uint32_t i = 0; i < scene->geometry.size() && next < affected.size(); i++) {
+        if (i == affected[next]) {
+            size_t count = write_brush_vertices(&scene->geometry[i], scene->face_flags[i], &scene->static_mesh.owned_vertices[0] + first_vertex);
+            if (count > 0) {
+                reload->vertex_ranges.push_back(first_vertex);
+                reload->vertex_ranges.push_back((uint32_t)count);
+            }
+            next++;
+        }
+        first_vertex += visible_face_count(scene->face_flags[i]) * FACE_VERTEX_COUNT;
+    }
+
+    reload->kind = RELOAD_PATCHED;
+}
+
+// Read the scene file again and bring the brushes up to date, keeping cubes, portals and the player where they are.
+// Only the changed brushes are patched when the brush count stayed the same, everything is rebuilt otherwise.
+// Returns 0 on success, the scene is left untouched on failure.
+int reload_scene_file(const char* path, Scene* scene, SceneReload* reload) {
+    reload->kind = RELOAD_UNCHANGED;
+    reload->vertex_ranges.clear();
+
+    Scene fresh;
+    if (load_scene_file(path, &fresh, 0) != 0) return 1;
+
+    scene->light_dir = fresh.light_dir;
+
+    // Brushes merged at load time are merged again, so they compare against the new ones
+    if (!scene->authored_geometry.empty() && fresh.authored_geometry.empty()) merge_brushes(&fresh);
+    adopt_authored_brushes(scene, &fresh);
+
+    int64_t portal1_index = portal_brush_index(scene, &scene->portal1);
+    int64_t portal2_index = portal_brush_index(scene, &scene->portal2);
+
+    std::vector<uint32_t> changed;
+    bool same_count = fresh.geometry.size() == scene->geometry.size();
+    for (size_t i = 0; same_count && i < scene->geometry.size(); i++) {
+        if (!same_brush(&scene->geometry[i], &fresh.geometry[i])) changed.push_back((uint32_t)i);
+    }
+
+    if (same_count && changed.size() * SCENE_PATCH_LIMIT <= scene->geometry.size()) {
+        adopt_scene_file(scene, &fresh);
+        if (changed.empty()) return 0;
+
+        // Cubes near the old or the new shape of a brush may have lost their footing
+        for (size_t i = 0; i < changed.size(); i++) {
+            wake_cubes(scene, scene->geometry[changed[i]].min - CUBE_CONTACT_MARGIN, scene->geometry[changed[i]].max + CUBE_CONTACT_MARGIN);
+            wake_cubes(scene, fresh.geometry[changed[i]].min - CUBE_CONTACT_MARGIN, fresh.geometry[changed[i]].max + CUBE_CONTACT_MARGIN);
+        }
+        patch_brushes(scene, &fresh, changed, reload);
+        clear_pvs(&scene->pvs); // Visibility was computed for the old brushes
+        compute_scene_bounds(scene);
+        build_brush_grid(scene->geometry, scene->bounds_min, scene->bounds_max, &scene->brush_grid);
+        build_face_planes(scene, &scene->face_planes);
+
+        // Brush indices did not change, only check that the portals still sit on their brush
+        resolve_portal(scene, &scene->portal1, portal1_index);
+        resolve_portal(scene, &scene->portal2, portal2_index);
+
+        std::cout << "Reloaded " << path << ": patched " << changed.size() << " brushes" << std::endl;
+        return 0;
+    }
+
+    // Follow the portal brushes to their new index through an exact match
+    int64_t portal1_new = -1, portal2_new = -1;
+    for (size_t i = 0; i < fresh.geometry.size(); i++) {
+        if (portal1_index >= 0 && portal1_new < 0 && same_brush(&scene->geometry[portal1_index], &fresh.geometry[i])) portal1_new = i;
+        if (portal2_index >= 0 && portal2_new < 0 && same_brush(&scene->geometry[portal2_index], &fresh.geometry[i])) portal2_new = i;
+    }
+
+    bake_scene(&fresh, load_baked_sections(&fresh.file, &fresh));
+    scene->geometry.swap(fresh.geometry);
+    scene->bvh.nodes.swap(fresh.bvh.nodes);
+    scene->bvh.indices.swap(fresh.bvh.indices);
+    std::swap(scene->bvh.leaf_bounds, fresh.bvh.leaf_bounds);
+    scene->face_flags.swap(fresh.face_flags);
+    move_static_mesh(&fresh.static_mesh, &scene->static_mesh);
+    scene->bounds_min = fresh.bounds_min;
+    scene->bounds_max = fresh.bounds_max;
+    std::swap(scene->brush_grid, fresh.brush_grid);
+    std::swap(scene->pvs, fresh.pvs);
+    std::swap(scene->face_planes, fresh.face_planes);
+
+    // The static mesh may point into the new mapping now
+    close_scene_file(scene);
+    scene->file = fresh.file;
+    fresh.file = SceneFile();
+
+    resolve_portal(scene, &scene->portal1, portal1_new);
+    resolve_portal(scene, &scene->portal2, portal2_new);
+    for (size_t i = 0; i < scene->cubes.count; i++) {
+        wake_cube(scene, (uint32_t)i);
+    }
+
+    reload->kind = RELOAD_REBUILT;
+    std::cout << "Reloaded " << path << ": rebuilt " << scene->geometry.size() << " brushes" << std::endl;
+    return 0;
+}
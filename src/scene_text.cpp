@@ -0,0 +1,263 @@
+#include "scene_text.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#define MAX_LINE_VALUES 9
+#define MAX_FAST_MANTISSA (1ull << 53) // Integers below this are exact in a double
+#define MAX_FAST_EXPONENT 22 // Powers of ten up to this are exact in a double
+#define MAX_NUMBER_LENGTH 64
+
+static const double powers_of_ten[MAX_FAST_EXPONENT + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+struct TextCursor {
+    const char* ptr;
+    const char* end;
+    size_t line;
+};
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void skip_blanks(TextCursor* cursor) {
+    while (cursor->ptr < cursor->end && is_blank(*cursor->ptr)) cursor->ptr++;
+}
+
+static bool at_line_end(TextCursor* cursor) {
+    skip_blanks(cursor);
+    return cursor->ptr == cursor->end || *cursor->ptr == '\n' || *cursor->ptr == '#';
+}
+
+static void next_line(TextCursor* cursor) {
+    const char* newline = static_cast<const char*>(memchr(cursor->ptr, '\n', cursor->end - cursor->ptr));
+    cursor->ptr = newline ? newline + 1 : cursor->end;
+    cursor->line++;
+}
+
+// Read a word up to the next blank. Returns its length.
+static size_t read_word(TextCursor* cursor, const char** word) {
+    skip_blanks(cursor);
+    *word = cursor->ptr;
+    while (cursor->ptr < cursor->end && !is_blank(*cursor->ptr) && *cursor->ptr != '\n' && *cursor->ptr != '#') cursor->ptr++;
+    return cursor->ptr - *word;
+}
+
+// Parse a decimal number. Numbers with up to 15 or so significant digits and small exponents are
+// converted exactly with one double operation, anything else goes through strtod.
+static bool read_float(TextCursor* cursor, float* value) {
+    const char* start;
+    size_t length = read_word(cursor, &start);
+    if (length == 0) return false;
+
+    const char* p = start;
+    const char* end = start + length;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool fast = true;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mantissa < MAX_FAST_MANTISSA / 10) mantissa = mantissa * 10 + (*p - '0');
+        else fast = false;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mantissa < MAX_FAST_MANTISSA / 10) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            } else {
+                fast = false;
+            }
+        }
+    }
+    if (digits == 0) fast = false;
+
+    if (fast && p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool exponent_negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        int written = 0;
+        int exponent_digits = 0;
+        for (; p < end && *p >= '0' && *p <= '9' && written < 1000; p++, exponent_digits++) {
+            written = written * 10 + (*p - '0');
+        }
+        if (exponent_digits == 0) fast = false;
+        exponent += exponent_negative ? -written : written;
+    }
+
+    if (fast && p == end && exponent >= -MAX_FAST_EXPONENT && exponent <= MAX_FAST_EXPONENT) {
+        double result = exponent < 0 ? (double)mantissa / powers_of_ten[-exponent] : (double)mantissa * powers_of_ten[exponent];
+        *value = (float)(negative ? -result : result);
+        return std::isfinite(*value);
+    }
+
+    // Slow path for long or unusual numbers, strtod needs a terminated copy
+    if (length >= MAX_NUMBER_LENGTH) return false;
+    char buffer[MAX_NUMBER_LENGTH];
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+
+    char* parsed_end;
+    double result = strtod(buffer, &parsed_end);
+    *value = (float)result;
+    return parsed_end == buffer + length && std::isfinite(*value);
+}
+
+// Read between min_count and max_count numbers up to the end of the line. Returns how many were read, -1 on error.
+static int read_floats(TextCursor* cursor, float* values, int min_count, int max_count) {
+    int count = 0;
+    while (!at_line_end(cursor)) {
+        if (count == max_count || !read_float(cursor, &values[count])) return -1;
+        count++;
+    }
+    return count >= min_count ? count : -1;
+}
+
+static bool word_is(const char* word, size_t length, const char* keyword) {
+    return length == strlen(keyword) && memcmp(word, keyword, length) == 0;
+}
+
+bool is_scene_text(const MappedFile* mapping) {
+    size_t header_length = strlen(SCENE_TEXT_HEADER);
+    return mapping->size >= header_length && memcmp(mapping->data, SCENE_TEXT_HEADER, header_length) == 0;
+}
+
+// Parse a text scene in a single pass over the mapping. Returns 0 on success.
+// On failure the line is reported and the scene is left untouched.
+int load_scene_text(const char* path, const MappedFile* mapping, Scene* scene) {
+    TextCursor cursor = { reinterpret_cast<const char*>(mapping->data), reinterpret_cast<const char*>(mapping->data) + mapping->size, 1 };
+
+    const char* word;
+    size_t length = read_word(&cursor, &word);
+    float version;
+    if (!word_is(word, length, SCENE_TEXT_HEADER) || !read_float(&cursor, &version) || version != SCENE_TEXT_VERSION || !at_line_end(&cursor)) {
+        std::cerr << "Scene file " << path << " has an unsupported text header" << std::endl;
+        return 1;
+    }
+    next_line(&cursor);
+
+    // Every brush takes a line, so the line count bounds the brush count
+    size_t line_count = 1;
+    for (const char* p = cursor.ptr; (p = static_cast<const char*>(memchr(p, '\n', cursor.end - p))) != NULL; p++) line_count++;
+
+    std::vector<Brush> brushes;
+    CubeBodies cubes;
+    brushes.reserve(line_count);
+
+    bool has_light = false;
+    bool has_cubes = false;
+    bool has_spawn = false;
+    int portal_count = 0;
+    glm::vec3 light_dir;
+    float spawn[5];
+    float portal_sizes[2][2];
+
+    float values[MAX_LINE_VALUES];
+    for (; cursor.ptr < cursor.end; next_line(&cursor)) {
+        if (at_line_end(&cursor)) continue;
+        length = read_word(&cursor, &word);
+
+        int count = -1;
+        if (word_is(word, length, "brush")) {
+            count = read_floats(&cursor, values, 9, 9);
+            if (count > 0) brushes.push_back(Brush(glm::vec3(values[0], values[1], values[2]), glm::vec3(values[3], values[4], values[5]), glm::vec3(values[6], values[7], values[8])));
+        } else if (word_is(word, length, "cube")) {
+            count = read_floats(&cursor, values, 6, 7);
+            if (count == 7 && values[6] <= 0.0f) count = -1; // Cubes need a positive size, as in validate_cubes
+            if (count > 0) {
+                Cube cube(glm::vec3(values[0], values[1], values[2]), glm::vec3(values[3], values[4], values[5]));
+                if (count == 7) cube.size = values[6];
+                add_cube_body(&cubes, &cube);
+                has_cubes = true;
+            }
+        } else if (word_is(word, length, "light")) {
+            count = read_floats(&cursor, values, 3, 3);
+            light_dir = glm::vec3(values[0], values[1], values[2]);
+            has_light = true;
+        } else if (word_is(word, length, "spawn")) {
+            count = read_floats(&cursor, spawn, 5, 5);
+            has_spawn = true;
+        } else if (word_is(word, length, "portal")) {
+            if (portal_count < 2) count = read_floats(&cursor, portal_sizes[portal_count++], 2, 2);
+        } else {
+            std::cerr << path << ":" << cursor.line << ": unknown item '" << std::string(word, length) << "'" << std::endl;
+            return 1;
+        }
+
+        if (count < 0) {
+            std::cerr << path << ":" << cursor.line << ": wrong values for " << std::string(word, length) << std::endl;
+            return 1;
+        }
+    }
+
+    if (!has_light) {
+        std::cerr << "Scene file " << path << " has no light" << std::endl;
+        return 1;
+    }
+    if (!brushes.empty() && !validate_brushes(path, &brushes[0], brushes.size())) return 1;
+
+    scene->light_dir = light_dir;
+    scene->geometry.swap(brushes);
+    apply_scene_defaults(scene);
+
+    if (has_cubes) std::swap(scene->cubes, cubes);
+    if (has_spawn) {
+        scene->spawn_position = glm::vec3(spawn[0], spawn[1], spawn[2]);
+        scene->spawn_yaw = spawn[3];
+        scene->spawn_pitch = spawn[4];
+    }
+    if (portal_count == 2) {
+        scene->portal1.width = portal_sizes[0][0];
+        scene->portal1.height = portal_sizes[0][1];
+        scene->portal2.width = portal_sizes[1][0];
+        scene->portal2.height = portal_sizes[1][1];
+    }
+
+    return 0;
+}
+
+// Write the scene description as text. Floats are written with enough digits to read back exactly.
+// Returns 0 on success.
+int save_scene_text(const char* path, Scene* scene) {
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        std::cerr << "Could not open " << path << " for writing" << std::endl;
+        return 1;
+    }
+
+    fprintf(out, "%s %d\n", SCENE_TEXT_HEADER, SCENE_TEXT_VERSION);
+    fprintf(out, "light %.9g %.9g %.9g\n", scene->light_dir.x, scene->light_dir.y, scene->light_dir.z);
+    fprintf(out, "spawn %.9g %.9g %.9g %.9g %.9g\n", scene->spawn_position.x, scene->spawn_position.y, scene->spawn_position.z, scene->spawn_yaw, scene->spawn_pitch);
+    fprintf(out, "portal %.9g %.9g\n", scene->portal1.width, scene->portal1.height);
+    fprintf(out, "portal %.9g %.9g\n", scene->portal2.width, scene->portal2.height);
+
+    for (size_t i = 0; i < scene->cubes.count; i++) {
+        Cube cube = cube_body(&scene->cubes, i);
+        fprintf(out, "cube %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", cube.position.x, cube.position.y, cube.position.z, cube.color.r, cube.color.g, cube.color.b, cube.size);
+    }
+
+    // Text is an authoring format, so merged brushes are written as authored
+    const std::vector<Brush>& brushes = scene->authored_geometry.empty() ? scene->geometry : scene->authored_geometry;
+    for (size_t i = 0; i < brushes.size(); i++) {
+        const Brush* brush = &brushes[i];
+        fprintf(out, "brush %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", brush->min.x, brush->min.y, brush->min.z, brush->max.x, brush->max.y, brush->max.z, brush->color.r, brush->color.g, brush->color.b);
+    }
+
+    bool failed = ferror(out) != 0;
+    if (fclose(out) != 0 || failed) {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
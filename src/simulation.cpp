@@ -0,0 +1,157 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Start counting ticks again, after a load or a restored snapshot. The scene clock follows the ticks.
+void reset_simulation(Simulation* sim, Scene* scene, const PlayerState* player) {
+    sim->accumulator = 0.0;
+    sim->tick = 0;
+    sim->previous_position = player->camera.position;
+    scene->time = 0.0;
+    save_previous_positions(&scene->cubes);
+}
+
+// Every tick simulates this much time, in seconds
+float tick_duration(const Simulation* sim) {
+    return 1.0f / (float)sim->tick_rate;
+}
+
+// Add the time a frame took and return how many ticks to run for it
+int advance_simulation(Simulation* sim, double frame_time) {
+    double tick_time = tick_duration(sim);
+    sim->accumulator += frame_time;
+
+    double ticks = std::floor(sim->accumulator / tick_time);
+    if (ticks > SIMULATION_MAX_FRAME_TICKS) {
+        ticks = SIMULATION_MAX_FRAME_TICKS;
+        sim->accumulator = ticks * tick_time;
+    }
+    sim->accumulator -= ticks * tick_time;
+    return (int)ticks;
+}
+
+// Cubes resting on or against a portal's surface may fall through once it opens, or stop doing so once it moves away
+static void wake_cubes_at_portal(Scene* scene, const Portal* portal) {
+    if (!portal->open) return;
+    glm::vec3 reach(std::max(portal->width, portal->height) + CUBE_CONTACT_MARGIN);
+    wake_cubes(scene, portal->position - reach, portal->position + reach);
+}
+
+static bool place_portal(Scene* scene, Portal* portal, Portal* other, RaycastHitInfo* hit_info) {
+    glm::vec3 position;
+    if (!find_portal_placement(scene, portal, other, hit_info, &position)) {
+        return false;
+    }
+
+    wake_cubes_at_portal(scene, portal);
+
+    portal->position = position + hit_info->normal * 0.001f;
+    portal->normal = hit_info->normal;
+    portal->spawn_time = (float)scene->time;
+    portal->brush = hit_info->brush;
+    portal->open = true;
+    wake_cubes_at_portal(scene, portal);
+
+    return true;
+}
+
+// Drop the held cube, or pick up the nearest cube in reach along the view
+static void grab_or_drop(Scene* scene, Camera* cam) {
+    CubeBodies* bodies = &scene->cubes;
+    for (size_t i = 0; i < bodies->count; i++) {
+        if (!(bodies->flags[i] & CUBE_GRABBED)) continue;
+        bodies->flags[i] &= ~CUBE_GRABBED;
+        glm::vec3 velocity = body_velocity(bodies, i);
+        if (glm::length(velocity) > 10.0f) {
+            set_body_velocity(bodies, i, glm::normalize(velocity) * 10.0f);
+        }
+        return;
+    }
+
+    int cube_index = nearest_cube_hit(scene, cam->position, cam->GetForwardDirection(), GRAB_REACH);
+    if (cube_index < 0) return;
+    wake_cube(scene, (uint32_t)cube_index);
+    bodies->flags[cube_index] |= CUBE_GRABBED;
+}
+
+// Advance the player, portals and cubes by one tick. Only reads the scene, the player and the input,
+// never the clock, so a replayed input stream ends up in the same state.
+void simulate_tick(Simulation* sim, Scene* scene, PlayerState* player, const TickInput* input) {
+    float dt = tick_duration(sim);
+    Camera* cam = &player->camera;
+    cam->yaw = input->yaw;
+    cam->pitch = input->pitch;
+    sim->previous_position = cam->position;
+
+    RaycastHitInfo hit_info;
+    if ((input->buttons & TICK_INPUT_PORTAL1) && raycast(cam, scene, &hit_info)) {
+        place_portal(scene, &scene->portal1, &scene->portal2, &hit_info);
+    }
+
+    if ((input->buttons & TICK_INPUT_PORTAL2) && raycast(cam, scene, &hit_info)) {
+        place_portal(scene, &scene->portal2, &scene->portal1, &hit_info);
+    }
+
+    if (input->buttons & TICK_INPUT_GRAB) {
+        grab_or_drop(scene, cam);
+    }
+
+    glm::vec3 translation = glm::vec3(0.0f);
+    float speed_multiplier = dt * MOVEMENT_SPEED * (input->buttons & TICK_INPUT_WALK ? 0.2f : 1.0f);
+
+    if (input->buttons & TICK_INPUT_FORWARD) {
+        translation += cam->GetPitchlessForwardDirection() * speed_multiplier;
+    }
+
+    if (input->buttons & TICK_INPUT_BACK) {
+        translation -= cam->GetPitchlessForwardDirection() * speed_multiplier;
+    }
+
+    if (input->buttons & TICK_INPUT_RIGHT) {
+        translation += cam->GetRightDirection() * speed_multiplier;
+    }
+
+    if (input->buttons & TICK_INPUT_LEFT) {
+        translation -= cam->GetRightDirection() * speed_multiplier;
+    }
+
+    if (player->on_ground && (input->buttons & TICK_INPUT_JUMP)) {
+        player->vel_y = JUMP_SPEED;
+    }
+
+    if (input->buttons & TICK_INPUT_DOWN) {
+        player->vel_y = -JUMP_SPEED;
+    }
+
+    translation.y += player->vel_y * dt;
+
+    if (scene_aware_movement(cam, translation, scene, &player->on_ground)) {
+        sim->previous_position = cam->position; // Went through a portal, do not draw the player crossing the level
+    }
+    update_cubes(scene, cam, dt);
+
+    scene->portal1.draw_on_top = scene->portal1.open && is_in_portal(cam->position, &scene->portal1);
+    scene->portal2.draw_on_top = scene->portal2.open && is_in_portal(cam->position, &scene->portal2);
+
+    if (player->on_ground) {
+        player->vel_y = 0;
+    } else {
+        player->vel_y += GRAVITY * dt;
+    }
+
+    sim->tick++;
+    scene->time = (double)sim->tick / sim->tick_rate;
+}
+
+// How far between the last two ticks the current frame is, from 0 at the previous tick to 1 at the last one
+float tick_blend(const Simulation* sim) {
+    return (float)(sim->accumulator / tick_duration(sim));
+}
+
+// Camera to draw the frame from: between the positions of the last two ticks, looking where the mouse points now
+Camera interpolated_camera(const Simulation* sim, const PlayerState* player) {
+    Camera cam = player->camera;
+    cam.position = glm::mix(sim->previous_position, player->camera.position, tick_blend(sim));
+    return cam;
+}
@@ -0,0 +1,235 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#define VEC3_TO_ARRAY(vec, arr) ((arr)[0] = (vec).x, (arr)[1] = (vec).y, (arr)[2] = (vec).z)
+#define ARRAY_TO_VEC3(arr) glm::vec3((arr)[0], (arr)[1], (arr)[2])
+
+static_assert(sizeof(Brush) == sizeof(SceneBrushRecord), "Brush must match SceneBrushRecord");
+
+template <typename T>
+static void put_record(unsigned char** cursor, const T& record) {
+    memcpy(*cursor, &record, sizeof(T));
+    *cursor += sizeof(T);
+}
+
+template <typename T>
+static void get_record(const unsigned char** cursor, T* record) {
+    memcpy(record, *cursor, sizeof(T));
+    *cursor += sizeof(T);
+}
+
+static size_t snapshot_size(size_t cube_count, size_t contact_count) {
+    return sizeof(SnapshotHeader) + sizeof(SnapshotPlayerRecord) + 2 * sizeof(SnapshotPortalRecord) + cube_count * sizeof(SnapshotCubeRecord) + contact_count * sizeof(SnapshotContactRecord);
+}
+
+static SnapshotPortalRecord portal_record(Scene* scene, Portal* portal) {
+    SnapshotPortalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.open = portal->open;
+    record.draw_on_top = portal->draw_on_top;
+    record.age = (float)scene->time - portal->spawn_time;
+    VEC3_TO_ARRAY(portal->position, record.position);
+    VEC3_TO_ARRAY(portal->normal, record.normal);
+    record.width = portal->width;
+    record.height = portal->height;
+
+    record.brush_index = SNAPSHOT_NO_BRUSH;
+    if (portal->open && portal->brush != NULL) {
+        record.brush_index = (uint32_t)(portal->brush - &scene->geometry[0]);
+        memcpy(&record.brush, portal->brush, sizeof(record.brush));
+    }
+    return record;
+}
+
+static bool portal_record_matches(Scene* scene, const SnapshotPortalRecord* record) {
+    if (record->brush_index == SNAPSHOT_NO_BRUSH) return true;
+    return record->brush_index < scene->geometry.size() && memcmp(&scene->geometry[record->brush_index], &record->brush, sizeof(record->brush)) == 0;
+}
+
+static void restore_portal(Scene* scene, const SnapshotPortalRecord* record, Portal* portal) {
+    portal->open = record->open != 0;
+    portal->draw_on_top = record->draw_on_top != 0;
+    portal->spawn_time = (float)scene->time - record->age;
+    portal->position = ARRAY_TO_VEC3(record->position);
+    portal->normal = ARRAY_TO_VEC3(record->normal);
+    portal->width = record->width;
+    portal->height = record->height;
+    portal->brush = record->brush_index == SNAPSHOT_NO_BRUSH ? NULL : &scene->geometry[record->brush_index];
+}
+
+// Take a snapshot of the dynamic state. The buffer is reused, so saving every frame does not allocate.
+void save_snapshot(Scene* scene, const PlayerState* player, std::vector<unsigned char>* snapshot) {
+    size_t size = snapshot_size(scene->cubes.count, scene->cube_contacts.size());
+    snapshot->resize(size);
+    unsigned char* cursor = &(*snapshot)[0] + sizeof(SnapshotHeader);
+
+    SnapshotPlayerRecord player_record;
+    VEC3_TO_ARRAY(player->camera.position, player_record.position);
+    player_record.yaw = player->camera.yaw;
+    player_record.pitch = player->camera.pitch;
+    player_record.vel_y = player->vel_y;
+    player_record.on_ground = player->on_ground;
+    put_record(&cursor, player_record);
+
+    put_record(&cursor, portal_record(scene, &scene->portal1));
+    put_record(&cursor, portal_record(scene, &scene->portal2));
+
+    for (size_t i = 0; i < scene->cubes.count; i++) {
+        Cube cube = cube_body(&scene->cubes, i);
+        SnapshotCubeRecord record;
+        VEC3_TO_ARRAY(cube.position, record.position);
+        VEC3_TO_ARRAY(cube.velocity, record.velocity);
+        VEC3_TO_ARRAY(cube.color, record.color);
+        record.size = cube.size;
+        record.grabbed = cube.grabbed;
+        record.asleep = (scene->cubes.flags[i] & CUBE_ASLEEP) != 0;
+        record.island = scene->cubes.island[i];
+        record.still_ticks = scene->cubes.still_ticks[i];
+        put_record(&cursor, record);
+    }
+
+    for (size_t i = 0; i < scene->cube_contacts.size(); i++) {
+        const CubeContact* contact = &scene->cube_contacts[i];
+        SnapshotContactRecord record = {
+            contact->a, contact->b, (uint32_t)contact->axis, contact->sign, contact->separation, contact->normal_impulse,
+            { contact->tangent_impulse.x, contact->tangent_impulse.y }
+        };
+        put_record(&cursor, record);
+    }
+
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.brush_count = (uint32_t)scene->geometry.size();
+    header.cube_count = (uint32_t)scene->cubes.count;
+    header.contact_count = (uint32_t)scene->cube_contacts.size();
+    header.crc = crc32(&(*snapshot)[0] + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader));
+    memcpy(&(*snapshot)[0], &header, sizeof(header));
+}
+
+// Restore a snapshot taken with save_snapshot. Returns 0 on success.
+// Nothing is changed when the snapshot is damaged or was taken from a different scene.
+int restore_snapshot(const unsigned char* data, size_t size, Scene* scene, PlayerState* player) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        std::cerr << "Snapshot is truncated" << std::endl;
+        return 1;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        std::cerr << "Not a snapshot or unsupported snapshot version" << std::endl;
+        return 1;
+    }
+
+    size_t expected = snapshot_size(header.cube_count, header.contact_count);
+    if (size != expected || crc32(data + sizeof(header), size - sizeof(header)) != header.crc) {
+        std::cerr << "Snapshot is damaged" << std::endl;
+        return 1;
+    }
+
+    const unsigned char* cursor = data + sizeof(header);
+    SnapshotPlayerRecord player_record;
+    SnapshotPortalRecord portal1, portal2;
+    get_record(&cursor, &player_record);
+    get_record(&cursor, &portal1);
+    get_record(&cursor, &portal2);
+
+    if (header.brush_count != scene->geometry.size() || !portal_record_matches(scene, &portal1) || !portal_record_matches(scene, &portal2)) {
+        std::cerr << "Snapshot was taken from a different scene" << std::endl;
+        return 1;
+    }
+
+    // The solver indexes the cubes by the contacts, so they are checked before anything changes
+    const unsigned char* contact_cursor = cursor + (size_t)header.cube_count * sizeof(SnapshotCubeRecord);
+    std::vector<CubeContact> contacts(header.contact_count);
+    for (uint32_t i = 0; i < header.contact_count; i++) {
+        SnapshotContactRecord record;
+        get_record(&contact_cursor, &record);
+        if (record.a >= header.cube_count || (record.b >= header.cube_count && record.b != CUBE_CONTACT_GROUND) || record.axis > 2) {
+            std::cerr << "Snapshot has a contact between cubes it does not have" << std::endl;
+            return 1;
+        }
+
+        CubeContact* contact = &contacts[i];
+        contact->a = record.a;
+        contact->b = record.b;
+        contact->axis = (int)record.axis;
+        contact->sign = record.sign;
+        contact->separation = record.separation;
+        contact->normal_impulse = record.normal_impulse;
+        contact->tangent_impulse = glm::vec2(record.tangent_impulse[0], record.tangent_impulse[1]);
+    }
+
+    player->camera = Camera(ARRAY_TO_VEC3(player_record.position), player_record.yaw, player_record.pitch);
+    player->vel_y = player_record.vel_y;
+    player->on_ground = player_record.on_ground != 0;
+    restore_portal(scene, &portal1, &scene->portal1);
+    restore_portal(scene, &portal2, &scene->portal2);
+
+    clear_cube_bodies(&scene->cubes);
+    for (uint32_t i = 0; i < header.cube_count; i++) {
+        SnapshotCubeRecord record;
+        get_record(&cursor, &record);
+
+        Cube cube(ARRAY_TO_VEC3(record.position), ARRAY_TO_VEC3(record.color));
+        cube.velocity = ARRAY_TO_VEC3(record.velocity);
+        cube.size = record.size;
+        cube.grabbed = record.grabbed != 0;
+        uint32_t index = add_cube_body(&scene->cubes, &cube);
+        if (record.asleep) scene->cubes.flags[index] |= CUBE_ASLEEP;
+        scene->cubes.island[index] = record.island;
+        scene->cubes.still_ticks[index] = record.still_ticks;
+    }
+
+    // A new cube tree drops the contacts, so it is built before they are put back
+    sync_cube_tree(scene);
+    scene->cube_contacts.swap(contacts);
+
+    return 0;
+}
+
+// Written to a temporary file first, so a crash while saving leaves the previous snapshot intact
+int write_snapshot_file(const char* path, const std::vector<unsigned char>& snapshot) {
+    std::string temporary_path = std::string(path) + ".tmp";
+    {
+        std::ofstream out(temporary_path.c_str(), std::ios::binary);
+        if (out && !snapshot.empty()) out.write(reinterpret_cast<const char*>(&snapshot[0]), snapshot.size());
+        if (!out) {
+            std::cerr << "Could not write " << temporary_path << std::endl;
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    std::remove(path);
+#endif
+    if (std::rename(temporary_path.c_str(), path) != 0) {
+        std::cerr << "Could not replace " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int read_snapshot_file(const char* path, std::vector<unsigned char>* snapshot) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    std::streamoff size = in.tellg();
+    in.seekg(0);
+    snapshot->resize((size_t)size);
+    if (size > 0) in.read(reinterpret_cast<char*>(&(*snapshot)[0]), size);
+    if (!in) {
+        std::cerr << "Could not read " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
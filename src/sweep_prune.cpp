@@ -0,0 +1,86 @@
+#include "sweep_prune.h"
+
+#include <algorithm>
+
+// Axis along which the centers of the boxes vary the most
+static int spread_axis(const glm::vec3* mins, const glm::vec3* maxs, size_t count, int current_axis) {
+    glm::vec3 sum(0.0f);
+    glm::vec3 sum_squares(0.0f);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 center = (mins[i] + maxs[i]) * 0.5f;
+        sum += center;
+        sum_squares += center * center;
+    }
+    glm::vec3 variance = sum_squares / (float)count - (sum / (float)count) * (sum / (float)count);
+
+    int axis = current_axis;
+    for (int a = 0; a < 3; a++) {
+        if (variance[a] > variance[axis] * SWEEP_AXIS_SWITCH_RATIO) axis = a;
+    }
+    return axis;
+}
+
+static bool entry_less(const SweepEntry& a, const SweepEntry& b) {
+    return a.min.x < b.min.x;
+}
+
+static glm::vec3 rotate_axes(glm::vec3 v, int axis) {
+    return glm::vec3(v[axis], v[(axis + 1) % 3], v[(axis + 2) % 3]);
+}
+
+// Bring the entries up to date with the boxes of objects 0 .. count - 1 and collect every pair of overlapping boxes
+// (touching counts as overlapping). Replaces the contents of pairs, which come out in sweep order.
+void sweep_prune_update(SweepPrune* sweep, const glm::vec3* mins, const glm::vec3* maxs, size_t count, std::vector<SweepPair>* pairs) {
+    pairs->clear();
+    std::vector<SweepEntry>& entries = sweep->entries;
+
+    bool resort = false;
+    if (entries.size() != count) {
+        entries.resize(count);
+        for (size_t i = 0; i < count; i++) entries[i].object = (uint32_t)i;
+        resort = true;
+    }
+    if (count < 2) return;
+
+    int axis = spread_axis(mins, maxs, count, sweep->axis);
+    if (axis != sweep->axis) {
+        sweep->axis = axis;
+        resort = true;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i].min = rotate_axes(mins[entries[i].object], axis);
+        entries[i].max = rotate_axes(maxs[entries[i].object], axis);
+    }
+
+    if (resort) {
+        std::sort(entries.begin(), entries.end(), entry_less);
+    } else {
+        // Objects only moved a little since the last update, so only a few entries are out of place
+        for (size_t i = 1; i < count; i++) {
+            SweepEntry entry = entries[i];
+            size_t j = i;
+            while (j > 0 && entry_less(entry, entries[j - 1])) {
+                entries[j] = entries[j - 1];
+                j--;
+            }
+            entries[j] = entry;
+        }
+    }
+
+    // Every box overlapping entry i along the axis starts before it ends, so the inner loop stops at the first one that does not.
+    // Most boxes overlapping along the axis miss on another one, so that test is kept free of branches.
+    for (size_t i = 0; i < count; i++) {
+        const SweepEntry* a = &entries[i];
+        for (size_t j = i + 1; j < count && entries[j].min.x <= a->max.x; j++) {
+            const SweepEntry* b = &entries[j];
+            bool overlap = (a->min.y <= b->max.y) & (b->min.y <= a->max.y) & (a->min.z <= b->max.z) & (b->min.z <= a->max.z);
+            if (!overlap) continue;
+
+            SweepPair pair;
+            pair.a = std::min(a->object, b->object);
+            pair.b = std::max(a->object, b->object);
+            pairs->push_back(pair);
+        }
+    }
+}
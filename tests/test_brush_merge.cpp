@@ -0,0 +1,157 @@
+// Merging must cover exactly the space the authored brushes covered, with their colors, and every
+// authored brush must map to the merged brush holding it, so raycasts still report the authored brush hit.
+
+#include "brush_merge.h"
+#include "test_util.h"
+
+#define SAMPLE_COUNT 200000
+#define RAY_COUNT 5000
+#define FACE_EPSILON 1e-3f
+
+static bool inside(const Brush* brush, glm::vec3 point) {
+    return point.x > brush->min.x && point.x < brush->max.x && point.y > brush->min.y && point.y < brush->max.y && point.z > brush->min.z && point.z < brush->max.z;
+}
+
+static bool solid(const std::vector<Brush>& brushes, glm::vec3 point) {
+    for (size_t i = 0; i < brushes.size(); i++) {
+        if (inside(&brushes[i], point)) return true;
+    }
+    return false;
+}
+
+// Whether every brush holding the point has the color of some authored brush holding it
+static bool colors_kept(const std::vector<Brush>& merged, const std::vector<Brush>& authored, glm::vec3 point) {
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (!inside(&merged[i], point)) continue;
+        bool found = false;
+        for (size_t k = 0; k < authored.size() && !found; k++) {
+            found = inside(&authored[k], point) && authored[k].color == merged[i].color;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+// A tiled floor, a wall built from segments, overlapping runs, a block of unit cubes and random boxes of random colors
+static void build_authored(Scene* scene) {
+    apply_scene_defaults(scene);
+    glm::vec3 grey(0.5f), red(0.8f, 0.2f, 0.2f), blue(0.2f, 0.2f, 0.8f);
+    for (int x = 0; x < 20; x++) {
+        for (int z = 0; z < 20; z++) {
+            scene->geometry.push_back(Brush(glm::vec3(x, -1.0f, z), glm::vec3(x + 1, 0.0f, z + 1), grey));
+        }
+    }
+
+    TestRandom random(17);
+    for (float x = 0.0f; x < 20.0f;) {
+        float length = glm::min(20.0f - x, 0.5f + (float)(int)random.range(0.0f, 4.0f));
+        scene->geometry.push_back(Brush(glm::vec3(x, 0.0f, 10.0f), glm::vec3(x + length, 3.0f, 10.5f), red));
+        x += length;
+    }
+    for (int i = 0; i < 5; i++) {
+        float z = 2.0f + i;
+        scene->geometry.push_back(Brush(glm::vec3(1.0f, 0.0f, z), glm::vec3(4.0f, 1.0f, z + 0.5f), blue));
+        scene->geometry.push_back(Brush(glm::vec3(3.0f, 0.0f, z), glm::vec3(6.0f, 1.0f, z + 0.5f), blue)); // Overlaps the one before
+    }
+    for (int x = 0; x < 2; x++) {
+        for (int y = 0; y < 2; y++) {
+            for (int z = 0; z < 2; z++) {
+                scene->geometry.push_back(Brush(glm::vec3(14 + x, y, 14 + z), glm::vec3(15 + x, y + 1, 15 + z), red));
+            }
+        }
+    }
+    for (int i = 0; i < 60; i++) {
+        glm::vec3 min(random.range(0.0f, 19.0f), random.range(0.0f, 4.0f), random.range(0.0f, 19.0f));
+        glm::vec3 color = i % 3 == 0 ? grey : glm::vec3(random.unit(), random.unit(), random.unit());
+        scene->geometry.push_back(Brush(min, min + glm::vec3(random.range(0.2f, 2.0f)), color));
+    }
+}
+
+// Random points are solid after merging exactly where they were before, with the same colors
+static void check_union(Scene* scene, const std::vector<Brush>& authored) {
+    TestRandom random(18);
+    int covered = 0;
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        glm::vec3 point(random.range(-0.5f, 20.5f), random.range(-1.5f, 6.5f), random.range(-0.5f, 20.5f));
+        bool before = solid(authored, point);
+        covered += before;
+        CHECK(before == solid(scene->geometry, point), "(%.3f %.3f %.3f) is solid only %s merging", point.x, point.y, point.z, before ? "before" : "after");
+        CHECK(colors_kept(scene->geometry, authored, point), "(%.3f %.3f %.3f) changed color when merging", point.x, point.y, point.z);
+    }
+    printf("  %d of %d sample points solid both before and after merging\n", covered, SAMPLE_COUNT);
+}
+
+static void check_authored_map(Scene* scene) {
+    const std::vector<Brush>& authored = scene->authored_geometry;
+    CHECK(scene->authored_map.size() == authored.size(), "%zu authored brushes but %zu in the map", authored.size(), scene->authored_map.size());
+    CHECK(scene->authored_first.size() == scene->geometry.size() + 1 && scene->authored_first.back() == authored.size(), "reverse lookup does not cover the authored brushes");
+
+    std::vector<int> listed(authored.size(), 0);
+    for (size_t m = 0; m + 1 < scene->authored_first.size(); m++) {
+        CHECK(scene->authored_first[m] < scene->authored_first[m + 1], "merged brush %zu holds no authored brush", m);
+        for (uint32_t k = scene->authored_first[m]; k < scene->authored_first[m + 1]; k++) {
+            uint32_t a = scene->authored_indices[k];
+            listed[a]++;
+            CHECK(scene->authored_map[a] == m, "authored brush %u is listed under merged brush %zu but maps to %u", a, m, scene->authored_map[a]);
+            CHECK(k == scene->authored_first[m] || scene->authored_indices[k - 1] < a, "authored brushes of merged brush %zu are not in index order", m);
+        }
+    }
+
+    for (size_t a = 0; a < authored.size(); a++) {
+        CHECK(listed[a] == 1, "authored brush %zu is listed %d times", a, listed[a]);
+        const Brush* merged = &scene->geometry[scene->authored_map[a]];
+        bool holds = merged->min.x <= authored[a].min.x && merged->min.y <= authored[a].min.y && merged->min.z <= authored[a].min.z &&
+                     merged->max.x >= authored[a].max.x && merged->max.y >= authored[a].max.y && merged->max.z >= authored[a].max.z;
+        CHECK(holds && merged->color == authored[a].color, "authored brush %zu is not inside its merged brush or has another color", a);
+    }
+}
+
+// Rays hitting merged brushes report an authored brush of the hit brush, with a face through the hit point
+static void check_raycasts(Scene* scene) {
+    TestRandom random(19);
+    int hits = 0;
+    for (int i = 0; i < RAY_COUNT; i++) {
+        glm::vec3 origin(random.range(0.5f, 19.5f), random.range(4.5f, 6.0f), random.range(0.5f, 19.5f));
+        glm::vec3 dir(random.range(-1.0f, 1.0f), random.range(-1.0f, -0.1f), random.range(-1.0f, 1.0f));
+        RaycastHitInfo hit_info;
+        if (!raycast_ray(scene, origin, dir, &hit_info)) continue;
+        hits++;
+
+        const Brush* authored = hit_info.authored_brush;
+        bool is_authored = authored >= &scene->authored_geometry[0] && authored < &scene->authored_geometry[0] + scene->authored_geometry.size();
+        CHECK(is_authored, "ray %d reports a brush that is not an authored one", i);
+        if (!is_authored) continue;
+
+        size_t a = authored - &scene->authored_geometry[0];
+        glm::vec3 p = hit_info.intersection;
+        bool on_brush = p.x >= authored->min.x - FACE_EPSILON && p.x <= authored->max.x + FACE_EPSILON &&
+                        p.y >= authored->min.y - FACE_EPSILON && p.y <= authored->max.y + FACE_EPSILON &&
+                        p.z >= authored->min.z - FACE_EPSILON && p.z <= authored->max.z + FACE_EPSILON;
+        CHECK(scene->authored_map[a] == (uint32_t)(hit_info.brush - &scene->geometry[0]), "ray %d reports authored brush %zu of another merged brush", i, a);
+        CHECK(on_brush, "ray %d hit (%.3f %.3f %.3f), off authored brush %zu", i, p.x, p.y, p.z, a);
+    }
+    printf("  %d raycasts report the authored brush they hit\n", hits);
+}
+
+int main() {
+    Scene scene;
+    build_authored(&scene);
+    std::vector<Brush> authored = scene.geometry;
+
+    size_t removed = merge_brushes(&scene);
+    CHECK(removed > 400, "only %zu of %zu brushes merged away", removed, authored.size());
+    CHECK(scene.authored_geometry.size() == authored.size(), "authored brushes were not kept");
+    printf("  %zu authored brushes merged into %zu\n", authored.size(), scene.geometry.size());
+
+    check_union(&scene, authored);
+    check_authored_map(&scene);
+
+    // Nothing is left to merge, and merging again keeps the map to the authored brushes
+    std::vector<uint32_t> map = scene.authored_map;
+    CHECK(merge_brushes(&scene) == 0 && scene.authored_map == map, "merging again changed the brushes");
+
+    bake_scene(&scene);
+    check_raycasts(&scene);
+    close_scene_file(&scene);
+    return test_result("brush merge");
+}
@@ -0,0 +1,83 @@
+// Boxes must not tunnel: a move long enough to jump over a thin brush in one tick, or one that only
+// clips the corner of a brush halfway through, stops where it first touches the brush.
+
+#include "test_util.h"
+
+#define DELTA_TIME (1.0f / 60.0f)
+#define THIN 0.05f // Thinner than any box moves in one of the ticks below
+
+// Where a box with the given bounds overlaps a brush of the scene, which no move may end in
+static bool overlaps_brush(Scene* scene, glm::vec3 min, glm::vec3 max) {
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        Brush* brush = &scene->geometry[i];
+        glm::vec3 overlap = glm::min(max, brush->max) - glm::max(min, brush->min);
+        if (overlap.x > 0.001f && overlap.y > 0.001f && overlap.z > 0.001f) return true;
+    }
+    return false;
+}
+
+static void build_scene(Scene* scene) {
+    apply_scene_defaults(scene);
+    glm::vec3 grey(0.7f);
+    scene->geometry.push_back(Brush(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(20.0f, THIN, 20.0f), grey)); // Thin floor
+    scene->geometry.push_back(Brush(glm::vec3(10.0f, THIN, 0.0f), glm::vec3(10.0f + THIN, 4.0f, 10.0f), grey)); // Thin wall across x
+    scene->geometry.push_back(Brush(glm::vec3(3.0f, THIN, 15.8f), glm::vec3(3.5f, 2.0f, 16.3f), grey)); // Post for the corner hit
+    bake_scene(scene);
+}
+
+// A box moving straight at a thin brush, far enough to be clear of it on the other side at the end of the move
+static void check_thin_brushes(Scene* scene) {
+    glm::vec3 half(0.25f);
+    glm::vec3 start(8.0f, 1.0f, 5.0f);
+    glm::vec3 translation(5.0f, 0.0f, 0.0f);
+    CHECK(!overlaps_brush(scene, start + translation - half, start + translation + half), "the move through the wall does not end clear of it");
+
+    std::vector<uint32_t> candidates;
+    bool on_ground = false;
+    glm::vec3 moved = move_aabb(scene, start - half, start + half, translation, NULL, &candidates, &on_ground);
+    CHECK(start.x + moved.x + half.x <= 10.0f + 0.001f, "box went %.2f through a wall %.2f thick", moved.x, THIN);
+    CHECK(start.x + moved.x + half.x >= 10.0f - 0.02f, "box stopped %.2f short of the wall", 10.0f - start.x - moved.x - half.x);
+
+    // A cube falling fast onto the thin floor lands on it
+    clear_cube_bodies(&scene->cubes);
+    Cube cube(glm::vec3(15.0f, 2.0f, 15.0f), glm::vec3(1.0f));
+    cube.velocity = glm::vec3(0.0f, -240.0f, 0.0f);
+    add_cube_body(&scene->cubes, &cube);
+    Camera cam(glm::vec3(2.0f, 1.6f, 2.0f), 0.0f, 0.0f);
+    update_cubes(scene, &cam, DELTA_TIME);
+    float bottom = body_position(&scene->cubes, 0).y - scene->cubes.size[0];
+    CHECK(bottom >= THIN - 0.001f && bottom < THIN + 0.02f, "cube falling %.1f per tick ended with its bottom at %.3f, not on the floor", 240.0f * DELTA_TIME, bottom);
+
+    // The player running at the wall in one long step stops in front of it
+    Camera player(glm::vec3(9.0f, 1.6f, 5.0f), 0.0f, 0.0f);
+    scene_aware_movement(&player, glm::vec3(3.0f, 0.0f, 0.0f), scene, &on_ground);
+    CHECK(player.position.x + 0.2f <= 10.0f + 0.001f, "player went through the wall to x %.2f", player.position.x);
+    printf("  box, falling cube and player stop at brushes %.2f thick\n", THIN);
+}
+
+// A box moving diagonally past a post is clear of it at both ends of the move, but clips its corner on the way
+static void check_corner(Scene* scene) {
+    glm::vec3 min(0.0f, 0.5f, 13.0f);
+    glm::vec3 max(1.0f, 1.5f, 14.0f);
+    glm::vec3 translation(4.0f, 0.0f, 4.0f);
+    CHECK(!overlaps_brush(scene, min, max) && !overlaps_brush(scene, min + translation, max + translation), "the corner move does not start and end clear of the post");
+
+    std::vector<uint32_t> candidates;
+    bool on_ground = false;
+    glm::vec3 moved = move_aabb(scene, min, max, translation, NULL, &candidates, &on_ground);
+
+    // It hits the face of the post at x = 3 first, then slides along it for the rest of the move along z
+    CHECK(max.x + moved.x <= 3.0f + 0.001f && max.x + moved.x >= 3.0f - 0.02f, "box clipping the corner ended at x %.3f instead of against the post", max.x + moved.x);
+    CHECK(glm::abs(moved.z - translation.z) < 0.001f, "box did not slide along the post, moved %.3f of %.3f", moved.z, translation.z);
+    CHECK(!overlaps_brush(scene, min + moved, max + moved), "box clipping the corner ended inside a brush");
+    printf("  box clipping a corner stops against it and slides along\n");
+}
+
+int main() {
+    Scene scene;
+    build_scene(&scene);
+    check_thin_brushes(&scene);
+    check_corner(&scene);
+    close_scene_file(&scene);
+    return test_result("collision");
+}
@@ -0,0 +1,206 @@
+// Cube stepping must not depend on how the work was split: the SIMD body loops match scalar ones,
+// update_cubes gives the same state on any number of workers, and a restored snapshot carries on
+// exactly like the run it was saved from. Cubes resting on each other sleep and wake as one island.
+
+#include <cstring>
+
+#include "job_system.h"
+#include "snapshot.h"
+#include "test_util.h"
+
+#define DELTA_TIME (1.0f / 60.0f)
+
+static void add_random_cubes(Scene* scene, int count, float size, float height, uint64_t seed) {
+    clear_cube_bodies(&scene->cubes);
+    TestRandom random(seed);
+    for (int i = 0; i < count; i++) {
+        Cube cube(glm::vec3(random.range(1.0f, size - 1.0f), random.range(0.5f, height - 1.0f), random.range(1.0f, size - 1.0f)), glm::vec3(1.0f));
+        cube.velocity = glm::vec3(random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f));
+        add_cube_body(&scene->cubes, &cube);
+    }
+}
+
+static void check_body_loops() {
+    CubeBodies bodies;
+    TestRandom random(3);
+    for (int i = 0; i < 37; i++) {
+        Cube cube(glm::vec3(random.range(-10.0f, 10.0f), random.range(-10.0f, 10.0f), random.range(-10.0f, 10.0f)), glm::vec3(1.0f));
+        cube.velocity = glm::vec3(random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f));
+        cube.size = random.range(0.1f, 1.0f);
+        cube.grabbed = i % 5 == 0;
+        add_cube_body(&bodies, &cube);
+        if (i % 7 == 0) bodies.flags[i] |= CUBE_ASLEEP;
+    }
+
+    size_t padded = padded_body_count(&bodies);
+    CHECK(padded % CUBE_BODIES_BATCH == 0 && padded >= bodies.count, "%zu bodies padded to %zu", bodies.count, padded);
+    const void* hot[] = { &bodies.position_x[0], &bodies.previous_y[0], &bodies.velocity_z[0], &bodies.size[0], &bodies.flags[0] };
+    for (size_t a = 0; a < sizeof(hot) / sizeof(hot[0]); a++) {
+        CHECK((uintptr_t)hot[a] % CUBE_BODIES_ALIGNMENT == 0, "hot array %zu is not aligned for the SIMD loops", a);
+    }
+
+    // Scalar versions of the loops in cube_bodies.cpp
+    CubeBodies expected = bodies;
+    BodyArray expected_masses(padded), pushes[3], expected_translations[3];
+    for (int axis = 0; axis < 3; axis++) {
+        pushes[axis].resize(padded);
+        expected_translations[axis].resize(padded);
+        for (size_t i = 0; i < padded; i++) pushes[axis][i] = random.range(-1.0f, 1.0f);
+    }
+    float* expected_velocities[3] = { &expected.velocity_x[0], &expected.velocity_y[0], &expected.velocity_z[0] };
+    float* expected_positions[3] = { &expected.position_x[0], &expected.position_y[0], &expected.position_z[0] };
+    for (size_t i = 0; i < padded; i++) {
+        if (expected.flags[i] == 0) expected.velocity_y[i] += -8.0f * DELTA_TIME;
+        float s = expected.size[i];
+        expected_masses[i] = expected.flags[i] == 0 ? 1.0f / (8.0f * s * s * s) : 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            expected_translations[axis][i] = (expected_velocities[axis][i] + pushes[axis][i]) * DELTA_TIME;
+            expected_positions[axis][i] += expected_translations[axis][i];
+        }
+    }
+
+    BodyArray masses(padded), translations[3]; // Aligned, as update_cubes passes them
+    for (int axis = 0; axis < 3; axis++) translations[axis].resize(padded);
+    const float* push_arrays[3] = { &pushes[0][0], &pushes[1][0], &pushes[2][0] };
+    float* translation_arrays[3] = { &translations[0][0], &translations[1][0], &translations[2][0] };
+    integrate_gravity(&bodies, -8.0f * DELTA_TIME);
+    body_inverse_masses(&bodies, &masses[0]);
+    body_translations(&bodies, push_arrays, DELTA_TIME, translation_arrays);
+    translate_bodies(&bodies, translation_arrays);
+
+    CHECK(bodies.velocity_y == expected.velocity_y, "integrate_gravity differs from the scalar loop");
+    CHECK(masses == expected_masses, "body_inverse_masses differs from the scalar loop");
+    for (int axis = 0; axis < 3; axis++) {
+        CHECK(translations[axis] == expected_translations[axis], "body_translations differs from the scalar loop on axis %d", axis);
+    }
+    CHECK(bodies.position_x == expected.position_x && bodies.position_y == expected.position_y && bodies.position_z == expected.position_z, "translate_bodies differs from the scalar loop");
+}
+
+static uint64_t run_cubes(size_t workers) {
+    start_job_system(shared_job_system(), workers);
+
+    Scene scene;
+    build_test_scene(&scene, 30.0f, 8.0f, 500, 4);
+    add_random_cubes(&scene, 1000, 30.0f, 8.0f, 5);
+    scene.cubes.flags[0] |= CUBE_GRABBED;
+    Camera cam(body_position(&scene.cubes, 0) + glm::vec3(0.0f, 0.0f, 2.0f), 0.0f, 0.0f);
+
+    for (int tick = 0; tick < 120; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+
+    uint64_t hash = cube_state_hash(&scene.cubes);
+    hash = hash_bytes(hash, scene.cube_pairs.empty() ? NULL : &scene.cube_pairs[0], scene.cube_pairs.size() * sizeof(SweepPair));
+    printf("  %zu workers: hash %016llx\n", workers, (unsigned long long)hash);
+    close_scene_file(&scene);
+    return hash;
+}
+
+static void check_snapshot_replay() {
+    Scene scene;
+    build_test_scene(&scene, 20.0f, 6.0f, 0, 6);
+    clear_cube_bodies(&scene.cubes);
+    for (int x = 0; x < 6; x++) {
+        for (int z = 0; z < 6; z++) {
+            for (int y = 0; y < 3; y++) {
+                Cube cube(glm::vec3(2.0f + x, 0.25f + 0.51f * y, 2.0f + z), glm::vec3(1.0f));
+                add_cube_body(&scene.cubes, &cube);
+            }
+        }
+    }
+    Camera cam(glm::vec3(1.0f, 1.6f, 1.0f), 0.0f, 0.0f);
+    PlayerState player(cam, 0.0f, true);
+
+    // Save while most of the cubes sleep and a dropped one is still settling onto them
+    for (int tick = 0; tick < 150; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+    Cube dropped(glm::vec3(2.1f, 3.0f, 2.1f), glm::vec3(1.0f));
+    add_cube_body(&scene.cubes, &dropped);
+    for (int tick = 0; tick < 45; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+
+    std::vector<unsigned char> snapshot;
+    save_snapshot(&scene, &player, &snapshot);
+    for (int tick = 0; tick < 200; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+    uint64_t saved_run = cube_state_hash(&scene.cubes);
+
+    CHECK(restore_snapshot(&snapshot[0], snapshot.size(), &scene, &player) == 0, "snapshot did not restore");
+    for (int tick = 0; tick < 200; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+    CHECK(cube_state_hash(&scene.cubes) == saved_run, "run from the restored snapshot differs from the run after saving it");
+
+    snapshot[sizeof(SnapshotHeader)] ^= 1;
+    CHECK(restore_snapshot(&snapshot[0], snapshot.size(), &scene, &player) != 0, "damaged snapshot restored");
+    close_scene_file(&scene);
+}
+
+static bool asleep(const Scene* scene, size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) {
+        if (!(scene->cubes.flags[i] & CUBE_ASLEEP)) return false;
+    }
+    return true;
+}
+
+static bool awake(const Scene* scene, size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) {
+        if (scene->cubes.flags[i] & CUBE_ASLEEP) return false;
+    }
+    return true;
+}
+
+// A stack falls asleep in the same tick as one island and wakes whole when anything touches one of its cubes,
+// while a cube resting alone elsewhere sleeps through it
+static void check_islands() {
+    Scene scene;
+    build_test_scene(&scene, 20.0f, 6.0f, 0, 6);
+    clear_cube_bodies(&scene.cubes);
+    for (int y = 0; y < 3; y++) {
+        Cube cube(glm::vec3(5.0f, 0.25f + 0.5f * y, 5.0f), glm::vec3(1.0f));
+        add_cube_body(&scene.cubes, &cube);
+    }
+    Cube lone(glm::vec3(15.0f, 0.25f, 15.0f), glm::vec3(1.0f));
+    add_cube_body(&scene.cubes, &lone);
+    Camera cam(glm::vec3(1.0f, 1.6f, 1.0f), 0.0f, 0.0f);
+
+    int tick = 0;
+    bool together = true;
+    for (; tick < 300 && !asleep(&scene, 0, 4); tick++) {
+        update_cubes(&scene, &cam, DELTA_TIME);
+        together = together && (asleep(&scene, 0, 3) || awake(&scene, 0, 3));
+    }
+    CHECK(asleep(&scene, 0, 4), "cubes still awake after %d ticks", tick);
+    CHECK(together, "the stack did not fall asleep in one tick");
+    CHECK(scene.cubes.island[0] == 0 && scene.cubes.island[1] == 0 && scene.cubes.island[2] == 0 && scene.cubes.island[3] == 3, "islands %u %u %u %u instead of 0 0 0 3",
+          scene.cubes.island[0], scene.cubes.island[1], scene.cubes.island[2], scene.cubes.island[3]);
+    int slept_at = tick;
+
+    // Waking the top cube wakes the cubes under it
+    wake_cube(&scene, 2);
+    CHECK(awake(&scene, 0, 3) && asleep(&scene, 3, 1), "waking the top of the stack did not wake exactly the stack");
+    for (tick = 0; tick < 300 && !asleep(&scene, 0, 3); tick++) update_cubes(&scene, &cam, DELTA_TIME);
+    CHECK(asleep(&scene, 0, 3), "woken stack does not fall asleep again");
+
+    // A cube dropped on the stack wakes all of it as soon as it comes within reach, the lone cube sleeps on
+    Cube dropped(glm::vec3(5.0f, 3.0f, 5.0f), glm::vec3(1.0f));
+    add_cube_body(&scene.cubes, &dropped);
+    bool woke_together = false, lone_slept = true;
+    for (tick = 0; tick < 120; tick++) {
+        update_cubes(&scene, &cam, DELTA_TIME);
+        CHECK(asleep(&scene, 0, 3) || awake(&scene, 0, 3), "tick %d: only part of the stack is awake", tick);
+        woke_together = woke_together || awake(&scene, 0, 3);
+        lone_slept = lone_slept && asleep(&scene, 3, 1);
+    }
+    CHECK(woke_together, "a cube landing on the stack did not wake it");
+    CHECK(lone_slept, "the lone cube woke up with the stack");
+    float top = body_position(&scene.cubes, 4).y;
+    CHECK(top > 1.7f && top < 1.8f, "dropped cube ended at height %.3f instead of on top of the stack", top);
+    printf("  stack of 3 fell asleep as one island after %d ticks, woke whole, lone cube slept through\n", slept_at);
+    close_scene_file(&scene);
+}
+
+int main() {
+    check_body_loops();
+
+    uint64_t serial = run_cubes(0);
+    CHECK(run_cubes(3) == serial, "update_cubes on 3 workers differs from the serial run");
+    CHECK(run_cubes(7) == serial, "update_cubes on 7 workers differs from the serial run");
+
+    check_snapshot_replay();
+    check_islands();
+    return test_result("cubes");
+}
@@ -0,0 +1,177 @@
+// The dynamic tree must stay valid while objects are inserted, moved and removed, and its queries
+// must find exactly the leaf boxes a linear scan finds. The cube queries built on it must not miss a cube.
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "dynamic_tree.h"
+#include "test_util.h"
+
+#define OBJECT_COUNT 2000
+#define ROUND_COUNT 20
+#define QUERY_COUNT 100
+#define WORLD_SIZE 100.0f
+#define DELTA_TIME (1.0f / 60.0f)
+
+static bool boxes_overlap(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max) {
+    return a_min.x <= b_max.x && b_min.x <= a_max.x &&
+           a_min.y <= b_max.y && b_min.y <= a_max.y &&
+           a_min.z <= b_max.z && b_min.z <= a_max.z;
+}
+
+// Same slab test as dynamic_tree_raycast
+static bool ray_enters_box(glm::vec3 origin, glm::vec3 dir, float max_distance, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 inv_dir = 1.0f / dir;
+    float t_min = 0.0f;
+    float t_max = max_distance;
+    for (int axis = 0; axis < 3; axis++) {
+        float t1 = (min[axis] - origin[axis]) * inv_dir[axis];
+        float t2 = (max[axis] - origin[axis]) * inv_dir[axis];
+        if (std::isnan(t1) || std::isnan(t2)) continue;
+        t_min = std::max(t_min, std::min(t1, t2));
+        t_max = std::min(t_max, std::max(t1, t2));
+    }
+    return t_min <= t_max;
+}
+
+static glm::vec3 random_point(TestRandom* random) {
+    return glm::vec3(random->range(0.0f, WORLD_SIZE), random->range(0.0f, WORLD_SIZE), random->range(0.0f, WORLD_SIZE));
+}
+
+static glm::vec3 random_dir(TestRandom* random, int i) {
+    glm::vec3 dir(random->range(-1.0f, 1.0f), random->range(-1.0f, 1.0f), random->range(-1.0f, 1.0f));
+    if (i % 8 == 0) dir[i / 8 % 3] = 0.0f; // Rays that do not move along an axis
+    return dir;
+}
+
+// Compare the queries with a scan over the leaves of the live objects
+static void check_tree_queries(const DynamicTree* tree, const std::vector<int>& proxies, TestRandom* random, int round) {
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        glm::vec3 min = random_point(random);
+        glm::vec3 max = min + glm::vec3(random->range(0.0f, 20.0f), random->range(0.0f, 20.0f), random->range(0.0f, 20.0f));
+        glm::vec3 origin = random_point(random);
+        glm::vec3 dir = random_dir(random, i);
+        float max_distance = random->range(1.0f, 50.0f);
+
+        std::vector<uint32_t> linear_boxes, linear_rays;
+        for (size_t object = 0; object < proxies.size(); object++) {
+            if (proxies[object] == DYNAMIC_TREE_NULL) continue;
+            const DynamicTreeNode* leaf = &tree->nodes[proxies[object]];
+            if (boxes_overlap(leaf->min, leaf->max, min, max)) linear_boxes.push_back((uint32_t)object);
+            if (ray_enters_box(origin, dir, max_distance, leaf->min, leaf->max)) linear_rays.push_back((uint32_t)object);
+        }
+
+        std::vector<uint32_t> results;
+        dynamic_tree_query(tree, min, max, &results);
+        std::sort(results.begin(), results.end());
+        CHECK(results == linear_boxes, "round %d: box query %d differs from the linear scan", round, i);
+
+        results.clear();
+        dynamic_tree_raycast(tree, origin, dir, max_distance, &results);
+        std::sort(results.begin(), results.end());
+        CHECK(results == linear_rays, "round %d: raycast %d differs from the linear scan", round, i);
+    }
+}
+
+static void check_tree_operations() {
+    DynamicTree tree;
+    TestRandom random(7);
+    std::vector<int> proxies(OBJECT_COUNT);
+    std::vector<glm::vec3> mins(OBJECT_COUNT), maxs(OBJECT_COUNT);
+    for (size_t i = 0; i < OBJECT_COUNT; i++) {
+        mins[i] = random_point(&random);
+        maxs[i] = mins[i] + glm::vec3(random.range(0.1f, 2.0f), random.range(0.1f, 2.0f), random.range(0.1f, 2.0f));
+        proxies[i] = dynamic_tree_insert(&tree, mins[i], maxs[i], (uint32_t)i);
+    }
+    CHECK(validate_dynamic_tree(&tree), "tree is invalid after inserting");
+    check_tree_queries(&tree, proxies, &random, 0);
+
+    for (int round = 1; round <= ROUND_COUNT; round++) {
+        // Move everything, and take out or put back a different part of the objects every round
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            glm::vec3 displacement(random.range(-0.5f, 0.5f), random.range(-0.5f, 0.5f), random.range(-0.5f, 0.5f));
+            mins[i] += displacement;
+            maxs[i] += displacement;
+            if ((i + round) % 5 == 0) {
+                if (proxies[i] != DYNAMIC_TREE_NULL) {
+                    dynamic_tree_remove(&tree, proxies[i]);
+                    proxies[i] = DYNAMIC_TREE_NULL;
+                } else {
+                    proxies[i] = dynamic_tree_insert(&tree, mins[i], maxs[i], (uint32_t)i);
+                }
+            } else if (proxies[i] != DYNAMIC_TREE_NULL) {
+                dynamic_tree_update(&tree, proxies[i], mins[i], maxs[i], displacement);
+            }
+        }
+
+        CHECK(validate_dynamic_tree(&tree), "round %d: tree is invalid", round);
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            if (proxies[i] == DYNAMIC_TREE_NULL) continue;
+            const DynamicTreeNode* leaf = &tree.nodes[proxies[i]];
+            bool inside = glm::min(leaf->min, mins[i]) == leaf->min && glm::max(leaf->max, maxs[i]) == leaf->max;
+            CHECK(leaf->object == i && inside, "round %d: leaf of object %zu does not hold it", round, i);
+        }
+        check_tree_queries(&tree, proxies, &random, round);
+    }
+
+    // Removed nodes are reused, so the node count stays at what the most objects at once needed
+    CHECK(tree.nodes.size() < 2 * OBJECT_COUNT, "%zu nodes for at most %d objects", tree.nodes.size(), OBJECT_COUNT);
+    printf("  %d rounds of moves, removals and insertions on %d objects: tree height %d\n", ROUND_COUNT, OBJECT_COUNT, tree.nodes[tree.root].height);
+
+    for (size_t i = 0; i < OBJECT_COUNT; i++) {
+        if (proxies[i] != DYNAMIC_TREE_NULL) dynamic_tree_remove(&tree, proxies[i]);
+    }
+    CHECK(tree.root == DYNAMIC_TREE_NULL && validate_dynamic_tree(&tree), "tree is not empty after removing everything");
+}
+
+// cube_query and cube_raycast may return extra cubes but never miss one the box or ray touches
+static void check_cube_queries() {
+    Scene scene;
+    build_test_scene(&scene, 20.0f, 6.0f, 0, 8);
+    clear_cube_bodies(&scene.cubes);
+    TestRandom random(9);
+    for (int i = 0; i < 300; i++) {
+        Cube cube(glm::vec3(random.range(1.0f, 19.0f), random.range(0.5f, 5.0f), random.range(1.0f, 19.0f)), glm::vec3(1.0f));
+        cube.velocity = glm::vec3(random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f), random.range(-5.0f, 5.0f));
+        add_cube_body(&scene.cubes, &cube);
+    }
+    Camera cam(glm::vec3(1.0f, 1.6f, 1.0f), 0.0f, 0.0f);
+    for (int tick = 0; tick < 60; tick++) update_cubes(&scene, &cam, DELTA_TIME);
+    CHECK(validate_dynamic_tree(&scene.cube_tree), "cube tree is invalid after stepping the cubes");
+
+    const CubeBodies* bodies = &scene.cubes;
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        glm::vec3 min(random.range(0.0f, 20.0f), random.range(0.0f, 6.0f), random.range(0.0f, 20.0f));
+        glm::vec3 max = min + glm::vec3(random.range(0.0f, 4.0f));
+        glm::vec3 origin(random.range(0.0f, 20.0f), random.range(0.0f, 6.0f), random.range(0.0f, 20.0f));
+        glm::vec3 dir = random_dir(&random, i);
+        float max_distance = random.range(1.0f, 20.0f);
+
+        std::vector<uint32_t> boxes, rays;
+        cube_query(&scene, min, max, &boxes);
+        cube_raycast(&scene, origin, dir, max_distance, &rays);
+        CHECK(std::adjacent_find(boxes.begin(), boxes.end(), std::greater_equal<uint32_t>()) == boxes.end(), "cube query %d is not in increasing order", i);
+        CHECK(std::adjacent_find(rays.begin(), rays.end(), std::greater_equal<uint32_t>()) == rays.end(), "cube raycast %d is not in increasing order", i);
+
+        for (size_t c = 0; c < bodies->count; c++) {
+            glm::vec3 position = body_position(bodies, c);
+            glm::vec3 cube_min = position - bodies->size[c];
+            glm::vec3 cube_max = position + bodies->size[c];
+            if (boxes_overlap(cube_min, cube_max, min, max)) {
+                CHECK(std::binary_search(boxes.begin(), boxes.end(), (uint32_t)c), "cube query %d misses cube %zu", i, c);
+            }
+            if (ray_enters_box(origin, dir, max_distance, cube_min, cube_max)) {
+                CHECK(std::binary_search(rays.begin(), rays.end(), (uint32_t)c), "cube raycast %d misses cube %zu", i, c);
+            }
+        }
+    }
+    printf("  %zu cubes: queries and raycasts find every cube they touch\n", bodies->count);
+    close_scene_file(&scene);
+}
+
+int main() {
+    check_tree_operations();
+    check_cube_queries();
+    return test_result("dynamic tree");
+}
@@ -0,0 +1,68 @@
+// Portals fit on any surface formed by coplanar faces, so a wall built to refuse portals must not be one
+// flat surface: scenegen staggers the strips of such walls, and merging brushes must not undo that.
+
+#include "brush_merge.h"
+#include "test_util.h"
+
+#define STRIP_WIDTH 1.5f // Same strips as scenegen
+#define STRIP_STAGGER 0.1f
+#define WALL_HEIGHT 5.0f
+#define WALL_THICKNESS 0.5f
+
+// Wall along x from from_x to to_x, centered on z, split into strips when stagger is not zero or striped is set
+static void add_wall(Scene* scene, float from_x, float to_x, float z, bool striped, float stagger) {
+    glm::vec3 color(0.7f);
+    float step = striped ? STRIP_WIDTH : to_x - from_x;
+    int strip = 0;
+    for (float start = from_x; start < to_x - 0.001f; start += step, strip++) {
+        float depth = strip % 2 == 1 ? stagger : 0.0f;
+        glm::vec3 min(start, 0.0f, z - WALL_THICKNESS / 2.0f + depth);
+        glm::vec3 max(glm::min(start + step, to_x), WALL_HEIGHT, z + WALL_THICKNESS / 2.0f + depth);
+        scene->geometry.push_back(Brush(min, max, color));
+    }
+}
+
+// Cast a ray at the wall and try to fit portal 1 where it hits
+static bool fits_portal(Scene* scene, glm::vec3 origin, glm::vec3 dir) {
+    RaycastHitInfo hit_info;
+    if (!raycast_ray(scene, origin, dir, &hit_info)) return false;
+    glm::vec3 position;
+    return find_portal_placement(scene, &scene->portal1, &scene->portal2, &hit_info, &position);
+}
+
+static void build_walls(Scene* scene, bool merge) {
+    apply_scene_defaults(scene);
+    scene->geometry.push_back(Brush(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(61.0f, 0.0f, 21.0f), glm::vec3(0.4f)));
+    add_wall(scene, 0.0f, 12.0f, 10.0f, false, 0.0f); // Solid
+    add_wall(scene, 20.0f, 32.0f, 10.0f, true, 0.0f); // Strips in one plane
+    add_wall(scene, 40.0f, 52.0f, 10.0f, true, STRIP_STAGGER); // Staggered strips, as scenegen builds them
+    if (merge) merge_brushes(scene);
+    bake_scene(scene);
+}
+
+static void check_walls(bool merge) {
+    Scene scene;
+    build_walls(&scene, merge);
+    const char* when = merge ? "after merging" : "as authored";
+
+    glm::vec3 forward(0.0f, 0.0f, 1.0f);
+    CHECK(fits_portal(&scene, glm::vec3(6.0f, 2.5f, 2.0f), forward), "%s: a portal does not fit on the solid wall", when);
+    CHECK(fits_portal(&scene, glm::vec3(26.0f, 2.5f, 2.0f), forward), "%s: a portal does not fit on strips forming one surface", when);
+
+    // Both sides of the staggered wall, aimed at a deep strip and at a shallow one
+    int fitted = 0;
+    for (int i = 0; i < 8; i++) {
+        float x = 40.5f + i * 1.5f;
+        if (fits_portal(&scene, glm::vec3(x, 2.5f, 2.0f), forward)) fitted++;
+        if (fits_portal(&scene, glm::vec3(x, 2.5f, 18.0f), -forward)) fitted++;
+    }
+    CHECK(fitted == 0, "%s: %d portals fit on the staggered striped wall", when, fitted);
+    printf("  %s: staggered striped wall %s\n", when, fitted == 0 ? "refuses portals" : "holds portals");
+    close_scene_file(&scene);
+}
+
+int main() {
+    check_walls(false);
+    check_walls(true);
+    return test_result("portals");
+}
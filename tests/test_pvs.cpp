@@ -0,0 +1,87 @@
+// The PVS must never cull a brush that can be seen: from random points of the open space, every brush a
+// ray hits must be in a cell the PVS marks visible from the point's cell, and its faces must be drawn.
+
+#include "test_util.h"
+
+#define POINT_COUNT 400
+#define RAYS_PER_POINT 200
+
+// Two rooms joined by a doorway, so the PVS has something to cull
+static void build_rooms(Scene* scene) {
+    build_test_scene(scene, 40.0f, 6.0f, 80, 21);
+    glm::vec3 grey(0.6f);
+    scene->geometry.push_back(Brush(glm::vec3(0.0f, 0.0f, 20.0f), glm::vec3(18.0f, 6.0f, 20.5f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(22.0f, 0.0f, 20.0f), glm::vec3(40.0f, 6.0f, 20.5f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(18.0f, 3.0f, 20.0f), glm::vec3(22.0f, 6.0f, 20.5f), grey));
+    scene->spawn_position = glm::vec3(10.0f, 1.6f, 10.0f);
+    bake_scene(scene);
+    build_pvs(scene, &scene->pvs);
+    build_pvs_indices(scene, &scene->pvs);
+}
+
+static bool inside_brush(Scene* scene, glm::vec3 point) {
+    for (size_t i = 0; i < scene->geometry.size(); i++) {
+        const Brush* brush = &scene->geometry[i];
+        if (point.x > brush->min.x && point.x < brush->max.x && point.y > brush->min.y && point.y < brush->max.y && point.z > brush->min.z && point.z < brush->max.z) return true;
+    }
+    return false;
+}
+
+// Whether the draw ranges of the cell cover the first face of the brush in the static mesh
+static bool brush_drawn(Scene* scene, const std::vector<uint32_t>& ranges, size_t brush_index) {
+    uint32_t first_vertex = 0;
+    for (size_t i = 0; i < brush_index; i++) first_vertex += visible_face_count(scene->face_flags[i]) * FACE_VERTEX_COUNT;
+    if (visible_face_count(scene->face_flags[brush_index]) == 0) return false;
+
+    for (size_t r = 0; r < ranges.size(); r += 2) {
+        for (uint32_t k = ranges[r]; k < ranges[r] + ranges[r + 1]; k++) {
+            if (scene->pvs.indices[k] == first_vertex) return true;
+        }
+    }
+    return false;
+}
+
+int main() {
+    Scene scene;
+    build_rooms(&scene);
+    const PVS* pvs = &scene.pvs;
+    CHECK(pvs->cell_count > 0 && !pvs->cell_first_index.empty(), "scene has no PVS to draw with");
+
+    TestRandom random(31);
+    std::vector<uint32_t> ranges;
+    int points = 0, culled_cells = 0, rays = 0, misses = 0;
+    for (int p = 0; p < POINT_COUNT && pvs->cell_count > 0; p++) {
+        glm::vec3 point(random.range(0.1f, 39.9f), random.range(0.1f, 5.9f), random.range(0.1f, 39.9f));
+        if (inside_brush(&scene, point)) continue;
+        int cell = pvs_cell(pvs, point);
+        CHECK(cell >= 0, "point %d of the room is outside the PVS grid", p);
+        if (cell < 0) continue;
+        points++;
+
+        for (uint32_t other = 0; other < pvs->cell_count; other++) culled_cells += !pvs_visible(pvs, cell, other);
+        pvs_draw_ranges(pvs, cell, &ranges);
+
+        for (int r = 0; r < RAYS_PER_POINT; r++) {
+            glm::vec3 dir(random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f));
+            RaycastHitInfo hit_info;
+            if (!raycast_ray(&scene, point, dir, &hit_info)) continue;
+            size_t brush_index = hit_info.brush - &scene.geometry[0];
+            const Brush* brush = hit_info.brush;
+            int brush_cell = pvs_cell(pvs, (brush->min + brush->max) * 0.5f);
+            bool seen = brush_cell < 0 || pvs_visible(pvs, cell, brush_cell);
+            bool drawn = brush_drawn(&scene, ranges, brush_index);
+            if (!seen || !drawn) {
+                misses++;
+                CHECK(false, "brush %zu hit from (%.2f %.2f %.2f) is %s", brush_index, point.x, point.y, point.z, seen ? "not drawn" : "culled");
+            }
+            rays++;
+        }
+    }
+
+    // Through the doorway the rooms see part of each other, but far corners of the other room are culled
+    CHECK(culled_cells > 0, "the PVS culls nothing");
+    printf("  %d rays from %d points: %d visible brushes culled, %.0f%% of cells culled on average\n", rays, points, misses,
+           100.0f * culled_cells / (float)(points * pvs->cell_count));
+    close_scene_file(&scene);
+    return test_result("pvs");
+}
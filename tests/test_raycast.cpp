@@ -0,0 +1,107 @@
+// Raycasts and box queries through the BVH and the bounds kernels must find exactly what a linear
+// scan over the brushes finds, with every kernel the CPU supports.
+
+#include <algorithm>
+#include <cstring>
+
+#include "brush_bounds.h"
+#include "bvh.h"
+#include "job_system.h"
+#include "test_util.h"
+
+#define RAY_COUNT 9000 // Enough for raycast_batch to split the rays into several jobs
+#define JOB_WORKERS 3
+#define BOX_COUNT 500
+
+static const char* kernel_names[] = { "scalar", "SSE", "AVX2" };
+
+static bool same_hit(bool hit_a, const RaycastHitInfo* a, bool hit_b, const RaycastHitInfo* b) {
+    if (hit_a != hit_b) return false;
+    if (!hit_a) return true;
+    return a->brush == b->brush && a->authored_brush == b->authored_brush &&
+        memcmp(&a->intersection, &b->intersection, sizeof(a->intersection)) == 0 &&
+        memcmp(&a->normal, &b->normal, sizeof(a->normal)) == 0 &&
+        memcmp(&a->face_min, &b->face_min, sizeof(a->face_min)) == 0 &&
+        memcmp(&a->face_max, &b->face_max, sizeof(a->face_max)) == 0;
+}
+
+int main() {
+    // The batches run over the job system, with workers even on a single core machine
+    start_job_system(shared_job_system(), JOB_WORKERS);
+
+    Scene scene;
+    build_test_scene(&scene, 40.0f, 10.0f, 3000, 1);
+
+    TestRandom random(2);
+    std::vector<glm::vec3> origins(RAY_COUNT), dirs(RAY_COUNT);
+    for (size_t i = 0; i < RAY_COUNT; i++) {
+        origins[i] = glm::vec3(random.range(0.0f, 40.0f), random.range(0.0f, 10.0f), random.range(0.0f, 40.0f));
+        dirs[i] = glm::vec3(random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f), random.range(-1.0f, 1.0f));
+        if (i % 16 == 0) dirs[i][i / 16 % 3] = 0.0f; // Rays along the faces of the brushes
+    }
+    std::vector<glm::vec3> box_mins(BOX_COUNT), box_maxs(BOX_COUNT);
+    for (size_t i = 0; i < BOX_COUNT; i++) {
+        box_mins[i] = glm::vec3(random.range(0.0f, 40.0f), random.range(0.0f, 10.0f), random.range(0.0f, 40.0f));
+        box_maxs[i] = box_mins[i] + glm::vec3(random.range(0.0f, 3.0f), random.range(0.0f, 3.0f), random.range(0.0f, 3.0f));
+    }
+
+    // Without the BVH indices raycast_ray scans every brush
+    std::vector<RaycastHitInfo> linear(RAY_COUNT);
+    std::vector<bool> linear_hit(RAY_COUNT);
+    std::vector<uint32_t> bvh_indices;
+    bvh_indices.swap(scene.bvh.indices);
+    for (size_t i = 0; i < RAY_COUNT; i++) {
+        linear_hit[i] = raycast_ray(&scene, origins[i], dirs[i], &linear[i]);
+    }
+    bvh_indices.swap(scene.bvh.indices);
+
+    std::vector<std::vector<uint32_t> > linear_boxes(BOX_COUNT);
+    for (size_t i = 0; i < BOX_COUNT; i++) {
+        for (size_t b = 0; b < scene.geometry.size(); b++) {
+            if (check_aabb_intersection(box_mins[i], box_maxs[i], scene.geometry[b].min, scene.geometry[b].max)) linear_boxes[i].push_back((uint32_t)b);
+        }
+    }
+
+    // Raw masks of the scalar kernel over the leaf bounds, the others must match them bit for bit
+    const BrushBounds* bounds = &scene.bvh.leaf_bounds;
+    std::vector<uint32_t> scalar_masks;
+    int best = set_bounds_kernel(BOUNDS_KERNEL_AVX2);
+
+    for (int kernel = BOUNDS_KERNEL_SCALAR; kernel <= best; kernel++) {
+        set_bounds_kernel(kernel);
+        int failures = test_failures;
+
+        std::vector<uint32_t> masks;
+        for (size_t first = 0; first < bounds->count; first += BOUNDS_BATCH) {
+            size_t count = std::min((size_t)BOUNDS_BATCH, bounds->count - first);
+            for (size_t i = 0; i < RAY_COUNT; i += 97) masks.push_back(ray_bounds_mask(bounds, first, count, origins[i], 1.0f / dirs[i]));
+            for (size_t i = 0; i < BOX_COUNT; i += 31) masks.push_back(overlap_bounds_mask(bounds, first, count, box_mins[i], box_maxs[i]));
+        }
+        if (kernel == BOUNDS_KERNEL_SCALAR) scalar_masks = masks;
+        CHECK(masks == scalar_masks, "%s masks differ from the scalar ones", kernel_names[kernel]);
+
+        for (size_t i = 0; i < RAY_COUNT; i++) {
+            RaycastHitInfo hit_info;
+            bool hit = raycast_ray(&scene, origins[i], dirs[i], &hit_info);
+            CHECK(same_hit(hit, &hit_info, linear_hit[i], &linear[i]), "%s BVH raycast %zu differs from the linear scan", kernel_names[kernel], i);
+        }
+
+        std::vector<RaycastHitInfo> batch(RAY_COUNT);
+        raycast_batch(&scene, &origins[0], &dirs[0], RAY_COUNT, &batch[0]);
+        for (size_t i = 0; i < RAY_COUNT; i++) {
+            CHECK(same_hit(batch[i].brush != NULL, &batch[i], linear_hit[i], &linear[i]), "%s batch raycast %zu differs from the linear scan", kernel_names[kernel], i);
+        }
+
+        for (size_t i = 0; i < BOX_COUNT; i++) {
+            std::vector<uint32_t> results;
+            bvh_query_aabb(&scene.bvh, box_mins[i], box_maxs[i], &results);
+            std::sort(results.begin(), results.end());
+            CHECK(results == linear_boxes[i], "%s BVH box query %zu differs from the linear scan", kernel_names[kernel], i);
+        }
+
+        printf("  %s kernel: %s\n", kernel_names[kernel], failures == test_failures ? "same as the linear scan" : "differs");
+    }
+
+    close_scene_file(&scene);
+    return test_result("raycast");
+}
@@ -0,0 +1,105 @@
+// Compact brushes must decode to exactly the brushes encoded on an exact grid, and to within half a step
+// when snapped. Streams whose frequency tables do not describe a full rANS table must be rejected.
+
+#include <cmath>
+#include <cstring>
+
+#include "scene_compact.h"
+#include "test_util.h"
+
+#define BRUSH_COUNT 2000
+#define SNAP_GRID 0.01f
+
+static bool same_brushes(const std::vector<Brush>& a, const std::vector<Brush>& b) {
+    return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(Brush)) == 0);
+}
+
+static void check_round_trips() {
+    // Eighths and quarters are exact, so the encoder finds a grid holding every coordinate and color
+    TestRandom random(5);
+    std::vector<Brush> brushes;
+    for (int i = 0; i < BRUSH_COUNT; i++) {
+        glm::vec3 min(std::floor(random.range(-200.0f, 200.0f) * 8.0f) / 8.0f, std::floor(random.range(0.0f, 40.0f) * 8.0f) / 8.0f, std::floor(random.range(-200.0f, 200.0f) * 8.0f) / 8.0f);
+        glm::vec3 extent(std::floor(random.range(1.0f, 64.0f)) / 8.0f, std::floor(random.range(1.0f, 64.0f)) / 8.0f, std::floor(random.range(1.0f, 64.0f)) / 8.0f);
+        glm::vec3 color(std::floor(random.range(0.0f, 4.0f)) / 4.0f, 0.5f, std::floor(random.range(0.0f, 4.0f)) / 4.0f);
+        brushes.push_back(Brush(min, min + extent, color));
+    }
+
+    SceneSectionData section(SCENE_SECTION_COMPACT_BRUSHES);
+    std::vector<Brush> decoded;
+    CHECK(encode_compact_brushes(brushes, 0.0f, &section) == 0, "brushes on an eighth grid do not encode exactly");
+    CHECK(decode_compact_brushes(section.data.data(), section.data.size(), section.element_count, &decoded) == 0, "exact brushes do not decode");
+    CHECK(same_brushes(brushes, decoded), "exact brushes do not decode bit for bit");
+    printf("  %d exact brushes in %zu bytes, %.1f bytes each\n", BRUSH_COUNT, section.data.size(), (float)section.data.size() / BRUSH_COUNT);
+
+    // Every coordinate off the grid lands within half a step of where it was
+    for (size_t i = 0; i < brushes.size(); i++) {
+        brushes[i].min += glm::vec3(random.range(0.0f, 0.1f));
+        brushes[i].max += glm::vec3(random.range(0.0f, 0.1f));
+    }
+    CHECK(encode_compact_brushes(brushes, SNAP_GRID, &section) == 0, "brushes do not snap to a %.2f grid", SNAP_GRID);
+    CHECK(decode_compact_brushes(section.data.data(), section.data.size(), section.element_count, &decoded) == 0, "snapped brushes do not decode");
+    float worst = 0.0f;
+    for (size_t i = 0; i < brushes.size() && i < decoded.size(); i++) {
+        glm::vec3 error = glm::max(glm::abs(decoded[i].min - brushes[i].min), glm::abs(decoded[i].max - brushes[i].max));
+        worst = glm::max(worst, glm::max(error.x, glm::max(error.y, error.z)));
+    }
+    CHECK(decoded.size() == brushes.size() && worst <= SNAP_GRID * 0.5f + 0.0001f, "snapped brushes are up to %f off", worst);
+
+    // No byte of the section can be dropped
+    bool rejected = true;
+    for (size_t size = 0; size < section.data.size(); size += 1 + size / 16) {
+        rejected = rejected && decode_compact_brushes(section.data.data(), size, section.element_count, &decoded) != 0;
+    }
+    CHECK(rejected, "a truncated section decodes");
+
+    std::vector<Brush> none;
+    CHECK(encode_compact_brushes(none, 0.0f, &section) == 0 && decode_compact_brushes(section.data.data(), section.data.size(), 0, &decoded) == 0 && decoded.empty(), "no brushes do not round trip");
+}
+
+// One brush at the origin, every field coded with a table where byte 0 owns every slot, except the
+// first field, which gets the table given. The rANS state never changes while decoding zeros with
+// such a table, so the stream is just the initial state.
+static int decode_with_table(const std::vector<unsigned char>& table, uint32_t brush_count) {
+    std::vector<unsigned char> coded(table);
+    for (int f = 1; f < COMPACT_FIELD_COUNT; f++) {
+        unsigned char zeros[] = { 1, 0, 0, 0x80, 0x20 }; // 1 byte: 0 with frequency 4096
+        coded.insert(coded.end(), zeros, zeros + sizeof(zeros));
+    }
+    unsigned char state[] = { 0, 0, 0x80, 0 };
+    coded.insert(coded.end(), state, state + sizeof(state));
+
+    SceneCompactBrushHeader header = { { 0.0f, 0.0f, 0.0f }, 1.0f, 1, (uint32_t)coded.size() };
+    float color[3] = { 1.0f, 1.0f, 1.0f };
+    std::vector<unsigned char> data((unsigned char*)&header, (unsigned char*)&header + sizeof(header));
+    data.insert(data.end(), (unsigned char*)color, (unsigned char*)color + sizeof(color));
+    data.insert(data.end(), coded.begin(), coded.end());
+
+    std::vector<Brush> decoded;
+    return decode_compact_brushes(data.data(), data.size(), brush_count, &decoded);
+}
+
+static void check_bad_tables() {
+    unsigned char full[] = { 1, 0, 0, 0x80, 0x20 };
+    unsigned char duplicate[] = { 2, 0, 0, 0x80, 0x10, 0, 0x80, 0x10 }; // 0 twice, leaving half the slots to no byte
+    unsigned char overflowing[] = { 2, 0, 0, 0x80, 0x20, 1, 0x80, 0x20 }; // 4096 twice
+    unsigned char wrapping[] = { 1, 0, 0, 0x80, 0xA0, 0x04 }; // 69632, 4096 when cut to 16 bits
+    unsigned char zero[] = { 2, 0, 0, 0x80, 0x20, 1, 0 };
+    unsigned char too_many[] = { 1, 1, 0, 0x80, 0x20 }; // 257 bytes
+    unsigned char missing[] = { 0, 0 };
+
+    CHECK(decode_with_table(std::vector<unsigned char>(full, full + sizeof(full)), 1) == 0, "hand built stream does not decode");
+    CHECK(decode_with_table(std::vector<unsigned char>(duplicate, duplicate + sizeof(duplicate)), 1) != 0, "table listing a byte twice decodes");
+    CHECK(decode_with_table(std::vector<unsigned char>(overflowing, overflowing + sizeof(overflowing)), 1) != 0, "table with more than 4096 slots decodes");
+    CHECK(decode_with_table(std::vector<unsigned char>(wrapping, wrapping + sizeof(wrapping)), 1) != 0, "table with a frequency over 16 bits decodes");
+    CHECK(decode_with_table(std::vector<unsigned char>(zero, zero + sizeof(zero)), 1) != 0, "table with a zero frequency decodes");
+    CHECK(decode_with_table(std::vector<unsigned char>(too_many, too_many + sizeof(too_many)), 1) != 0, "table with 257 bytes decodes");
+    CHECK(decode_with_table(std::vector<unsigned char>(missing, missing + sizeof(missing)), 1) != 0, "field without a table decodes");
+    printf("  duplicate, overflowing, zero and missing frequency tables rejected\n");
+}
+
+int main() {
+    check_round_trips();
+    check_bad_tables();
+    return test_result("compact brushes");
+}
@@ -0,0 +1,190 @@
+// Scenes must load back exactly as saved, with and without the baked runtime data, and unversioned
+// files must keep loading. A file with a corrupt or truncated section, or with records out of range,
+// must be refused without touching the scene, or have the corrupt baked data rebuilt.
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "test_util.h"
+
+#define SCENE_PATH "obj/test_scene_file.scene" // Next to the test programs
+
+static std::vector<unsigned char> read_bytes(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+static void write_bytes(const char* path, const std::vector<unsigned char>& bytes) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+static bool same_brushes(const std::vector<Brush>& a, const std::vector<Brush>& b) {
+    return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(Brush)) == 0);
+}
+
+static void build_scene(Scene* scene) {
+    build_test_scene(scene, 30.0f, 8.0f, 200, 4);
+    clear_cube_bodies(&scene->cubes);
+    TestRandom random(6);
+    for (int i = 0; i < 20; i++) {
+        Cube cube(glm::vec3(random.range(1.0f, 29.0f), random.range(1.0f, 7.0f), random.range(1.0f, 29.0f)), glm::vec3(random.unit(), random.unit(), random.unit()));
+        cube.size = random.range(0.1f, 0.5f);
+        add_cube_body(&scene->cubes, &cube);
+    }
+    scene->spawn_yaw = 30.0f;
+    scene->spawn_pitch = -5.0f;
+    scene->portal1.width = 1.5f;
+    scene->portal2.height = 2.5f;
+}
+
+// Write the scene with its baked sections, as scenec does
+static void write_baked(Scene* scene, const char* path) {
+    std::vector<SceneSectionData> sections;
+    scene_sections(scene, &sections);
+    baked_sections(scene, &sections);
+    CHECK(write_scene_sections(path, sections) == 0, "could not write %s", path);
+}
+
+// Flip a byte in the middle of the first section of the given type
+static void corrupt_section(const char* path, uint32_t type) {
+    SceneFile file;
+    CHECK(scene_file_open(path, &file) == 0, "could not open %s", path);
+    const SceneSectionEntry* entry = scene_file_find(&file, type);
+    size_t offset = entry != NULL ? (size_t)(entry->offset + entry->size / 2) : 0;
+    scene_file_close(&file);
+
+    std::vector<unsigned char> bytes = read_bytes(path);
+    bytes[offset] ^= 0x40;
+    write_bytes(path, bytes);
+}
+
+static void check_round_trip() {
+    Scene scene;
+    build_scene(&scene);
+    CHECK(save_scene_file(SCENE_PATH, &scene) == 0, "could not save the scene");
+
+    Scene loaded;
+    CHECK(load_scene_file(SCENE_PATH, &loaded) == 0, "saved scene does not load");
+    CHECK(same_brushes(scene.geometry, loaded.geometry), "brushes differ after loading");
+    CHECK(cube_state_hash(&scene.cubes) == cube_state_hash(&loaded.cubes) && scene.cubes.count == loaded.cubes.count, "cubes differ after loading");
+    for (size_t i = 0; i < scene.cubes.count && i < loaded.cubes.count; i++) {
+        CHECK(scene.cubes.size[i] == loaded.cubes.size[i] && scene.cubes.color[i] == loaded.cubes.color[i], "cube %zu differs after loading", i);
+    }
+    CHECK(scene.light_dir == loaded.light_dir && scene.spawn_position == loaded.spawn_position, "light or spawn point differs after loading");
+    CHECK(scene.spawn_yaw == loaded.spawn_yaw && scene.spawn_pitch == loaded.spawn_pitch, "spawn direction differs after loading");
+    CHECK(scene.portal1.width == loaded.portal1.width && scene.portal2.height == loaded.portal2.height, "portal sizes differ after loading");
+    close_scene_file(&loaded);
+
+    // Every part of the runtime data comes back from the baked sections
+    write_baked(&scene, SCENE_PATH);
+    Scene baked;
+    CHECK(load_scene_file(SCENE_PATH, &baked, 0) == 0, "baked scene does not load");
+    SceneFile file;
+    CHECK(scene_file_open(SCENE_PATH, &file) == 0, "baked scene does not open");
+    int loaded_parts = load_baked_sections(&file, &baked);
+    CHECK(loaded_parts == BAKED_ALL, "only parts %x of the runtime data load from a baked file, not %x", loaded_parts, BAKED_ALL);
+    scene_file_close(&file);
+    close_scene_file(&baked);
+    close_scene_file(&scene);
+    printf("  %zu brushes and %zu cubes round trip, baked runtime data loads back whole\n", scene.geometry.size(), scene.cubes.count);
+}
+
+static void check_corruption() {
+    Scene scene;
+    build_scene(&scene);
+    std::vector<Brush> original = scene.geometry;
+
+    // The scene a failed load must leave alone
+    Scene target;
+    build_test_scene(&target, 10.0f, 4.0f, 3, 9);
+    std::vector<Brush> untouched = target.geometry;
+
+    // A corrupt brush section fails its CRC and the load
+    save_scene_file(SCENE_PATH, &scene);
+    corrupt_section(SCENE_PATH, SCENE_SECTION_BRUSHES);
+    CHECK(load_scene_file(SCENE_PATH, &target) != 0, "scene with a corrupt brush section loads");
+    CHECK(same_brushes(target.geometry, untouched), "failed load changed the scene");
+
+    // A corrupt baked section is ignored and rebuilt
+    write_baked(&scene, SCENE_PATH);
+    corrupt_section(SCENE_PATH, SCENE_SECTION_BVH);
+    Scene rebuilt;
+    CHECK(load_scene_file(SCENE_PATH, &rebuilt) == 0, "scene with a corrupt baked BVH does not load");
+    CHECK(same_brushes(rebuilt.geometry, original) && validate_bvh(&rebuilt.bvh, rebuilt.geometry.size()), "scene with a corrupt baked BVH did not rebuild it");
+    SceneFile file;
+    CHECK(scene_file_open(SCENE_PATH, &file) == 0 && !(load_baked_sections(&file, &rebuilt) & BAKED_BVH), "corrupt baked BVH is used");
+    scene_file_close(&file);
+    close_scene_file(&rebuilt);
+
+    // A file cut short anywhere is refused, from inside the header to the last section
+    save_scene_file(SCENE_PATH, &scene);
+    std::vector<unsigned char> bytes = read_bytes(SCENE_PATH);
+    bool refused = true;
+    for (size_t size = 8; size < bytes.size(); size += 1 + size / 4) {
+        write_bytes(SCENE_PATH, std::vector<unsigned char>(bytes.begin(), bytes.begin() + size));
+        refused = refused && load_scene_file(SCENE_PATH, &target) != 0;
+    }
+    write_bytes(SCENE_PATH, std::vector<unsigned char>(bytes.begin(), bytes.end() - 1)); // Only the last section is short
+    refused = refused && load_scene_file(SCENE_PATH, &target) != 0;
+    CHECK(refused, "a truncated scene file loads");
+
+    // Cubes out of range are refused like brushes
+    for (int c = 0; c < 2; c++) {
+        std::vector<SceneSectionData> sections;
+        scene_sections(&scene, &sections);
+        for (size_t i = 0; i < sections.size(); i++) {
+            if (sections[i].type != SCENE_SECTION_CUBES) continue;
+            SceneCubeRecord* record = reinterpret_cast<SceneCubeRecord*>(&sections[i].data[sizeof(SceneCubeRecord) * 3]);
+            if (c == 0) record->size = 0.0f;
+            else record->position[1] = NAN;
+        }
+        write_scene_sections(SCENE_PATH, sections);
+        CHECK(load_scene_file(SCENE_PATH, &target) != 0, "scene with a cube %s loads", c == 0 ? "of size 0" : "at a NaN position");
+    }
+    CHECK(same_brushes(target.geometry, untouched), "failed loads changed the scene");
+    close_scene_file(&target);
+    close_scene_file(&scene);
+    printf("  corrupt, truncated and out of range files refused, corrupt baked data rebuilt\n");
+}
+
+// Light direction, brush count and the brushes, as the game wrote before the sectioned format
+static std::vector<unsigned char> v1_file(const glm::vec3& light_dir, const std::vector<Brush>& brushes, int32_t brush_count) {
+    std::vector<unsigned char> bytes((const unsigned char*)&light_dir, (const unsigned char*)&light_dir + sizeof(light_dir));
+    bytes.insert(bytes.end(), (const unsigned char*)&brush_count, (const unsigned char*)&brush_count + sizeof(brush_count));
+    bytes.insert(bytes.end(), (const unsigned char*)&brushes[0], (const unsigned char*)&brushes[0] + brushes.size() * sizeof(Brush));
+    return bytes;
+}
+
+static void check_v1() {
+    Scene scene;
+    build_scene(&scene);
+    close_scene_file(&scene);
+
+    write_bytes(SCENE_PATH, v1_file(scene.light_dir, scene.geometry, (int32_t)scene.geometry.size()));
+    Scene loaded;
+    CHECK(load_scene_file(SCENE_PATH, &loaded) == 0, "unversioned scene does not load");
+    CHECK(same_brushes(scene.geometry, loaded.geometry) && loaded.light_dir == scene.light_dir, "unversioned scene loads different brushes or light");
+    CHECK(loaded.cubes.count == 1 && loaded.portal1.width == 1.0f, "unversioned scene does not get the defaults");
+    CHECK(validate_bvh(&loaded.bvh, loaded.geometry.size()), "unversioned scene is not baked at load time");
+
+    // Brush counts that do not match the size of the file
+    Scene target;
+    write_bytes(SCENE_PATH, v1_file(scene.light_dir, scene.geometry, (int32_t)scene.geometry.size() + 1));
+    CHECK(load_scene_file(SCENE_PATH, &target) != 0, "unversioned scene with too few brushes loads");
+    write_bytes(SCENE_PATH, v1_file(scene.light_dir, scene.geometry, (int32_t)scene.geometry.size() - 1));
+    CHECK(load_scene_file(SCENE_PATH, &target) != 0, "unversioned scene with trailing bytes loads");
+    write_bytes(SCENE_PATH, v1_file(scene.light_dir, scene.geometry, -1));
+    CHECK(load_scene_file(SCENE_PATH, &target) != 0, "unversioned scene with a negative brush count loads");
+    close_scene_file(&loaded);
+    printf("  unversioned scene with %zu brushes loads, wrong brush counts refused\n", loaded.geometry.size());
+}
+
+int main() {
+    check_round_trip();
+    check_corruption();
+    check_v1();
+    remove(SCENE_PATH);
+    return test_result("scene file");
+}
@@ -0,0 +1,112 @@
+// Text scenes must read back bit for bit what save_scene_text wrote, numbers must parse like strtod
+// whichever path the parser takes, and malformed text must be refused without touching the scene.
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "scene_text.h"
+#include "test_util.h"
+
+#define SCENE_PATH "obj/test_scene_text.txt" // Next to the test programs
+
+static void write_text(const char* path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+}
+
+static bool same_brushes(const std::vector<Brush>& a, const std::vector<Brush>& b) {
+    return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(Brush)) == 0);
+}
+
+static void check_round_trip() {
+    Scene scene;
+    build_test_scene(&scene, 30.0f, 8.0f, 300, 12);
+    scene.spawn_yaw = 33.3f;
+    scene.portal2.width = 0.7f;
+    CHECK(save_scene_text(SCENE_PATH, &scene) == 0, "could not save the text scene");
+
+    Scene loaded;
+    CHECK(load_scene_file(SCENE_PATH, &loaded, 0) == 0, "saved text scene does not load");
+    CHECK(same_brushes(scene.geometry, loaded.geometry), "brushes differ after a text round trip");
+    CHECK(cube_state_hash(&scene.cubes) == cube_state_hash(&loaded.cubes), "cubes differ after a text round trip");
+    CHECK(memcmp(&scene.light_dir, &loaded.light_dir, sizeof(glm::vec3)) == 0 && memcmp(&scene.spawn_position, &loaded.spawn_position, sizeof(glm::vec3)) == 0, "light or spawn point differs after a text round trip");
+    CHECK(scene.spawn_yaw == loaded.spawn_yaw && scene.portal2.width == loaded.portal2.width, "spawn yaw or portal size differs after a text round trip");
+    close_scene_file(&scene);
+    printf("  %zu brushes read back bit for bit\n", loaded.geometry.size());
+}
+
+// Numbers taking the fast path, the strtod path and the edges between them, all read like strtod reads them
+static void check_numbers() {
+    static const char* numbers[] = {
+        "0", "-0", "1", "+2", "0.1", "-0.3", ".5", "5.", "1e3", "1E-3", "2.5e+7", "1e22", "1e23", "1e-22", "1e-23",
+        "123456789012345678", "0.000000000000000000001", "3.4028234e38", "1.17549435e-38", "1e-45",
+        "9007199254740993", "0.30000000000000004", "7e-1", "0x10",
+    };
+    size_t count = sizeof(numbers) / sizeof(numbers[0]);
+
+    std::string text = "portal-scene 1\nlight 0 -1 0\n";
+    for (size_t i = 0; i < count; i++) {
+        text += std::string("brush ") + numbers[i] + " 0 0 " + numbers[i] + " 0 0 0 0 0\n";
+    }
+    write_text(SCENE_PATH, text);
+
+    Scene scene;
+    CHECK(load_scene_file(SCENE_PATH, &scene, 0) == 0 && scene.geometry.size() == count, "text with every kind of number does not load");
+    for (size_t i = 0; i < scene.geometry.size(); i++) {
+        float expected = (float)strtod(numbers[i], NULL);
+        CHECK(memcmp(&scene.geometry[i].min.x, &expected, sizeof(float)) == 0, "%s reads as %.9g instead of %.9g", numbers[i], scene.geometry[i].min.x, expected);
+    }
+    printf("  %zu numbers read like strtod reads them\n", count);
+}
+
+static void check_malformed() {
+    static const char* texts[] = {
+        "",
+        "portal-scene 2\nlight 0 -1 0\n", // Unknown version
+        "portal-scene\nlight 0 -1 0\n",
+        "portal-scene 1 extra\nlight 0 -1 0\n",
+        "portal-scene 1\nbrush 0 0 0 1 1 1 1 1 1\n", // No light
+        "portal-scene 1\nlight 0 -1 0\nwall 0 0 0\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1 1 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1 1 1 1 1 x\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1.2.3 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1e 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1e40 1 1 1 1 1\n", // Too large for a float
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 inf 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 nan 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 0 0 0 1.000000000000000000000000000000000000000000000000000000000000000001 1 1 1 1 1\n",
+        "portal-scene 1\nlight 0 -1 0\nbrush 2 0 0 1 1 1 1 1 1\n", // Inverted
+        "portal-scene 1\nlight 0 -1 0\ncube 1 1 1 1 1 1 0\n",
+        "portal-scene 1\nlight 0 -1 0\ncube 1 1 1 1 1 1 -0.5\n",
+        "portal-scene 1\nlight 0 -1\n",
+        "portal-scene 1\nlight 0 -1 0\nportal 1\n",
+    };
+    size_t count = sizeof(texts) / sizeof(texts[0]);
+
+    Scene scene;
+    build_test_scene(&scene, 10.0f, 4.0f, 3, 9);
+    std::vector<Brush> untouched = scene.geometry;
+    for (size_t i = 0; i < count; i++) {
+        write_text(SCENE_PATH, texts[i]);
+        CHECK(load_scene_file(SCENE_PATH, &scene, 0) != 0, "malformed text %zu loads", i);
+    }
+    CHECK(same_brushes(scene.geometry, untouched), "a failed load changed the scene");
+
+    // Comments, blank lines, carriage returns and a missing last newline are all fine
+    write_text(SCENE_PATH, "portal-scene 1 # comment\r\n\n  # comment\r\nlight 0 -1 0\r\n\t brush 0 0 0 1 1 1 1 1 1 # comment\r\nbrush 1 1 1 2 2 2 0 0 0");
+    CHECK(load_scene_file(SCENE_PATH, &scene, 0) == 0 && scene.geometry.size() == 2, "text with comments and blank lines does not load");
+    close_scene_file(&scene);
+    printf("  %zu malformed texts refused\n", count);
+}
+
+int main() {
+    check_round_trip();
+    check_numbers();
+    check_malformed();
+    remove(SCENE_PATH);
+    return test_result("text scenes");
+}
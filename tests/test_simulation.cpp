@@ -0,0 +1,220 @@
+// The same input stream must give the same state bit for bit whatever the frame times were.
+// Frames are drawn between the last two ticks, and a stall is dropped rather than caught up on.
+// Portals keep their age across a snapshot restored after the clock was reset. Grabbing picks up the
+// nearest cube in reach along the view, never one behind a brush.
+
+#include <cmath>
+#include <cstring>
+
+#include "simulation.h"
+#include "test_util.h"
+
+#define TICK_COUNT 900
+
+static uint64_t replay(uint64_t frame_seed) {
+    Scene scene;
+    build_test_scene(&scene, 24.0f, 6.0f, 40, 7);
+    clear_cube_bodies(&scene.cubes);
+    for (int i = 0; i < 8; i++) {
+        Cube cube(glm::vec3(10.0f + i * 0.6f, 2.0f + i, 12.0f), glm::vec3(1.0f));
+        add_cube_body(&scene.cubes, &cube);
+    }
+
+    PlayerState player(Camera(scene.spawn_position, scene.spawn_yaw, scene.spawn_pitch), 0.0f, false);
+    Simulation sim;
+    reset_simulation(&sim, &scene, &player);
+
+    TestRandom frames(frame_seed);
+    int done = 0;
+    while (done < TICK_COUNT) {
+        int ticks = advance_simulation(&sim, frames.range(0.0f, 0.1f));
+        for (int i = 0; i < ticks && done < TICK_COUNT; i++, done++) {
+            TickInput input;
+            input.buttons = 0;
+            int phase = done / 120;
+            if (phase % 3 == 0) input.buttons |= TICK_INPUT_FORWARD;
+            if (phase % 4 == 1) input.buttons |= TICK_INPUT_RIGHT | TICK_INPUT_JUMP;
+            if (done % 200 == 50) input.buttons |= TICK_INPUT_PORTAL1;
+            if (done % 200 == 150) input.buttons |= TICK_INPUT_PORTAL2;
+            if (done % 300 == 10) input.buttons |= TICK_INPUT_GRAB;
+            input.yaw = done * 0.7f;
+            input.pitch = -10.0f + (done % 40);
+            simulate_tick(&sim, &scene, &player, &input);
+        }
+    }
+
+    uint64_t hash = cube_state_hash(&scene.cubes);
+    hash = hash_bytes(hash, &player.camera.position, sizeof(player.camera.position));
+    hash = hash_bytes(hash, &player.vel_y, sizeof(player.vel_y));
+    hash = hash_bytes(hash, &scene.portal1.position, sizeof(scene.portal1.position));
+    hash = hash_bytes(hash, &scene.portal2.position, sizeof(scene.portal2.position));
+    printf("  frame pattern %llu: portals %d %d, hash %016llx\n", (unsigned long long)frame_seed, scene.portal1.open, scene.portal2.open, (unsigned long long)hash);
+    close_scene_file(&scene);
+    return hash;
+}
+
+static void run_ticks(Simulation* sim, Scene* scene, PlayerState* player, int count, uint32_t buttons) {
+    for (int i = 0; i < count; i++) {
+        TickInput input;
+        input.buttons = buttons;
+        input.yaw = player->camera.yaw;
+        input.pitch = player->camera.pitch;
+        simulate_tick(sim, scene, player, &input);
+    }
+}
+
+// The drawn camera and cubes sit between their positions at the last two ticks, as far as the frame is between them
+static void check_interpolation() {
+    Scene scene;
+    build_test_scene(&scene, 24.0f, 6.0f, 0, 7);
+    clear_cube_bodies(&scene.cubes);
+    Cube cube(glm::vec3(12.0f, 4.0f, 6.0f), glm::vec3(1.0f));
+    add_cube_body(&scene.cubes, &cube);
+    PlayerState player(Camera(scene.spawn_position, 0.0f, 0.0f), 0.0f, true);
+    Simulation sim;
+    reset_simulation(&sim, &scene, &player);
+    run_ticks(&sim, &scene, &player, 30, 0); // Let the player settle and the cube start falling
+
+    // Two and a half ticks of time leaves the frame half way between the last two ticks
+    CHECK(advance_simulation(&sim, 2.5 * tick_duration(&sim)) == 2, "two and a half ticks of time do not run two ticks");
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_FORWARD);
+    glm::vec3 cube_before = body_position(&scene.cubes, 0);
+    glm::vec3 camera_before = player.camera.position;
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_FORWARD);
+
+    float blend = tick_blend(&sim);
+    CHECK(std::fabs(blend - 0.5f) < 1e-4f, "frame is %f of a tick past the last one instead of half", blend);
+    CHECK(sim.previous_position == camera_before, "camera before the last tick is not kept for drawing");
+    CHECK(body_previous_position(&scene.cubes, 0) == cube_before && body_position(&scene.cubes, 0) != cube_before, "cube position before the last tick is not kept for drawing");
+
+    glm::vec3 drawn = interpolated_camera(&sim, &player).position;
+    glm::vec3 expected = camera_before + (player.camera.position - camera_before) * 0.5f;
+    CHECK(glm::length(drawn - expected) < 1e-4f && glm::length(player.camera.position - camera_before) > 0.01f, "drawn camera is not half way between the last two ticks");
+
+    // However the frames fall, the drawn state stays between the last two ticks
+    TestRandom frames(11);
+    bool in_range = true;
+    for (int i = 0; i < 1000; i++) {
+        advance_simulation(&sim, frames.range(0.0f, 0.05f));
+        in_range = in_range && tick_blend(&sim) >= 0.0f && tick_blend(&sim) < 1.0f;
+    }
+    CHECK(in_range, "frame blend left the range between two ticks");
+    printf("  half a tick after the last one: camera drawn %.3f of the way through its last move\n", glm::length(drawn - camera_before) / glm::length(player.camera.position - camera_before));
+    close_scene_file(&scene);
+}
+
+// A stall runs at most SIMULATION_MAX_FRAME_TICKS ticks and the rest of it is dropped, not run by the next frames
+static void check_stall() {
+    Simulation sim;
+    CHECK(advance_simulation(&sim, 5.0) == SIMULATION_MAX_FRAME_TICKS, "a stall runs more than SIMULATION_MAX_FRAME_TICKS ticks");
+    CHECK(tick_blend(&sim) >= 0.0f && tick_blend(&sim) < 1.0f, "a stall leaves %f ticks of time behind", tick_blend(&sim));
+    CHECK(advance_simulation(&sim, 0.0) == 0, "the frame after a stall catches up on it");
+    CHECK(advance_simulation(&sim, tick_duration(&sim)) == 1, "the frame after a stall does not run at the normal rate");
+    printf("  5 second stall: %d ticks run, the rest dropped\n", SIMULATION_MAX_FRAME_TICKS);
+}
+
+static int grabbed_cube(const CubeBodies* bodies) {
+    int grabbed = -1;
+    for (size_t i = 0; i < bodies->count; i++) {
+        if (bodies->flags[i] & CUBE_GRABBED) grabbed = grabbed < 0 ? (int)i : -2; // -2 when several are held
+    }
+    return grabbed;
+}
+
+// Replace the cubes with ones at the given distances along dir from the eye, offset sideways by the given amounts
+static void place_cubes(Scene* scene, glm::vec3 eye, glm::vec3 dir, const float* distances, const float* offsets, int count) {
+    clear_cube_bodies(&scene->cubes);
+    glm::vec3 side = glm::cross(dir, glm::vec3(0.0f, 1.0f, 0.0f));
+    for (int i = 0; i < count; i++) {
+        Cube cube(eye + dir * distances[i] + side * offsets[i], glm::vec3(1.0f));
+        add_cube_body(&scene->cubes, &cube);
+    }
+}
+
+static void check_grab() {
+    Scene scene;
+    build_test_scene(&scene, 24.0f, 6.0f, 0, 7);
+    PlayerState player(Camera(scene.spawn_position, 0.0f, 0.0f), 0.0f, true);
+    glm::vec3 forward = player.camera.GetForwardDirection();
+
+    // A wall behind the player, across the view when turned around
+    glm::vec3 center = scene.spawn_position - forward * 3.0f;
+    glm::vec3 half = glm::vec3(2.0f) - glm::abs(forward) * 1.9f;
+    scene.geometry.push_back(Brush(glm::vec3(center.x - half.x, 0.0f, center.z - half.z), glm::vec3(center.x + half.x, 4.0f, center.z + half.z), glm::vec3(0.5f)));
+    bake_scene(&scene);
+
+    Simulation sim;
+    reset_simulation(&sim, &scene, &player);
+    run_ticks(&sim, &scene, &player, 30, 0); // Let the player settle
+    glm::vec3 eye = player.camera.position;
+
+    // The nearer of two cubes on the view ray, not the first cube nor the one beside the ray
+    float distances[] = { 4.0f, 2.0f, 2.0f };
+    float offsets[] = { 0.0f, 0.0f, 1.5f };
+    place_cubes(&scene, eye, forward, distances, offsets, 3);
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_GRAB);
+    CHECK(grabbed_cube(&scene.cubes) == 1, "grab took cube %d instead of the nearest one on the view ray", grabbed_cube(&scene.cubes));
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_GRAB);
+    CHECK(grabbed_cube(&scene.cubes) == -1, "grabbing again did not drop the cube");
+
+    // Nothing in reach
+    float far[] = { GRAB_REACH + 1.0f };
+    float none[] = { 0.0f };
+    place_cubes(&scene, eye, forward, far, none, 1);
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_GRAB);
+    CHECK(grabbed_cube(&scene.cubes) == -1, "grab took a cube out of reach");
+
+    // Turned around, the cube in reach is behind the wall
+    float behind[] = { 4.0f };
+    place_cubes(&scene, eye, -forward, behind, none, 1);
+    player.camera.yaw = 180.0f;
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_GRAB);
+    CHECK(grabbed_cube(&scene.cubes) == -1, "grab took a cube behind a wall");
+    printf("  grab takes the nearest cube on the view ray, not one beside it, out of reach or behind a wall\n");
+    close_scene_file(&scene);
+}
+
+// Save with a portal open, then restore into a restarted session whose clock starts again at 0
+static void check_snapshot_clock() {
+    Scene scene;
+    build_test_scene(&scene, 24.0f, 6.0f, 0, 7);
+    PlayerState player(Camera(scene.spawn_position, 0.0f, -60.0f), 0.0f, false);
+    Simulation sim;
+    reset_simulation(&sim, &scene, &player);
+
+    run_ticks(&sim, &scene, &player, 30, 0);
+    run_ticks(&sim, &scene, &player, 1, TICK_INPUT_PORTAL1);
+    run_ticks(&sim, &scene, &player, 240, 0);
+    CHECK(scene.portal1.open, "portal did not open on the floor");
+    float age = (float)scene.time - scene.portal1.spawn_time;
+
+    std::vector<unsigned char> snapshot;
+    save_snapshot(&scene, &player, &snapshot);
+    close_scene_file(&scene);
+
+    Scene restarted;
+    build_test_scene(&restarted, 24.0f, 6.0f, 0, 7);
+    PlayerState restarted_player(Camera(restarted.spawn_position, 0.0f, 0.0f), 0.0f, false);
+    Simulation restarted_sim;
+    reset_simulation(&restarted_sim, &restarted, &restarted_player);
+    CHECK(restore_snapshot(&snapshot[0], snapshot.size(), &restarted, &restarted_player) == 0, "snapshot did not restore after the restart");
+
+    float restored_age = (float)restarted.time - restarted.portal1.spawn_time;
+    CHECK(restarted.portal1.open && restored_age == age, "portal aged %f seconds when saved, %f after the restart", age, restored_age);
+    run_ticks(&restarted_sim, &restarted, &restarted_player, 60, 0);
+    CHECK((float)restarted.time - restarted.portal1.spawn_time > age, "restored portal does not age");
+    printf("  portal %.2f seconds old when saved, %.2f after restoring into a restarted clock\n", age, restored_age);
+    close_scene_file(&restarted);
+}
+
+int main() {
+    uint64_t first = replay(1);
+    CHECK(replay(2) == first, "second frame pattern gives a different state");
+    CHECK(replay(3) == first, "third frame pattern gives a different state");
+
+    check_interpolation();
+    check_stall();
+    check_snapshot_clock();
+    check_grab();
+    return test_result("simulation");
+}
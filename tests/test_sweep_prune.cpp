@@ -0,0 +1,85 @@
+// The sweep must report exactly the pairs of boxes a brute force test over every pair finds, after small
+// moves that keep the entries nearly sorted, after jumps, when the spread moves the sweep to another axis
+// and when objects come and go.
+
+#include <algorithm>
+
+#include "sweep_prune.h"
+#include "test_util.h"
+
+#define OBJECT_COUNT 1500
+#define ROUND_COUNT 40
+
+static bool pair_less(const SweepPair& a, const SweepPair& b) {
+    return a.a != b.a ? a.a < b.a : a.b < b.b;
+}
+
+static bool same_pairs(const std::vector<SweepPair>& a, const std::vector<SweepPair>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].a != b[i].a || a[i].b != b[i].b) return false;
+    }
+    return true;
+}
+
+// Touching counts as overlapping, as in sweep_prune_update
+static void brute_force_pairs(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, size_t count, std::vector<SweepPair>* pairs) {
+    pairs->clear();
+    for (uint32_t a = 0; a < count; a++) {
+        for (uint32_t b = a + 1; b < count; b++) {
+            if (mins[a].x <= maxs[b].x && mins[b].x <= maxs[a].x &&
+                mins[a].y <= maxs[b].y && mins[b].y <= maxs[a].y &&
+                mins[a].z <= maxs[b].z && mins[b].z <= maxs[a].z) {
+                SweepPair pair = { a, b };
+                pairs->push_back(pair);
+            }
+        }
+    }
+}
+
+int main() {
+    TestRandom random(13);
+    std::vector<glm::vec3> mins(OBJECT_COUNT), maxs(OBJECT_COUNT);
+    glm::vec3 world(60.0f, 10.0f, 20.0f); // Most spread along x to start with
+    for (size_t i = 0; i < OBJECT_COUNT; i++) {
+        mins[i] = glm::vec3(random.range(0.0f, world.x), random.range(0.0f, world.y), random.range(0.0f, world.z));
+        maxs[i] = mins[i] + glm::vec3(random.range(0.2f, 1.5f));
+    }
+
+    SweepPrune sweep;
+    std::vector<SweepPair> pairs, expected;
+    size_t count = OBJECT_COUNT;
+    int axes_used = 0;
+    size_t most_pairs = 0;
+    for (int round = 0; round < ROUND_COUNT; round++) {
+        sweep_prune_update(&sweep, &mins[0], &maxs[0], count, &pairs);
+        axes_used |= 1 << sweep.axis;
+
+        bool ordered = true;
+        for (size_t i = 0; i < pairs.size(); i++) ordered = ordered && pairs[i].a < pairs[i].b;
+        CHECK(ordered, "round %d: a pair does not have a < b", round);
+
+        std::sort(pairs.begin(), pairs.end(), pair_less);
+        brute_force_pairs(mins, maxs, count, &expected);
+        CHECK(same_pairs(pairs, expected), "round %d: %zu pairs instead of the %zu brute force finds", round, pairs.size(), expected.size());
+        most_pairs = std::max(most_pairs, expected.size());
+
+        // Mostly small moves, some jumps, and the objects stretched along z halfway through so the sweep changes axis
+        float stretch = round == ROUND_COUNT / 2 ? 6.0f : 1.0f;
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            glm::vec3 move(random.range(-0.3f, 0.3f), random.range(-0.3f, 0.3f), random.range(-0.3f, 0.3f));
+            if (i % 97 == (size_t)round) move *= 40.0f;
+            glm::vec3 size = maxs[i] - mins[i];
+            mins[i] += move;
+            mins[i].z *= stretch;
+            maxs[i] = mins[i] + size;
+        }
+
+        // Objects come and go from the end
+        if (round % 10 == 3) count -= 200;
+        if (round % 10 == 7) count += 200;
+    }
+    CHECK(axes_used == ((1 << 0) | (1 << 2)), "sweep used axes %x instead of moving from x to z", axes_used);
+    printf("  %d rounds of up to %d objects and %zu pairs match brute force\n", ROUND_COUNT, OBJECT_COUNT, most_pairs);
+    return test_result("sweep and prune");
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// Helpers shared by the tests. Every test is a program that prints what it checked and returns
+// non-zero when a check failed, see the test target of the Makefile.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "scene.h"
+#include "scene_bake.h"
+
+static int test_failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        test_failures++; \
+        printf("  FAILED %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+static inline int test_result(const char* name) {
+    printf("%s: %s\n", name, test_failures == 0 ? "passed" : "FAILED");
+    return test_failures == 0 ? 0 : 1;
+}
+
+// FNV-1a, to compare whole states bit for bit
+static inline uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static inline uint64_t cube_state_hash(const CubeBodies* bodies) {
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < bodies->count; i++) {
+        glm::vec3 position = body_position(bodies, i);
+        glm::vec3 velocity = body_velocity(bodies, i);
+        hash = hash_bytes(hash, &position, sizeof(position));
+        hash = hash_bytes(hash, &velocity, sizeof(velocity));
+        hash = hash_bytes(hash, &bodies->flags[i], sizeof(bodies->flags[i]));
+    }
+    return hash;
+}
+
+// xorshift64*, the same sequence on every standard library
+struct TestRandom {
+    uint64_t state;
+
+    TestRandom(uint64_t seed) : state(seed) {}
+
+    float unit() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ((state * 0x2545F4914F6CDD1Dull) >> 40) / 16777216.0f;
+    }
+
+    float range(float min, float max) {
+        return min + (max - min) * unit();
+    }
+};
+
+// Closed room of the given size with a floor at y = 0, filled with random boxes, baked like a loaded scene
+static inline void build_test_scene(Scene* scene, float size, float height, int box_count, uint64_t seed) {
+    apply_scene_defaults(scene);
+    scene->light_dir = glm::normalize(glm::vec3(0.4f, -0.75f, -0.52f));
+    scene->spawn_position = glm::vec3(size / 2.0f, 1.6f, size / 2.0f);
+
+    glm::vec3 grey(0.7f);
+    scene->geometry.push_back(Brush(glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(size + 1.0f, 0.0f, size + 1.0f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(-1.0f, height, -1.0f), glm::vec3(size + 1.0f, height + 1.0f, size + 1.0f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(0.0f, height, size + 1.0f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(size, 0.0f, -1.0f), glm::vec3(size + 1.0f, height, size + 1.0f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(size, height, 0.0f), grey));
+    scene->geometry.push_back(Brush(glm::vec3(0.0f, 0.0f, size), glm::vec3(size, height, size + 1.0f), grey));
+
+    TestRandom random(seed);
+    for (int i = 0; i < box_count; i++) {
+        glm::vec3 min(random.range(0.0f, size - 1.0f), random.range(0.0f, height - 1.0f), random.range(0.0f, size - 1.0f));
+        glm::vec3 extent(random.range(0.1f, 1.0f), random.range(0.1f, 1.0f), random.range(0.1f, 1.0f));
+        scene->geometry.push_back(Brush(min, min + extent, glm::vec3(random.unit(), random.unit(), random.unit())));
+    }
+    bake_scene(scene);
+}
@@ -0,0 +1,139 @@
+// Scene compiler: bakes the runtime data of a scene into a version 2 scene file
+// so the game can map it instead of building it at every launch.
+//
+// Usage: scenec <input scene> <output scene> [options]
+//   --compact          store brushes in the compact encoding, see scene_compact.h
+//   --grid G           grid size for --compact, coordinates are snapped to it (default: exact grid)
+//   --no-bake          leave out the baked runtime data, for the smallest file
+//   --merge            merge brushes whose union is a box, keeping the authored ones for raycast hits
+//   --text             write the scene description as text instead, see scene_text.h
+//   --pvs              also compute which parts of the level are visible from each other, see pvs.h
+//
+// The input can be any scene file, including a text one.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "scene.h"
+#include "scene_bake.h"
+#include "scene_compact.h"
+#include "scene_text.h"
+
+static int decode_section_brushes(const SceneSectionData* section, std::vector<Brush>* brushes) {
+    if (decode_compact_brushes(&section->data[0], section->data.size(), section->element_count, brushes) != 0) {
+        std::cerr << "Compact brushes failed to decode" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Whether the compact section gives back exactly these brushes, as the game will load them
+static bool decodes_to(const SceneSectionData* section, const std::vector<Brush>& brushes) {
+    std::vector<Brush> decoded;
+    if (decode_section_brushes(section, &decoded) != 0 || decoded.size() != brushes.size()) return false;
+    return decoded.empty() || memcmp(&decoded[0], &brushes[0], brushes.size() * sizeof(Brush)) == 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argv[1][0] == '-' || argv[2][0] == '-') {
+        std::cerr << "Usage: " << argv[0] << " <input scene> <output scene> [--compact] [--grid G] [--no-bake] [--merge] [--text] [--pvs]" << std::endl;
+        return 1;
+    }
+
+    bool compact = false;
+    bool bake = true;
+    bool text = false;
+    bool pvs = false;
+    int options = SCENE_LOAD_RUNTIME_DATA;
+    float grid = 0.0f;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--compact") == 0) {
+            compact = true;
+        } else if (strcmp(argv[i], "--no-bake") == 0) {
+            bake = false;
+        } else if (strcmp(argv[i], "--text") == 0) {
+            text = true;
+        } else if (strcmp(argv[i], "--pvs") == 0) {
+            pvs = true;
+        } else if (strcmp(argv[i], "--merge") == 0) {
+            options |= SCENE_LOAD_MERGE_BRUSHES;
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            grid = (float)atof(argv[++i]);
+            if (!(grid > 0.0f)) {
+                std::cerr << "Grid size must be positive" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Loading already builds everything the input file does not have baked
+    Scene scene;
+    if (load_scene_file(argv[1], &scene, text ? 0 : options) != 0) return 1;
+
+    if (text) {
+        int result = save_scene_text(argv[2], &scene);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (result == 0) std::cout << argv[1] << " -> " << argv[2] << " as text in " << seconds << "s" << std::endl;
+        close_scene_file(&scene);
+        return result;
+    }
+
+    std::vector<SceneSectionData> sections;
+    scene_sections(&scene, &sections);
+    // scene_sections puts the brushes first. The game gets the compact brushes back snapped to the grid,
+    // so the scene takes the decoded brushes and is baked again from them.
+    if (compact) {
+        std::vector<Brush> snapped;
+        if (encode_compact_brushes(scene.geometry, grid, &sections[0]) != 0 || decode_section_brushes(&sections[0], &snapped) != 0 ||
+            !validate_brushes(argv[2], snapped.empty() ? NULL : &snapped[0], snapped.size())) {
+            close_scene_file(&scene);
+            return 1;
+        }
+        scene.geometry.swap(snapped);
+        if (bake) bake_scene(&scene, scene.pvs.cell_count > 0 ? BAKED_PVS : 0);
+    }
+    if (bake && pvs) build_pvs(&scene, &scene.pvs);
+    if (bake) baked_sections(&scene, &sections);
+
+    if (compact && !decodes_to(&sections[0], scene.geometry)) {
+        std::cerr << "Compact brushes do not decode to the baked brushes" << std::endl;
+        close_scene_file(&scene);
+        return 1;
+    }
+
+    if (write_scene_sections(argv[2], sections) != 0) {
+        close_scene_file(&scene);
+        return 1;
+    }
+
+    size_t visible_faces = scene.static_mesh.index_count / FACE_INDEX_COUNT;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << argv[1] << " -> " << argv[2] << " in " << seconds << "s" << std::endl;
+    std::cout << "  " << scene.geometry.size() << " brushes, " << scene.bvh.nodes.size() << " BVH nodes" << std::endl;
+    if (!scene.authored_geometry.empty()) {
+        std::cout << "  merged from " << scene.authored_geometry.size() << " authored brushes" << std::endl;
+    }
+    std::cout << "  brushes take " << sections[0].data.size() << " bytes" << (compact ? " compact, " : ", ") << scene.geometry.size() * sizeof(SceneBrushRecord) << " uncompressed" << std::endl;
+    std::cout << "  " << visible_faces << " of " << scene.geometry.size() * FACE_COUNT << " faces visible, on " << scene.face_planes.planes.size() << " portal surface planes" << std::endl;
+    if (bake && scene.pvs.cell_count > 0) {
+        size_t visible_cells = 0;
+        for (uint32_t from = 0; from < scene.pvs.cell_count; from++) {
+            for (uint32_t to = 0; to < scene.pvs.cell_count; to++) {
+                if (pvs_visible(&scene.pvs, from, to)) visible_cells++;
+            }
+        }
+        std::cout << "  PVS of " << scene.pvs.cell_count << " cells of size " << scene.pvs.cell_size << ", "
+                  << (double)visible_cells / scene.pvs.cell_count << " visible from each on average" << std::endl;
+    }
+
+    close_scene_file(&scene);
+    return 0;
+}
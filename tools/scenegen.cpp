@@ -0,0 +1,260 @@
+// Procedural stress scene generator. Writes version 2 scene files with a configurable
+// number of brushes laid out as a grid of rooms, optionally joined by corridors.
+// The same options and seed always produce the same file.
+//
+// Usage: scenegen <output scene> [options]
+//   --brushes N        total number of brushes (default 1000, at most 1000000)
+//   --cubes N          number of cubes (default 1, at most 100000)
+//   --layout L         "rooms" (adjacent rooms) or "corridors" (rooms joined by corridors)
+//   --portal-walls P   percentage of walls that are solid enough to hold a portal (default 50, 0 to 100)
+//   --seed S           random seed (default 1)
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "scene.h"
+
+#define MAX_BRUSHES 1000000
+#define MAX_CUBES 100000 // Each cube is simulated every tick, more than this only makes a slideshow
+
+#define ROOM_SIZE 12.0f
+#define ROOM_HEIGHT 5.0f
+#define WALL_THICKNESS 0.5f
+#define DOOR_WIDTH 2.0f
+#define DOOR_HEIGHT 3.0f
+#define CORRIDOR_LENGTH 8.0f
+#define STRIP_WIDTH 1.5f // Narrower than a portal
+#define STRIP_STAGGER 0.1f // Every other strip of a striped wall sits this much further back, so strips never form one surface
+
+// xorshift64*, used instead of <random> distributions whose output differs between standard libraries
+struct Random {
+    uint64_t state;
+
+    Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // Uniform in [0, 1)
+    float unit() {
+        return (next() >> 40) / 16777216.0f;
+    }
+
+    float range(float min, float max) {
+        return min + (max - min) * unit();
+    }
+};
+
+struct Generator {
+    Scene* scene;
+    Random random;
+    size_t max_brushes;
+    int portal_wall_percent;
+
+    Generator(Scene* scene, uint64_t seed, size_t max_brushes, int portal_wall_percent) : scene(scene), random(seed), max_brushes(max_brushes), portal_wall_percent(portal_wall_percent) {}
+
+    bool full() {
+        return scene->geometry.size() >= max_brushes;
+    }
+
+    void add(glm::vec3 min, glm::vec3 max, glm::vec3 color) {
+        if (!full()) scene->geometry.push_back(Brush(min, max, color));
+    }
+
+    glm::vec3 wall_color() {
+        float shade = random.range(0.6f, 0.9f);
+        return glm::vec3(shade);
+    }
+
+    // Wall segment between from and to along the given horizontal axis (0 = x, 2 = z) at a fixed
+    // position on the other axis. Solid segments can hold portals. Striped ones are split into strips
+    // too narrow for one, staggered so that neither side of the wall is one flat surface.
+    void wall_segment(int axis, float from, float to, float position, float bottom, float top, bool solid) {
+        int other = 2 - axis;
+        glm::vec3 color = wall_color();
+
+        float step = solid ? to - from : STRIP_WIDTH;
+        int strip = 0;
+        for (float start = from; start < to - 0.001f; start += step, strip++) {
+            float depth = strip % 2 == 1 ? STRIP_STAGGER : 0.0f;
+            glm::vec3 min, max;
+            min[axis] = start;
+            max[axis] = glm::min(start + step, to);
+            min[other] = position - WALL_THICKNESS / 2.0f + depth;
+            max[other] = position + WALL_THICKNESS / 2.0f + depth;
+            min.y = bottom;
+            max.y = top;
+            add(min, max, color);
+        }
+    }
+
+    // Wall with an optional doorway in the middle
+    void wall(int axis, float from, float to, float position, bool doorway) {
+        bool solid = (int)(random.next() % 100) < portal_wall_percent;
+
+        if (!doorway) {
+            wall_segment(axis, from, to, position, 0.0f, ROOM_HEIGHT, solid);
+            return;
+        }
+
+        float middle = (from + to) / 2.0f;
+        wall_segment(axis, from, middle - DOOR_WIDTH / 2.0f, position, 0.0f, ROOM_HEIGHT, solid);
+        wall_segment(axis, middle + DOOR_WIDTH / 2.0f, to, position, 0.0f, ROOM_HEIGHT, solid);
+        wall_segment(axis, middle - DOOR_WIDTH / 2.0f, middle + DOOR_WIDTH / 2.0f, position, DOOR_HEIGHT, ROOM_HEIGHT, true);
+    }
+
+    // A room that shares its east or south wall with the next room leaves that wall out, the next room
+    // builds it as its west or north wall, so every wall is generated once
+    void room(glm::vec3 origin, bool door_west, bool door_east, bool door_north, bool door_south, bool wall_east, bool wall_south) {
+        add(origin + glm::vec3(0.0f, -WALL_THICKNESS, 0.0f), origin + glm::vec3(ROOM_SIZE, 0.0f, ROOM_SIZE), glm::vec3(0.4f, 0.4f, 0.45f));
+        add(origin + glm::vec3(0.0f, ROOM_HEIGHT, 0.0f), origin + glm::vec3(ROOM_SIZE, ROOM_HEIGHT + WALL_THICKNESS, ROOM_SIZE), glm::vec3(0.8f));
+
+        wall(2, origin.z, origin.z + ROOM_SIZE, origin.x, door_west);
+        if (wall_east) wall(2, origin.z, origin.z + ROOM_SIZE, origin.x + ROOM_SIZE, door_east);
+        wall(0, origin.x, origin.x + ROOM_SIZE, origin.z, door_north);
+        if (wall_south) wall(0, origin.x, origin.x + ROOM_SIZE, origin.z + ROOM_SIZE, door_south);
+    }
+
+    // Corridor starting at the given point and running along the axis
+    void corridor(glm::vec3 start, int axis) {
+        int other = 2 - axis;
+        float half_width = DOOR_WIDTH / 2.0f + WALL_THICKNESS;
+
+        glm::vec3 min = start, max = start;
+        max[axis] += CORRIDOR_LENGTH;
+        min[other] -= half_width;
+        max[other] += half_width;
+
+        add(glm::vec3(min.x, -WALL_THICKNESS, min.z), glm::vec3(max.x, 0.0f, max.z), glm::vec3(0.35f, 0.35f, 0.4f));
+        add(glm::vec3(min.x, DOOR_HEIGHT, min.z), glm::vec3(max.x, DOOR_HEIGHT + WALL_THICKNESS, max.z), glm::vec3(0.7f));
+        wall(axis, start[axis], start[axis] + CORRIDOR_LENGTH, start[other] - half_width + WALL_THICKNESS / 2.0f, false);
+        wall(axis, start[axis], start[axis] + CORRIDOR_LENGTH, start[other] + half_width - WALL_THICKNESS / 2.0f, false);
+    }
+
+    // Small boxes scattered on the floor of a room, used to reach the requested brush count
+    void detail(glm::vec3 origin) {
+        glm::vec3 size(random.range(0.2f, 1.0f), random.range(0.2f, 2.0f), random.range(0.2f, 1.0f));
+        glm::vec3 min(origin.x + random.range(1.0f, ROOM_SIZE - 2.0f), 0.0f, origin.z + random.range(1.0f, ROOM_SIZE - 2.0f));
+        add(min, min + size, glm::vec3(random.unit(), random.unit(), random.unit()));
+    }
+};
+
+// Whole decimal number between min and max, with nothing after it
+static bool parse_count(const char* text, long min, long max, long* value) {
+    char* end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+    *value = parsed;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        std::cerr << "Usage: " << argv[0] << " <output scene> [--brushes N] [--cubes N] [--layout rooms|corridors] [--portal-walls P] [--seed S]" << std::endl;
+        return 1;
+    }
+
+    const char* output = argv[1];
+    long brush_count = 1000;
+    long cube_count = 1;
+    bool corridors = false;
+    long portal_wall_percent = 50;
+    uint64_t seed = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--brushes") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], 1, MAX_BRUSHES, &brush_count)) {
+                std::cerr << "Brush count must be between 1 and " << MAX_BRUSHES << ", got " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cubes") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], 0, MAX_CUBES, &cube_count)) {
+                std::cerr << "Cube count must be between 0 and " << MAX_CUBES << ", got " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            const char* layout = argv[++i];
+            if (strcmp(layout, "rooms") != 0 && strcmp(layout, "corridors") != 0) {
+                std::cerr << "Unknown layout " << layout << ", expected rooms or corridors" << std::endl;
+                return 1;
+            }
+            corridors = strcmp(layout, "corridors") == 0;
+        } else if (strcmp(argv[i], "--portal-walls") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], 0, 100, &portal_wall_percent)) {
+                std::cerr << "Portal wall percentage must be between 0 and 100, got " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            const char* text = argv[++i];
+            char* end;
+            errno = 0;
+            seed = strtoull(text, &end, 10);
+            if (end == text || *end != '\0' || errno == ERANGE || text[0] == '-') {
+                std::cerr << "Seed must be a whole number, got " << text << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    Scene scene;
+    Generator generator(&scene, seed, brush_count, (int)portal_wall_percent);
+    scene.geometry.reserve(brush_count);
+
+    // Rooms take 15 to 40 brushes depending on their walls, detail fills the rest of the budget
+    int rooms = (int)glm::max(1.0f, brush_count / 40.0f);
+    int grid = 1;
+    while (grid * grid < rooms) grid++;
+
+    float spacing = ROOM_SIZE + (corridors ? CORRIDOR_LENGTH : 0.0f);
+    std::vector<glm::vec3> room_origins;
+    for (int i = 0; i < rooms && !generator.full(); i++) {
+        int x = i % grid;
+        int z = i / grid;
+        glm::vec3 origin(x * spacing, 0.0f, z * spacing);
+        room_origins.push_back(origin);
+
+        bool west = x > 0;
+        bool east = x < grid - 1 && i + 1 < rooms;
+        bool north = z > 0;
+        bool south = i + grid < rooms;
+        generator.room(origin, west, east, north, south, corridors || !east, corridors || !south);
+
+        if (corridors && east) generator.corridor(origin + glm::vec3(ROOM_SIZE, 0.0f, ROOM_SIZE / 2.0f), 0);
+        if (corridors && south) generator.corridor(origin + glm::vec3(ROOM_SIZE / 2.0f, 0.0f, ROOM_SIZE), 2);
+    }
+
+    while (!generator.full()) {
+        generator.detail(room_origins[generator.random.next() % room_origins.size()]);
+    }
+
+    for (long i = 0; i < cube_count; i++) {
+        glm::vec3 origin = room_origins[generator.random.next() % room_origins.size()];
+        glm::vec3 position = origin + glm::vec3(generator.random.range(1.0f, ROOM_SIZE - 1.0f), generator.random.range(1.0f, ROOM_HEIGHT - 1.0f), generator.random.range(1.0f, ROOM_SIZE - 1.0f));
+        Cube cube(position, glm::vec3(generator.random.unit(), generator.random.unit(), generator.random.unit()));
+        add_cube_body(&scene.cubes, &cube);
+    }
+
+    scene.light_dir = glm::normalize(glm::vec3(0.4f, -0.75f, -0.52f));
+    scene.spawn_position = room_origins[0] + glm::vec3(ROOM_SIZE / 2.0f, 1.6f, ROOM_SIZE / 2.0f);
+    scene.spawn_yaw = 0.0f;
+    scene.spawn_pitch = 0.0f;
+    scene.portal1.width = 1.0f;
+    scene.portal1.height = 1.0f;
+    scene.portal2.width = 1.0f;
+    scene.portal2.height = 1.0f;
+
+    if (save_scene_file(output, &scene) != 0) return 1;
+
+    std::cout << "Wrote " << output << ": " << scene.geometry.size() << " brushes in " << room_origins.size() << " rooms, " << scene.cubes.count << " cubes" << std::endl;
+    return 0;
+}